@@ -0,0 +1,877 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#include "mustach.h"
+#include "mustach-wrap.h"
+#include "mustach-cbor.h"
+
+/* maximum nesting of arrays, maps and tags in CBOR data */
+#if !defined(MUSTACH_CBOR_MAX_NESTING)
+# define MUSTACH_CBOR_MAX_NESTING 1024
+#endif
+
+/* major types of CBOR */
+#define M_UINT    0
+#define M_NINT    1
+#define M_BYTES   2
+#define M_TEXT    3
+#define M_ARRAY   4
+#define M_MAP     5
+#define M_TAG     6
+#define M_SIMPLE  7
+
+/* argument of strings and containers of indefinite length */
+#define INDEF     UINT64_MAX
+
+/* the byte ending items of indefinite length */
+#define BREAK     0xff
+
+/* types of values */
+enum type {
+	T_null,
+	T_false,
+	T_true,
+	T_integer,
+	T_real,
+	T_string,
+	T_array,
+	T_object
+};
+
+typedef const unsigned char *item_t;
+
+/******************************************************************************/
+/* CHECKING                                                                   */
+/******************************************************************************/
+
+/* check the item at 'p' and return the pointer after it or NULL when invalid */
+static item_t check(item_t p, item_t end, int depth)
+{
+	int major, info, n;
+	uint64_t arg;
+
+	if (p >= end)
+		return NULL;
+	major = *p >> 5;
+	info = *p++ & 31;
+	if (info < 24)
+		arg = (uint64_t)info;
+	else if (info < 28) {
+		n = 1 << (info - 24);
+		if (end - p < n)
+			return NULL;
+		for (arg = 0 ; n ; n--)
+			arg = (arg << 8) | *p++;
+	}
+	else if (info == 31 && major >= M_BYTES && major <= M_MAP)
+		arg = INDEF;
+	else
+		return NULL;
+
+	switch (major) {
+	case M_BYTES:
+	case M_TEXT:
+		if (arg == INDEF) {
+			/* chunks are definite strings of the same major type */
+			for (;;) {
+				if (p >= end)
+					return NULL;
+				if (*p == BREAK)
+					return p + 1;
+				if ((*p >> 5) != major || (*p & 31) == 31 || (p = check(p, end, depth)) == NULL)
+					return NULL;
+			}
+		}
+		return arg <= (uint64_t)(end - p) ? p + arg : NULL;
+	case M_ARRAY:
+	case M_MAP:
+		if (depth >= MUSTACH_CBOR_MAX_NESTING)
+			return NULL;
+		if (arg == INDEF) {
+			for (n = 0 ; ; n ^= major == M_MAP) {
+				if (p >= end)
+					return NULL;
+				if (*p == BREAK)
+					return n ? NULL : p + 1;
+				if ((p = check(p, end, depth + 1)) == NULL)
+					return NULL;
+			}
+		}
+		/* each item takes at least one byte */
+		if (arg > (uint64_t)(end - p))
+			return NULL;
+		if (major == M_MAP)
+			arg <<= 1;
+		for ( ; arg && p != NULL ; arg--)
+			p = check(p, end, depth + 1);
+		return p;
+	case M_TAG:
+		return depth >= MUSTACH_CBOR_MAX_NESTING ? NULL : check(p, end, depth + 1);
+	default:
+		return p;
+	}
+}
+
+int mustach_cbor_check(const void *cbor, size_t size)
+{
+	item_t p = cbor;
+
+	if (check(p, p + size, 0) != p + size) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/******************************************************************************/
+/* ACCESSING                                                                  */
+/******************************************************************************/
+
+/* read the head of the checked item 'p' and return the pointer after it */
+static inline item_t head(item_t p, int *major, uint64_t *arg)
+{
+	int info = *p & 31, n;
+	uint64_t a;
+
+	*major = *p++ >> 5;
+	if (info < 24)
+		a = (uint64_t)info;
+	else if (info == 31)
+		a = INDEF;
+	else
+		for (a = 0, n = 1 << (info - 24) ; n ; n--)
+			a = (a << 8) | *p++;
+	*arg = a;
+	return p;
+}
+
+/* skip the tags of the item 'p' */
+static inline item_t untag(item_t p)
+{
+	int major;
+	uint64_t arg;
+
+	while ((*p >> 5) == M_TAG)
+		p = head(p, &major, &arg);
+	return p;
+}
+
+/* return the pointer after the item 'p' */
+static item_t skipitem(item_t p)
+{
+	int major;
+	uint64_t arg;
+
+	p = head(untag(p), &major, &arg);
+	switch (major) {
+	case M_BYTES:
+	case M_TEXT:
+	case M_ARRAY:
+	case M_MAP:
+		if (arg == INDEF) {
+			while (*p != BREAK)
+				p = skipitem(p);
+			return p + 1;
+		}
+		if (major < M_ARRAY)
+			return p + arg;
+		if (major == M_MAP)
+			arg <<= 1;
+		for ( ; arg ; arg--)
+			p = skipitem(p);
+		return p;
+	default:
+		return p;
+	}
+}
+
+static int typeof_(item_t p)
+{
+	if (p == NULL)
+		return T_null;
+	switch (*p >> 5) {
+	case M_UINT:
+	case M_NINT:
+		return T_integer;
+	case M_BYTES:
+	case M_TEXT:
+		return T_string;
+	case M_ARRAY:
+		return T_array;
+	case M_MAP:
+		return T_object;
+	default:
+		switch (*p & 31) {
+		case 20: return T_false;
+		case 21: return T_true;
+		case 25:
+		case 26:
+		case 27: return T_real;
+		default: return T_null;
+		}
+	}
+}
+
+/* count of items of the array or of members of the map 'p', INDEF if unknown */
+static uint64_t countof(item_t p)
+{
+	int major;
+	uint64_t arg;
+
+	head(p, &major, &arg);
+	return arg;
+}
+
+/* the first item of the array or the first key of the map 'p', NULL when empty */
+static item_t first(item_t p)
+{
+	int major;
+	uint64_t arg;
+
+	p = head(p, &major, &arg);
+	return arg == 0 || (arg == INDEF && *p == BREAK) ? NULL : p;
+}
+
+/* total length of the string 'p' */
+static size_t strlength(item_t p)
+{
+	int major;
+	uint64_t arg, len;
+
+	p = head(p, &major, &arg);
+	if (arg != INDEF)
+		return (size_t)arg;
+	for (len = 0 ; *p != BREAK ; p += arg, len += arg)
+		p = head(p, &major, &arg);
+	return (size_t)len;
+}
+
+/*
+ * get the string 'p' in 'str' of 'len': definite strings are not copied,
+ * the chunks of indefinite strings are joined in '*mem' to be freed
+ */
+static int string(item_t p, const char **str, size_t *len, char **mem)
+{
+	int major;
+	uint64_t arg;
+	size_t length;
+	item_t q;
+	char *s;
+
+	*mem = NULL;
+	q = head(p, &major, &arg);
+	if (arg != INDEF) {
+		*str = (const char*)q;
+		*len = (size_t)arg;
+		return 0;
+	}
+	length = strlength(p);
+	p = q;
+	*str = *mem = s = malloc(length + 1);
+	if (s == NULL)
+		return -1;
+	while (*p != BREAK) {
+		p = head(p, &major, &arg);
+		memcpy(s, p, (size_t)arg);
+		s += arg;
+		p += arg;
+	}
+	*s = 0;
+	*len = length;
+	return 0;
+}
+
+/* compare the string 'p' with 'value' of 'len' as memcmp does on equal lengths */
+static int strcmpitem(item_t p, const char *value, size_t len)
+{
+	const char *s;
+	size_t l;
+	char *mem;
+	int r;
+
+	if (string(p, &s, &l, &mem))
+		return 1;
+	r = memcmp(s, value, len < l ? len : l);
+	r = r ? r : l < len ? -1 : l > len;
+	free(mem);
+	return r;
+}
+
+/* search in the map 'p' the value of the text key 'name' */
+static item_t member(item_t p, const char *name, size_t len)
+{
+	uint64_t count;
+	item_t key;
+	int major;
+
+	if (p == NULL || (*p >> 5) != M_MAP)
+		return NULL;
+	p = head(p, &major, &count);
+	while (count == INDEF ? *p != BREAK : count--) {
+		key = untag(p);
+		p = skipitem(key);
+		if ((*key >> 5) == M_TEXT && !strcmpitem(key, name, len))
+			return untag(p);
+		p = skipitem(p);
+	}
+	return NULL;
+}
+
+/* get the value of the half precision float 'h' */
+static double half(unsigned h)
+{
+	union { uint32_t u; float f; } f32;
+	unsigned e = (h >> 10) & 0x1f, m = h & 0x3ff;
+
+	if (e == 0)
+		f32.f = (float)m / 16777216.0f; /* subnormal, m * 2^-24 */
+	else
+		f32.u = (uint32_t)(e == 31 ? 255 : e + 112) << 23 | (uint32_t)m << 13;
+	return h & 0x8000 ? -(double)f32.f : (double)f32.f;
+}
+
+/* get the number 'p' as a double */
+static double number(item_t p)
+{
+	int major, info = *p & 31;
+	uint64_t arg;
+	union { uint32_t u; float f; } f32;
+	union { uint64_t u; double d; } f64;
+
+	head(p, &major, &arg);
+	switch (major) {
+	case M_UINT:
+		return (double)arg;
+	case M_NINT:
+		return -1.0 - (double)arg;
+	default:
+		switch (info) {
+		case 25:
+			return half((unsigned)arg);
+		case 26:
+			f32.u = (uint32_t)arg;
+			return f32.f;
+		case 27:
+			f64.u = arg;
+			return f64.d;
+		default:
+			return 0;
+		}
+	}
+}
+
+/* get in 'value' the integer 'p' if it fits in a long long */
+static int integer(item_t p, long long *value)
+{
+	int major;
+	uint64_t arg;
+
+	head(p, &major, &arg);
+	if (arg > (uint64_t)LLONG_MAX)
+		return 0;
+	*value = major == M_UINT ? (long long)arg : -1 - (long long)arg;
+	return 1;
+}
+
+/* format the number 'p' in 'buffer' of at least 32 bytes, returns its length */
+static int numtext(item_t p, char *buffer)
+{
+	int major, prec, len;
+	uint64_t arg;
+	double d;
+
+	head(p, &major, &arg);
+	if (major == M_UINT)
+		return sprintf(buffer, "%llu", (unsigned long long)arg);
+	if (major == M_NINT) {
+		if (arg == UINT64_MAX)
+			return sprintf(buffer, "-18446744073709551616");
+		return sprintf(buffer, "-%llu", (unsigned long long)arg + 1);
+	}
+	/* shortest text reading back the same double */
+	d = number(p);
+	prec = 1;
+	do {
+		len = sprintf(buffer, "%.*g", prec, d);
+	} while (prec++ < 17 && strtod(buffer, NULL) != d);
+	if (isfinite(d) && !strchr(buffer, '.')) {
+		/* integral values are written as reals without exponent */
+		if (strchr(buffer, 'e') && fabs(d) < 1e17)
+			len = sprintf(buffer, "%.0f", d);
+		if (!strchr(buffer, 'e'))
+			len += sprintf(&buffer[len], ".0");
+	}
+	return len;
+}
+
+/* serialization of containers in compact JSON */
+struct serial {
+	char *buffer;
+	size_t length;
+	size_t alloc;
+};
+
+static int put(struct serial *s, const char *text, size_t length)
+{
+	char *b;
+	size_t alloc;
+
+	if (s->length + length >= s->alloc) {
+		alloc = s->alloc + (s->alloc >> 1) + length + 64;
+		b = realloc(s->buffer, alloc);
+		if (b == NULL)
+			return -1;
+		s->buffer = b;
+		s->alloc = alloc;
+	}
+	memcpy(&s->buffer[s->length], text, length);
+	s->length += length;
+	return 0;
+}
+
+/* put the JSON string of 'text' of 'length' */
+static int putstring(struct serial *s, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = text + length, *begin;
+	char esc[6];
+	unsigned char c;
+	int rc;
+
+	rc = put(s, "\"", 1);
+	while (!rc && text != end) {
+		for (begin = text ; text != end && (c = (unsigned char)*text) >= ' ' && c != '"' && c != '\\' ; text++);
+		rc = put(s, begin, (size_t)(text - begin));
+		if (!rc && text != end) {
+			c = (unsigned char)*text++;
+			esc[0] = '\\';
+			switch (c) {
+			case '"': case '\\': esc[1] = (char)c; break;
+			case '\b': esc[1] = 'b'; break;
+			case '\f': esc[1] = 'f'; break;
+			case '\n': esc[1] = 'n'; break;
+			case '\r': esc[1] = 'r'; break;
+			case '\t': esc[1] = 't'; break;
+			default:
+				memcpy(&esc[1], "u00", 3);
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 15];
+				rc = put(s, esc, 6);
+				continue;
+			}
+			rc = put(s, esc, 2);
+		}
+	}
+	return rc || put(s, "\"", 1);
+}
+
+static int serialize(item_t p, struct serial *s, int iskey)
+{
+	uint64_t count;
+	const char *str;
+	char *mem, buffer[40];
+	size_t len;
+	int rc, major, n;
+	struct serial k;
+
+	p = untag(p);
+	switch (typeof_(p)) {
+	case T_null: str = "null"; break;
+	case T_false: str = "false"; break;
+	case T_true: str = "true"; break;
+	case T_real:
+		if (!isfinite(number(p))) {
+			str = "null";
+			break;
+		}
+		/* fallthrough */
+	case T_integer:
+		n = numtext(p, buffer);
+		return iskey ? putstring(s, buffer, (size_t)n) : put(s, buffer, (size_t)n);
+	case T_string:
+		if (string(p, &str, &len, &mem))
+			return -1;
+		rc = putstring(s, str, len);
+		free(mem);
+		return rc;
+	default:
+		if (iskey) {
+			/* JSON keys are strings */
+			memset(&k, 0, sizeof k);
+			rc = serialize(p, &k, 0) || putstring(s, k.buffer, k.length);
+			free(k.buffer);
+			return rc;
+		}
+		p = head(p, &major, &count);
+		rc = put(s, major == M_ARRAY ? "[" : "{", 1);
+		for (n = 0 ; !rc && (count == INDEF ? *p != BREAK : count--) ; n++) {
+			if (n)
+				rc = put(s, ",", 1);
+			if (!rc && major == M_MAP) {
+				rc = serialize(p, s, 1) || put(s, ":", 1);
+				p = skipitem(p);
+			}
+			if (!rc)
+				rc = serialize(p, s, 0);
+			p = skipitem(p);
+		}
+		return rc || put(s, major == M_ARRAY ? "]" : "}", 1);
+	}
+	return iskey ? putstring(s, str, strlen(str)) : put(s, str, strlen(str));
+}
+
+char *mustach_cbor_json(const void *cbor, size_t size)
+{
+	struct serial s;
+
+	if (mustach_cbor_check(cbor, size))
+		return NULL;
+	memset(&s, 0, sizeof s);
+	if (serialize(cbor, &s, 0) || put(&s, "", 1)) {
+		free(s.buffer);
+		return NULL;
+	}
+	return s.buffer;
+}
+
+/******************************************************************************/
+/* WRAP INTERFACE                                                             */
+/******************************************************************************/
+
+struct expl {
+	item_t data;
+	size_t size;
+	int checked;
+	item_t selection;
+	int depth;
+	struct {
+		item_t cont;
+		item_t obj;
+		item_t key;
+		uint64_t count;      /* remaining items or INDEF */
+		int is_objiter;
+	} stack[MUSTACH_MAX_DEPTH];
+};
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+
+	if (!e->checked && mustach_cbor_check(e->data, e->size))
+		return MUSTACH_ERROR_SYSTEM;
+	e->depth = 0;
+	e->selection = NULL;
+	e->stack[0].cont = NULL;
+	e->stack[0].obj = untag(e->data);
+	e->stack[0].key = NULL;
+	e->stack[0].count = 1;
+	e->stack[0].is_objiter = 0;
+	return MUSTACH_OK;
+}
+
+static int compare(void *closure, const char *value)
+{
+	struct expl *e = closure;
+	item_t o = e->selection;
+	double d;
+	long long i;
+
+	switch (typeof_(o)) {
+	case T_integer:
+		if (integer(o, &i)) {
+			i -= atoll(value);
+			return i < 0 ? -1 : i > 0 ? 1 : 0;
+		}
+		/* fallthrough */
+	case T_real:
+		d = number(o) - atof(value);
+		return d < 0 ? -1 : d > 0 ? 1 : 0;
+	case T_string:
+		return strcmpitem(o, value, strlen(value));
+	case T_true:
+		return strcmp("true", value);
+	case T_false:
+		return strcmp("false", value);
+	case T_null:
+		return strcmp("null", value);
+	default:
+		return 1;
+	}
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	item_t o;
+	size_t len;
+	int i, r;
+
+	if (name == NULL) {
+		o = e->stack[e->depth].obj;
+		r = 1;
+	} else {
+		o = NULL;
+		len = strlen(name);
+		i = e->depth;
+		while (i >= 0 && (o = member(e->stack[i].obj, name, len)) == NULL)
+			i--;
+		r = i >= 0;
+	}
+	e->selection = o;
+	return r;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	item_t o;
+
+	o = member(e->selection, name, strlen(name));
+	if (o == NULL)
+		return 0;
+	e->selection = o;
+	return 1;
+}
+
+/* truth of the item 'p' when it is not a container */
+static int truth(item_t p)
+{
+	switch (typeof_(p)) {
+	case T_true:
+		return 1;
+	case T_integer:
+		return (*p >> 5) == M_NINT || countof(p) != 0;
+	case T_real:
+		return number(p) != 0;
+	case T_string:
+		return strlength(p) != 0;
+	default:
+		return 0;
+	}
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+	item_t o, f;
+	int t;
+
+	if (++e->depth >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+
+	o = e->selection;
+	t = typeof_(o);
+	e->stack[e->depth].is_objiter = 0;
+	e->stack[e->depth].key = NULL;
+	e->stack[e->depth].cont = o;
+	if (objiter) {
+		if (t != T_object || (f = first(o)) == NULL)
+			goto not_entering;
+		e->stack[e->depth].key = untag(f);
+		e->stack[e->depth].obj = untag(skipitem(f));
+		e->stack[e->depth].count = countof(o);
+		e->stack[e->depth].is_objiter = 1;
+	} else if (t == T_array) {
+		if ((f = first(o)) == NULL)
+			goto not_entering;
+		e->stack[e->depth].obj = untag(f);
+		e->stack[e->depth].count = countof(o);
+	} else if (t == T_object || truth(o)) {
+		e->stack[e->depth].obj = o;
+		e->stack[e->depth].count = 1;
+	} else
+		goto not_entering;
+	return 1;
+
+not_entering:
+	e->depth--;
+	return 0;
+}
+
+static int next(void *closure)
+{
+	struct expl *e = closure;
+	item_t p;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	if (e->stack[e->depth].count != INDEF && --e->stack[e->depth].count == 0)
+		return 0;
+
+	p = skipitem(e->stack[e->depth].obj);
+	if (*p == BREAK && e->stack[e->depth].count == INDEF)
+		return 0;
+	if (e->stack[e->depth].is_objiter) {
+		e->stack[e->depth].key = untag(p);
+		p = skipitem(p);
+	}
+	e->stack[e->depth].obj = untag(p);
+	return 1;
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	e->depth--;
+	return 0;
+}
+
+static int getvalue(item_t o, struct mustach_sbuf *sbuf)
+{
+	struct serial s;
+	char *mem;
+	size_t len;
+	int t;
+
+	t = typeof_(o);
+	switch (t) {
+	case T_null:
+		sbuf->value = "";
+		break;
+	case T_false:
+		sbuf->value = "false";
+		break;
+	case T_true:
+		sbuf->value = "true";
+		break;
+	case T_string:
+		if (string(o, &sbuf->value, &len, &mem))
+			return MUSTACH_ERROR_SYSTEM;
+		if (mem != NULL)
+			sbuf->freecb = free;
+		else if (len == 0)
+			sbuf->value = "";
+		else
+			sbuf->length = len;
+		break;
+	default:
+		memset(&s, 0, sizeof s);
+		if (t == T_integer || t == T_real) {
+			s.buffer = malloc(40);
+			if (s.buffer == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+			numtext(o, s.buffer);
+		}
+		else if (serialize(o, &s, 0) || put(&s, "", 1)) {
+			free(s.buffer);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		sbuf->value = s.buffer;
+		sbuf->freecb = free;
+		break;
+	}
+	return 1;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+
+	if (key) {
+		if (!e->stack[e->depth].is_objiter) {
+			sbuf->value = "";
+			return 1;
+		}
+		return getvalue(e->stack[e->depth].key, sbuf);
+	}
+	return getvalue(e->selection, sbuf);
+}
+
+const struct mustach_wrap_itf mustach_cbor_wrap_itf = {
+	.start = start,
+	.compare = compare,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get
+};
+
+static void *init(struct expl *e, const void *cbor, size_t size, int flags)
+{
+	e->data = cbor;
+	e->size = size;
+	e->checked = !!(flags & Mustach_With_Checked);
+	return e;
+}
+
+int mustach_cbor_file(const char *template, size_t length, const void *cbor, size_t size, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_file(template, length, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, file);
+}
+
+int mustach_cbor_fd(const char *template, size_t length, const void *cbor, size_t size, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_fd(template, length, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, fd);
+}
+
+int mustach_cbor_mem(const char *template, size_t length, const void *cbor, size_t size, int flags, char **result, size_t *rsize)
+{
+	struct expl e;
+	return mustach_wrap_mem(template, length, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, result, rsize);
+}
+
+int mustach_cbor_write(const char *template, size_t length, const void *cbor, size_t size, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_write(template, length, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, writecb, closure);
+}
+
+int mustach_cbor_emit(const char *template, size_t length, const void *cbor, size_t size, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_emit(template, length, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, emitcb, closure);
+}
+
+int mustach_cbor_compiled_file(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_compiled_file(tmpl, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, file);
+}
+
+int mustach_cbor_compiled_fd(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, fd);
+}
+
+int mustach_cbor_compiled_mem(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, char **result, size_t *rsize)
+{
+	struct expl e;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, result, rsize);
+}
+
+int mustach_cbor_compiled_write(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_write(tmpl, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, writecb, closure);
+}
+
+int mustach_cbor_compiled_emit(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_cbor_wrap_itf, init(&e, cbor, size, flags), flags, emitcb, closure);
+}
@@ -0,0 +1,194 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _mustach_cbor_h_included_
+#define _mustach_cbor_h_included_
+
+/*
+ * mustach-cbor is a self contained backend for mustach rendering data
+ * encoded in CBOR (RFC 8949).
+ *
+ * It does not depend on any external library and renders directly from
+ * the encoded buffer: strings are not copied and numbers are formatted
+ * from their binary values. The buffer must hold exactly one data item.
+ * It is checked before each rendering, so that invalid buffers make
+ * rendering fail with MUSTACH_ERROR_SYSTEM and errno set to EINVAL.
+ * A buffer already checked by 'mustach_cbor_check' can be rendered many
+ * times without being checked again using the flag Mustach_With_Checked.
+ *
+ * Tags are ignored and their content is rendered. Undefined and the
+ * simple values other than false, true and null are rendered as null.
+ * Byte strings are rendered as text strings. Only the text string keys
+ * of maps can be selected.
+ */
+
+#include "mustach-wrap.h"
+
+/**
+ * Wrap interface used internally by mustach cbor functions.
+ * Can be used for overriding behaviour.
+ */
+extern const struct mustach_wrap_itf mustach_cbor_wrap_itf;
+
+/**
+ * mustach_cbor_check - Checks that the buffer 'cbor' of 'size' holds
+ * exactly one well formed CBOR data item.
+ *
+ * Returns 0 when valid or -1 with errno set to EINVAL.
+ */
+extern int mustach_cbor_check(const void *cbor, size_t size);
+
+/**
+ * mustach_cbor_json - Returns the compact JSON text of the CBOR data
+ * item of the buffer 'cbor' of 'size' or NULL with errno set. The
+ * returned value must be released using 'free'.
+ */
+extern char *mustach_cbor_json(const void *cbor, size_t size);
+
+/**
+ * mustach_cbor_file - Renders the mustache 'template' in 'file' for 'cbor'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_file(const char *template, size_t length, const void *cbor, size_t size, int flags, FILE *file);
+
+/**
+ * mustach_cbor_fd - Renders the mustache 'template' in 'fd' for 'cbor'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_fd(const char *template, size_t length, const void *cbor, size_t size, int flags, int fd);
+
+/**
+ * mustach_cbor_mem - Renders the mustache 'template' in 'result' for 'cbor'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @result:   the pointer receiving the result when 0 is returned
+ * @rsize:    the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_mem(const char *template, size_t length, const void *cbor, size_t size, int flags, char **result, size_t *rsize);
+
+/**
+ * mustach_cbor_write - Renders the mustache 'template' for 'cbor' to custom writer 'writecb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_write(const char *template, size_t length, const void *cbor, size_t size, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_cbor_emit - Renders the mustache 'template' for 'cbor' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_emit(const char *template, size_t length, const void *cbor, size_t size, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_cbor_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'cbor'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_compiled_file(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, FILE *file);
+
+/**
+ * mustach_cbor_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'cbor'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_compiled_fd(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, int fd);
+
+/**
+ * mustach_cbor_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'cbor'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @result:   the pointer receiving the result when 0 is returned
+ * @rsize:    the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_compiled_mem(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, char **result, size_t *rsize);
+
+/**
+ * mustach_cbor_compiled_write - Renders the compiled template 'tmpl' for 'cbor' to custom writer 'writecb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_compiled_write(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_cbor_compiled_emit - Renders the compiled template 'tmpl' for 'cbor' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @cbor:     the buffer of the CBOR data to render
+ * @size:     size of the buffer
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_cbor_compiled_emit(const struct mustach_template *tmpl, const void *cbor, size_t size, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+#endif
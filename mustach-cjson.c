@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include "mustach.h"
 #include "mustach-wrap.h"
@@ -18,7 +19,9 @@
 
 struct expl {
 	cJSON null;
-	cJSON *root;
+	cJSON *const *roots;
+	unsigned count;
+	int base;
 	cJSON *selection;
 	int depth;
 	struct {
@@ -32,12 +35,24 @@ struct expl {
 static int start(void *closure)
 {
 	struct expl *e = closure;
-	e->depth = 0;
+	unsigned i;
+
+	if (e->count == 0) {
+		errno = EINVAL;
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	if (e->count > MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
 	memset(&e->null, 0, sizeof e->null);
 	e->null.type = cJSON_NULL;
 	e->selection = &e->null;
-	e->stack[0].cont = NULL;
-	e->stack[0].obj = e->root;
+	/* the roots are the bottom frames, the first root on top */
+	for (i = 0 ; i < e->count ; i++) {
+		e->stack[i].cont = NULL;
+		e->stack[i].obj = e->roots[e->count - 1 - i];
+		e->stack[i].is_objiter = 0;
+	}
+	e->depth = e->base = (int)e->count - 1;
 	return MUSTACH_OK;
 }
 
@@ -143,7 +158,7 @@ static int next(void *closure)
 	struct expl *e = closure;
 	cJSON *o;
 
-	if (e->depth <= 0)
+	if (e->depth <= e->base)
 		return MUSTACH_ERROR_CLOSING;
 
 	o = e->stack[e->depth].next;
@@ -159,7 +174,7 @@ static int leave(void *closure)
 {
 	struct expl *e = closure;
 
-	if (e->depth <= 0)
+	if (e->depth <= e->base)
 		return MUSTACH_ERROR_CLOSING;
 
 	e->depth--;
@@ -202,38 +217,80 @@ const struct mustach_wrap_itf mustach_cJSON_wrap_itf = {
 	.get = get
 };
 
+/* prepares the explorer 'e' for rendering 'roots' and returns it */
+static void *init(struct expl *e, cJSON *const *roots, unsigned count, int flags)
+{
+	e->roots = roots;
+	e->count = count;
+	(void)flags; /* unused */
+	return e;
+}
+
 int mustach_cJSON_file(const char *template, size_t length, cJSON *root, int flags, FILE *file)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_file(template, length, &mustach_cJSON_wrap_itf, &e, flags, file);
+	return mustach_wrap_file(template, length, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, file);
 }
 
 int mustach_cJSON_fd(const char *template, size_t length, cJSON *root, int flags, int fd)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_fd(template, length, &mustach_cJSON_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd(template, length, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, fd);
 }
 
 int mustach_cJSON_mem(const char *template, size_t length, cJSON *root, int flags, char **result, size_t *size)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_mem(template, length, &mustach_cJSON_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem(template, length, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
 }
 
 int mustach_cJSON_write(const char *template, size_t length, cJSON *root, int flags, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_write(template, length, &mustach_cJSON_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write(template, length, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, writecb, closure);
 }
 
 int mustach_cJSON_emit(const char *template, size_t length, cJSON *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_emit(template, length, &mustach_cJSON_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_emit(template, length, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, emitcb, closure);
+}
+
+int mustach_cJSON_compiled_file(const struct mustach_template *tmpl, cJSON *root, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_compiled_file(tmpl, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, file);
+}
+
+int mustach_cJSON_compiled_fd(const struct mustach_template *tmpl, cJSON *root, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, fd);
+}
+
+int mustach_cJSON_compiled_mem(const struct mustach_template *tmpl, cJSON *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
+}
+
+int mustach_cJSON_compiled_write(const struct mustach_template *tmpl, cJSON *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_write(tmpl, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, writecb, closure);
+}
+
+int mustach_cJSON_compiled_emit(const struct mustach_template *tmpl, cJSON *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, emitcb, closure);
+}
+
+MUSTACH_WRAP_LAYERS_DEFINE(mustach_cJSON, cJSON, &mustach_cJSON_wrap_itf, struct expl, init)
+
+int mustach_cJSON_specialize(const char *template, size_t length, cJSON *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_specialize(template, length, &mustach_cJSON_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
 }
 
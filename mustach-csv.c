@@ -0,0 +1,774 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mustach.h"
+#include "mustach-wrap.h"
+#include "mustach-csv.h"
+
+/* offset of no row */
+#define NOROW  ((size_t)-1)
+
+/* types of values */
+enum {
+	T_none,
+	T_table,   /* the table, object of 'header' and 'rows' */
+	T_header,  /* the array of the names of the columns */
+	T_rows,    /* the array of the rows */
+	T_row,     /* a row, object of its cells */
+	T_cell     /* a cell or a name, string */
+};
+
+/* a cell of 'len' bytes at 'pos' in the text, 'esc' when it has doubled quotes */
+struct cell {
+	size_t pos;
+	size_t len;
+	int esc;
+};
+
+struct mustach_csv {
+	const char *text;
+	size_t size;
+	char sep;
+	char quote;
+	size_t ncols;        /* count of columns */
+	size_t body;         /* offset of the first row */
+	size_t current;      /* offset of the current row or NOROW */
+	size_t cached;       /* offset of the row whose cells are in 'cells' or NOROW */
+	size_t after;        /* offset of the row after the cached row */
+	size_t count;        /* count of cells of the cached row, at most 'ncols' */
+	struct cell *names;  /* names of the columns */
+	struct cell *cells;  /* cells of the cached row */
+};
+
+/******************************************************************************/
+/* SCANNING                                                                   */
+/******************************************************************************/
+
+/* skip the empty lines at 'pos' */
+static size_t skipblank(const struct mustach_csv *csv, size_t pos)
+{
+	const char *text = csv->text;
+	size_t size = csv->size;
+
+	for (;;) {
+		if (pos < size && text[pos] == '\n')
+			pos++;
+		else if (pos + 1 < size && text[pos] == '\r' && text[pos + 1] == '\n')
+			pos += 2;
+		else
+			return pos;
+	}
+}
+
+/*
+ * scan the cell at 'pos' in 'c', return the offset of the separator or new line
+ * ending it or NOROW when a quoted cell isn't terminated or is followed by text
+ */
+static size_t scancell(const struct mustach_csv *csv, size_t pos, struct cell *c)
+{
+	const char *text = csv->text, *q;
+	size_t size = csv->size;
+
+	c->esc = 0;
+	if (csv->quote && pos < size && text[pos] == csv->quote) {
+		c->pos = ++pos;
+		for (;;) {
+			q = memchr(&text[pos], csv->quote, size - pos);
+			if (q == NULL)
+				return NOROW;
+			pos = (size_t)(q - text) + 1;
+			if (pos == size || text[pos] != csv->quote)
+				break;
+			c->esc = 1;
+			pos++;
+		}
+		c->len = pos - 1 - c->pos;
+		if (pos < size && text[pos] == '\r' && (pos + 1 == size || text[pos + 1] == '\n'))
+			pos++;
+		if (pos < size && text[pos] != csv->sep && text[pos] != '\n')
+			return NOROW;
+	} else {
+		c->pos = pos;
+		while (pos < size && text[pos] != csv->sep && text[pos] != '\n')
+			pos++;
+		c->len = pos - c->pos;
+		if (c->len && text[pos - 1] == '\r' && pos < size && text[pos] == '\n')
+			c->len--;
+	}
+	return pos;
+}
+
+/*
+ * scan the row at 'pos', store its 'max' first cells in 'cells', its
+ * count of cells in 'count' and return the offset of the next row,
+ * the row having been checked by checkrow
+ */
+static size_t scanrow(const struct mustach_csv *csv, size_t pos, struct cell *cells, size_t max, size_t *count)
+{
+	struct cell c;
+	size_t n = 0;
+
+	for (;;) {
+		pos = scancell(csv, pos, n < max ? &cells[n] : &c);
+		n++;
+		if (pos == csv->size || csv->text[pos++] == '\n')
+			break;
+	}
+	*count = n;
+	return skipblank(csv, pos);
+}
+
+/*
+ * check the row at '*pos' that has at most 'max' cells, set '*pos' to the
+ * offset of the next row and return 0, or to the offset of the invalid cell
+ * and return -1
+ */
+static int checkrow(const struct mustach_csv *csv, size_t *pos, size_t max)
+{
+	struct cell c;
+	size_t n, p, end;
+
+	for (n = 1, p = *pos ; ; n++, p = end + 1) {
+		end = scancell(csv, p, &c);
+		if (end == NOROW || n > max) {
+			*pos = p;
+			return -1;
+		}
+		if (end == csv->size || csv->text[end] == '\n') {
+			*pos = skipblank(csv, end + (end < csv->size));
+			return 0;
+		}
+	}
+}
+
+/* locate the cells of the row at 'pos' unless already done */
+static void rowcells(struct mustach_csv *csv, size_t pos)
+{
+	if (csv->cached != pos) {
+		csv->after = scanrow(csv, pos, csv->cells, csv->ncols, &csv->count);
+		if (csv->count > csv->ncols)
+			csv->count = csv->ncols;
+		csv->cached = pos;
+	}
+}
+
+/* the offset of the row after the row at 'pos' */
+static size_t nextrow(struct mustach_csv *csv, size_t pos)
+{
+	rowcells(csv, pos);
+	return csv->after;
+}
+
+/* compare the cell 'c' with 'value' of 'len' */
+static int cellcmp(const struct mustach_csv *csv, const struct cell *c, const char *value, size_t len)
+{
+	const unsigned char *t = (const unsigned char*)&csv->text[c->pos];
+	const unsigned char *v = (const unsigned char*)value;
+	size_t i = 0, j = 0;
+
+	while (i < c->len && j < len) {
+		if (t[i] != v[j])
+			return t[i] < v[j] ? -1 : 1;
+		i += 1 + (c->esc && t[i] == (unsigned char)csv->quote);
+		j++;
+	}
+	return (i < c->len) - (j < len);
+}
+
+/* the index of the column of 'name' or 'ncols' when not found */
+static size_t column(const struct mustach_csv *csv, const char *name)
+{
+	size_t i, len = strlen(name);
+
+	for (i = 0 ; i < csv->ncols && cellcmp(csv, &csv->names[i], name, len) ; i++);
+	return i;
+}
+
+/******************************************************************************/
+/* TABLES                                                                     */
+/******************************************************************************/
+
+struct mustach_csv *mustach_csv_open(const char *text, size_t size, int separator, int quote, size_t *errpos)
+{
+	struct mustach_csv *csv;
+	size_t pos, head, count;
+
+	if (separator <= 0 || separator > 255 || separator == '\n' || separator == '\r'
+	 || quote < 0 || quote > 255 || quote == '\n' || quote == '\r' || quote == separator) {
+		errno = EINVAL;
+		return NULL;
+	}
+	csv = malloc(sizeof *csv);
+	if (csv == NULL)
+		return NULL;
+	csv->text = text;
+	csv->size = size;
+	csv->sep = (char)separator;
+	csv->quote = (char)quote;
+	csv->ncols = 0;
+	csv->names = csv->cells = NULL;
+	csv->current = csv->cached = NOROW;
+
+	/* skip the byte order mark */
+	pos = size >= 3 && !memcmp(text, "\xef\xbb\xbf", 3) ? 3 : 0;
+	pos = skipblank(csv, pos);
+	if (pos == size)
+		csv->body = size;
+	else {
+		/* the header */
+		head = pos;
+		if (checkrow(csv, &pos, NOROW) < 0)
+			goto invalid;
+		scanrow(csv, head, NULL, 0, &count);
+		csv->names = malloc(2 * count * sizeof *csv->names);
+		if (csv->names == NULL) {
+			free(csv);
+			return NULL;
+		}
+		csv->cells = &csv->names[count];
+		csv->body = scanrow(csv, head, csv->names, count, &csv->ncols);
+
+		/* the rows are checked once, the renderings rely on it */
+		for (pos = csv->body ; pos < size ; )
+			if (checkrow(csv, &pos, csv->ncols) < 0)
+				goto invalid;
+	}
+	return csv;
+
+invalid:
+	if (errpos != NULL)
+		*errpos = pos;
+	free(csv->names);
+	free(csv);
+	errno = EINVAL;
+	return NULL;
+}
+
+int mustach_csv_next(struct mustach_csv *csv)
+{
+	csv->current = csv->current == NOROW ? csv->body : nextrow(csv, csv->current);
+	if (csv->current < csv->size)
+		return 1;
+	csv->current = NOROW;
+	return 0;
+}
+
+void mustach_csv_rewind(struct mustach_csv *csv)
+{
+	csv->current = NOROW;
+}
+
+void mustach_csv_close(struct mustach_csv *csv)
+{
+	if (csv != NULL) {
+		free(csv->names);
+		free(csv);
+	}
+}
+
+/******************************************************************************/
+/* SERIALIZING                                                                */
+/******************************************************************************/
+
+/* serialization of values in compact JSON */
+struct serial {
+	char *buffer;
+	size_t length;
+	size_t alloc;
+};
+
+static int put(struct serial *s, const char *text, size_t length)
+{
+	char *b;
+	size_t alloc;
+
+	if (s->length + length >= s->alloc) {
+		alloc = s->alloc + (s->alloc >> 1) + length + 64;
+		b = realloc(s->buffer, alloc);
+		if (b == NULL)
+			return -1;
+		s->buffer = b;
+		s->alloc = alloc;
+	}
+	memcpy(&s->buffer[s->length], text, length);
+	s->length += length;
+	return 0;
+}
+
+/* put the characters of 'text' of 'length' escaped for JSON strings */
+static int putchars(struct serial *s, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = text + length, *begin;
+	char esc[6];
+	unsigned char c;
+	int rc = 0;
+
+	while (!rc && text != end) {
+		for (begin = text ; text != end && (c = (unsigned char)*text) >= ' ' && c != '"' && c != '\\' ; text++);
+		rc = put(s, begin, (size_t)(text - begin));
+		if (!rc && text != end) {
+			c = (unsigned char)*text++;
+			esc[0] = '\\';
+			switch (c) {
+			case '"': case '\\': esc[1] = (char)c; break;
+			case '\b': esc[1] = 'b'; break;
+			case '\f': esc[1] = 'f'; break;
+			case '\n': esc[1] = 'n'; break;
+			case '\r': esc[1] = 'r'; break;
+			case '\t': esc[1] = 't'; break;
+			default:
+				memcpy(&esc[1], "u00", 3);
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 15];
+				rc = put(s, esc, 6);
+				continue;
+			}
+			rc = put(s, esc, 2);
+		}
+	}
+	return rc;
+}
+
+/* put the JSON string of the cell 'c' */
+static int putcell(struct serial *s, const struct mustach_csv *csv, const struct cell *c)
+{
+	const char *text = &csv->text[c->pos], *end = text + c->len, *q;
+	int rc;
+
+	rc = put(s, "\"", 1);
+	while (!rc && text != end) {
+		q = c->esc ? memchr(text, csv->quote, (size_t)(end - text)) : NULL;
+		if (q == NULL) {
+			rc = putchars(s, text, (size_t)(end - text));
+			break;
+		}
+		/* keep one of the doubled quotes */
+		rc = putchars(s, text, (size_t)(q + 1 - text));
+		text = q + 2 < end ? q + 2 : end;
+	}
+	return rc || put(s, "\"", 1);
+}
+
+static int putrow(struct serial *s, struct mustach_csv *csv, size_t pos)
+{
+	size_t i;
+	int rc;
+
+	rowcells(csv, pos);
+	rc = put(s, "{", 1);
+	for (i = 0 ; !rc && i < csv->count ; i++)
+		rc = (i && put(s, ",", 1))
+		  || putcell(s, csv, &csv->names[i])
+		  || put(s, ":", 1)
+		  || putcell(s, csv, &csv->cells[i]);
+	return rc || put(s, "}", 1);
+}
+
+static int putheader(struct serial *s, struct mustach_csv *csv)
+{
+	size_t i;
+	int rc;
+
+	rc = put(s, "[", 1);
+	for (i = 0 ; !rc && i < csv->ncols ; i++)
+		rc = (i && put(s, ",", 1)) || putcell(s, csv, &csv->names[i]);
+	return rc || put(s, "]", 1);
+}
+
+static int putrows(struct serial *s, struct mustach_csv *csv)
+{
+	size_t pos;
+	int rc;
+
+	rc = put(s, "[", 1);
+	for (pos = csv->body ; !rc && pos < csv->size ; pos = nextrow(csv, pos))
+		rc = (pos != csv->body && put(s, ",", 1)) || putrow(s, csv, pos);
+	return rc || put(s, "]", 1);
+}
+
+/******************************************************************************/
+/* WRAP INTERFACE                                                             */
+/******************************************************************************/
+
+struct value {
+	int type;
+	size_t row;
+	struct cell cell;
+};
+
+struct expl {
+	struct mustach_csv *csv;
+	struct value selection;
+	int depth;
+	struct {
+		struct value cont;
+		struct value obj;
+		size_t index;
+		int is_objiter;
+	} stack[MUSTACH_MAX_DEPTH];
+};
+
+/* search in the object 'o' the value of key 'name' and store it in 'r' */
+static int member(struct mustach_csv *csv, const struct value *o, const char *name, struct value *r)
+{
+	size_t i;
+
+	switch (o->type) {
+	case T_table:
+		if (!strcmp(name, "header"))
+			r->type = T_header;
+		else if (!strcmp(name, "rows"))
+			r->type = T_rows;
+		else
+			return 0;
+		return 1;
+	case T_row:
+		i = column(csv, name);
+		if (i == csv->ncols)
+			return 0;
+		rowcells(csv, o->row);
+		if (i >= csv->count)
+			return 0;
+		r->type = T_cell;
+		r->cell = csv->cells[i];
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+	struct mustach_csv *csv = e->csv;
+
+	e->depth = 0;
+	e->selection.type = T_none;
+	e->stack[0].cont.type = T_none;
+	e->stack[0].obj.type = csv->current == NOROW ? T_table : T_row;
+	e->stack[0].obj.row = csv->current;
+	e->stack[0].index = 0;
+	e->stack[0].is_objiter = 0;
+	return MUSTACH_OK;
+}
+
+static int compare(void *closure, const char *value)
+{
+	struct expl *e = closure;
+	struct cell *c = &e->selection.cell;
+	char buffer[64], *end;
+	double d, v;
+
+	if (e->selection.type != T_cell)
+		return 1;
+
+	/* numbers are compared numerically */
+	if (!c->esc && c->len != 0 && c->len < sizeof buffer && *value) {
+		memcpy(buffer, &e->csv->text[c->pos], c->len);
+		buffer[c->len] = 0;
+		d = strtod(buffer, &end);
+		if (!*end) {
+			v = strtod(value, &end);
+			if (!*end)
+				return d < v ? -1 : d > v;
+		}
+	}
+	return cellcmp(e->csv, c, value, strlen(value));
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	int i;
+
+	if (name == NULL) {
+		e->selection = e->stack[e->depth].obj;
+		return 1;
+	}
+	for (i = e->depth ; i >= 0 ; i--)
+		if (member(e->csv, &e->stack[i].obj, name, &e->selection))
+			return 1;
+	e->selection.type = T_none;
+	return 0;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	struct value o = e->selection;
+
+	return member(e->csv, &o, name, &e->selection);
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+	struct mustach_csv *csv = e->csv;
+	struct value *o = &e->selection, *obj;
+
+	if (++e->depth >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+
+	e->stack[e->depth].cont = *o;
+	e->stack[e->depth].index = 0;
+	e->stack[e->depth].is_objiter = 0;
+	obj = &e->stack[e->depth].obj;
+	if (objiter) {
+		if (o->type != T_row)
+			goto not_entering;
+		rowcells(csv, o->row);
+		if (csv->count == 0)
+			goto not_entering;
+		obj->type = T_cell;
+		obj->cell = csv->cells[0];
+		e->stack[e->depth].is_objiter = 1;
+	} else {
+		switch (o->type) {
+		case T_rows:
+			if (csv->body >= csv->size)
+				goto not_entering;
+			obj->type = T_row;
+			obj->row = csv->body;
+			break;
+		case T_header:
+			if (csv->ncols == 0)
+				goto not_entering;
+			obj->type = T_cell;
+			obj->cell = csv->names[0];
+			break;
+		case T_cell:
+			if (o->cell.len == 0)
+				goto not_entering;
+			/* fallthrough */
+		case T_table:
+		case T_row:
+			*obj = *o;
+			break;
+		default:
+			goto not_entering;
+		}
+	}
+	return 1;
+
+not_entering:
+	e->depth--;
+	return 0;
+}
+
+static int next(void *closure)
+{
+	struct expl *e = closure;
+	struct mustach_csv *csv = e->csv;
+	size_t pos;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	if (e->stack[e->depth].is_objiter) {
+		rowcells(csv, e->stack[e->depth].cont.row);
+		if (++e->stack[e->depth].index >= csv->count)
+			return 0;
+		e->stack[e->depth].obj.cell = csv->cells[e->stack[e->depth].index];
+		return 1;
+	}
+	switch (e->stack[e->depth].cont.type) {
+	case T_rows:
+		pos = nextrow(csv, e->stack[e->depth].obj.row);
+		if (pos >= csv->size)
+			return 0;
+		e->stack[e->depth].obj.row = pos;
+		return 1;
+	case T_header:
+		if (++e->stack[e->depth].index >= csv->ncols)
+			return 0;
+		e->stack[e->depth].obj.cell = csv->names[e->stack[e->depth].index];
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	e->depth--;
+	return 0;
+}
+
+static int getvalue(struct mustach_csv *csv, const struct value *o, struct mustach_sbuf *sbuf)
+{
+	struct serial s;
+	const char *text, *end;
+	char *mem;
+	size_t len;
+	int rc;
+
+	switch (o->type) {
+	case T_none:
+		sbuf->value = "";
+		break;
+	case T_cell:
+		text = &csv->text[o->cell.pos];
+		len = o->cell.len;
+		if (len == 0)
+			sbuf->value = "";
+		else if (!o->cell.esc) {
+			/* in place */
+			sbuf->value = text;
+			sbuf->length = len;
+		} else {
+			/* undouble the quotes */
+			sbuf->value = mem = malloc(len);
+			if (mem == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+			for (end = text + len ; text != end ; text += 1 + (*text == csv->quote))
+				*mem++ = *text;
+			*mem = 0;
+			sbuf->freecb = free;
+		}
+		break;
+	default:
+		memset(&s, 0, sizeof s);
+		switch (o->type) {
+		case T_table:
+			rc = put(&s, "{\"header\":", 10)
+			  || putheader(&s, csv)
+			  || put(&s, ",\"rows\":", 8)
+			  || putrows(&s, csv)
+			  || put(&s, "}", 1);
+			break;
+		case T_header:
+			rc = putheader(&s, csv);
+			break;
+		case T_rows:
+			rc = putrows(&s, csv);
+			break;
+		default:
+			rc = putrow(&s, csv, o->row);
+			break;
+		}
+		if (rc || put(&s, "", 1)) {
+			free(s.buffer);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		sbuf->value = s.buffer;
+		sbuf->freecb = free;
+		break;
+	}
+	return 1;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+	struct value k;
+
+	if (key) {
+		if (!e->stack[e->depth].is_objiter) {
+			sbuf->value = "";
+			return 1;
+		}
+		k.type = T_cell;
+		k.cell = e->csv->names[e->stack[e->depth].index];
+		return getvalue(e->csv, &k, sbuf);
+	}
+	return getvalue(e->csv, &e->selection, sbuf);
+}
+
+const struct mustach_wrap_itf mustach_csv_wrap_itf = {
+	.start = start,
+	.compare = compare,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get
+};
+
+int mustach_csv_file(const char *template, size_t length, struct mustach_csv *csv, int flags, FILE *file)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_file(template, length, &mustach_csv_wrap_itf, &e, flags, file);
+}
+
+int mustach_csv_fd(const char *template, size_t length, struct mustach_csv *csv, int flags, int fd)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_fd(template, length, &mustach_csv_wrap_itf, &e, flags, fd);
+}
+
+int mustach_csv_mem(const char *template, size_t length, struct mustach_csv *csv, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_mem(template, length, &mustach_csv_wrap_itf, &e, flags, result, size);
+}
+
+int mustach_csv_write(const char *template, size_t length, struct mustach_csv *csv, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_write(template, length, &mustach_csv_wrap_itf, &e, flags, writecb, closure);
+}
+
+int mustach_csv_emit(const char *template, size_t length, struct mustach_csv *csv, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_emit(template, length, &mustach_csv_wrap_itf, &e, flags, emitcb, closure);
+}
+
+int mustach_csv_compiled_file(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, FILE *file)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_compiled_file(tmpl, &mustach_csv_wrap_itf, &e, flags, file);
+}
+
+int mustach_csv_compiled_fd(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, int fd)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_csv_wrap_itf, &e, flags, fd);
+}
+
+int mustach_csv_compiled_mem(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_csv_wrap_itf, &e, flags, result, size);
+}
+
+int mustach_csv_compiled_write(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_compiled_write(tmpl, &mustach_csv_wrap_itf, &e, flags, writecb, closure);
+}
+
+int mustach_csv_compiled_emit(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.csv = csv;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_csv_wrap_itf, &e, flags, emitcb, closure);
+}
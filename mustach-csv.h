@@ -0,0 +1,219 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _mustach_csv_h_included_
+#define _mustach_csv_h_included_
+
+/*
+ * mustach-csv is a self contained backend for mustach rendering tables
+ * of comma or tab separated values (CSV and TSV).
+ *
+ * The first line of the text is the header giving the names of the
+ * columns. Each following line is a row, seen as an object whose keys
+ * are the names of the columns and whose values are the strings of its
+ * cells. Empty lines are ignored and missing cells are undefined. The
+ * rows having more cells than the header are invalid.
+ *
+ * The text is never copied nor converted: cells are located when their
+ * row is explored and are rendered from the text, so that the memory
+ * used doesn't depend on the count of rows. The text given to
+ * 'mustach_csv_open' must remain valid and unchanged until it is closed.
+ *
+ * The root of the rendering is either the table, an object whose key
+ * 'header' is the array of the names of the columns and whose key 'rows'
+ * is the array of the rows, or the current row, see 'mustach_csv_next'.
+ *
+ * A handle can't be used by concurrent renderings.
+ */
+
+#include "mustach-wrap.h"
+
+struct mustach_csv;
+
+/**
+ * Wrap interface used internally by mustach csv functions.
+ * Can be used for overriding behaviour.
+ */
+extern const struct mustach_wrap_itf mustach_csv_wrap_itf;
+
+/**
+ * mustach_csv_open - Returns a handle for rendering the table of 'text'.
+ *
+ * @text:      the text of the table, it is not copied
+ * @size:      the size of the text
+ * @separator: the character separating the cells, ',' for CSV, '\t' for TSV
+ * @quote:     the character quoting cells, '"' for CSV, or 0 when cells
+ *             are never quoted as in TSV
+ * @errpos:    if not NULL, receives the offset of the invalid cell
+ *
+ * Quoted cells can contain separators and new lines. The quote is doubled
+ * within quoted cells. Lines can end with carriage return and line feed.
+ * The text is checked once by the opening: a quoted cell must be
+ * terminated and followed by a separator or the end of its line, a row
+ * can't have more cells than the header.
+ *
+ * Returns the handle or NULL with errno set to EINVAL for invalid
+ * characters or an invalid text or to ENOMEM when out of memory.
+ */
+extern struct mustach_csv *mustach_csv_open(const char *text, size_t size, int separator, int quote, size_t *errpos);
+
+/**
+ * mustach_csv_next - Makes the next row the root of the renderings.
+ *
+ * @csv: the handle
+ *
+ * The first call selects the first row. Returns 1 when a row is selected
+ * or 0 when there is no more row, the root being then the table again.
+ */
+extern int mustach_csv_next(struct mustach_csv *csv);
+
+/**
+ * mustach_csv_rewind - Makes the table the root of the renderings again,
+ * the next call to 'mustach_csv_next' selecting the first row.
+ *
+ * @csv: the handle
+ */
+extern void mustach_csv_rewind(struct mustach_csv *csv);
+
+/**
+ * mustach_csv_close - Releases the handle 'csv'.
+ */
+extern void mustach_csv_close(struct mustach_csv *csv);
+
+/**
+ * mustach_csv_file - Renders the mustache 'template' in 'file' for 'csv'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @csv:      the handle of the table to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_file(const char *template, size_t length, struct mustach_csv *csv, int flags, FILE *file);
+
+/**
+ * mustach_csv_fd - Renders the mustache 'template' in 'fd' for 'csv'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @csv:      the handle of the table to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_fd(const char *template, size_t length, struct mustach_csv *csv, int flags, int fd);
+
+/**
+ * mustach_csv_mem - Renders the mustache 'template' in 'result' for 'csv'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @csv:      the handle of the table to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_mem(const char *template, size_t length, struct mustach_csv *csv, int flags, char **result, size_t *size);
+
+/**
+ * mustach_csv_write - Renders the mustache 'template' for 'csv' to custom writer 'writecb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @csv:      the handle of the table to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_write(const char *template, size_t length, struct mustach_csv *csv, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_csv_emit - Renders the mustache 'template' for 'csv' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @csv:      the handle of the table to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_emit(const char *template, size_t length, struct mustach_csv *csv, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_csv_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'csv'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @csv:      the handle of the table to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_compiled_file(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, FILE *file);
+
+/**
+ * mustach_csv_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'csv'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @csv:      the handle of the table to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_compiled_fd(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, int fd);
+
+/**
+ * mustach_csv_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'csv'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @csv:      the handle of the table to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_compiled_mem(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, char **result, size_t *size);
+
+/**
+ * mustach_csv_compiled_write - Renders the compiled template 'tmpl' for 'csv' to custom writer 'writecb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @csv:      the handle of the table to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_compiled_write(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_csv_compiled_emit - Renders the compiled template 'tmpl' for 'csv' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @csv:      the handle of the table to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_csv_compiled_emit(const struct mustach_template *tmpl, struct mustach_csv *csv, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+#endif
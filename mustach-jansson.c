@@ -10,13 +10,16 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-jansson.h"
 
 struct expl {
-	json_t *root;
+	json_t *const *roots;
+	unsigned count;
+	int base;
 	json_t *selection;
 	int depth;
 	struct {
@@ -31,12 +34,24 @@ struct expl {
 static int start(void *closure)
 {
 	struct expl *e = closure;
-	e->depth = 0;
+	unsigned i;
+
+	if (e->count == 0) {
+		errno = EINVAL;
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	if (e->count > MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
 	e->selection = json_null();
-	e->stack[0].cont = NULL;
-	e->stack[0].obj = e->root;
-	e->stack[0].index = 0;
-	e->stack[0].count = 1;
+	/* the roots are the bottom frames, the first root on top */
+	for (i = 0 ; i < e->count ; i++) {
+		e->stack[i].cont = NULL;
+		e->stack[i].obj = e->roots[e->count - 1 - i];
+		e->stack[i].index = 0;
+		e->stack[i].count = 1;
+		e->stack[i].is_objiter = 0;
+	}
+	e->depth = e->base = (int)e->count - 1;
 	return MUSTACH_OK;
 }
 
@@ -148,7 +163,7 @@ static int next(void *closure)
 {
 	struct expl *e = closure;
 
-	if (e->depth <= 0)
+	if (e->depth <= e->base)
 		return MUSTACH_ERROR_CLOSING;
 
 	if (e->stack[e->depth].is_objiter) {
@@ -171,7 +186,7 @@ static int leave(void *closure)
 {
 	struct expl *e = closure;
 
-	if (e->depth <= 0)
+	if (e->depth <= e->base)
 		return MUSTACH_ERROR_CLOSING;
 
 	e->depth--;
@@ -214,38 +229,80 @@ const struct mustach_wrap_itf mustach_jansson_wrap_itf = {
 	.get = get
 };
 
+/* prepares the explorer 'e' for rendering 'roots' and returns it */
+static void *init(struct expl *e, json_t *const *roots, unsigned count, int flags)
+{
+	e->roots = roots;
+	e->count = count;
+	(void)flags; /* unused */
+	return e;
+}
+
 int mustach_jansson_file(const char *template, size_t length, json_t *root, int flags, FILE *file)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_file(template, length, &mustach_jansson_wrap_itf, &e, flags, file);
+	return mustach_wrap_file(template, length, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, file);
 }
 
 int mustach_jansson_fd(const char *template, size_t length, json_t *root, int flags, int fd)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_fd(template, length, &mustach_jansson_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd(template, length, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, fd);
 }
 
 int mustach_jansson_mem(const char *template, size_t length, json_t *root, int flags, char **result, size_t *size)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_mem(template, length, &mustach_jansson_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem(template, length, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
 }
 
 int mustach_jansson_write(const char *template, size_t length, json_t *root, int flags, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_write(template, length, &mustach_jansson_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write(template, length, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, writecb, closure);
 }
 
 int mustach_jansson_emit(const char *template, size_t length, json_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_emit(template, length, &mustach_jansson_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_emit(template, length, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, emitcb, closure);
+}
+
+int mustach_jansson_compiled_file(const struct mustach_template *tmpl, json_t *root, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_compiled_file(tmpl, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, file);
+}
+
+int mustach_jansson_compiled_fd(const struct mustach_template *tmpl, json_t *root, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, fd);
+}
+
+int mustach_jansson_compiled_mem(const struct mustach_template *tmpl, json_t *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
+}
+
+int mustach_jansson_compiled_write(const struct mustach_template *tmpl, json_t *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_write(tmpl, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, writecb, closure);
+}
+
+int mustach_jansson_compiled_emit(const struct mustach_template *tmpl, json_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, emitcb, closure);
+}
+
+MUSTACH_WRAP_LAYERS_DEFINE(mustach_jansson, json_t, &mustach_jansson_wrap_itf, struct expl, init)
+
+int mustach_jansson_specialize(const char *template, size_t length, json_t *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_specialize(template, length, &mustach_jansson_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
 }
 
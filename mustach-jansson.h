@@ -92,5 +92,91 @@ extern int mustach_jansson_write(const char *template, size_t length, json_t *ro
  */
 extern int mustach_jansson_emit(const char *template, size_t length, json_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
 
+/**
+ * mustach_jansson_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'root'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_jansson_compiled_file(const struct mustach_template *tmpl, json_t *root, int flags, FILE *file);
+
+/**
+ * mustach_jansson_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'root'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_jansson_compiled_fd(const struct mustach_template *tmpl, json_t *root, int flags, int fd);
+
+/**
+ * mustach_jansson_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'root'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_jansson_compiled_mem(const struct mustach_template *tmpl, json_t *root, int flags, char **result, size_t *size);
+
+/**
+ * mustach_jansson_compiled_write - Renders the compiled template 'tmpl' for 'root' to custom writer 'writecb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_jansson_compiled_write(const struct mustach_template *tmpl, json_t *root, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_jansson_compiled_emit - Renders the compiled template 'tmpl' for 'root' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_jansson_compiled_emit(const struct mustach_template *tmpl, json_t *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/*
+ * The functions mustach_jansson_layers_XXX and mustach_jansson_compiled_layers_XXX
+ * render for the list of 'count' jansson values 'roots', searched in that
+ * order. See MUSTACH_WRAP_LAYERS_DECLARE in mustach-wrap.h.
+ */
+MUSTACH_WRAP_LAYERS_DECLARE(mustach_jansson, json_t);
+
+/**
+ * mustach_jansson_specialize - Specializes the mustache 'template' for the static data 'root'.
+ * The result is rendered with 'root' as the last of the roots of the layers
+ * functions. See mustach_wrap_specialize.
+ *
+ * @template: the template string to specialize
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json object of the static data
+ * @result:   the pointer receiving the specialized template when 0 is returned
+ * @size:     the size of the returned template
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_jansson_specialize(const char *template, size_t length, json_t *root, int flags, char **result, size_t *size);
+
 #endif
 
@@ -8,15 +8,21 @@
 
 #define _GNU_SOURCE
 
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
 
 #include "mustach.h"
 #include "mustach-wrap.h"
 #include "mustach-json-c.h"
 
 struct expl {
-	struct json_object *root;
+	struct json_object *const *roots;
+	unsigned count;
+	int base;
+	int readonly;
 	struct json_object *selection;
 	int depth;
 	struct {
@@ -32,19 +38,169 @@ struct expl {
 static int start(void *closure)
 {
 	struct expl *e = closure;
-	e->depth = 0;
+	unsigned i;
+
+	if (e->count == 0) {
+		errno = EINVAL;
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	if (e->count > MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
 	e->selection = NULL;
-	e->stack[0].cont = NULL;
-	e->stack[0].obj = e->root;
-	e->stack[0].index = 0;
-	e->stack[0].count = 1;
+	/* the roots are the bottom frames, the first root on top */
+	for (i = 0 ; i < e->count ; i++) {
+		e->stack[i].cont = NULL;
+		e->stack[i].obj = e->roots[e->count - 1 - i];
+		e->stack[i].index = 0;
+		e->stack[i].count = 1;
+		e->stack[i].is_objiter = 0;
+	}
+	e->depth = e->base = (int)e->count - 1;
 	return MUSTACH_OK;
 }
 
+/*
+ * json-c caches the text of the values it serializes in the values
+ * themselves. In read-only mode, the values are serialized by the functions
+ * below as json_object_to_json_string_ext(o, 0) does but without writing
+ * in the shared tree. The serialization is either appended to 'buffer'
+ * or, when 'compared' isn't NULL, compared to it without being stored.
+ */
+struct serial {
+	char *buffer;
+	size_t length;
+	size_t alloc;
+	const char *compared;
+	int diff;
+};
+
+static int put(struct serial *s, const char *text, size_t length)
+{
+	char *b;
+	size_t alloc, i;
+
+	if (s->compared) {
+		for (i = 0 ; !s->diff && i < length ; i++) {
+			s->diff = (int)(unsigned char)text[i] - (int)(unsigned char)*s->compared;
+			s->compared += *s->compared != 0;
+		}
+		return 0;
+	}
+	if (s->length + length > s->alloc) {
+		alloc = s->alloc ? s->alloc : 64;
+		while (s->length + length > alloc)
+			alloc <<= 1;
+		b = realloc(s->buffer, alloc);
+		if (b == NULL)
+			return -1;
+		s->buffer = b;
+		s->alloc = alloc;
+	}
+	if (length) {
+		memcpy(&s->buffer[s->length], text, length);
+		s->length += length;
+	}
+	return 0;
+}
+
+static int putstring(struct serial *s, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6];
+	size_t i, j;
+	int rc;
+
+	rc = put(s, "\"", 1);
+	for (i = j = 0 ; !rc && j < len ; j++) {
+		esc[0] = '\\';
+		switch (str[j]) {
+		case '"': case '\\': case '/': esc[1] = str[j]; break;
+		case '\b': esc[1] = 'b'; break;
+		case '\f': esc[1] = 'f'; break;
+		case '\n': esc[1] = 'n'; break;
+		case '\r': esc[1] = 'r'; break;
+		case '\t': esc[1] = 't'; break;
+		default:
+			if ((unsigned char)str[j] >= ' ')
+				continue;
+			esc[1] = 'u';
+			esc[2] = esc[3] = '0';
+			esc[4] = hex[(unsigned char)str[j] >> 4];
+			esc[5] = hex[str[j] & 15];
+			rc = put(s, &str[i], j - i) || put(s, esc, 6);
+			i = j + 1;
+			continue;
+		}
+		rc = put(s, &str[i], j - i) || put(s, esc, 2);
+		i = j + 1;
+	}
+	return rc || put(s, &str[i], j - i) || put(s, "\"", 1);
+}
+
+static int serialize(struct json_object *o, struct serial *s)
+{
+	struct json_object_iterator iter, end;
+	char buffer[40];
+	const char *text;
+	size_t i, n;
+	int64_t i64;
+	double d;
+	int rc;
+
+	switch (json_object_get_type(o)) {
+	case json_type_null:
+		return put(s, "null", 4);
+	case json_type_boolean:
+		return json_object_get_boolean(o) ? put(s, "true", 4) : put(s, "false", 5);
+	case json_type_int:
+		i64 = json_object_get_int64(o);
+		if (i64 == INT64_MAX)
+			n = (size_t)sprintf(buffer, "%llu", (unsigned long long)json_object_get_uint64(o));
+		else
+			n = (size_t)sprintf(buffer, "%lld", (long long)i64);
+		return put(s, buffer, n);
+	case json_type_double:
+		/* the parser records the text of the doubles as user data */
+		text = json_object_get_userdata(o);
+		if (text != NULL)
+			return put(s, text, strlen(text));
+		d = json_object_get_double(o);
+		if (isnan(d))
+			return put(s, "NaN", 3);
+		if (isinf(d))
+			return d < 0 ? put(s, "-Infinity", 9) : put(s, "Infinity", 8);
+		n = (size_t)sprintf(buffer, "%.17g", d);
+		if (!strchr(buffer, '.') && !strchr(buffer, 'e'))
+			n += (size_t)sprintf(&buffer[n], ".0");
+		return put(s, buffer, n);
+	case json_type_string:
+		return putstring(s, json_object_get_string(o), (size_t)json_object_get_string_len(o));
+	case json_type_array:
+		rc = put(s, "[", 1);
+		for (i = 0, n = json_object_array_length(o) ; !rc && i < n ; i++)
+			rc = (i && put(s, ",", 1)) || serialize(json_object_array_get_idx(o, i), s);
+		return rc || put(s, "]", 1);
+	default:
+		rc = put(s, "{", 1);
+		iter = json_object_iter_begin(o);
+		end = json_object_iter_end(o);
+		for (i = 0 ; !rc && !json_object_iter_equal(&iter, &end) ; i++) {
+			text = json_object_iter_peek_name(&iter);
+			rc = (i && put(s, ",", 1))
+				|| putstring(s, text, strlen(text))
+				|| put(s, ":", 1)
+				|| serialize(json_object_iter_peek_value(&iter), s);
+			json_object_iter_next(&iter);
+		}
+		return rc || put(s, "}", 1);
+	}
+}
+
 static int compare(void *closure, const char *value)
 {
 	struct expl *e = closure;
 	struct json_object *o = e->selection;
+	struct serial s;
 	double d;
 	int64_t i;
 
@@ -55,8 +211,16 @@ static int compare(void *closure, const char *value)
 	case json_type_int:
 		i = json_object_get_int64(o) - (int64_t)atoll(value);
 		return i < 0 ? -1 : i > 0 ? 1 : 0;
-	default:
+	case json_type_string:
 		return strcmp(json_object_get_string(o), value);
+	default:
+		if (!e->readonly)
+			return strcmp(json_object_get_string(o), value);
+		/* compared while serialized, nothing is allocated */
+		memset(&s, 0, sizeof s);
+		s.compared = value;
+		serialize(o, &s);
+		return s.diff ? s.diff : -(int)(unsigned char)*s.compared;
 	}
 }
 
@@ -142,7 +306,7 @@ static int next(void *closure)
 {
 	struct expl *e = closure;
 
-	if (e->depth <= 0)
+	if (e->depth <= e->base)
 		return MUSTACH_ERROR_CLOSING;
 
 	if (e->stack[e->depth].is_objiter) {
@@ -165,7 +329,7 @@ static int leave(void *closure)
 {
 	struct expl *e = closure;
 
-	if (e->depth <= 0)
+	if (e->depth <= e->base)
 		return MUSTACH_ERROR_CLOSING;
 
 	e->depth--;
@@ -175,25 +339,37 @@ static int leave(void *closure)
 static int get(void *closure, struct mustach_sbuf *sbuf, int key)
 {
 	struct expl *e = closure;
-	const char *s;
+	struct serial s;
 
 	if (key)
-		s = e->stack[e->depth].is_objiter
+		sbuf->value = e->stack[e->depth].is_objiter
 			? json_object_iter_peek_name(&e->stack[e->depth].iter)
 			: "";
 	else
 		switch (json_object_get_type(e->selection)) {
 		case json_type_string:
-			s = json_object_get_string(e->selection);
+			sbuf->value = json_object_get_string(e->selection);
 			break;
 		case json_type_null:
-			s = "";
+			sbuf->value = "";
+			break;
+		case json_type_boolean:
+			sbuf->value = json_object_get_boolean(e->selection) ? "true" : "false";
 			break;
 		default:
-			s = json_object_to_json_string_ext(e->selection, 0);
+			if (!e->readonly) {
+				sbuf->value = json_object_to_json_string_ext(e->selection, 0);
+				break;
+			}
+			memset(&s, 0, sizeof s);
+			if (serialize(e->selection, &s) || put(&s, "", 1)) {
+				free(s.buffer);
+				return MUSTACH_ERROR_SYSTEM;
+			}
+			sbuf->value = s.buffer;
+			sbuf->freecb = free;
 			break;
 		}
-	sbuf->value = s;
 	return 1;
 }
 
@@ -209,39 +385,81 @@ const struct mustach_wrap_itf mustach_json_c_wrap_itf = {
 	.get = get
 };
 
+/* prepares the explorer 'e' for rendering 'roots' and returns it */
+static void *init(struct expl *e, struct json_object *const *roots, unsigned count, int flags)
+{
+	e->roots = roots;
+	e->count = count;
+	e->readonly = !!(flags & Mustach_With_ReadOnly);
+	return e;
+}
+
 int mustach_json_c_file(const char *template, size_t length, struct json_object *root, int flags, FILE *file)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_file(template, length, &mustach_json_c_wrap_itf, &e, flags, file);
+	return mustach_wrap_file(template, length, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, file);
 }
 
 int mustach_json_c_fd(const char *template, size_t length, struct json_object *root, int flags, int fd)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_fd(template, length, &mustach_json_c_wrap_itf, &e, flags, fd);
+	return mustach_wrap_fd(template, length, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, fd);
 }
 
 int mustach_json_c_mem(const char *template, size_t length, struct json_object *root, int flags, char **result, size_t *size)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_mem(template, length, &mustach_json_c_wrap_itf, &e, flags, result, size);
+	return mustach_wrap_mem(template, length, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
 }
 
 int mustach_json_c_write(const char *template, size_t length, struct json_object *root, int flags, mustach_write_cb_t *writecb, void *closure)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_write(template, length, &mustach_json_c_wrap_itf, &e, flags, writecb, closure);
+	return mustach_wrap_write(template, length, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, writecb, closure);
 }
 
 int mustach_json_c_emit(const char *template, size_t length, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
 {
 	struct expl e;
-	e.root = root;
-	return mustach_wrap_emit(template, length, &mustach_json_c_wrap_itf, &e, flags, emitcb, closure);
+	return mustach_wrap_emit(template, length, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, emitcb, closure);
+}
+
+int mustach_json_c_compiled_file(const struct mustach_template *tmpl, struct json_object *root, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_compiled_file(tmpl, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, file);
+}
+
+int mustach_json_c_compiled_fd(const struct mustach_template *tmpl, struct json_object *root, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, fd);
+}
+
+int mustach_json_c_compiled_mem(const struct mustach_template *tmpl, struct json_object *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
+}
+
+int mustach_json_c_compiled_write(const struct mustach_template *tmpl, struct json_object *root, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_write(tmpl, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, writecb, closure);
+}
+
+int mustach_json_c_compiled_emit(const struct mustach_template *tmpl, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, emitcb, closure);
+}
+
+MUSTACH_WRAP_LAYERS_DEFINE(mustach_json_c, struct json_object, &mustach_json_c_wrap_itf, struct expl, init)
+
+int mustach_json_c_specialize(const char *template, size_t length, struct json_object *root, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_specialize(template, length, &mustach_json_c_wrap_itf, init(&e, &root, 1, flags), flags, result, size);
 }
 
 int fmustach_json_c(const char *template, struct json_object *root, FILE *file)
@@ -12,6 +12,11 @@
 /*
  * mustach-json-c is intended to make integration of json-c
  * library by providing integrated functions.
+ *
+ * json-c caches in the values the text of the numbers, booleans, objects
+ * and arrays it serializes. For rendering one tree from many threads
+ * concurrently, use the flag Mustach_With_ReadOnly: these values are then
+ * serialized by mustach in its own buffers and the tree is never modified.
  */
 
 #include <json-c/json.h>
@@ -91,6 +96,92 @@ extern int mustach_json_c_write(const char *template, size_t length, struct json
  */
 extern int mustach_json_c_emit(const char *template, size_t length, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
 
+/**
+ * mustach_json_c_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'root'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_file(const struct mustach_template *tmpl, struct json_object *root, int flags, FILE *file);
+
+/**
+ * mustach_json_c_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'root'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_fd(const struct mustach_template *tmpl, struct json_object *root, int flags, int fd);
+
+/**
+ * mustach_json_c_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'root'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_mem(const struct mustach_template *tmpl, struct json_object *root, int flags, char **result, size_t *size);
+
+/**
+ * mustach_json_c_compiled_write - Renders the compiled template 'tmpl' for 'root' to custom writer 'writecb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_write(const struct mustach_template *tmpl, struct json_object *root, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_json_c_compiled_emit - Renders the compiled template 'tmpl' for 'root' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @root:     the root json object to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_compiled_emit(const struct mustach_template *tmpl, struct json_object *root, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/*
+ * The functions mustach_json_c_layers_XXX and mustach_json_c_compiled_layers_XXX
+ * render for the list of 'count' json-c objects 'roots', searched in that
+ * order. See MUSTACH_WRAP_LAYERS_DECLARE in mustach-wrap.h.
+ */
+MUSTACH_WRAP_LAYERS_DECLARE(mustach_json_c, struct json_object);
+
+/**
+ * mustach_json_c_specialize - Specializes the mustache 'template' for the static data 'root'.
+ * The result is rendered with 'root' as the last of the roots of the layers
+ * functions. See mustach_wrap_specialize.
+ *
+ * @template: the template string to specialize
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @root:     the root json object of the static data
+ * @result:   the pointer receiving the specialized template when 0 is returned
+ * @size:     the size of the returned template
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_json_c_specialize(const char *template, size_t length, struct json_object *root, int flags, char **result, size_t *size);
+
 /***************************************************************************
 * compatibility with version before 1.0
 */
@@ -0,0 +1,704 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "mustach.h"
+#include "mustach-wrap.h"
+#include "mustach-struct.h"
+
+/* count of the buffers of numbers of the explorer */
+#define NUMBERS    8
+
+/* size of the buffers of numbers */
+#define NUMSIZE    32
+
+/* type of null values, not a field type */
+#define T_null     -1
+
+/* a value: its address, its type and, for arrays, its items */
+struct value {
+	const char *addr;                       /* address of the value or of the first item */
+	const struct mustach_struct_desc *desc; /* description of structures or of items */
+	size_t count;                           /* count of items of arrays, size of chars */
+	int type;                               /* type of the value */
+	int item;                               /* type of the items of arrays */
+};
+
+/******************************************************************************/
+/* ACCESSING                                                                  */
+/******************************************************************************/
+
+/* size of the items of type 'type' */
+static size_t itemsize(int type, const struct mustach_struct_desc *desc)
+{
+	switch (type) {
+	case Mustach_Struct_Bool: return sizeof(bool);
+	case Mustach_Struct_Int: return sizeof(int);
+	case Mustach_Struct_Unsigned: return sizeof(unsigned);
+	case Mustach_Struct_Long: return sizeof(long);
+	case Mustach_Struct_ULong: return sizeof(unsigned long);
+	case Mustach_Struct_Int64: return sizeof(int64_t);
+	case Mustach_Struct_UInt64: return sizeof(uint64_t);
+	case Mustach_Struct_Size: return sizeof(size_t);
+	case Mustach_Struct_Float: return sizeof(float);
+	case Mustach_Struct_Double: return sizeof(double);
+	case Mustach_Struct_Struct: return desc->size;
+	default: return sizeof(void*);
+	}
+}
+
+/* is 'type' a type of integer? */
+static inline int isinteger(int type)
+{
+	return type >= Mustach_Struct_Int && type <= Mustach_Struct_Size;
+}
+
+/* is 'type' a type of signed integer? */
+static inline int issigned(int type)
+{
+	return type == Mustach_Struct_Int || type == Mustach_Struct_Long || type == Mustach_Struct_Int64;
+}
+
+/* get the signed integer at 'addr' of 'type' */
+static long long sinteger(const char *addr, int type)
+{
+	switch (type) {
+	case Mustach_Struct_Int: return *(const int*)addr;
+	case Mustach_Struct_Long: return *(const long*)addr;
+	default: return *(const int64_t*)addr;
+	}
+}
+
+/* get the unsigned integer at 'addr' of 'type' */
+static unsigned long long uinteger(const char *addr, int type)
+{
+	switch (type) {
+	case Mustach_Struct_Unsigned: return *(const unsigned*)addr;
+	case Mustach_Struct_ULong: return *(const unsigned long*)addr;
+	case Mustach_Struct_UInt64: return *(const uint64_t*)addr;
+	case Mustach_Struct_Size: return *(const size_t*)addr;
+	default: return (unsigned long long)sinteger(addr, type);
+	}
+}
+
+/* get the number at 'addr' of 'type' as a double */
+static double number(const char *addr, int type)
+{
+	switch (type) {
+	case Mustach_Struct_Float: return *(const float*)addr;
+	case Mustach_Struct_Double: return *(const double*)addr;
+	default: return issigned(type) ? (double)sinteger(addr, type) : (double)uinteger(addr, type);
+	}
+}
+
+/* set 'v' to the value at 'addr' of 'type', following the pointers */
+static void setvalue(struct value *v, const char *addr, int type, const struct mustach_struct_desc *desc)
+{
+	v->desc = desc;
+	v->count = 0;
+	v->type = type;
+	v->addr = addr;
+	if (type == Mustach_Struct_String || type == Mustach_Struct_Pointer) {
+		v->addr = *(const char * const *)addr;
+		if (v->addr == NULL)
+			v->type = T_null;
+		else if (type == Mustach_Struct_Pointer)
+			v->type = Mustach_Struct_Struct;
+	}
+}
+
+/* set 'v' to the value of the field 'f' of the structure at 'base' */
+static void fieldvalue(struct value *v, const char *base, const struct mustach_struct_field *f)
+{
+	const struct mustach_struct_field *c;
+
+	long long n;
+
+	setvalue(v, base + f->offset, f->type, f->desc);
+	if (f->type == Mustach_Struct_Chars)
+		v->count = f->length;
+	else if (f->type == Mustach_Struct_Array || f->type == Mustach_Struct_Vector) {
+		/* vectors are arrays whose items are in the structure */
+		if (f->type == Mustach_Struct_Array)
+			v->addr = *(const char * const *)v->addr;
+		v->type = Mustach_Struct_Array;
+		v->item = f->item;
+		c = f->count;
+		if (v->addr == NULL)
+			v->count = 0;
+		else if (c == NULL || !isinteger(c->type))
+			v->count = f->length;
+		else if (issigned(c->type)) {
+			n = sinteger(base + c->offset, c->type);
+			v->count = n > 0 ? (size_t)n : 0;
+		}
+		else
+			v->count = (size_t)uinteger(base + c->offset, c->type);
+		if (f->type == Mustach_Struct_Vector && v->count > f->length)
+			v->count = f->length;
+	}
+}
+
+/* set 'v' to the item 'index' of the array 'a' */
+static void itemvalue(struct value *v, const struct value *a, size_t index)
+{
+	setvalue(v, a->addr + index * itemsize(a->item, a->desc), a->item, a->desc);
+}
+
+/* search in the structure 'o' the field of 'name' */
+static const struct mustach_struct_field *field(const struct value *o, const char *name)
+{
+	const struct mustach_struct_field *f, *end;
+
+	if (o->type != Mustach_Struct_Struct)
+		return NULL;
+	for (f = o->desc->fields, end = f + o->desc->count ; f != end ; f++)
+		if (!strcmp(f->name, name))
+			return f;
+	return NULL;
+}
+
+/* get the text of the string or chars 'v' and its length */
+static const char *text(const struct value *v, size_t *length)
+{
+	*length = v->type == Mustach_Struct_Chars ? strnlen(v->addr, v->count) : strlen(v->addr);
+	return v->addr;
+}
+
+/* format the number 'v' in 'buffer' of NUMSIZE bytes, returns its length */
+static int numtext(const struct value *v, char *buffer)
+{
+	int prec, len;
+	double d;
+	float f;
+
+	switch (v->type) {
+	case Mustach_Struct_Bool:
+		return sprintf(buffer, "%s", *(const bool*)v->addr ? "true" : "false");
+	case Mustach_Struct_Float:
+		/* shortest text reading back the same float */
+		f = *(const float*)v->addr;
+		prec = 1;
+		do {
+			len = snprintf(buffer, NUMSIZE, "%.*g", prec, (double)f);
+		} while (prec++ < 9 && strtof(buffer, NULL) != f);
+		d = f;
+		break;
+	case Mustach_Struct_Double:
+		/* shortest text reading back the same double */
+		d = *(const double*)v->addr;
+		prec = 1;
+		do {
+			len = snprintf(buffer, NUMSIZE, "%.*g", prec, d);
+		} while (prec++ < 17 && strtod(buffer, NULL) != d);
+		break;
+	default:
+		if (issigned(v->type))
+			return sprintf(buffer, "%lld", sinteger(v->addr, v->type));
+		return sprintf(buffer, "%llu", uinteger(v->addr, v->type));
+	}
+	if (isfinite(d) && !strchr(buffer, '.')) {
+		/* integral values are written as reals without exponent */
+		if (strchr(buffer, 'e') && fabs(d) < 1e17)
+			len = snprintf(buffer, NUMSIZE, "%.0f", d);
+		if (!strchr(buffer, 'e'))
+			len += snprintf(&buffer[len], (size_t)(NUMSIZE - len), ".0");
+	}
+	return len;
+}
+
+/* serialization of structures and arrays in compact JSON */
+struct serial {
+	char *buffer;
+	size_t length;
+	size_t alloc;
+};
+
+static int put(struct serial *s, const char *text, size_t length)
+{
+	char *b;
+	size_t alloc;
+
+	if (s->length + length >= s->alloc) {
+		alloc = s->alloc + (s->alloc >> 1) + length + 64;
+		b = realloc(s->buffer, alloc);
+		if (b == NULL)
+			return -1;
+		s->buffer = b;
+		s->alloc = alloc;
+	}
+	memcpy(&s->buffer[s->length], text, length);
+	s->length += length;
+	return 0;
+}
+
+/* put the JSON string of 'text' of 'length' */
+static int putstring(struct serial *s, const char *text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = text + length, *begin;
+	char esc[6];
+	unsigned char c;
+	int rc;
+
+	rc = put(s, "\"", 1);
+	while (!rc && text != end) {
+		for (begin = text ; text != end && (c = (unsigned char)*text) >= ' ' && c != '"' && c != '\\' ; text++);
+		rc = put(s, begin, (size_t)(text - begin));
+		if (!rc && text != end) {
+			c = (unsigned char)*text++;
+			esc[0] = '\\';
+			switch (c) {
+			case '"': case '\\': esc[1] = (char)c; break;
+			case '\b': esc[1] = 'b'; break;
+			case '\f': esc[1] = 'f'; break;
+			case '\n': esc[1] = 'n'; break;
+			case '\r': esc[1] = 'r'; break;
+			case '\t': esc[1] = 't'; break;
+			default:
+				memcpy(&esc[1], "u00", 3);
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 15];
+				rc = put(s, esc, 6);
+				continue;
+			}
+			rc = put(s, esc, 2);
+		}
+	}
+	return rc || put(s, "\"", 1);
+}
+
+static int serialize(const struct value *v, struct serial *s)
+{
+	const struct mustach_struct_field *f;
+	struct value x;
+	char buffer[NUMSIZE];
+	const char *str;
+	size_t i, len;
+	int rc;
+
+	switch (v->type) {
+	case T_null:
+		return put(s, "null", 4);
+	case Mustach_Struct_String:
+	case Mustach_Struct_Chars:
+		str = text(v, &len);
+		return putstring(s, str, len);
+	case Mustach_Struct_Struct:
+		rc = put(s, "{", 1);
+		for (i = 0 ; !rc && i < v->desc->count ; i++) {
+			f = &v->desc->fields[i];
+			fieldvalue(&x, v->addr, f);
+			rc = (i && put(s, ",", 1))
+				|| putstring(s, f->name, strlen(f->name))
+				|| put(s, ":", 1)
+				|| serialize(&x, s);
+		}
+		return rc || put(s, "}", 1);
+	case Mustach_Struct_Array:
+		rc = put(s, "[", 1);
+		for (i = 0 ; !rc && i < v->count ; i++) {
+			itemvalue(&x, v, i);
+			rc = (i && put(s, ",", 1)) || serialize(&x, s);
+		}
+		return rc || put(s, "]", 1);
+	case Mustach_Struct_Float:
+	case Mustach_Struct_Double:
+		if (!isfinite(number(v->addr, v->type)))
+			return put(s, "null", 4);
+		/* fallthrough */
+	default:
+		return put(s, buffer, (size_t)numtext(v, buffer));
+	}
+}
+
+char *mustach_struct_json(const void *data, const struct mustach_struct_desc *desc)
+{
+	struct serial s;
+	struct value v;
+
+	memset(&s, 0, sizeof s);
+	v.addr = data;
+	v.desc = desc;
+	v.type = Mustach_Struct_Struct;
+	if (serialize(&v, &s) || put(&s, "", 1)) {
+		free(s.buffer);
+		return NULL;
+	}
+	return s.buffer;
+}
+
+/******************************************************************************/
+/* WRAP INTERFACE                                                             */
+/******************************************************************************/
+
+struct expl {
+	const void *root;
+	const struct mustach_struct_desc *desc;
+	struct value selection;
+	int depth;
+	unsigned busy;                    /* the buffers of numbers in use */
+	char numbers[NUMBERS][NUMSIZE];   /* buffers of numbers given to mustach */
+	struct {
+		struct value cont;
+		struct value obj;
+		const struct mustach_struct_field *key;
+		size_t index;
+		int is_objiter;
+	} stack[MUSTACH_MAX_DEPTH];
+};
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+
+	e->depth = 0;
+	e->busy = 0;
+	e->selection.type = T_null;
+	e->stack[0].cont.type = T_null;
+	e->stack[0].obj.addr = e->root;
+	e->stack[0].obj.desc = e->desc;
+	e->stack[0].obj.type = Mustach_Struct_Struct;
+	e->stack[0].key = NULL;
+	e->stack[0].index = 0;
+	e->stack[0].is_objiter = 0;
+	return MUSTACH_OK;
+}
+
+static int compare(void *closure, const char *value)
+{
+	struct expl *e = closure;
+	const struct value *v = &e->selection;
+	const char *s;
+	size_t len, vlen;
+	long long i, j;
+	unsigned long long u, w;
+	double d;
+	int r;
+
+	switch (v->type) {
+	case T_null:
+		return strcmp("null", value);
+	case Mustach_Struct_Bool:
+		return strcmp(*(const bool*)v->addr ? "true" : "false", value);
+	case Mustach_Struct_String:
+	case Mustach_Struct_Chars:
+		s = text(v, &len);
+		vlen = strlen(value);
+		r = memcmp(s, value, len < vlen ? len : vlen);
+		return r ? r : len < vlen ? -1 : len > vlen;
+	case Mustach_Struct_Float:
+	case Mustach_Struct_Double:
+		d = number(v->addr, v->type) - atof(value);
+		return d < 0 ? -1 : d > 0 ? 1 : 0;
+	case Mustach_Struct_Int:
+	case Mustach_Struct_Long:
+	case Mustach_Struct_Int64:
+		i = sinteger(v->addr, v->type);
+		j = atoll(value);
+		return i < j ? -1 : i > j;
+	case Mustach_Struct_Unsigned:
+	case Mustach_Struct_ULong:
+	case Mustach_Struct_UInt64:
+	case Mustach_Struct_Size:
+		if (*value == '-')
+			return 1;
+		u = uinteger(v->addr, v->type);
+		w = strtoull(value, NULL, 10);
+		return u < w ? -1 : u > w;
+	default:
+		return 1;
+	}
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	const struct mustach_struct_field *f;
+	int i;
+
+	if (name == NULL) {
+		e->selection = e->stack[e->depth].obj;
+		return 1;
+	}
+	for (i = e->depth ; i >= 0 ; i--) {
+		f = field(&e->stack[i].obj, name);
+		if (f != NULL) {
+			fieldvalue(&e->selection, e->stack[i].obj.addr, f);
+			return 1;
+		}
+	}
+	e->selection.type = T_null;
+	return 0;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	const struct mustach_struct_field *f;
+
+	f = field(&e->selection, name);
+	if (f == NULL)
+		return 0;
+	fieldvalue(&e->selection, e->selection.addr, f);
+	return 1;
+}
+
+/* truth of the value 'v' when it is not a structure nor an array */
+static int truth(const struct value *v)
+{
+	size_t len;
+
+	switch (v->type) {
+	case T_null:
+		return 0;
+	case Mustach_Struct_Bool:
+		return *(const bool*)v->addr;
+	case Mustach_Struct_String:
+	case Mustach_Struct_Chars:
+		text(v, &len);
+		return len != 0;
+	default:
+		return number(v->addr, v->type) != 0;
+	}
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+	const struct value *o = &e->selection;
+
+	if (++e->depth >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+
+	e->stack[e->depth].is_objiter = 0;
+	e->stack[e->depth].key = NULL;
+	e->stack[e->depth].index = 0;
+	e->stack[e->depth].cont = *o;
+	if (objiter) {
+		if (o->type != Mustach_Struct_Struct || o->desc->count == 0)
+			goto not_entering;
+		e->stack[e->depth].key = o->desc->fields;
+		fieldvalue(&e->stack[e->depth].obj, o->addr, o->desc->fields);
+		e->stack[e->depth].is_objiter = 1;
+	} else if (o->type == Mustach_Struct_Array) {
+		if (o->count == 0)
+			goto not_entering;
+		itemvalue(&e->stack[e->depth].obj, o, 0);
+	} else if (o->type == Mustach_Struct_Struct || truth(o)) {
+		e->stack[e->depth].obj = *o;
+	} else
+		goto not_entering;
+	return 1;
+
+not_entering:
+	e->depth--;
+	return 0;
+}
+
+static int next(void *closure)
+{
+	struct expl *e = closure;
+	const struct value *c;
+	size_t index;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	c = &e->stack[e->depth].cont;
+	index = ++e->stack[e->depth].index;
+	if (e->stack[e->depth].is_objiter) {
+		if (index >= c->desc->count)
+			return 0;
+		e->stack[e->depth].key = &c->desc->fields[index];
+		fieldvalue(&e->stack[e->depth].obj, c->addr, e->stack[e->depth].key);
+		return 1;
+	}
+	if (c->type != Mustach_Struct_Array || index >= c->count)
+		return 0;
+	itemvalue(&e->stack[e->depth].obj, c, index);
+	return 1;
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+
+	if (e->depth <= 0)
+		return MUSTACH_ERROR_CLOSING;
+
+	e->depth--;
+	return 0;
+}
+
+/* release the buffer of number 'value' */
+static void release(const char *value, void *closure)
+{
+	struct expl *e = closure;
+
+	e->busy &= ~(1u << (value - e->numbers[0]) / NUMSIZE);
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+	const struct value *v = &e->selection;
+	struct serial s;
+	size_t len;
+	int i;
+
+	if (key) {
+		sbuf->value = e->stack[e->depth].is_objiter ? e->stack[e->depth].key->name : "";
+		return 1;
+	}
+	switch (v->type) {
+	case T_null:
+		sbuf->value = "";
+		break;
+	case Mustach_Struct_Bool:
+		sbuf->value = *(const bool*)v->addr ? "true" : "false";
+		break;
+	case Mustach_Struct_String:
+	case Mustach_Struct_Chars:
+		sbuf->value = text(v, &len);
+		if (len == 0)
+			sbuf->value = "";
+		else
+			sbuf->length = len;
+		break;
+	case Mustach_Struct_Struct:
+	case Mustach_Struct_Array:
+		memset(&s, 0, sizeof s);
+		if (serialize(v, &s) || put(&s, "", 1)) {
+			free(s.buffer);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		sbuf->value = s.buffer;
+		sbuf->freecb = free;
+		break;
+	default:
+		/* numbers are written in a free buffer of the explorer */
+		for (i = 0 ; i < NUMBERS && (e->busy & (1u << i)) ; i++);
+		if (i < NUMBERS) {
+			e->busy |= 1u << i;
+			sbuf->length = (size_t)numtext(v, e->numbers[i]);
+			sbuf->value = e->numbers[i];
+			sbuf->releasecb = release;
+			sbuf->closure = e;
+		} else {
+			s.buffer = malloc(NUMSIZE);
+			if (s.buffer == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+			sbuf->length = (size_t)numtext(v, s.buffer);
+			sbuf->value = s.buffer;
+			sbuf->freecb = free;
+		}
+		break;
+	}
+	return 1;
+}
+
+const struct mustach_wrap_itf mustach_struct_wrap_itf = {
+	.start = start,
+	.compare = compare,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get
+};
+
+int mustach_struct_file(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, FILE *file)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_file(template, length, &mustach_struct_wrap_itf, &e, flags, file);
+}
+
+int mustach_struct_fd(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, int fd)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_fd(template, length, &mustach_struct_wrap_itf, &e, flags, fd);
+}
+
+int mustach_struct_mem(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_mem(template, length, &mustach_struct_wrap_itf, &e, flags, result, size);
+}
+
+int mustach_struct_write(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_write(template, length, &mustach_struct_wrap_itf, &e, flags, writecb, closure);
+}
+
+int mustach_struct_emit(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_emit(template, length, &mustach_struct_wrap_itf, &e, flags, emitcb, closure);
+}
+
+int mustach_struct_compiled_file(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, FILE *file)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_compiled_file(tmpl, &mustach_struct_wrap_itf, &e, flags, file);
+}
+
+int mustach_struct_compiled_fd(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, int fd)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_struct_wrap_itf, &e, flags, fd);
+}
+
+int mustach_struct_compiled_mem(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_struct_wrap_itf, &e, flags, result, size);
+}
+
+int mustach_struct_compiled_write(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_compiled_write(tmpl, &mustach_struct_wrap_itf, &e, flags, writecb, closure);
+}
+
+int mustach_struct_compiled_emit(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	e.root = data;
+	e.desc = desc;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_struct_wrap_itf, &e, flags, emitcb, closure);
+}
@@ -0,0 +1,286 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _mustach_struct_h_included_
+#define _mustach_struct_h_included_
+
+/*
+ * mustach-struct is a backend for mustach rendering C structures
+ * described by static tables of their fields, without any conversion.
+ *
+ * Example:
+ *
+ *    struct line { const char *item; int qty; };
+ *    struct order { int id; struct line *lines; size_t nlines; };
+ *
+ *    static const struct mustach_struct_field line_fields[] = {
+ *        MUSTACH_STRUCT_FIELD(struct line, item, Mustach_Struct_String),
+ *        MUSTACH_STRUCT_FIELD(struct line, qty, Mustach_Struct_Int)
+ *    };
+ *    static const struct mustach_struct_desc line_desc =
+ *        MUSTACH_STRUCT_DESC(struct line, line_fields);
+ *
+ *    static const struct mustach_struct_field order_fields[] = {
+ *        MUSTACH_STRUCT_FIELD(struct order, id, Mustach_Struct_Int),
+ *        MUSTACH_STRUCT_ARRAY(struct order, lines, Mustach_Struct_Struct,
+ *                             &line_desc, &order_fields[2]),
+ *        MUSTACH_STRUCT_FIELD(struct order, nlines, Mustach_Struct_Size)
+ *    };
+ *    static const struct mustach_struct_desc order_desc =
+ *        MUSTACH_STRUCT_DESC(struct order, order_fields);
+ *
+ *    mustach_struct_file(template, 0, &order, &order_desc, flags, stdout);
+ */
+
+#include <stddef.h>
+#include "mustach-wrap.h"
+
+/**
+ * Types of the fields
+ */
+enum mustach_struct_type {
+	Mustach_Struct_Bool,     /* bool */
+	Mustach_Struct_Int,      /* int */
+	Mustach_Struct_Unsigned, /* unsigned */
+	Mustach_Struct_Long,     /* long */
+	Mustach_Struct_ULong,    /* unsigned long */
+	Mustach_Struct_Int64,    /* int64_t */
+	Mustach_Struct_UInt64,   /* uint64_t */
+	Mustach_Struct_Size,     /* size_t */
+	Mustach_Struct_Float,    /* float */
+	Mustach_Struct_Double,   /* double */
+	Mustach_Struct_String,   /* const char *, zero terminated, NULL is null */
+	Mustach_Struct_Chars,    /* char[length], zero terminated when shorter */
+	Mustach_Struct_Struct,   /* structure described by 'desc' */
+	Mustach_Struct_Pointer,  /* pointer to a structure described by 'desc', NULL is null */
+	Mustach_Struct_Array,    /* pointer to items of type 'item' */
+	Mustach_Struct_Vector    /* array of 'length' items of type 'item' */
+};
+
+struct mustach_struct_desc;
+
+/**
+ * mustach_struct_field - Description of a field of a structure
+ *
+ * @name:   the name of the field for the templates
+ *
+ * @type:   the type of the field, see enum mustach_struct_type
+ *
+ * @offset: the offset of the field in the structure
+ *
+ * @desc:   for Struct and Pointer, the description of the structure,
+ *          for Array and Vector of Struct or of Pointer, the one of the items
+ *
+ * @item:   for Array and Vector, the type of the items that can't be Chars,
+ *          Array nor Vector
+ *
+ * @count:  for Array and Vector, the field of the same structure giving
+ *          the count of items, of any integer type, or NULL if it is 'length'
+ *
+ * @length: for Chars, the size of the array of chars,
+ *          for Array without 'count', the count of items,
+ *          for Vector, the size of the array
+ */
+struct mustach_struct_field {
+	const char *name;
+	int type;
+	size_t offset;
+	const struct mustach_struct_desc *desc;
+	int item;
+	const struct mustach_struct_field *count;
+	size_t length;
+};
+
+/**
+ * mustach_struct_desc - Description of a structure
+ *
+ * @size:   the size of the structure, for the arrays of structures
+ *
+ * @count:  the count of fields
+ *
+ * @fields: the fields
+ */
+struct mustach_struct_desc {
+	size_t size;
+	size_t count;
+	const struct mustach_struct_field *fields;
+};
+
+/**
+ * Helpers for declaring the fields of the structure 'stype' and its
+ * description
+ */
+#define MUSTACH_STRUCT_FIELD(stype,member,type) \
+	{ #member, type, offsetof(stype, member), NULL, 0, NULL, 0 }
+#define MUSTACH_STRUCT_CHARS(stype,member) \
+	{ #member, Mustach_Struct_Chars, offsetof(stype, member), NULL, 0, NULL, sizeof(((stype*)0)->member) }
+#define MUSTACH_STRUCT_STRUCT(stype,member,type,desc) \
+	{ #member, type, offsetof(stype, member), desc, 0, NULL, 0 }
+#define MUSTACH_STRUCT_ARRAY(stype,member,item,desc,count) \
+	{ #member, Mustach_Struct_Array, offsetof(stype, member), desc, item, count, 0 }
+#define MUSTACH_STRUCT_VECTOR(stype,member,item,desc,count) \
+	{ #member, Mustach_Struct_Vector, offsetof(stype, member), desc, item, count, \
+	  sizeof(((stype*)0)->member) / sizeof(*((stype*)0)->member) }
+#define MUSTACH_STRUCT_DESC(stype,fields) \
+	{ sizeof(stype), sizeof(fields) / sizeof(*(fields)), fields }
+
+/**
+ * Wrap interface used internally by mustach struct functions.
+ * Can be used for overriding behaviour.
+ */
+extern const struct mustach_wrap_itf mustach_struct_wrap_itf;
+
+/**
+ * mustach_struct_json - Returns the compact JSON text of the structure
+ * 'data' described by 'desc' or NULL with errno set. The returned value
+ * must be released using 'free'.
+ */
+extern char *mustach_struct_json(const void *data, const struct mustach_struct_desc *desc);
+
+/**
+ * mustach_struct_file - Renders the mustache 'template' in 'file' for 'data'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_file(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, FILE *file);
+
+/**
+ * mustach_struct_fd - Renders the mustache 'template' in 'fd' for 'data'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_fd(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, int fd);
+
+/**
+ * mustach_struct_mem - Renders the mustache 'template' in 'result' for 'data'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_mem(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, char **result, size_t *size);
+
+/**
+ * mustach_struct_write - Renders the mustache 'template' for 'data' to custom writer 'writecb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_write(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_struct_emit - Renders the mustache 'template' for 'data' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_emit(const char *template, size_t length, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_struct_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'data'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_compiled_file(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, FILE *file);
+
+/**
+ * mustach_struct_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'data'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_compiled_fd(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, int fd);
+
+/**
+ * mustach_struct_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'data'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_compiled_mem(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, char **result, size_t *size);
+
+/**
+ * mustach_struct_compiled_write - Renders the compiled template 'tmpl' for 'data' to custom writer 'writecb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_compiled_write(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_struct_compiled_emit - Renders the compiled template 'tmpl' for 'data' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @data:     the structure to render
+ * @desc:     the description of the structure
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_struct_compiled_emit(const struct mustach_template *tmpl, const void *data, const struct mustach_struct_desc *desc, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+#endif
@@ -0,0 +1,1942 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
+#include "mustach.h"
+#include "mustach-wrap.h"
+#include "mustach-tape.h"
+
+/* maximum nesting of arrays and objects in JSON texts */
+#if !defined(MUSTACH_TAPE_MAX_NESTING)
+# define MUSTACH_TAPE_MAX_NESTING 1024
+#endif
+
+/* maximum nesting of partials bound in compiled templates for projections */
+#if !defined(MUSTACH_TAPE_MAX_PARTIALS)
+# define MUSTACH_TAPE_MAX_PARTIALS 32
+#endif
+
+/* minimal count of members of the objects whose keys are indexed in snapshots */
+#if !defined(MUSTACH_TAPE_INDEX_MIN)
+# define MUSTACH_TAPE_INDEX_MIN 8
+#endif
+
+/* index of no node, used for the null selection */
+#define NONE UINT32_MAX
+
+/* types of nodes */
+enum type {
+	T_null,
+	T_false,
+	T_true,
+	T_number,
+	T_string,
+	T_array,
+	T_object
+};
+
+/* flags of nodes */
+#define F_ESCAPED  1   /* string with escape sequences */
+#define F_REAL     2   /* number with fraction or exponent */
+#define F_STREAM   4   /* streamed array, its items are parsed when iterated */
+#define F_INDEXED  8   /* object of a snapshot whose keys are in the index from 'offset' */
+
+/*
+ * The tape is a flat array of nodes in the order of the JSON text.
+ * The children of a container follow it immediately and 'skip' gives
+ * the index of the node after the container and all its children.
+ * Members of objects are a string node, the key, followed by the value.
+ *
+ * The offsets are relative to the text, except when an array is streamed:
+ * the nodes following the streamed array are then relative to the end of
+ * the array and the nodes of the item being iterated, appended to the
+ * tape, are relative to the beginning of the item. This also lets texts
+ * bigger than 4G be streamed.
+ */
+struct node {
+	uint32_t offset;  /* offset in text of strings (without quotes) and numbers */
+	uint32_t length;  /* length of strings and numbers, count of items of containers */
+	uint32_t skip;    /* index of the next sibling */
+	uint16_t type;    /* the type of the node */
+	uint16_t flags;   /* flags of the node */
+};
+
+/* entry of the index of keys of the objects of snapshots, sorted by hash */
+struct kidx {
+	uint32_t hash;    /* hash of the decoded key */
+	uint32_t key;     /* index of the node of the key */
+};
+
+struct mustach_tape {
+	const char *text;
+	struct node *nodes;
+	uint32_t count;
+	uint32_t alloc;
+	uint32_t root;    /* index of the root value */
+	int shared;       /* nodes are shared with an other tape */
+	uint32_t stream;  /* index of the streamed array or NONE */
+	uint32_t items;   /* index of the first node of the streamed item */
+	const char *after;/* end of the streamed array */
+	const char *item; /* beginning of the streamed item */
+	const struct kidx *index; /* index of the keys of snapshots */
+};
+
+/******************************************************************************/
+/* PROJECTION                                                                 */
+/******************************************************************************/
+
+/*
+ * A projection is the set of the keys that templates can select. The
+ * members of objects whose key is not in the set are skipped when parsing.
+ * Keys marked full have their values kept entirely because the templates
+ * may render them as JSON or iterate on their members.
+ */
+struct pkey {
+	size_t length;
+	int full;
+	char name[];
+};
+
+struct mustach_tape_projection {
+	int all;             /* nothing is skipped */
+	uint32_t count;      /* count of keys */
+	uint32_t size;       /* size of the hash table, a power of 2 */
+	struct pkey **slots; /* the hash table */
+};
+
+/* results of lookups */
+#define P_SKIP  0
+#define P_KEEP  1
+#define P_FULL  2
+
+static uint32_t hashkey(const char *name, size_t length)
+{
+	uint32_t h = 2166136261u;
+	while (length--)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+static struct pkey **slotof(const struct mustach_tape_projection *proj, const char *name, size_t length)
+{
+	uint32_t mask = proj->size - 1, i = hashkey(name, length) & mask;
+	struct pkey *k;
+
+	while ((k = proj->slots[i]) != NULL
+	    && (k->length != length || memcmp(k->name, name, length)))
+		i = (i + 1) & mask;
+	return &proj->slots[i];
+}
+
+static struct pkey *addkey(struct mustach_tape_projection *proj, const char *name)
+{
+	size_t length = strlen(name);
+	struct pkey **slot, **slots, *k;
+	uint32_t i, size;
+
+	if (2 * (proj->count + 1) > proj->size) {
+		size = proj->size ? 2 * proj->size : 64;
+		slots = calloc(size, sizeof *slots);
+		if (slots == NULL)
+			return NULL;
+		for (i = 0 ; i < proj->size ; i++) {
+			k = proj->slots[i];
+			if (k != NULL) {
+				proj->slots[i] = NULL;
+				*slotof(&(struct mustach_tape_projection){ .size = size, .slots = slots }, k->name, k->length) = k;
+			}
+		}
+		free(proj->slots);
+		proj->slots = slots;
+		proj->size = size;
+	}
+	slot = slotof(proj, name, length);
+	if (*slot == NULL) {
+		k = malloc(sizeof *k + length + 1);
+		if (k == NULL)
+			return NULL;
+		k->length = length;
+		k->full = 0;
+		memcpy(k->name, name, length + 1);
+		*slot = k;
+		proj->count++;
+	}
+	return *slot;
+}
+
+/* returns P_SKIP, P_KEEP or P_FULL for the key 'name' of 'length' */
+static int lookup(const struct mustach_tape_projection *proj, const char *name, size_t length)
+{
+	struct pkey *k = proj->count ? *slotof(proj, name, length) : NULL;
+	return k == NULL ? P_SKIP : k->full ? P_FULL : P_KEEP;
+}
+
+/* the value of 'k', or the root when NULL, is kept entirely */
+static void setfull(struct mustach_tape_projection *proj, struct pkey *k)
+{
+	if (k == NULL)
+		proj->all = 1;
+	else
+		k->full = 1;
+}
+
+/* is 'head' on a comparator? names are read as in mustach-wrap */
+static int iscomp(const char *head, int sflags)
+{
+	return (head[0] == '=' && (sflags & Mustach_With_Equal))
+	    || ((head[0] == '<' || head[0] == '>') && (sflags & Mustach_With_Compare));
+}
+
+/* removes the compared value of 'head' */
+static void keyonly(char *head, int sflags)
+{
+	char *w, car, escaped;
+
+	w = head;
+	car = *head;
+	escaped = (sflags & Mustach_With_EscFirstCmp) && iscomp(head, sflags);
+	while (car && (escaped || !iscomp(head, sflags))) {
+		if (escaped)
+			escaped = 0;
+		else
+			escaped = ((sflags & Mustach_With_JsonPointer) ? car == '~' : car == '\\')
+			    && iscomp(head + 1, sflags);
+		if (!escaped)
+			*w++ = car;
+		head++;
+		car = *head;
+	}
+	*w = 0;
+}
+
+/* extracts the next key of the name at 'head' */
+static char *nextkey(char **head, int sflags)
+{
+	char *result, *iter, *write, car;
+
+	car = *(iter = *head);
+	if (!car)
+		return NULL;
+	result = write = iter;
+	if (sflags & Mustach_With_JsonPointer) {
+		while (car && car != '/') {
+			if (car == '~')
+				switch (iter[1]) {
+				case '1': car = '/'; /*@fallthrough@*/
+				case '0': iter++;
+				}
+			*write++ = car;
+			car = *++iter;
+		}
+		*write = 0;
+		while (car == '/')
+			car = *++iter;
+	} else {
+		while (car && car != '.') {
+			if (car == '\\' && (iter[1] == '.' || iter[1] == '\\'))
+				car = *++iter;
+			*write++ = car;
+			car = *++iter;
+		}
+		*write = 0;
+		while (car == '.')
+			car = *++iter;
+	}
+	*head = iter;
+	return result;
+}
+
+/*
+ * Adds the keys of the tag 'name' selected in the context 'ctx' and
+ * stores in 'last' the key of the selected value, or 'ctx' for the
+ * current value. When 'full', the selected value is kept entirely.
+ */
+static int addname(struct mustach_tape_projection *proj, const char *name, int flags,
+		struct pkey *ctx, int full, struct pkey **last)
+{
+	size_t lenname = 1 + strlen(name);
+	char buffer[lenname];
+	char *copy = buffer, *key;
+	struct pkey *k;
+	int sflags;
+
+	memcpy(copy, name, lenname);
+	sflags = flags;
+	if (sflags & Mustach_With_JsonPointer) {
+		if (copy[0] == '/')
+			copy++;
+		else
+			sflags ^= Mustach_With_JsonPointer;
+	}
+	if (sflags & (Mustach_With_Equal | Mustach_With_Compare))
+		keyonly(copy, sflags);
+
+	k = ctx;
+	if (!(copy[0] == '.' && copy[1] == 0)) {
+		while ((key = nextkey(&copy, sflags)) != NULL) {
+			/* iteration on the members of the previous value */
+			if (key[0] == '*' && !key[1] && !*copy && (flags & Mustach_With_ObjectIter))
+				setfull(proj, k);
+			k = addkey(proj, key);
+			if (k == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+		}
+	}
+	if (full)
+		setfull(proj, k);
+	*last = k;
+	return MUSTACH_OK;
+}
+
+/* state of the analysis of templates */
+struct analysis {
+	struct mustach_tape_projection *proj;
+	int flags;
+	unsigned count;
+	unsigned alloc;
+	struct {
+		const struct mustach_template *tmpl;
+		struct pkey *ctx;
+	} *done;
+};
+
+/* adds the names of 'tmpl' rendered in the context 'ctx' */
+static int project(struct analysis *a, const struct mustach_template *tmpl, struct pkey *ctx, int depth)
+{
+	struct mustach_tape_projection *proj = a->proj;
+	int flags = a->flags;
+	const struct mustach_token *tok;
+	struct pkey *stack[MUSTACH_MAX_DEPTH], *k;
+	unsigned i;
+	void *done;
+	int rc, sp;
+
+	/* a template gives the same keys in a same context */
+	for (i = 0 ; i < a->count ; i++)
+		if (a->done[i].tmpl == tmpl && a->done[i].ctx == ctx)
+			return MUSTACH_OK;
+	if (depth >= MUSTACH_TAPE_MAX_PARTIALS) {
+		proj->all = 1;
+		return MUSTACH_OK;
+	}
+	if (a->count == a->alloc) {
+		done = realloc(a->done, (a->alloc + 16) * sizeof *a->done);
+		if (done == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		a->done = done;
+		a->alloc += 16;
+	}
+	a->done[a->count].tmpl = tmpl;
+	a->done[a->count++].ctx = ctx;
+
+	sp = 0;
+	rc = MUSTACH_OK;
+	for (tok = tmpl->tokens ; rc == MUSTACH_OK && tok->kind != Mustach_Token_End ; tok++) {
+		switch (tok->kind) {
+		case Mustach_Token_Section:
+		case Mustach_Token_Inverted:
+			if (sp == MUSTACH_MAX_DEPTH) {
+				proj->all = 1;
+				return MUSTACH_OK;
+			}
+			rc = addname(proj, tok->name, flags, ctx, 0, &k);
+			stack[sp++] = ctx;
+			if (tok->kind == Mustach_Token_Section)
+				ctx = k;
+			break;
+		case Mustach_Token_Close:
+			if (sp)
+				ctx = stack[--sp];
+			break;
+		case Mustach_Token_Escaped:
+		case Mustach_Token_Raw:
+			rc = addname(proj, tok->name, flags, ctx, 1, &k);
+			break;
+		case Mustach_Token_Partial:
+			if (tok->partial != NULL)
+				rc = project(a, tok->partial, ctx, depth + 1);
+			else
+				/* the partial can be taken from the data */
+				rc = addname(proj, tok->name, flags, ctx, 1, &k);
+			break;
+		default:
+			break;
+		}
+	}
+	return rc;
+}
+
+struct mustach_tape_projection *mustach_tape_projection_create(void)
+{
+	return calloc(1, sizeof(struct mustach_tape_projection));
+}
+
+int mustach_tape_projection_add(struct mustach_tape_projection *proj, const char *template, size_t length, int flags)
+{
+	struct mustach_template *tmpl;
+	int rc;
+
+	rc = mustach_compile(template, length, flags, &tmpl);
+	if (rc == MUSTACH_OK) {
+		rc = mustach_tape_projection_add_compiled(proj, tmpl, flags);
+		mustach_template_free(tmpl);
+	}
+	else
+		/* rendering can output values before reaching the error */
+		proj->all = 1;
+	return rc;
+}
+
+int mustach_tape_projection_add_compiled(struct mustach_tape_projection *proj, const struct mustach_template *tmpl, int flags)
+{
+	struct analysis a;
+	int rc;
+
+	a.proj = proj;
+	a.flags = flags;
+	a.count = a.alloc = 0;
+	a.done = NULL;
+	rc = project(&a, tmpl, NULL, 0);
+	if (rc != MUSTACH_OK)
+		proj->all = 1;
+	free(a.done);
+	return rc;
+}
+
+void mustach_tape_projection_free(struct mustach_tape_projection *proj)
+{
+	uint32_t i;
+
+	if (proj != NULL) {
+		for (i = 0 ; i < proj->size ; i++)
+			free(proj->slots[i]);
+		free(proj->slots);
+		free(proj);
+	}
+}
+
+/******************************************************************************/
+/* PARSING                                                                    */
+/******************************************************************************/
+
+struct parser {
+	struct mustach_tape *tape;
+	const struct mustach_tape_projection *proj; /* NULL when keeping all */
+	const char *path; /* remaining path of the streamed array or NULL */
+	const char *base; /* origin of the offsets of the nodes */
+	const char *pos;
+	const char *end;
+	int nesting;
+};
+
+static uint32_t addnode(struct parser *p, enum type type, const char *text, uint32_t length)
+{
+	struct mustach_tape *t = p->tape;
+	struct node *nodes;
+	uint32_t alloc;
+
+	if (t->count == t->alloc) {
+		alloc = t->alloc + (t->alloc >> 1) + 64;
+		nodes = realloc(t->nodes, alloc * sizeof *nodes);
+		if (nodes == NULL)
+			return NONE;
+		t->nodes = nodes;
+		t->alloc = alloc;
+	}
+	if ((size_t)(text - p->base) > UINT32_MAX) {
+		errno = EFBIG;
+		return NONE;
+	}
+	nodes = &t->nodes[t->count];
+	nodes->offset = (uint32_t)(text - p->base);
+	nodes->length = length;
+	nodes->skip = t->count + 1;
+	nodes->type = (uint16_t)type;
+	nodes->flags = 0;
+	return t->count++;
+}
+
+static inline const char *skipspaces(const char *s, const char *end)
+{
+	while (s != end && (*s == ' ' || *s == '\n' || *s == '\r' || *s == '\t'))
+		s++;
+	return s;
+}
+
+static inline int ishex(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+/* the end of the escape sequence at 's' or NULL when it is invalid */
+static inline const char *escapeend(const char *s, const char *end)
+{
+	if (end - s >= 2)
+		switch (s[1]) {
+		case '"': case '\\': case '/': case 'b':
+		case 'f': case 'n': case 'r': case 't':
+			return s + 2;
+		case 'u':
+			if (end - s >= 6 && ishex(s[2]) && ishex(s[3]) && ishex(s[4]) && ishex(s[5]))
+				return s + 6;
+			break;
+		}
+	return NULL;
+}
+
+/* search the first quote, backslash or control character */
+static inline const char *scanstring(const char *s, const char *end)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i ctl = _mm_set1_epi8(0x1f);
+	__m128i v, m;
+	int mask;
+
+	while (end - s >= 16) {
+		v = _mm_loadu_si128((const __m128i*)s);
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return s + __builtin_ctz((unsigned)mask);
+		s += 16;
+	}
+#endif
+	while (s != end && *s != '"' && *s != '\\' && (unsigned char)*s >= 0x20)
+		s++;
+	return s;
+}
+
+/* search the first quote or bracket */
+static inline const char *scanstruct(const char *s, const char *end)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i mask5 = _mm_set1_epi8((char)0xdf);
+	const __m128i obrack = _mm_set1_epi8('[');
+	const __m128i cbrack = _mm_set1_epi8(']');
+	__m128i v, u, m;
+	int mask;
+
+	while (end - s >= 16) {
+		/* clearing bit 5 maps { and } to [ and ] */
+		v = _mm_loadu_si128((const __m128i*)s);
+		u = _mm_and_si128(v, mask5);
+		m = _mm_or_si128(_mm_cmpeq_epi8(u, obrack), _mm_cmpeq_epi8(u, cbrack));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return s + __builtin_ctz((unsigned)mask);
+		s += 16;
+	}
+#endif
+	while (s != end && *s != '"' && (*s & 0xdf) != '[' && (*s & 0xdf) != ']')
+		s++;
+	return s;
+}
+
+/*
+ * skip the value at p->pos without adding nodes. Only the structure of
+ * skipped values is checked: strings must end and brackets must balance.
+ */
+static int skipvalue(struct parser *p)
+{
+	const char *s = p->pos, *end = p->end;
+	int depth = 0;
+
+	if (s == end || *s == ',' || *s == ':' || *s == ']' || *s == '}')
+		goto error;
+	if (*s != '"' && *s != '[' && *s != '{') {
+		/* number or literal */
+		while (s != end && *s != ',' && *s != ']' && *s != '}'
+		    && *s != ' ' && *s != '\n' && *s != '\r' && *s != '\t')
+			s++;
+		p->pos = s;
+		return 0;
+	}
+	for (;;) {
+		if (*s == '"') {
+			for (s++ ; ; s += 2) {
+				s = scanstring(s, end);
+				if (s == end)
+					goto error;
+				if (*s == '"')
+					break;
+				if (*s != '\\')
+					s--; /* control character */
+				else if (end - s < 2)
+					goto error;
+			}
+		}
+		else if (*s == '[' || *s == '{')
+			depth++;
+		else if (--depth < 0)
+			goto error;
+		s++;
+		if (depth == 0)
+			break;
+		s = scanstruct(s, end);
+		if (s == end)
+			goto error;
+	}
+	p->pos = s;
+	return 0;
+error:
+	p->pos = s;
+	errno = EINVAL;
+	return -1;
+}
+
+/* parse a string, p->pos is on the opening quote */
+static uint32_t parsestring(struct parser *p)
+{
+	const char *s = p->pos + 1, *beg = s, *e;
+	uint16_t flags = 0;
+	uint32_t idx;
+
+	for (;;) {
+		s = scanstring(s, p->end);
+		if (s == p->end || *s != '\\')
+			break;
+		flags = F_ESCAPED;
+		e = escapeend(s, p->end);
+		if (e == NULL)
+			goto error;
+		s = e;
+	}
+	if (s == p->end || *s != '"')
+		goto error;
+	if ((size_t)(s - beg) > UINT32_MAX)
+		goto error;
+	idx = addnode(p, T_string, beg, (uint32_t)(s - beg));
+	if (idx != NONE) {
+		p->tape->nodes[idx].flags = flags;
+		p->pos = s + 1;
+	}
+	return idx;
+error:
+	p->pos = s;
+	errno = EINVAL;
+	return NONE;
+}
+
+/* parse a number */
+static uint32_t parsenumber(struct parser *p)
+{
+	const char *s = p->pos, *end = p->end;
+	uint16_t flags = 0;
+	uint32_t idx;
+
+	if (s != end && *s == '-')
+		s++;
+	if (s == end || *s < '0' || *s > '9')
+		goto error;
+	if (*s++ != '0')
+		while (s != end && *s >= '0' && *s <= '9')
+			s++;
+	if (s != end && *s == '.') {
+		flags = F_REAL;
+		if (++s == end || *s < '0' || *s > '9')
+			goto error;
+		while (s != end && *s >= '0' && *s <= '9')
+			s++;
+	}
+	if (s != end && (*s == 'e' || *s == 'E')) {
+		flags = F_REAL;
+		if (++s != end && (*s == '+' || *s == '-'))
+			s++;
+		if (s == end || *s < '0' || *s > '9')
+			goto error;
+		while (s != end && *s >= '0' && *s <= '9')
+			s++;
+	}
+	idx = addnode(p, T_number, p->pos, (uint32_t)(s - p->pos));
+	if (idx != NONE) {
+		p->tape->nodes[idx].flags = flags;
+		p->pos = s;
+	}
+	return idx;
+error:
+	p->pos = s;
+	errno = EINVAL;
+	return NONE;
+}
+
+static uint32_t parseliteral(struct parser *p, enum type type, const char *word, size_t length)
+{
+	uint32_t idx;
+
+	if ((size_t)(p->end - p->pos) < length || memcmp(p->pos, word, length)) {
+		errno = EINVAL;
+		return NONE;
+	}
+	idx = addnode(p, type, p->pos, 0);
+	if (idx != NONE)
+		p->pos += length;
+	return idx;
+}
+
+static uint32_t parsevalue(struct parser *p);
+
+/* returns the rest of 'path' after the key 'name' of 'length' or NULL */
+static const char *nextpath(const char *path, const char *name, size_t length)
+{
+	if (strncmp(path, name, length) || (path[length] && path[length] != '.'))
+		return NULL;
+	return path[length] ? &path[length + 1] : &path[length];
+}
+
+/* parse the streamed array, p->pos is on its opening bracket */
+static uint32_t parsestream(struct parser *p)
+{
+	uint32_t idx;
+
+	if (p->pos == p->end || *p->pos != '[') {
+		errno = EINVAL;
+		return NONE;
+	}
+	idx = addnode(p, T_array, p->pos, 0);
+	if (idx == NONE || skipvalue(p) < 0)
+		return NONE;
+	p->tape->nodes[idx].flags = F_STREAM;
+	p->tape->stream = idx;
+	p->tape->after = p->base = p->pos;
+	return idx;
+}
+
+/* parse an array or an object, p->pos is on the opening bracket */
+static uint32_t parsecontainer(struct parser *p, enum type type)
+{
+	const struct mustach_tape_projection *proj = p->proj;
+	const char *path = p->path;
+	const struct node *key;
+	uint32_t idx, count;
+	int kept;
+	char close = type == T_object ? '}' : ']';
+
+	if (++p->nesting > MUSTACH_TAPE_MAX_NESTING) {
+		errno = EINVAL;
+		return NONE;
+	}
+	idx = addnode(p, type, p->pos, 0);
+	if (idx == NONE)
+		return NONE;
+	count = 0;
+	p->pos = skipspaces(p->pos + 1, p->end);
+	if (p->pos != p->end && *p->pos == close)
+		p->pos++;
+	else {
+		for (;;) {
+			kept = P_KEEP;
+			p->path = NULL;
+			if (type == T_object) {
+				if (p->pos == p->end || *p->pos != '"' || parsestring(p) == NONE)
+					goto error;
+				p->pos = skipspaces(p->pos, p->end);
+				if (p->pos == p->end || *p->pos != ':')
+					goto error;
+				p->pos = skipspaces(p->pos + 1, p->end);
+				key = &p->tape->nodes[p->tape->count - 1];
+				if (proj != NULL)
+					/* keys with escapes are kept entirely */
+					kept = (key->flags & F_ESCAPED) ? P_FULL
+						: lookup(proj, &p->base[key->offset], key->length);
+				if (path != NULL && p->tape->stream == NONE && !(key->flags & F_ESCAPED))
+					p->path = nextpath(path, &p->base[key->offset], key->length);
+			}
+			if (p->path != NULL && *p->path == 0) {
+				if (parsestream(p) == NONE)
+					return NONE;
+				count++;
+			} else if (kept == P_SKIP && p->path == NULL) {
+				p->tape->count--;
+				if (skipvalue(p) < 0)
+					return NONE;
+			} else {
+				p->proj = kept == P_FULL ? NULL : proj;
+				if (parsevalue(p) == NONE)
+					return NONE;
+				p->proj = proj;
+				count++;
+			}
+			p->pos = skipspaces(p->pos, p->end);
+			if (p->pos == p->end)
+				goto error;
+			if (*p->pos == close) {
+				p->pos++;
+				break;
+			}
+			if (*p->pos != ',')
+				goto error;
+			p->pos = skipspaces(p->pos + 1, p->end);
+		}
+	}
+	p->tape->nodes[idx].length = count;
+	p->tape->nodes[idx].skip = p->tape->count;
+	p->path = path;
+	p->nesting--;
+	return idx;
+error:
+	errno = EINVAL;
+	return NONE;
+}
+
+static uint32_t parsevalue(struct parser *p)
+{
+	if (p->pos != p->end) {
+		switch (*p->pos) {
+		case '{': return parsecontainer(p, T_object);
+		case '[': return parsecontainer(p, T_array);
+		case '"': return parsestring(p);
+		case 't': return parseliteral(p, T_true, "true", 4);
+		case 'f': return parseliteral(p, T_false, "false", 5);
+		case 'n': return parseliteral(p, T_null, "null", 4);
+		default: return parsenumber(p);
+		}
+	}
+	errno = EINVAL;
+	return NONE;
+}
+
+static struct mustach_tape *parse(const char *text, size_t length,
+		const struct mustach_tape_projection *proj, const char *path, size_t *errpos)
+{
+	struct mustach_tape *tape;
+	struct parser p;
+	uint32_t idx;
+
+	if (length == 0)
+		length = strlen(text);
+	if (length > UINT32_MAX && path == NULL) {
+		errno = EFBIG;
+		return NULL;
+	}
+	tape = malloc(sizeof *tape);
+	if (tape == NULL)
+		return NULL;
+	tape->text = text;
+	tape->root = 0;
+	tape->shared = 0;
+	tape->stream = NONE;
+	tape->items = NONE;
+	tape->after = tape->item = text;
+	tape->index = NULL;
+	tape->alloc = path == NULL ? (uint32_t)(length >> 3) : 64;
+	tape->nodes = malloc(tape->alloc * sizeof *tape->nodes + 1);
+	tape->count = 0;
+	if (tape->nodes != NULL) {
+		p.tape = tape;
+		p.proj = proj == NULL || proj->all ? NULL : proj;
+		p.path = path;
+		p.base = text;
+		p.end = text + length;
+		p.pos = skipspaces(text, p.end);
+		p.nesting = 0;
+		idx = path != NULL && *path == 0 ? parsestream(&p) : parsevalue(&p);
+		if (idx != NONE) {
+			p.pos = skipspaces(p.pos, p.end);
+			if (p.pos != p.end)
+				errno = EINVAL;
+			else if (path != NULL && tape->stream == NONE)
+				errno = ENOENT;
+			else
+				return tape;
+		}
+		if (errpos != NULL)
+			*errpos = (size_t)(p.pos - text);
+	}
+	mustach_tape_free(tape);
+	return NULL;
+}
+
+struct mustach_tape *mustach_tape_parse(const char *text, size_t length, size_t *errpos)
+{
+	return parse(text, length, NULL, NULL, errpos);
+}
+
+struct mustach_tape *mustach_tape_parse_projected(const char *text, size_t length,
+		const struct mustach_tape_projection *proj, size_t *errpos)
+{
+	return parse(text, length, proj, NULL, errpos);
+}
+
+struct mustach_tape *mustach_tape_parse_stream(const char *text, size_t length,
+		const char *path, size_t *errpos)
+{
+	return parse(text, length, NULL, path, errpos);
+}
+
+/*
+ * parse in 'work' the next item of its streamed array at '*pos'. Returns 1
+ * with the item in 'item', 0 at the end of the array or an error.
+ */
+static int streamitem(struct mustach_tape *work, const char **pos, uint32_t *item)
+{
+	struct parser p;
+
+	p.tape = work;
+	p.proj = NULL;
+	p.path = NULL;
+	p.end = work->after;
+	p.nesting = 0;
+	p.pos = skipspaces(*pos, p.end);
+	if (p.pos != p.end && *p.pos == ']')
+		return 0;
+	work->count = work->items;
+	work->item = p.base = p.pos;
+	*item = parsevalue(&p);
+	if (*item == NONE)
+		return MUSTACH_ERROR_SYSTEM;
+	p.pos = skipspaces(p.pos, p.end);
+	if (p.pos == p.end || (*p.pos != ',' && *p.pos != ']')) {
+		errno = EINVAL;
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	*pos = p.pos + (*p.pos == ',');
+	return 1;
+}
+
+struct mustach_tape *mustach_tape_sub(const struct mustach_tape *tape, unsigned node)
+{
+	struct mustach_tape *sub;
+
+	if (node >= tape->count) {
+		errno = EINVAL;
+		return NULL;
+	}
+	sub = malloc(sizeof *sub);
+	if (sub != NULL) {
+		*sub = *tape;
+		sub->root = node;
+		sub->shared = 1;
+	}
+	return sub;
+}
+
+void mustach_tape_free(struct mustach_tape *tape)
+{
+	if (tape != NULL) {
+		if (!tape->shared)
+			free(tape->nodes);
+		free(tape);
+	}
+}
+
+/******************************************************************************/
+/* ACCESSING                                                                  */
+/******************************************************************************/
+
+static inline const char *textof(const struct mustach_tape *tape, uint32_t idx)
+{
+	if (idx > tape->stream)
+		return &(idx >= tape->items ? tape->item : tape->after)[tape->nodes[idx].offset];
+	return &tape->text[tape->nodes[idx].offset];
+}
+
+static inline int typeof_(const struct mustach_tape *tape, uint32_t idx)
+{
+	return idx == NONE ? T_null : tape->nodes[idx].type;
+}
+
+static unsigned hexval(const char *s)
+{
+	unsigned r = 0, i;
+	for (i = 0 ; i < 4 ; i++)
+		r = (r << 4) | (unsigned)(s[i] <= '9' ? s[i] - '0' : (s[i] | 32) - 'a' + 10);
+	return r;
+}
+
+/* decode the escaped string of 'length' in 'dest' that is big enough, returns decoded length */
+static size_t unescape(const char *src, size_t length, char *dest)
+{
+	const char *end = src + length;
+	char *d = dest;
+	unsigned c, c2;
+
+	while (src != end) {
+		if (*src != '\\')
+			*d++ = *src++;
+		else {
+			src++;
+			switch (*src++) {
+			case 'b': *d++ = '\b'; break;
+			case 'f': *d++ = '\f'; break;
+			case 'n': *d++ = '\n'; break;
+			case 'r': *d++ = '\r'; break;
+			case 't': *d++ = '\t'; break;
+			case 'u':
+				c = hexval(src);
+				src += 4;
+				if (c >= 0xd800 && c < 0xdc00 && end - src >= 6 && src[0] == '\\' && src[1] == 'u') {
+					c2 = hexval(src + 2);
+					if (c2 >= 0xdc00 && c2 < 0xe000) {
+						c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+						src += 6;
+					}
+				}
+				if (c < 0x80)
+					*d++ = (char)c;
+				else if (c < 0x800) {
+					*d++ = (char)(0xc0 | (c >> 6));
+					*d++ = (char)(0x80 | (c & 0x3f));
+				} else if (c < 0x10000) {
+					*d++ = (char)(0xe0 | (c >> 12));
+					*d++ = (char)(0x80 | ((c >> 6) & 0x3f));
+					*d++ = (char)(0x80 | (c & 0x3f));
+				} else {
+					*d++ = (char)(0xf0 | (c >> 18));
+					*d++ = (char)(0x80 | ((c >> 12) & 0x3f));
+					*d++ = (char)(0x80 | ((c >> 6) & 0x3f));
+					*d++ = (char)(0x80 | (c & 0x3f));
+				}
+				break;
+			default: *d++ = src[-1]; break;
+			}
+		}
+	}
+	return (size_t)(d - dest);
+}
+
+/* returns the decoded string of node 'idx' as a fresh allocated string */
+static char *decode(const struct mustach_tape *tape, uint32_t idx)
+{
+	const struct node *n = &tape->nodes[idx];
+	char *s = malloc(n->length + 1);
+	if (s != NULL)
+		s[unescape(textof(tape, idx), n->length, s)] = 0;
+	return s;
+}
+
+/* compare the string of node 'idx' with 'value' as strcmp does */
+static int strcmpnode(const struct mustach_tape *tape, uint32_t idx, const char *value)
+{
+	const struct node *n = &tape->nodes[idx];
+	size_t len;
+	char *s;
+	int r;
+
+	if (n->flags & F_ESCAPED) {
+		s = decode(tape, idx);
+		if (s == NULL)
+			return 1;
+		r = strcmp(s, value);
+		free(s);
+		return r;
+	}
+	len = strlen(value);
+	r = memcmp(textof(tape, idx), value, len < n->length ? len : n->length);
+	return r ? r : n->length < len ? -1 : n->length > len;
+}
+
+/* is the key node 'i' equal to 'name' of 'len'? */
+static inline int iskey(const struct mustach_tape *tape, uint32_t i, const char *name, size_t len)
+{
+	const struct node *n = &tape->nodes[i];
+
+	if (n->flags & F_ESCAPED)
+		return n->length >= len && !strcmpnode(tape, i, name);
+	return n->length == len && !memcmp(textof(tape, i), name, len);
+}
+
+/* search the member of 'name' in the object 'idx' whose keys are indexed */
+static uint32_t indexed(const struct mustach_tape *tape, uint32_t idx, const char *name, size_t len)
+{
+	const struct kidx *x = &tape->index[tape->nodes[idx].offset];
+	uint32_t h = hashkey(name, len), lo = 0, hi = tape->nodes[idx].length, mid;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) >> 1);
+		if (x[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* entries of same hash are in the order of the keys */
+	for ( ; lo < tape->nodes[idx].length && x[lo].hash == h ; lo++)
+		if (iskey(tape, x[lo].key, name, len))
+			return x[lo].key + 1;
+	return NONE;
+}
+
+/* search in the object 'idx' the member of 'name' */
+static uint32_t member(const struct mustach_tape *tape, uint32_t idx, const char *name, size_t len)
+{
+	const struct node *nodes = tape->nodes;
+	uint32_t i, n;
+
+	if (idx == NONE || nodes[idx].type != T_object)
+		return NONE;
+	if (nodes[idx].flags & F_INDEXED)
+		return indexed(tape, idx, name, len);
+	for (i = idx + 1, n = nodes[idx].length ; n ; n--, i = nodes[i + 1].skip)
+		if (iskey(tape, i, name, len))
+			return i + 1;
+	return NONE;
+}
+
+/* get the number of node 'idx' as a double */
+static double number(const struct mustach_tape *tape, uint32_t idx)
+{
+	char buffer[64];
+	size_t len = tape->nodes[idx].length;
+
+	if (len >= sizeof buffer)
+		len = sizeof buffer - 1;
+	memcpy(buffer, textof(tape, idx), len);
+	buffer[len] = 0;
+	return strtod(buffer, NULL);
+}
+
+/* format the real number of node 'idx' in 'buffer' of at least 32 bytes, returns its length */
+static int numtext(const struct mustach_tape *tape, uint32_t idx, char *buffer)
+{
+	int prec, len;
+	double d;
+
+	/* shortest text reading back the same double */
+	d = number(tape, idx);
+	prec = 1;
+	do {
+		len = sprintf(buffer, "%.*g", prec, d);
+	} while (prec++ < 17 && strtod(buffer, NULL) != d);
+	if (isfinite(d) && !strchr(buffer, '.')) {
+		/* integral values are written as reals without exponent */
+		if (strchr(buffer, 'e') && fabs(d) < 1e17)
+			len = sprintf(buffer, "%.0f", d);
+		if (!strchr(buffer, 'e'))
+			len += sprintf(&buffer[len], ".0");
+	}
+	return len;
+}
+
+/* get the number of node 'idx' as a integer */
+static long long integer(const struct mustach_tape *tape, uint32_t idx)
+{
+	char buffer[32];
+	size_t len = tape->nodes[idx].length;
+
+	if (len >= sizeof buffer)
+		return (long long)number(tape, idx);
+	memcpy(buffer, textof(tape, idx), len);
+	buffer[len] = 0;
+	return strtoll(buffer, NULL, 10);
+}
+
+/* serialization of containers in compact JSON */
+struct serial {
+	char *buffer;
+	size_t length;
+	size_t alloc;
+};
+
+static int put(struct serial *s, const char *text, size_t length)
+{
+	char *b;
+	size_t alloc;
+
+	if (s->length + length >= s->alloc) {
+		alloc = s->alloc + (s->alloc >> 1) + length + 64;
+		b = realloc(s->buffer, alloc);
+		if (b == NULL)
+			return -1;
+		s->buffer = b;
+		s->alloc = alloc;
+	}
+	memcpy(&s->buffer[s->length], text, length);
+	s->length += length;
+	return 0;
+}
+
+static int serialize(const struct mustach_tape *tape, uint32_t idx, struct serial *s);
+
+/* serialize the streamed array 'idx' by parsing its items in a tape of their own */
+static int serialstream(const struct mustach_tape *tape, uint32_t idx, struct serial *s)
+{
+	struct mustach_tape item;
+	const char *pos = textof(tape, idx) + 1;
+	uint32_t i;
+	int rc, n;
+
+	memset(&item, 0, sizeof item);
+	item.stream = NONE;
+	item.after = tape->after;
+	n = 0;
+	rc = put(s, "[", 1) ? -1 : 0;
+	while (rc == 0 && (rc = streamitem(&item, &pos, &i)) > 0) {
+		item.text = item.item;
+		rc = (n++ && put(s, ",", 1)) || serialize(&item, i, s) ? -1 : 0;
+	}
+	free(item.nodes);
+	return rc || put(s, "]", 1);
+}
+
+static int serialize(const struct mustach_tape *tape, uint32_t idx, struct serial *s)
+{
+	const struct node *n = &tape->nodes[idx];
+	uint32_t i, count;
+	char buffer[40];
+	int rc;
+
+	switch (n->type) {
+	case T_null: return put(s, "null", 4);
+	case T_false: return put(s, "false", 5);
+	case T_true: return put(s, "true", 4);
+	case T_number:
+		if (!(n->flags & F_REAL))
+			return put(s, textof(tape, idx), n->length);
+		return put(s, buffer, (size_t)numtext(tape, idx, buffer));
+	case T_string:
+		return put(s, "\"", 1) || put(s, textof(tape, idx), n->length) || put(s, "\"", 1);
+	default:
+		if (n->flags & F_STREAM)
+			return serialstream(tape, idx, s);
+		rc = put(s, n->type == T_array ? "[" : "{", 1);
+		for (i = idx + 1, count = n->length ; !rc && count ; count--) {
+			if (n->type == T_object) {
+				rc = serialize(tape, i, s) || put(s, ":", 1);
+				i++;
+			}
+			if (!rc)
+				rc = serialize(tape, i, s);
+			i = tape->nodes[i].skip;
+			if (!rc && count > 1)
+				rc = put(s, ",", 1);
+		}
+		return rc || put(s, n->type == T_array ? "]" : "}", 1);
+	}
+}
+
+unsigned mustach_tape_root(const struct mustach_tape *tape)
+{
+	return tape->root;
+}
+
+unsigned mustach_tape_count(const struct mustach_tape *tape, unsigned node)
+{
+	int t = typeof_(tape, node);
+	return t == T_array || t == T_object ? tape->nodes[node].length : 0;
+}
+
+unsigned mustach_tape_item(const struct mustach_tape *tape, unsigned node, unsigned index)
+{
+	uint32_t i;
+
+	if (typeof_(tape, node) != T_array || index >= tape->nodes[node].length)
+		return MUSTACH_TAPE_NONE;
+	for (i = node + 1 ; index ; index--)
+		i = tape->nodes[i].skip;
+	return i;
+}
+
+unsigned mustach_tape_member(const struct mustach_tape *tape, unsigned node, const char *name)
+{
+	return member(tape, node, name, strlen(name));
+}
+
+char *mustach_tape_string(const struct mustach_tape *tape, unsigned node)
+{
+	if (typeof_(tape, node) != T_string) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return decode(tape, node);
+}
+
+char *mustach_tape_json(const struct mustach_tape *tape, unsigned node)
+{
+	struct serial s;
+
+	if (node >= tape->count) {
+		errno = EINVAL;
+		return NULL;
+	}
+	s.buffer = NULL;
+	s.length = s.alloc = 0;
+	if (serialize(tape, node, &s) || put(&s, "", 1)) {
+		free(s.buffer);
+		return NULL;
+	}
+	return s.buffer;
+}
+
+/******************************************************************************/
+/* SNAPSHOTS                                                                  */
+/******************************************************************************/
+
+/*
+ * A snapshot is a tape in a single block made to be used in place, for
+ * example when mapped from a file: the header, the nodes, the index of
+ * the keys and the texts of the strings and numbers. The members of big
+ * objects are found by dichotomy on the hashes of their keys.
+ */
+#define SNAP_MAGIC  "MUSTAPE1"
+#define SNAP_ORDER  0x01020304u
+
+struct snaphead {
+	char magic[8];
+	uint32_t order;     /* SNAP_ORDER in the byte order of the writer */
+	uint32_t nodesize;  /* size of the nodes of the writer */
+	uint32_t count;     /* count of nodes */
+	uint32_t root;      /* index of the root value */
+	uint32_t keys;      /* count of entries of the index */
+	uint32_t unused;
+	uint64_t textsize;  /* size of the texts */
+};
+
+static int cmpkidx(const void *a, const void *b)
+{
+	const struct kidx *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/* put in 'x' the entries of the keys of the object 'idx' */
+static int indexkeys(const struct mustach_tape *tape, uint32_t idx, struct kidx *x)
+{
+	const struct node *nodes = tape->nodes;
+	uint32_t i, n;
+	char *s;
+
+	for (i = idx + 1, n = nodes[idx].length ; n ; n--, i = nodes[i + 1].skip, x++) {
+		x->key = i;
+		if (!(nodes[i].flags & F_ESCAPED))
+			x->hash = hashkey(textof(tape, i), nodes[i].length);
+		else {
+			s = malloc(nodes[i].length + 1);
+			if (s == NULL)
+				return -1;
+			x->hash = hashkey(s, unescape(textof(tape, i), nodes[i].length, s));
+			free(s);
+		}
+	}
+	qsort(x - nodes[idx].length, nodes[idx].length, sizeof *x, cmpkidx);
+	return 0;
+}
+
+void *mustach_tape_snapshot(const struct mustach_tape *tape, size_t *size)
+{
+	const struct node *n;
+	struct snaphead *head;
+	struct node *nodes;
+	struct kidx *index;
+	char *text;
+	uint64_t textsize;
+	uint32_t i, keys, pos;
+	size_t total;
+
+	if (tape->stream != NONE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (textsize = 0, keys = 0, i = 0 ; i < tape->count ; i++) {
+		n = &tape->nodes[i];
+		if (n->type == T_string || n->type == T_number)
+			textsize += n->length;
+		else if (n->type == T_object && n->length >= MUSTACH_TAPE_INDEX_MIN)
+			keys += n->length;
+	}
+	if (textsize > UINT32_MAX) {
+		errno = EFBIG;
+		return NULL;
+	}
+	total = sizeof *head + tape->count * sizeof *nodes + keys * sizeof *index + (size_t)textsize;
+	head = calloc(1, total);
+	if (head == NULL)
+		return NULL;
+	nodes = (struct node*)(head + 1);
+	index = (struct kidx*)&nodes[tape->count];
+	text = (char*)&index[keys];
+
+	memcpy(head->magic, SNAP_MAGIC, sizeof head->magic);
+	head->order = SNAP_ORDER;
+	head->nodesize = (uint32_t)sizeof *nodes;
+	head->count = tape->count;
+	head->root = tape->root;
+	head->keys = keys;
+	head->textsize = textsize;
+	for (keys = 0, pos = 0, i = 0 ; i < tape->count ; i++) {
+		n = &tape->nodes[i];
+		nodes[i] = *n;
+		nodes[i].offset = 0;
+		if (n->type == T_string || n->type == T_number) {
+			/* only the texts of strings and numbers are kept */
+			memcpy(&text[pos], textof(tape, i), n->length);
+			nodes[i].offset = pos;
+			pos += n->length;
+		} else if (n->type == T_object && n->length >= MUSTACH_TAPE_INDEX_MIN) {
+			if (indexkeys(tape, i, &index[keys]) < 0) {
+				free(head);
+				return NULL;
+			}
+			nodes[i].flags |= F_INDEXED;
+			nodes[i].offset = keys;
+			keys += n->length;
+		}
+	}
+	*size = total;
+	return head;
+}
+
+/*
+ * check the nodes of the snapshot: their types, their flags, their texts,
+ * the entries of their index and the children of their containers, so
+ * that the tape is explored without reading out of the snapshot
+ */
+static int checksnap(const struct snaphead *head)
+{
+	const struct node *nodes = (const struct node*)(head + 1), *n;
+	const struct kidx *index = (const struct kidx*)&nodes[head->count], *x;
+	const char *text = (const char*)&index[head->keys], *s, *end;
+	uint32_t i, c, m;
+
+	for (i = 0 ; i < head->count ; i++) {
+		n = &nodes[i];
+		if (n->skip <= i || n->skip > head->count)
+			return -1;
+		switch (n->type) {
+		case T_null:
+		case T_false:
+		case T_true:
+			if (n->flags || n->skip != i + 1)
+				return -1;
+			break;
+		case T_number:
+		case T_string:
+			if (n->skip != i + 1
+			 || (n->flags & ~(n->type == T_number ? F_REAL : F_ESCAPED))
+			 || (uint64_t)n->offset + n->length > head->textsize)
+				return -1;
+			if (n->flags & F_ESCAPED) {
+				/* the escape sequences are decoded without checking */
+				s = &text[n->offset];
+				end = s + n->length;
+				while ((s = memchr(s, '\\', (size_t)(end - s))) != NULL)
+					if ((s = escapeend(s, end)) == NULL)
+						return -1;
+			}
+			break;
+		case T_array:
+		case T_object:
+			if (n->flags & ~(n->type == T_object ? F_INDEXED : 0))
+				return -1;
+			/* the children, keys followed by values for objects, end at 'skip' */
+			for (c = i + 1, m = n->length ; m ; m--) {
+				if (n->type == T_object) {
+					if (c >= n->skip || nodes[c].type != T_string)
+						return -1;
+					c++;
+				}
+				if (c >= n->skip || nodes[c].skip <= c)
+					return -1;
+				c = nodes[c].skip;
+			}
+			if (c != n->skip)
+				return -1;
+			if (n->flags & F_INDEXED) {
+				if ((uint64_t)n->offset + n->length > head->keys)
+					return -1;
+				for (x = &index[n->offset], m = n->length ; m ; m--, x++)
+					if (x->key <= i || x->key >= n->skip - 1 || nodes[x->key].type != T_string)
+						return -1;
+			}
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+struct mustach_tape *mustach_tape_map(const void *snapshot, size_t size)
+{
+	const struct snaphead *head = snapshot;
+	struct mustach_tape *tape;
+
+	if ((uintptr_t)snapshot % sizeof(uint64_t) != 0
+	 || size < sizeof *head
+	 || memcmp(head->magic, SNAP_MAGIC, sizeof head->magic)
+	 || head->order != SNAP_ORDER
+	 || head->nodesize != sizeof(struct node)
+	 || head->root >= head->count
+	 || size != sizeof *head + (uint64_t)head->count * sizeof(struct node)
+			+ (uint64_t)head->keys * sizeof(struct kidx) + head->textsize
+	 || checksnap(head) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	tape = malloc(sizeof *tape);
+	if (tape != NULL) {
+		/* the nodes are never modified because they are shared */
+		tape->nodes = (struct node*)(head + 1);
+		tape->index = (const struct kidx*)&tape->nodes[head->count];
+		tape->text = (const char*)&tape->index[head->keys];
+		tape->count = tape->alloc = head->count;
+		tape->root = head->root;
+		tape->shared = 1;
+		tape->stream = tape->items = NONE;
+		tape->after = tape->item = tape->text;
+	}
+	return tape;
+}
+
+/******************************************************************************/
+/* WRAP INTERFACE                                                             */
+/******************************************************************************/
+
+struct expl {
+	const struct mustach_tape *const *roots;
+	unsigned count;
+	int base;
+	struct mustach_tape *work;  /* copy of a streaming tape receiving the items */
+	const struct mustach_tape *seltape; /* tape of the selection */
+	uint32_t selection;
+	int depth;
+	int streaming;              /* the streamed array is iterated */
+	struct {
+		const struct mustach_tape *tape;
+		uint32_t cont;
+		uint32_t obj;
+		uint32_t key;
+		uint32_t count;
+		const char *next;       /* text of the next streamed item */
+		int is_objiter;
+		int is_stream;
+	} stack[MUSTACH_MAX_DEPTH];
+};
+
+static int start(void *closure)
+{
+	struct expl *e = closure;
+	const struct mustach_tape *tape;
+	struct mustach_tape *work;
+	unsigned i;
+
+	if (e->count == 0) {
+		errno = EINVAL;
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	if (e->count > MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+	for (i = 1 ; i < e->count ; i++)
+		if (e->roots[i]->stream != NONE) {
+			/* only the first root can stream */
+			errno = EINVAL;
+			return MUSTACH_ERROR_SYSTEM;
+		}
+	e->work = NULL;
+	e->streaming = 0;
+	tape = e->roots[0];
+	if (tape->stream != NONE) {
+		/* the items are appended to a copy of the nodes */
+		work = malloc(sizeof *work);
+		if (work == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		*work = *tape;
+		work->shared = 0;
+		work->alloc = tape->count + 64;
+		work->items = tape->count;
+		work->nodes = malloc(work->alloc * sizeof *work->nodes);
+		if (work->nodes == NULL) {
+			free(work);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		memcpy(work->nodes, tape->nodes, tape->count * sizeof *work->nodes);
+		e->work = work;
+	}
+	e->selection = NONE;
+	e->seltape = NULL;
+	/* the roots are the bottom frames, the first root on top */
+	for (i = 0 ; i < e->count ; i++) {
+		tape = i == e->count - 1 && e->work ? e->work : e->roots[e->count - 1 - i];
+		e->stack[i].tape = tape;
+		e->stack[i].cont = NONE;
+		e->stack[i].obj = tape->root;
+		e->stack[i].key = NONE;
+		e->stack[i].count = 1;
+		e->stack[i].is_objiter = 0;
+		e->stack[i].is_stream = 0;
+	}
+	e->depth = e->base = (int)e->count - 1;
+	return MUSTACH_OK;
+}
+
+static void stop(void *closure, int status)
+{
+	struct expl *e = closure;
+
+	(void)status; /* unused */
+	mustach_tape_free(e->work);
+}
+
+static int compare(void *closure, const char *value)
+{
+	struct expl *e = closure;
+	const struct mustach_tape *tape = e->seltape;
+	uint32_t o = e->selection;
+	double d;
+	long long i;
+
+	switch (typeof_(tape, o)) {
+	case T_number:
+		if (tape->nodes[o].flags & F_REAL) {
+			d = number(tape, o) - atof(value);
+			return d < 0 ? -1 : d > 0 ? 1 : 0;
+		}
+		i = integer(tape, o) - atoll(value);
+		return i < 0 ? -1 : i > 0 ? 1 : 0;
+	case T_string:
+		return strcmpnode(tape, o, value);
+	case T_true:
+		return strcmp("true", value);
+	case T_false:
+		return strcmp("false", value);
+	case T_null:
+		return strcmp("null", value);
+	default:
+		return 1;
+	}
+}
+
+static int sel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	uint32_t o;
+	size_t len;
+	int i, r;
+
+	if (name == NULL) {
+		i = e->depth;
+		o = e->stack[i].obj;
+		r = 1;
+	} else {
+		o = NONE;
+		len = strlen(name);
+		i = e->depth;
+		while (i >= 0 && (o = member(e->stack[i].tape, e->stack[i].obj, name, len)) == NONE)
+			i--;
+		r = i >= 0;
+	}
+	e->selection = o;
+	e->seltape = r ? e->stack[i].tape : NULL;
+	return r;
+}
+
+static int subsel(void *closure, const char *name)
+{
+	struct expl *e = closure;
+	uint32_t o;
+
+	o = member(e->seltape, e->selection, name, strlen(name));
+	if (o == NONE)
+		return 0;
+	e->selection = o;
+	return 1;
+}
+
+/* truth of the node 'idx' when it is not a container */
+static int truth(const struct mustach_tape *tape, uint32_t idx)
+{
+	switch (typeof_(tape, idx)) {
+	case T_true:
+		return 1;
+	case T_number:
+		return number(tape, idx) != 0;
+	case T_string:
+		return tape->nodes[idx].length != 0;
+	default:
+		return 0;
+	}
+}
+
+static int enter(void *closure, int objiter)
+{
+	struct expl *e = closure;
+	const struct mustach_tape *tape = e->seltape;
+	uint32_t o;
+	int t;
+
+	if (++e->depth >= MUSTACH_MAX_DEPTH)
+		return MUSTACH_ERROR_TOO_DEEP;
+
+	o = e->selection;
+	t = typeof_(tape, o);
+	e->stack[e->depth].tape = tape;
+	e->stack[e->depth].is_objiter = 0;
+	e->stack[e->depth].is_stream = 0;
+	e->stack[e->depth].key = NONE;
+	e->stack[e->depth].cont = o;
+	if (objiter) {
+		if (t != T_object || tape->nodes[o].length == 0)
+			goto not_entering;
+		e->stack[e->depth].key = o + 1;
+		e->stack[e->depth].obj = o + 2;
+		e->stack[e->depth].count = tape->nodes[o].length;
+		e->stack[e->depth].is_objiter = 1;
+	} else if (t == T_array && (tape->nodes[o].flags & F_STREAM)) {
+		if (e->streaming) {
+			/* the items of the running iteration would be lost */
+			e->depth--;
+			errno = EBUSY;
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		e->stack[e->depth].next = textof(tape, o) + 1;
+		t = streamitem(e->work, &e->stack[e->depth].next, &o);
+		if (t <= 0) {
+			e->depth--;
+			return t;
+		}
+		e->stack[e->depth].obj = o;
+		e->stack[e->depth].count = 1;
+		e->stack[e->depth].is_stream = 1;
+		e->streaming = 1;
+	} else if (t == T_array) {
+		if (tape->nodes[o].length == 0)
+			goto not_entering;
+		e->stack[e->depth].obj = o + 1;
+		e->stack[e->depth].count = tape->nodes[o].length;
+	} else if (t == T_object || truth(tape, o)) {
+		e->stack[e->depth].obj = o;
+		e->stack[e->depth].count = 1;
+	} else
+		goto not_entering;
+	return 1;
+
+not_entering:
+	e->depth--;
+	return 0;
+}
+
+static int next(void *closure)
+{
+	struct expl *e = closure;
+	const struct node *nodes = e->stack[e->depth].tape->nodes;
+
+	if (e->depth <= e->base)
+		return MUSTACH_ERROR_CLOSING;
+
+	if (e->stack[e->depth].is_stream)
+		return streamitem(e->work, &e->stack[e->depth].next, &e->stack[e->depth].obj);
+
+	if (--e->stack[e->depth].count == 0)
+		return 0;
+
+	if (e->stack[e->depth].is_objiter) {
+		e->stack[e->depth].key = nodes[e->stack[e->depth].obj].skip;
+		e->stack[e->depth].obj = e->stack[e->depth].key + 1;
+	} else
+		e->stack[e->depth].obj = nodes[e->stack[e->depth].obj].skip;
+	return 1;
+}
+
+static int leave(void *closure)
+{
+	struct expl *e = closure;
+
+	if (e->depth <= e->base)
+		return MUSTACH_ERROR_CLOSING;
+
+	if (e->stack[e->depth].is_stream)
+		e->streaming = 0;
+	e->depth--;
+	return 0;
+}
+
+static int getstring(const struct mustach_tape *tape, uint32_t idx, struct mustach_sbuf *sbuf)
+{
+	const struct node *n = &tape->nodes[idx];
+	char *s;
+
+	if (n->length == 0)
+		sbuf->value = "";
+	else if (!(n->flags & F_ESCAPED)) {
+		sbuf->value = textof(tape, idx);
+		sbuf->length = n->length;
+	} else {
+		s = decode(tape, idx);
+		if (s == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		sbuf->value = s;
+		sbuf->freecb = free;
+	}
+	return 1;
+}
+
+static int get(void *closure, struct mustach_sbuf *sbuf, int key)
+{
+	struct expl *e = closure;
+	const struct mustach_tape *tape = e->seltape;
+	uint32_t o = e->selection;
+	struct serial s;
+
+	if (key) {
+		if (!e->stack[e->depth].is_objiter) {
+			sbuf->value = "";
+			return 1;
+		}
+		return getstring(e->stack[e->depth].tape, e->stack[e->depth].key, sbuf);
+	}
+	switch (typeof_(tape, o)) {
+	case T_null:
+		sbuf->value = "";
+		break;
+	case T_false:
+		sbuf->value = "false";
+		break;
+	case T_true:
+		sbuf->value = "true";
+		break;
+	case T_number:
+		if (!(tape->nodes[o].flags & F_REAL)) {
+			sbuf->value = textof(tape, o);
+			sbuf->length = tape->nodes[o].length;
+			break;
+		}
+		s.buffer = malloc(40);
+		if (s.buffer == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		numtext(tape, o, s.buffer);
+		sbuf->value = s.buffer;
+		sbuf->freecb = free;
+		break;
+	case T_string:
+		return getstring(tape, o, sbuf);
+	default:
+		s.buffer = NULL;
+		s.length = s.alloc = 0;
+		if (serialize(tape, o, &s) || put(&s, "", 1)) {
+			free(s.buffer);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		sbuf->value = s.buffer;
+		sbuf->freecb = free;
+		break;
+	}
+	return 1;
+}
+
+const struct mustach_wrap_itf mustach_tape_wrap_itf = {
+	.start = start,
+	.stop = stop,
+	.compare = compare,
+	.sel = sel,
+	.subsel = subsel,
+	.enter = enter,
+	.next = next,
+	.leave = leave,
+	.get = get
+};
+
+/* prepares the explorer 'e' for rendering 'roots' and returns it */
+static void *init(struct expl *e, const struct mustach_tape *const *roots, unsigned count, int flags)
+{
+	(void)flags; /* unused */
+	e->roots = roots;
+	e->count = count;
+	return e;
+}
+
+int mustach_tape_file(const char *template, size_t length, const struct mustach_tape *tape, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_file(template, length, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, file);
+}
+
+int mustach_tape_fd(const char *template, size_t length, const struct mustach_tape *tape, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_fd(template, length, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, fd);
+}
+
+int mustach_tape_mem(const char *template, size_t length, const struct mustach_tape *tape, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_mem(template, length, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, result, size);
+}
+
+int mustach_tape_write(const char *template, size_t length, const struct mustach_tape *tape, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_write(template, length, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, writecb, closure);
+}
+
+int mustach_tape_emit(const char *template, size_t length, const struct mustach_tape *tape, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_emit(template, length, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, emitcb, closure);
+}
+
+int mustach_tape_compiled_file(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_compiled_file(tmpl, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, file);
+}
+
+int mustach_tape_compiled_fd(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_compiled_fd(tmpl, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, fd);
+}
+
+int mustach_tape_compiled_mem(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_compiled_mem(tmpl, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, result, size);
+}
+
+int mustach_tape_compiled_write(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, mustach_write_cb_t *writecb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_write(tmpl, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, writecb, closure);
+}
+
+int mustach_tape_compiled_emit(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, mustach_emit_cb_t *emitcb, void *closure)
+{
+	struct expl e;
+	return mustach_wrap_compiled_emit(tmpl, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, emitcb, closure);
+}
+
+MUSTACH_WRAP_LAYERS_DEFINE(mustach_tape, const struct mustach_tape, &mustach_tape_wrap_itf, struct expl, init)
+
+int mustach_tape_stream_file(mustach_read_cb_t *readcb, void *closure, const struct mustach_tape *tape, int flags, FILE *file)
+{
+	struct expl e;
+	return mustach_wrap_stream_file(readcb, closure, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, file);
+}
+
+int mustach_tape_stream_fd(mustach_read_cb_t *readcb, void *closure, const struct mustach_tape *tape, int flags, int fd)
+{
+	struct expl e;
+	return mustach_wrap_stream_fd(readcb, closure, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, fd);
+}
+
+int mustach_tape_stream_mem(mustach_read_cb_t *readcb, void *closure, const struct mustach_tape *tape, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_stream_mem(readcb, closure, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, result, size);
+}
+
+int mustach_tape_specialize(const char *template, size_t length, const struct mustach_tape *tape, int flags, char **result, size_t *size)
+{
+	struct expl e;
+	return mustach_wrap_specialize(template, length, &mustach_tape_wrap_itf, init(&e, &tape, 1, flags), flags, result, size);
+}
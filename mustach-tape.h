@@ -0,0 +1,434 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _mustach_tape_h_included_
+#define _mustach_tape_h_included_
+
+/*
+ * mustach-tape is a self contained JSON backend for mustach.
+ *
+ * It does not depend on any external JSON library. The JSON text is
+ * parsed in a flat array of nodes, the tape, whose strings and numbers
+ * are views on the JSON text. Because nothing is copied, the JSON text
+ * given to 'mustach_tape_parse' must remain valid and unchanged until
+ * the tape is released using 'mustach_tape_free'.
+ */
+
+#include "mustach-wrap.h"
+
+struct mustach_tape;
+
+/**
+ * Wrap interface used internally by mustach tape functions.
+ * Can be used for overriding behaviour.
+ */
+extern const struct mustach_wrap_itf mustach_tape_wrap_itf;
+
+/**
+ * mustach_tape_parse - Parses the JSON 'text' of 'length' and returns
+ * its tape.
+ *
+ * @text:   the JSON text to parse, it is not copied
+ * @length: length of the text or zero if unknown and text null terminated
+ * @errpos: if not NULL, receives the offset of the error on syntax error
+ *
+ * Returns the tape or NULL with errno set to EINVAL on syntax error or
+ * to ENOMEM when out of memory.
+ */
+extern struct mustach_tape *mustach_tape_parse(const char *text, size_t length, size_t *errpos);
+
+/**
+ * mustach_tape_sub - Returns a tape whose root is the value 'node' of 'tape'.
+ *
+ * @tape: the tape
+ * @node: the node of the root of the returned tape
+ *
+ * The returned tape shares its text and its nodes with 'tape' that must
+ * remain valid until the returned tape is released using 'mustach_tape_free'.
+ *
+ * Returns the tape or NULL with errno set.
+ */
+extern struct mustach_tape *mustach_tape_sub(const struct mustach_tape *tape, unsigned node);
+
+/**
+ * mustach_tape_free - Releases the memory used by 'tape'.
+ *
+ * @tape: the tape to release, can be NULL
+ */
+extern void mustach_tape_free(struct mustach_tape *tape);
+
+/**
+ * mustach_tape_parse_stream - Parses the JSON 'text' of 'length' except
+ * the items of the array at 'path' that are parsed when iterated.
+ *
+ * @text:   the JSON text to parse, it is not copied
+ * @length: length of the text or zero if unknown and text null terminated
+ * @path:   keys of objects separated by dots leading to the streamed
+ *          array from the root, the empty string for the root
+ * @errpos: if not NULL, receives the offset of the error on syntax error
+ *
+ * When rendering, each item of the streamed array is parsed, rendered and
+ * released before the next, so the memory used doesn't depend on the
+ * count of items. The streamed array is only checked for the termination
+ * of its strings and the balance of its brackets: syntax errors in items
+ * are reported when rendering, with MUSTACH_ERROR_SYSTEM and errno set to
+ * EINVAL. The streamed array can't be iterated while it is iterated:
+ * rendering then fails with MUSTACH_ERROR_SYSTEM and errno set to EBUSY.
+ * The functions mustach_tape_count and mustach_tape_item see it empty.
+ *
+ * Texts of more than 4G can be streamed when the items and the texts
+ * before and after the streamed array are smaller.
+ *
+ * Returns the tape or NULL with errno set to EINVAL on syntax error, to
+ * ENOENT when the array is not found or to ENOMEM when out of memory.
+ */
+extern struct mustach_tape *mustach_tape_parse_stream(const char *text, size_t length, const char *path, size_t *errpos);
+
+/**
+ * A projection records the keys that templates can select. Parsing with a
+ * projection skips the members of objects that the templates can't select
+ * without creating nodes for them, which saves most of the parsing when
+ * the templates use a small part of the JSON text.
+ */
+struct mustach_tape_projection;
+
+/**
+ * mustach_tape_projection_create - Returns a new empty projection or
+ * NULL when out of memory.
+ */
+extern struct mustach_tape_projection *mustach_tape_projection_create(void);
+
+/**
+ * mustach_tape_projection_add - Adds to 'proj' the keys used by 'template'.
+ *
+ * @proj:     the projection
+ * @template: the template string
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @flags:    the flags that will be used for rendering
+ *
+ * The templates of the partials must be added too. The partials taken
+ * from the data are not analyzed: they only see the values selected by
+ * the added templates.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error in the template. In case of
+ * error, the projection keeps all the values.
+ */
+extern int mustach_tape_projection_add(struct mustach_tape_projection *proj, const char *template, size_t length, int flags);
+
+/**
+ * mustach_tape_projection_add_compiled - Adds to 'proj' the keys used by
+ * the compiled template 'tmpl' and by its bound partials.
+ *
+ * @proj:  the projection
+ * @tmpl:  the compiled template
+ * @flags: the flags that will be used for rendering
+ *
+ * Returns 0 in case of success or MUSTACH_ERROR_SYSTEM, in which case
+ * the projection keeps all the values.
+ */
+extern int mustach_tape_projection_add_compiled(struct mustach_tape_projection *proj, const struct mustach_template *tmpl, int flags);
+
+/**
+ * mustach_tape_projection_free - Releases the projection 'proj', can be NULL.
+ */
+extern void mustach_tape_projection_free(struct mustach_tape_projection *proj);
+
+/**
+ * mustach_tape_parse_projected - Parses the JSON 'text' of 'length' and
+ * returns its tape reduced to the keys of the projection 'proj'.
+ *
+ * @text:   the JSON text to parse, it is not copied
+ * @length: length of the text or zero if unknown and text null terminated
+ * @proj:   the projection, NULL for keeping all values
+ * @errpos: if not NULL, receives the offset of the error on syntax error
+ *
+ * The values that are skipped are only checked for the termination of
+ * their strings and the balance of their brackets. Rendering the added
+ * templates with the returned tape gives the same result than with the
+ * complete tape.
+ *
+ * Returns the tape or NULL with errno set to EINVAL on syntax error or
+ * to ENOMEM when out of memory.
+ */
+extern struct mustach_tape *mustach_tape_parse_projected(const char *text, size_t length,
+		const struct mustach_tape_projection *proj, size_t *errpos);
+
+/**
+ * mustach_tape_snapshot - Returns the snapshot of 'tape', a single block
+ * holding the tape and the texts of its strings and numbers, that can be
+ * saved in a file and used in place with 'mustach_tape_map'. The keys of
+ * the big objects are indexed in the snapshot for faster selections.
+ *
+ * @tape: the tape, it can't be streaming
+ * @size: receives the size of the returned snapshot
+ *
+ * Returns the snapshot to be released using 'free' or NULL with errno set.
+ */
+extern void *mustach_tape_snapshot(const struct mustach_tape *tape, size_t *size);
+
+/**
+ * mustach_tape_map - Returns the tape of the 'snapshot' of 'size' used in
+ * place, without parsing nor copying, typically mapped from a file using
+ * mmap, so that processes share its pages.
+ *
+ * @snapshot: the snapshot, aligned on 8 bytes, it is not copied
+ * @size:     size of the snapshot
+ *
+ * The snapshot is checked once: its nodes must be in its bounds and form
+ * the tree of values that 'mustach_tape_snapshot' produces on a machine of
+ * the same byte order. It must remain valid and unchanged until the tape
+ * is released using 'mustach_tape_free'.
+ *
+ * Returns the tape or NULL with errno set to EINVAL when 'snapshot' isn't
+ * a snapshot or to ENOMEM when out of memory.
+ */
+extern struct mustach_tape *mustach_tape_map(const void *snapshot, size_t size);
+
+/**
+ * Value returned for nodes that don't exist.
+ */
+#define MUSTACH_TAPE_NONE ((unsigned)-1)
+
+/**
+ * mustach_tape_root - Returns the node of the root value of 'tape'.
+ */
+extern unsigned mustach_tape_root(const struct mustach_tape *tape);
+
+/**
+ * mustach_tape_count - Returns the count of items of the array or of
+ * members of the object 'node' or 0 for other values.
+ */
+extern unsigned mustach_tape_count(const struct mustach_tape *tape, unsigned node);
+
+/**
+ * mustach_tape_item - Returns the node of the item of 'index' of the
+ * array 'node' or MUSTACH_TAPE_NONE.
+ */
+extern unsigned mustach_tape_item(const struct mustach_tape *tape, unsigned node, unsigned index);
+
+/**
+ * mustach_tape_member - Returns the node of the value of the member
+ * 'name' of the object 'node' or MUSTACH_TAPE_NONE.
+ */
+extern unsigned mustach_tape_member(const struct mustach_tape *tape, unsigned node, const char *name);
+
+/**
+ * mustach_tape_string - Returns a copy of the string value of 'node'
+ * or NULL with errno set when 'node' is not a string. The returned
+ * value must be released using 'free'.
+ */
+extern char *mustach_tape_string(const struct mustach_tape *tape, unsigned node);
+
+/**
+ * mustach_tape_json - Returns the compact JSON text of the value of
+ * 'node' or NULL with errno set. The returned value must be released
+ * using 'free'.
+ */
+extern char *mustach_tape_json(const struct mustach_tape *tape, unsigned node);
+
+/**
+ * mustach_tape_file - Renders the mustache 'template' in 'file' for 'tape'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @tape:     the tape of the JSON data to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_file(const char *template, size_t length, const struct mustach_tape *tape, int flags, FILE *file);
+
+/**
+ * mustach_tape_fd - Renders the mustache 'template' in 'fd' for 'tape'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @tape:     the tape of the JSON data to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_fd(const char *template, size_t length, const struct mustach_tape *tape, int flags, int fd);
+
+/**
+ * mustach_tape_mem - Renders the mustache 'template' in 'result' for 'tape'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @tape:     the tape of the JSON data to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_mem(const char *template, size_t length, const struct mustach_tape *tape, int flags, char **result, size_t *size);
+
+/**
+ * mustach_tape_write - Renders the mustache 'template' for 'tape' to custom writer 'writecb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @tape:     the tape of the JSON data to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_write(const char *template, size_t length, const struct mustach_tape *tape, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_tape_emit - Renders the mustache 'template' for 'tape' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @template: the template string to instantiate
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @tape:     the tape of the JSON data to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_emit(const char *template, size_t length, const struct mustach_tape *tape, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/**
+ * mustach_tape_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'tape'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @tape:     the tape of the JSON data to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_compiled_file(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, FILE *file);
+
+/**
+ * mustach_tape_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'tape'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @tape:     the tape of the JSON data to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_compiled_fd(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, int fd);
+
+/**
+ * mustach_tape_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'tape'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @tape:     the tape of the JSON data to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_compiled_mem(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, char **result, size_t *size);
+
+/**
+ * mustach_tape_compiled_write - Renders the compiled template 'tmpl' for 'tape' to custom writer 'writecb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @tape:     the tape of the JSON data to render
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_compiled_write(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, mustach_write_cb_t *writecb, void *closure);
+
+/**
+ * mustach_tape_compiled_emit - Renders the compiled template 'tmpl' for 'tape' to custom emiter 'emitcb' with 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @tape:     the tape of the JSON data to render
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_compiled_emit(const struct mustach_template *tmpl, const struct mustach_tape *tape, int flags, mustach_emit_cb_t *emitcb, void *closure);
+
+/*
+ * The functions mustach_tape_layers_XXX and mustach_tape_compiled_layers_XXX
+ * render for the list of 'count' tapes 'roots', searched in that order.
+ * Only the first tape can stream its designated array.
+ * See MUSTACH_WRAP_LAYERS_DECLARE in mustach-wrap.h.
+ */
+MUSTACH_WRAP_LAYERS_DECLARE(mustach_tape, const struct mustach_tape);
+
+/**
+ * mustach_tape_stream_file - Renders in 'file' for 'tape' the mustache template
+ * read progressively by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:   the function reading the template
+ * @closure:  the closure of the reading function
+ * @tape:     the tape of the JSON data to render
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_stream_file(mustach_read_cb_t *readcb, void *closure, const struct mustach_tape *tape, int flags, FILE *file);
+
+/**
+ * mustach_tape_stream_fd - Renders in 'fd' for 'tape' the mustache template
+ * read progressively by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:   the function reading the template
+ * @closure:  the closure of the reading function
+ * @tape:     the tape of the JSON data to render
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_stream_fd(mustach_read_cb_t *readcb, void *closure, const struct mustach_tape *tape, int flags, int fd);
+
+/**
+ * mustach_tape_stream_mem - Renders in 'result' for 'tape' the mustache template
+ * read progressively by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:   the function reading the template
+ * @closure:  the closure of the reading function
+ * @tape:     the tape of the JSON data to render
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_stream_mem(mustach_read_cb_t *readcb, void *closure, const struct mustach_tape *tape, int flags, char **result, size_t *size);
+
+/**
+ * mustach_tape_specialize - Specializes the mustache 'template' for the static data of 'tape'.
+ * The result is rendered with a tape that also has the static data or
+ * with the static tape as the last of the roots of the layers functions.
+ * See mustach_wrap_specialize.
+ *
+ * @template: the template string to specialize
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @tape:     the tape of the static JSON data
+ * @result:   the pointer receiving the specialized template when 0 is returned
+ * @size:     the size of the returned template
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_tape_specialize(const char *template, size_t length, const struct mustach_tape *tape, int flags, char **result, size_t *size);
+
+#endif
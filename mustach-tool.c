@@ -11,15 +11,35 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <libgen.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "mustach-wrap.h"
 
+#define MUSTACH_TOOL_JSON_C  1
+#define MUSTACH_TOOL_JANSSON 2
+#define MUSTACH_TOOL_CJSON   3
+#define MUSTACH_TOOL_TAPE    4
+#define MUSTACH_TOOL_CBOR    5
+
+#if !defined(INCLUDE_PARTIAL_EXTENSION)
+# define INCLUDE_PARTIAL_EXTENSION ".mustache"
+#endif
+
 static const size_t BLOCKSIZE = 8192;
 
+/* status of the requests of --serve whose data are invalid */
+#define TOOL_ERROR_DATA  (-1000)
+
 static const char *errors[] = {
 	"??? unreferenced ???",
 	"system",
@@ -39,6 +59,22 @@ static const char *errors[] = {
 static const char *errmsg = 0;
 static int flags = 0;
 static FILE *output = 0;
+static FILE *map = 0;
+static const char *mapname = 0;
+static size_t outpos = 0;
+static int csvsep = 0;
+static int csvquote = 0;
+static int csvrows = 0;
+static int nthreads = 4;
+static int watch = 0;
+static int prefetch = 0;
+#if TOOL != MUSTACH_TOOL_CBOR
+static int specialize = 0;
+#endif
+#if TOOL == MUSTACH_TOOL_TAPE
+static const char *stream = 0;
+static const char *snapshot = 0;
+#endif
 
 static void help(char *prog)
 {
@@ -52,81 +88,1126 @@ static void help(char *prog)
 		"\n"
 		"USAGE:\n"
 		"    %s [FLAGS] <json-file> <mustach-templates...>\n"
+		"    %s --generate <mustach-templates...>\n"
+		"    %s --header <mustach-templates...>\n"
+		"    %s [FLAGS] --serve <socket> <mustach-templates...>\n"
+		"    %s --client <socket> <mustach-template> [<json-file>]\n"
 		"\n"
 		"FLAGS:\n"
 		"    -h, --help     Prints help information\n"
 		"    -s, --strict   Error when a tag is undefined\n"
+		"    -m, --map FILE Writes in FILE the template positions of the output\n"
+		"    -g, --generate Writes C code rendering the compiled templates\n"
+		"    --header       Writes the C declarations of the generated templates\n"
+#if TOOL == MUSTACH_TOOL_TAPE
+		"    -S, --stream PATH  Parses the items of the array at PATH when rendered\n"
+		"    -w, --snapshot FILE  Writes in FILE the snapshot of the JSON file\n"
+#endif
+		"    -c, --csv      The data file is CSV, rows are objects keyed by the header\n"
+		"    -t, --tsv      The data file is TSV, rows are objects keyed by the header\n"
+		"    -r, --rows     Renders the templates for each row of CSV or TSV\n"
+		"    -j, --threads N  Count of threads of --serve and --prefetch (default 4)\n"
+		"    -P, --prefetch Reads the partials in parallel before rendering\n"
+		"    -W, --watch    Reloads the modified templates of --serve\n"
+#if TOOL != MUSTACH_TOOL_CBOR
+		"    --specialize   Writes the templates specialized for the JSON data\n"
+		"                   taken as static data\n"
+#endif
+		"    --serve SOCKET Renders the templates for the JSON data of the\n"
+		"                   requests received on the unix socket SOCKET\n"
+		"    --client SOCKET  Sends to the server of SOCKET the request of\n"
+		"                   rendering the template for the JSON data\n"
 		"\n"
 		"ARGS: (if a file is -, read standard input)\n"
 		"    <json-file>              JSON file with input data\n"
 		"    <mustach-templates...>   Template files to instantiate\n",
-		name);
+		name, name, name, name, name);
 	exit(0);
 }
 
-static char *readfile(const char *filename, size_t *length)
+/*
+ * load the file, "-" being the standard input, the regular files are mapped,
+ * their pages are not kept in the heap and are shared
+ */
+static char *loadfile(const char *filename, size_t *length, struct mustach_sbuf *file)
 {
-	int f;
-	struct stat s;
-	char *result;
+	if (mustach_wrap_load_file(filename, file) != MUSTACH_OK) {
+		fprintf(stderr, "Can't read file %s: %s\n", filename, strerror(errno));
+		exit(1);
+	}
+	*length = file->length;
+	return (char*)file->value;
+}
+
+/* advise the sequential reading of the mapped files */
+static void sequential(const struct mustach_sbuf *file)
+{
+	if (file->freecb != free)
+		madvise((void*)file->value, file->length, MADV_SEQUENTIAL);
+}
+
+static int writemap(void *closure, const char *buffer, size_t size)
+{
+	outpos += size;
+	return fwrite(buffer, 1, size, closure) != size ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+}
+
+#if TOOL != MUSTACH_TOOL_CBOR
+static int writespecialized(int rc, char *result, size_t size)
+{
+	if (rc == MUSTACH_OK) {
+		if (fwrite(result, 1, size, output) != size)
+			rc = MUSTACH_ERROR_SYSTEM;
+		free(result);
+	}
+	return rc;
+}
+#endif
+
+static int srcposmap(const struct mustach_srcpos *pos, void *closure)
+{
+	(void)closure; /* unused */
+	fprintf(map, "%zu", outpos);
+	for ( ; pos ; pos = pos->parent)
+		fprintf(map, " %s:%u:%zu", pos->name ? pos->name : mapname, pos->line, pos->offset);
+	return fputc('\n', map) == EOF ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+}
+
+struct unit {
+	struct unit *next;
+	const char *name; /* name of the partial or NULL */
+	const char *path;
+	char *text;
+	struct mustach_sbuf file;
+	struct mustach_template *tmpl;
+	int index;
+	int wd; /* watch descriptor of the directory */
+};
+
+static struct unit *units = 0;
+
+static void genstr(FILE *out, const char *str, size_t length)
+{
+	size_t i;
+	unsigned char c;
+
+	fputc('"', out);
+	for (i = 0 ; i < length ; i++) {
+		c = (unsigned char)str[i];
+		switch (c) {
+		case '\n':
+			fputs(i + 1 < length ? "\\n\"\n\t\"" : "\\n", out);
+			break;
+		case '\t': fputs("\\t", out); break;
+		case '\r': fputs("\\r", out); break;
+		case '\\': fputs("\\\\", out); break;
+		case '"': fputs("\\\"", out); break;
+		case '?': fputs(i && str[i - 1] == '?' ? "\\?" : "?", out); break;
+		default:
+			if (c < ' ' || c >= 127)
+				fprintf(out, "\\%03o", c);
+			else
+				fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static void genident(FILE *out, const char *path, int upper)
+{
+	const char *b, *e;
+
+	b = strrchr(path, '/');
+	b = b ? b + 1 : path;
+	e = strchr(b, '.');
+	if (e == NULL || e == b)
+		e = b + strlen(b);
+	if (isdigit((unsigned char)*b))
+		fputc('_', out);
+	for ( ; b != e ; b++)
+		fputc(!isalnum((unsigned char)*b) ? '_' : upper ? toupper((unsigned char)*b) : *b, out);
+}
+
+static void gensym(FILE *out, struct unit *u)
+{
+	if (u->name)
+		fprintf(out, "partial_%d", u->index);
+	else {
+		fputs("mustach_template_", out);
+		genident(out, u->path, 0);
+	}
+}
+
+static struct unit *addunit(const char *name, const char *path, char *text, size_t length, const struct mustach_sbuf *file)
+{
+	static struct unit **last = &units;
+	static int count = 0;
+	struct unit *u;
+	int s;
+
+	u = calloc(1, sizeof *u);
+	if (u == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	s = mustach_compile(text, length, flags, &u->tmpl);
+	if (s != MUSTACH_OK) {
+		s = -s;
+		if (s < 1 || s >= (int)(sizeof errors / sizeof * errors))
+			s = 0;
+		fprintf(stderr, "Template error %s (file %s)\n", errors[s], path);
+		exit(1);
+	}
+	u->name = name;
+	u->path = path;
+	u->text = text;
+	u->file = *file;
+	u->index = count++;
+	*last = u;
+	last = &u->next;
+	return u;
+}
+
+static struct unit *findpartial(const char *name)
+{
+	struct unit *u;
+
+	for (u = units ; u && (!u->name || strcmp(u->name, name)) ; u = u->next);
+	return u;
+}
+
+/* partials found as files are bound statically, others are queried at run */
+static struct unit *getpartial(const char *name)
+{
+	struct unit *u;
+	char *path, *text, *copy;
+	size_t length;
+	struct mustach_sbuf file;
+
+	u = findpartial(name);
+	if (u != NULL)
+		return u;
+	/* copy the name, the server releases the template holding it */
+	path = malloc(2 * strlen(name) + 1 + sizeof INCLUDE_PARTIAL_EXTENSION);
+	if (path == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	strcpy(path, name);
+	if (access(path, R_OK))
+		strcat(path, INCLUDE_PARTIAL_EXTENSION);
+	if (access(path, R_OK)) {
+		free(path);
+		return NULL;
+	}
+	text = loadfile(path, &length, &file);
+	if (length == 0) {
+		mustach_wrap_unload_file(&file);
+		free(path);
+		return NULL;
+	}
+	copy = strcpy(&path[strlen(path) + 1], name);
+	return addunit(copy, path, text, length, &file);
+}
+
+/*
+ * Generation of the function rendering a template: its tokens become the
+ * calls that process() of mustach.c makes for them. The standalone state
+ * and the text preceding the last tag are followed while generating, they
+ * are only kept at run, in the variables 'sa', 'ps' and 'pl', after the
+ * sections.
+ */
+struct gen {
+	FILE *out;                        /* where the code is written */
+	const struct mustach_template *tmpl;
+	int index;                        /* index of the unit */
+	int level;                        /* indentation of the code */
+	int calls;                        /* the code uses 'rc' */
+	int readsa, readp;                /* the code reads 'sa', 'ps' and 'pl' */
+	int sa;                           /* standalone state or -1 if known at run */
+	int sasync;                       /* 'sa' holds the standalone state */
+	int pknown;                       /* the preceding text is known */
+	const struct mustach_token *ptok; /* tag of the known preceding text */
+	size_t plen;                      /* length of the known preceding text */
+	int psync;                        /* 'ps' and 'pl' hold the preceding text */
+};
+
+static void gentabs(struct gen *g)
+{
+	int i;
+
+	for (i = 0 ; i < g->level ; i++)
+		fputc('\t', g->out);
+}
+
+static void gencheck(struct gen *g)
+{
+	g->calls = 1;
+	gentabs(g);
+	fputs("if (rc < 0)\n", g->out);
+	gentabs(g);
+	fputs("\treturn rc;\n", g->out);
+}
+
+/* the arguments giving the text preceding the tag */
+static void genpref(struct gen *g)
+{
+	if (!g->pknown) {
+		g->readp = 1;
+		fputs("ps, pl", g->out);
+	}
+	else if (g->plen)
+		fprintf(g->out, "text_%d + %zu, %zu", g->index, (size_t)(g->ptok->text - g->tmpl->text), g->plen);
+	else
+		fputs("NULL, 0", g->out);
+}
+
+static void genemitpref(struct gen *g)
+{
+	gentabs(g);
+	fputs("rc = emitpref(run, ", g->out);
+	genpref(g);
+	fputs(");\n", g->out);
+	gencheck(g);
+}
+
+static void gensetsa(struct gen *g, int sa)
+{
+	if (g->sa != sa) {
+		g->sa = sa;
+		g->sasync = 0;
+	}
+}
+
+static void gensetpref(struct gen *g, const struct mustach_token *tok, size_t len)
+{
+	if (!g->pknown || len || g->plen)
+		g->psync = 0;
+	g->pknown = 1;
+	g->ptok = tok;
+	g->plen = len;
+}
+
+/* the state becomes known at run only */
+static void genunknown(struct gen *g)
+{
+	g->sa = -1;
+	g->sasync = 1;
+	g->pknown = 0;
+	g->psync = 1;
+}
+
+/* writes the known state in the variables */
+static void gensync(struct gen *g)
+{
+	if (g->sa >= 0 && !g->sasync) {
+		if (g->readsa) {
+			gentabs(g);
+			fprintf(g->out, "sa = %d;\n", g->sa);
+		}
+		g->sasync = 1;
+	}
+	if (g->pknown && !g->psync) {
+		if (g->readp) {
+			if (g->plen) {
+				gentabs(g);
+				fprintf(g->out, "ps = text_%d + %zu;\n", g->index, (size_t)(g->ptok->text - g->tmpl->text));
+			}
+			gentabs(g);
+			fprintf(g->out, "pl = %zu;\n", g->plen);
+		}
+		g->psync = 1;
+	}
+}
+
+/* text before the tag or the end of line, then the tag, as in process() */
+static void genprelude(struct gen *g, const struct mustach_token *tok, int enabled)
+{
+	int nonspace = tok->flags & Mustach_Token_NonSpace;
+
+	if (enabled && (tok->kind > Mustach_Token_Line || nonspace)) {
+		if (g->sa == 2) {
+			genemitpref(g);
+			gensetpref(g, g->ptok, 0);
+			gensetsa(g, 0);
+		}
+		else if (g->sa < 0) {
+			gensync(g);
+			g->readsa = 1;
+			gentabs(g);
+			fputs("if (sa == 2) {\n", g->out);
+			g->level++;
+			genemitpref(g);
+			if (g->readp) {
+				gentabs(g);
+				fputs("pl = 0;\n", g->out);
+			}
+			gentabs(g);
+			fputs("sa = 0;\n", g->out);
+			g->level--;
+			gentabs(g);
+			fputs("}\n", g->out);
+			genunknown(g);
+		}
+	}
+	if (nonspace)
+		gensetsa(g, 0);
+	if (tok->kind <= Mustach_Token_Line) {
+		if (enabled && tok->length) {
+			if (g->sa < 0) {
+				gensync(g);
+				g->readsa = 1;
+				gentabs(g);
+				fputs("if (sa != 2) {\n", g->out);
+				g->level++;
+			}
+			if (g->sa != 2) {
+				if (tok->length > (tok->kind == Mustach_Token_Line))
+					genemitpref(g);
+				gentabs(g);
+				fprintf(g->out, "rc = run->emit(run->closure, text_%d + %zu, %zu, 0, run->file);\n",
+					g->index, (size_t)(tok->text - g->tmpl->text), tok->length);
+				gencheck(g);
+			}
+			if (g->sa < 0) {
+				g->level--;
+				gentabs(g);
+				fputs("}\n", g->out);
+			}
+		}
+		gensetsa(g, 1);
+		gensetpref(g, tok, 0);
+		return;
+	}
+	gensetpref(g, tok, enabled ? tok->length : 0);
+	if (tok->kind >= Mustach_Token_Escaped)
+		gensetsa(g, 0);
+	if (g->sa > 0)
+		gensetsa(g, 2);
+	else if (g->sa < 0) {
+		gensync(g);
+		g->readsa = 1;
+		gentabs(g);
+		fputs("if (sa)\n", g->out);
+		gentabs(g);
+		fputs("\tsa = 2;\n", g->out);
+		if (enabled) {
+			gentabs(g);
+			fputs("else {\n", g->out);
+			g->level++;
+			genemitpref(g);
+			if (g->readp) {
+				gentabs(g);
+				fputs("pl = 0;\n", g->out);
+			}
+			g->level--;
+			gentabs(g);
+			fputs("}\n", g->out);
+			genunknown(g);
+		}
+	}
+	else if (enabled) {
+		genemitpref(g);
+		gensetpref(g, tok, 0);
+	}
+}
+
+static const struct mustach_token *genbody(struct gen *g, const struct mustach_token *tok, int enabled);
+
+/* the section opened by 'open', returns its closing token */
+static const struct mustach_token *gensection(struct gen *g, const struct mustach_token *open, int enabled)
+{
+	const struct mustach_token *close;
+	struct gen save;
+	FILE *out;
+	char *buffer;
+	size_t size;
+
+	if (!enabled)
+		return genbody(g, open + 1, 0);
+	gensync(g);
+	save = *g;
+	gentabs(g);
+	fputs("rc = run->enter(run->closure, ", g->out);
+	genstr(g->out, open->name, open->namelen);
+	fputs(");\n", g->out);
+	gencheck(g);
+	gentabs(g);
+	fputs("if (rc) {\n", g->out);
+	g->level++;
+	if (open->kind == Mustach_Token_Section) {
+		gentabs(g);
+		fputs("do {\n", g->out);
+		g->level++;
+		genunknown(g);
+		close = genbody(g, open + 1, 1);
+		gensync(g);
+		gentabs(g);
+		fputs("rc = run->next(run->closure);\n", g->out);
+		gencheck(g);
+		g->level--;
+		gentabs(g);
+		fputs("} while (rc);\n", g->out);
+	}
+	else {
+		close = genbody(g, open + 1, 0);
+		gensync(g);
+	}
+	gentabs(g);
+	fputs("run->leave(run->closure);\n", g->out);
+	g->level--;
+
+	/* the other case, omitted when empty */
+	save.calls = g->calls;
+	save.readsa = g->readsa;
+	save.readp = g->readp;
+	out = g->out;
+	*g = save;
+	g->out = open_memstream(&buffer, &size);
+	if (g->out == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	g->level++;
+	genbody(g, open + 1, open->kind == Mustach_Token_Inverted);
+	gensync(g);
+	g->level--;
+	fclose(g->out);
+	g->out = out;
+	gentabs(g);
+	if (size) {
+		fprintf(out, "} else {\n%s", buffer);
+		gentabs(g);
+	}
+	fputs("}\n", out);
+	free(buffer);
+	genunknown(g);
+	return close;
+}
+
+/* the tokens from 'tok' up to the closing of its section, returned */
+static const struct mustach_token *genbody(struct gen *g, const struct mustach_token *tok, int enabled)
+{
+	for (;; tok++) {
+		genprelude(g, tok, enabled);
+		switch (tok->kind) {
+		case Mustach_Token_End:
+		case Mustach_Token_Close:
+			return tok;
+		case Mustach_Token_Section:
+		case Mustach_Token_Inverted:
+			tok = gensection(g, tok, enabled);
+			break;
+		case Mustach_Token_Partial:
+			if (enabled) {
+				struct unit *p = getpartial(tok->name);
+				gentabs(g);
+				fputs("rc = mustach_run_partial(run, ", g->out);
+				genstr(g->out, tok->name, tok->namelen);
+				if (p) {
+					fputs(", &", g->out);
+					gensym(g->out, p);
+				}
+				else
+					fputs(", NULL", g->out);
+				fputs(", ", g->out);
+				genpref(g);
+				fputs(");\n", g->out);
+				gencheck(g);
+			}
+			break;
+		case Mustach_Token_Escaped:
+		case Mustach_Token_Raw:
+			if (enabled) {
+				gentabs(g);
+				fputs("rc = run->put(run->closure_put, ", g->out);
+				genstr(g->out, tok->name, tok->namelen);
+				fprintf(g->out, ", %d, run->file);\n", tok->kind == Mustach_Token_Escaped);
+				gencheck(g);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* the rendering of 'u' in 'out' */
+static void genrender(struct gen *g, struct unit *u, FILE *out)
+{
+	g->out = out;
+	g->tmpl = u->tmpl;
+	g->index = u->index;
+	g->level = 1;
+	g->sa = g->sasync = 1;
+	g->pknown = g->psync = 1;
+	g->ptok = NULL;
+	g->plen = 0;
+	genbody(g, u->tmpl->tokens, 1);
+}
+
+/* sections iterated again from their text aren't generated */
+static int relexed(const struct mustach_template *tmpl)
+{
+	const struct mustach_token *tok;
+
+	for (tok = tmpl->tokens ; tok->kind != Mustach_Token_End ; tok++)
+		if (tok->kind == Mustach_Token_Close && (tok->flags & Mustach_Token_Relex))
+			return 1;
+	return 0;
+}
+
+static void addunits(char **files)
+{
+	const struct mustach_token *tok;
+	struct unit *u;
+	char *t;
+	size_t length;
+	struct mustach_sbuf file;
+
+	for ( ; *files ; files++) {
+		t = loadfile(*files, &length, &file);
+		addunit(NULL, *files, t, length, &file);
+	}
+	for (u = units ; u ; u = u->next)
+		for (tok = u->tmpl->tokens ; tok->kind != Mustach_Token_End ; tok++)
+			if (tok->kind == Mustach_Token_Partial)
+				getpartial(tok->name);
+}
+
+static void genextern(void)
+{
+	struct unit *u;
+
+	for (u = units ; u ; u = u->next)
+		if (!u->name) {
+			fputs("extern const struct mustach_template ", stdout);
+			gensym(stdout, u);
+			fputs(";\n", stdout);
+		}
+}
+
+static void genheader(char **files)
+{
+	addunits(files);
+	fputs("/* generated by mustach, do not edit */\n\n#ifndef MUSTACH_GENERATED", stdout);
+	if (units) {
+		putchar('_');
+		genident(stdout, units->path, 1);
+	}
+	fputs("_H\n#define MUSTACH_GENERATED", stdout);
+	if (units) {
+		putchar('_');
+		genident(stdout, units->path, 1);
+	}
+	fputs("_H\n\n#include \"mustach.h\"\n\n", stdout);
+	genextern();
+	fputs("\n#endif\n", stdout);
+}
+
+static void generate(char **files)
+{
+	static const char *kinds[] = {
+		"Mustach_Token_End", "Mustach_Token_Line", "Mustach_Token_Comment",
+		"Mustach_Token_Delim", "Mustach_Token_Section", "Mustach_Token_Inverted",
+		"Mustach_Token_Close", "Mustach_Token_Partial", "Mustach_Token_Escaped",
+		"Mustach_Token_Raw"
+	};
+	static const char *tokflags[] = {
+		"0", "Mustach_Token_NonSpace", "Mustach_Token_Relex",
+		"Mustach_Token_NonSpace|Mustach_Token_Relex"
+	};
+	const struct mustach_token *tok;
+	struct unit *u, *p;
+	struct gen g;
+	FILE *out;
+	char *buffer;
+	size_t size;
+
+	addunits(files);
+	printf("/* generated by mustach, do not edit */\n\n#include <stdio.h>\n#include \"mustach.h\"\n\n");
+	genextern();
+	for (u = units ; u ; u = u->next)
+		if (u->name)
+			printf("static const struct mustach_template partial_%d;\n", u->index);
+	printf("\n/* emits the prefix of the including partials and the text preceding a tag */\n"
+		"static inline int emitpref(const struct mustach_run *run, const char *text, size_t length)\n"
+		"{\n"
+		"\tint rc = run->prefix ? run->emit(run->closure, run->prefix, run->prefixlen, 0, run->file) : 0;\n"
+		"\treturn rc < 0 || !length ? rc : run->emit(run->closure, text, length, 0, run->file);\n"
+		"}\n");
+	for (u = units ; u ; u = u->next) {
+		printf("\n/* %s */\nstatic const char text_%d[] =\n\t", u->path, u->index);
+		genstr(stdout, u->text, u->tmpl->length);
+		printf(";\n\nstatic const struct mustach_token tokens_%d[] = {\n", u->index);
+		tok = u->tmpl->tokens;
+		do {
+			printf("\t{ &text_%d[%zu], %zu, ", u->index, (size_t)(tok->text - u->tmpl->text), tok->length);
+			if (tok->name) {
+				genstr(stdout, tok->name, tok->namelen);
+				printf(", %zu, ", tok->namelen);
+			}
+			else
+				printf("NULL, 0, ");
+			if (tok->kind == Mustach_Token_Partial && (p = getpartial(tok->name)) != NULL) {
+				putchar('&');
+				gensym(stdout, p);
+			}
+			else
+				printf("NULL");
+			printf(", %u, %s, %s },\n", tok->line, kinds[tok->kind], tokflags[tok->flags & 3]);
+		} while (tok++->kind != Mustach_Token_End);
+		printf("};\n");
+		if (relexed(u->tmpl))
+			printf("\n/* the delimiters change in a section, its tokens are rendered */\n");
+		else {
+			/* first pass for knowing the variables used */
+			memset(&g, 0, sizeof g);
+			out = open_memstream(&buffer, &size);
+			if (out == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+			genrender(&g, u, out);
+			fclose(out);
+			free(buffer);
+			printf("\nstatic int render_%d(const struct mustach_run *run)\n{\n", u->index);
+			if (g.calls)
+				printf("\tint rc;\n");
+			if (g.readsa)
+				printf("\tint sa = 1;\n");
+			if (g.readp)
+				printf("\tconst char *ps = NULL;\n\tsize_t pl = 0;\n");
+			if (g.calls || g.readsa || g.readp)
+				putchar('\n');
+			else
+				printf("\t(void)run;\n");
+			genrender(&g, u, stdout);
+			printf("\treturn MUSTACH_OK;\n}\n");
+		}
+		printf("\n%sconst struct mustach_template ", u->name ? "static " : "");
+		gensym(stdout, u);
+		printf(" = { text_%d, %zu, tokens_%d, ", u->index, u->tmpl->length, u->index);
+		if (relexed(u->tmpl))
+			printf("NULL };\n");
+		else
+			printf("render_%d };\n", u->index);
+	}
+}
+
+/*
+ * Rendering server: the templates and their partials are loaded and
+ * compiled once, the partials being bound to the compiled templates.
+ * Requests are received on a unix socket, each by a connection:
+ *
+ *  - the client sends the name of the template as given to --serve, a
+ *    new line, the JSON data, and then shuts down its writing side;
+ *  - the server answers a status line, 0 or a negative error code
+ *    followed by its message, and, when the status is 0, the output.
+ *
+ * The connections are accepted and processed by a pool of threads.
+ *
+ * The templates and their partials are recorded in a registry whose
+ * lookups don't lock: the renderings never wait for each other.
+ *
+ * With --watch, the directories of the templates and of the partials are
+ * watched and the modified files are compiled again and swapped in the
+ * registry, the replaced templates being released after the end of the
+ * renderings using them.
+ */
+
+static int render_data(const struct mustach_template *tmpl, const char *text, size_t length, char **result, size_t *size);
+
+static int listenfd;
+static const char *sockpath;
+static struct mustach_registry *registry;
+
+static int writeall(int fd, const char *buffer, size_t size)
+{
+	ssize_t rc;
+
+	while (size) {
+		rc = write(fd, buffer, size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buffer += rc;
+		size -= (size_t)rc;
+	}
+	return 0;
+}
+
+static char *readall(int fd, size_t *length)
+{
+	char *buffer, *b;
 	size_t size, pos;
 	ssize_t rc;
 
-	result = NULL;
-	if (filename[0] == '-' &&  filename[1] == 0)
-		f = dup(0);
-	else
-		f = open(filename, O_RDONLY);
-	if (f < 0) {
-		fprintf(stderr, "Can't open file: %s\n", filename);
+	pos = 0;
+	size = BLOCKSIZE;
+	buffer = malloc(size);
+	while (buffer != NULL) {
+		rc = read(fd, &buffer[pos], size - pos);
+		if (rc <= 0) {
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc == 0) {
+				/* pos < size, terminate with zero */
+				buffer[pos] = 0;
+				*length = pos;
+				return buffer;
+			}
+			break;
+		}
+		pos += (size_t)rc;
+		if (pos == size) {
+			size <<= 1;
+			b = realloc(buffer, size);
+			if (b == NULL)
+				break;
+			buffer = b;
+		}
+	}
+	free(buffer);
+	return NULL;
+}
+
+static void reply(int fd, int status, const char *output, size_t size)
+{
+	char line[80];
+	int s;
+
+	if (status == MUSTACH_OK)
+		snprintf(line, sizeof line, "0\n");
+	else if (status == TOOL_ERROR_DATA)
+		snprintf(line, sizeof line, "%d invalid data\n", status);
+	else {
+		s = -status;
+		if (s < 1 || s >= (int)(sizeof errors / sizeof * errors))
+			s = 0;
+		snprintf(line, sizeof line, "%d %s\n", status, errors[s]);
+	}
+	if (writeall(fd, line, strlen(line)) == 0 && status == MUSTACH_OK)
+		writeall(fd, output, size);
+}
+
+static void request(int fd)
+{
+	const struct mustach_template *tmpl;
+	char *text, *eol, *output;
+	size_t length, size = 0;
+	int rc, section;
+
+	text = readall(fd, &length);
+	if (text == NULL)
+		return;
+	eol = memchr(text, '\n', length);
+	if (eol == NULL)
+		reply(fd, MUSTACH_ERROR_ITEM_NOT_FOUND, NULL, 0);
+	else {
+		*eol++ = 0;
+		output = NULL;
+		section = mustach_registry_enter(registry);
+		tmpl = mustach_registry_get(registry, text);
+		rc = tmpl == NULL ? MUSTACH_ERROR_ITEM_NOT_FOUND
+			: render_data(tmpl, eol, length - (size_t)(eol - text), &output, &size);
+		mustach_registry_leave(registry, section);
+		reply(fd, rc, output, size);
+		free(output);
+	}
+	free(text);
+}
+
+static void *worker(void *arg)
+{
+	int fd;
+
+	(void)arg; /* unused */
+	for (;;) {
+		fd = accept(listenfd, NULL, NULL);
+		if (fd >= 0) {
+			request(fd);
+			close(fd);
+		}
+		else if (errno != EINTR && errno != ECONNABORTED) {
+			fprintf(stderr, "Can't accept: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+static int inotifd;
+
+/* compiles again the modified template and swaps it in */
+static void reload(struct unit *u)
+{
+	char *text;
+	size_t length;
+	int fd, rc;
+
+	fd = open(u->path, O_RDONLY);
+	if (fd < 0)
+		return;
+	text = readall(fd, &length);
+	close(fd);
+	if (text == NULL)
+		return;
+	rc = mustach_registry_set(registry, u->name ? u->name : u->path, text, length, flags);
+	if (rc < 0) {
+		rc = -rc;
+		if (rc < 1 || rc >= (int)(sizeof errors / sizeof * errors))
+			rc = 0;
+		fprintf(stderr, "Template error %s (file %s), not reloaded\n", errors[rc], u->path);
+	}
+	free(text);
+}
+
+static void *watcher(void *arg)
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	struct unit *u;
+	const char *base;
+	ssize_t len;
+	char *p;
+
+	(void)arg; /* unused */
+	for (;;) {
+		len = read(inotifd, buffer, sizeof buffer);
+		if (len <= 0) {
+			if (len < 0 && errno == EINTR)
+				continue;
+			fprintf(stderr, "Can't watch templates: %s\n", strerror(errno));
+			return NULL;
+		}
+		for (p = buffer ; p < buffer + len ; p += sizeof *event + event->len) {
+			event = (const struct inotify_event*)p;
+			if (event->len)
+				for (u = units ; u ; u = u->next) {
+					base = strrchr(u->path, '/');
+					base = base ? base + 1 : u->path;
+					if (u->wd == event->wd && !strcmp(base, event->name))
+						reload(u);
+				}
+		}
+	}
+}
+
+/* watch the directories of the templates, their files can be replaced */
+static void startwatch()
+{
+	struct unit *u;
+	pthread_t tid;
+	char *dir;
+
+	inotifd = inotify_init1(IN_CLOEXEC);
+	if (inotifd < 0) {
+		fprintf(stderr, "Can't watch templates: %s\n", strerror(errno));
 		exit(1);
 	}
+	for (u = units ; u ; u = u->next) {
+		dir = strdup(u->path);
+		if (dir == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		u->wd = inotify_add_watch(inotifd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO);
+		free(dir);
+		if (u->wd < 0) {
+			fprintf(stderr, "Can't watch %s: %s\n", u->path, strerror(errno));
+			exit(1);
+		}
+	}
+	if (pthread_create(&tid, NULL, watcher, NULL) != 0) {
+		fprintf(stderr, "Can't create thread\n");
+		exit(1);
+	}
+}
+#else
+static void startwatch()
+{
+	fprintf(stderr, "Watching templates is not supported\n");
+	exit(1);
+}
+#endif
+
+static void terminate(int signum)
+{
+	(void)signum; /* unused */
+	unlink(sockpath);
+	_exit(0);
+}
+
+static int unixaddr(const char *path, struct sockaddr_un *addr)
+{
+	if (path == NULL || strlen(path) >= sizeof addr->sun_path) {
+		fprintf(stderr, "Bad socket path: %s\n", path ? path : "(missing)");
+		exit(1);
+	}
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return socket(AF_UNIX, SOCK_STREAM, 0);
+}
 
-	fstat(f, &s);
-	switch (s.st_mode & S_IFMT) {
-	case S_IFREG:
-		size = s.st_size;
-		break;
-	case S_IFSOCK:
-	case S_IFIFO:
-		size = BLOCKSIZE;
-		break;
-	default:
-		fprintf(stderr, "Bad file: %s\n", filename);
+static void serve(char **args)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	const struct mustach_token *tok;
+	struct unit *u;
+	pthread_t tid;
+	char *t;
+	size_t length;
+	struct mustach_sbuf file;
+	int i;
+
+	sockpath = *args++;
+	if (*args == NULL) {
+		fprintf(stderr, "Missing templates for option --serve\n");
 		exit(1);
 	}
 
-	pos = 0;
-	result = malloc(size + 1);
-	do {
-		if (result == NULL) {
+	/* load the templates and their partials */
+	for ( ; *args ; args++) {
+		t = loadfile(*args, &length, &file);
+		addunit(NULL, *args, t, length, &file);
+	}
+	for (u = units ; u ; u = u->next)
+		for (tok = u->tmpl->tokens ; tok->kind != Mustach_Token_End ; tok++)
+			if (tok->kind == Mustach_Token_Partial)
+				getpartial(tok->name);
+
+	/* record them in the registry that resolves the partials */
+	registry = mustach_registry_create();
+	if (registry == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (u = units ; u ; u = u->next) {
+		if (mustach_registry_set(registry, u->name ? u->name : u->path, u->text, u->tmpl->length, flags) < 0) {
 			fprintf(stderr, "Out of memory\n");
 			exit(1);
 		}
-		rc = read(f, &result[pos], (size - pos) + 1);
-		if (rc < 0) {
-			fprintf(stderr, "Error while reading %s\n", filename);
+		mustach_template_free(u->tmpl);
+		mustach_wrap_unload_file(&u->file);
+		u->tmpl = NULL;
+		u->text = NULL;
+	}
+	mustach_wrap_registry = registry;
+	if (watch)
+		startwatch();
+
+	/* listen, replacing a previous socket */
+	listenfd = unixaddr(sockpath, &addr);
+	if (lstat(sockpath, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(sockpath);
+	if (listenfd < 0
+	 || bind(listenfd, (struct sockaddr*)&addr, sizeof addr) < 0
+	 || listen(listenfd, SOMAXCONN) < 0) {
+		fprintf(stderr, "Can't listen on %s: %s\n", sockpath, strerror(errno));
+		exit(1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, terminate);
+	signal(SIGTERM, terminate);
+
+	for (i = 1 ; i < nthreads ; i++)
+		if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+			fprintf(stderr, "Can't create thread\n");
 			exit(1);
 		}
-		if (rc > 0) {
-			pos += (size_t)rc;
-			if (pos > size) {
-				size = pos + BLOCKSIZE;
-				result = realloc(result, size + 1);
-			}
+	worker(NULL);
+}
+
+/* the partials of the template are read by the threads in the registry */
+static int prefetch_partials(const char *text, size_t length)
+{
+	if (registry == NULL) {
+		registry = mustach_registry_create();
+		if (registry == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
 		}
-	} while(rc > 0);
+		mustach_wrap_registry = registry;
+	}
+	return mustach_registry_prefetch(registry, text, length, flags, nthreads);
+}
+
+static int client(char **args)
+{
+	struct sockaddr_un addr;
+	char *text, line[80];
+	size_t length, pos;
+	struct mustach_sbuf file;
+	ssize_t rc;
+	int fd, status;
+
+	fd = unixaddr(args[0], &addr);
+	if (args[1] == NULL) {
+		fprintf(stderr, "Missing template for option --client\n");
+		exit(1);
+	}
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof addr) < 0) {
+		fprintf(stderr, "Can't connect to %s: %s\n", args[0], strerror(errno));
+		exit(1);
+	}
+
+	/* send the request */
+	text = loadfile(args[2] ? args[2] : "-", &length, &file);
+	if (writeall(fd, args[1], strlen(args[1])) < 0
+	 || writeall(fd, "\n", 1) < 0
+	 || writeall(fd, text, length) < 0
+	 || shutdown(fd, SHUT_WR) < 0) {
+		fprintf(stderr, "Can't send request: %s\n", strerror(errno));
+		exit(1);
+	}
+	mustach_wrap_unload_file(&file);
 
-	close(f);
-	if (length != NULL)
-		*length = pos;
-	result[pos] = 0;
-	return result;
+	/* receive the status line then the output */
+	pos = 0;
+	while (pos == 0 || (line[pos - 1] != '\n' && pos < sizeof line - 1)) {
+		rc = read(fd, &line[pos], 1);
+		if (rc <= 0) {
+			fprintf(stderr, "No reply from %s\n", args[0]);
+			exit(1);
+		}
+		pos++;
+	}
+	line[pos] = 0;
+	status = atoi(line);
+	if (status != MUSTACH_OK) {
+		fprintf(stderr, "Render error %s", strchr(line, ' ') ? strchr(line, ' ') + 1 : line);
+		close(fd);
+		return 1;
+	}
+	text = malloc(BLOCKSIZE);
+	if (text == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	while ((rc = read(fd, text, BLOCKSIZE)) > 0)
+		fwrite(text, 1, (size_t)rc, stdout);
+	free(text);
+	close(fd);
+	return 0;
 }
 
 static int load_json(const char *filename);
 static int process(const char *content, size_t length);
 static void close_json();
+#if TOOL == MUSTACH_TOOL_TAPE
+static int write_snapshot(const char *filename);
+#endif
+static int load_csv(const char *filename);
+static int process_csv(const char *content, size_t length);
+static void close_csv();
 
 int main(int ac, char **av)
 {
@@ -134,6 +1215,7 @@ int main(int ac, char **av)
 	char *prog = *av;
 	int s;
 	size_t length;
+	struct mustach_sbuf file;
 
 	(void)ac; /* unused */
 	flags = Mustach_With_AllExtensions;
@@ -144,20 +1226,95 @@ int main(int ac, char **av)
 			help(prog);
 		if (!strcmp(*av, "-s") || !strcmp(*av, "--strict"))
 			flags |= Mustach_With_ErrorUndefined;
+		if (!strcmp(*av, "-m") || !strcmp(*av, "--map")) {
+			if (!*++av) {
+				fprintf(stderr, "Missing file for option %s\n", av[-1]);
+				exit(1);
+			}
+			map = fopen(*av, "w");
+			if (map == NULL) {
+				fprintf(stderr, "Can't open file: %s\n", *av);
+				exit(1);
+			}
+			mustach_wrap_srcpos = srcposmap;
+		}
+#if TOOL == MUSTACH_TOOL_TAPE
+		if (!strcmp(*av, "-S") || !strcmp(*av, "--stream")) {
+			if (!*++av) {
+				fprintf(stderr, "Missing path for option %s\n", av[-1]);
+				exit(1);
+			}
+			stream = *av;
+		}
+		if (!strcmp(*av, "-w") || !strcmp(*av, "--snapshot")) {
+			if (!*++av) {
+				fprintf(stderr, "Missing file for option %s\n", av[-1]);
+				exit(1);
+			}
+			snapshot = *av;
+		}
+#endif
+		if (!strcmp(*av, "-c") || !strcmp(*av, "--csv")) {
+			csvsep = ',';
+			csvquote = '"';
+		}
+		if (!strcmp(*av, "-t") || !strcmp(*av, "--tsv")) {
+			csvsep = '\t';
+			csvquote = 0;
+		}
+		if (!strcmp(*av, "-r") || !strcmp(*av, "--rows"))
+			csvrows = 1;
+		if (!strcmp(*av, "-g") || !strcmp(*av, "--generate")) {
+			generate(++av);
+			return 0;
+		}
+		if (!strcmp(*av, "--header")) {
+			genheader(++av);
+			return 0;
+		}
+		if (!strcmp(*av, "-j") || !strcmp(*av, "--threads")) {
+			if (!*++av || (nthreads = atoi(*av)) < 1) {
+				fprintf(stderr, "Bad count of threads for option %s\n", av[-1]);
+				exit(1);
+			}
+		}
+		if (!strcmp(*av, "-W") || !strcmp(*av, "--watch"))
+			watch = 1;
+		if (!strcmp(*av, "-P") || !strcmp(*av, "--prefetch"))
+			prefetch = 1;
+#if TOOL != MUSTACH_TOOL_CBOR
+		if (!strcmp(*av, "--specialize"))
+			specialize = 1;
+#endif
+		if (!strcmp(*av, "--serve")) {
+			serve(++av);
+			return 0;
+		}
+		if (!strcmp(*av, "--client"))
+			return client(++av);
 	}
 	if (*av) {
 		f = (av[0][0] == '-' && !av[0][1]) ? "/dev/stdin" : av[0];
-		s = load_json(f);
+		s = csvsep ? load_csv(f) : load_json(f);
 		if (s < 0) {
 			fprintf(stderr, "Can't load json file %s\n", av[0]);
 			if(errmsg)
 				fprintf(stderr, "   reason: %s\n", errmsg);
 			exit(1);
 		}
+#if TOOL == MUSTACH_TOOL_TAPE
+		if (snapshot != NULL && write_snapshot(snapshot) < 0) {
+			fprintf(stderr, "Can't write snapshot file %s\n", snapshot);
+			exit(1);
+		}
+#endif
 		while(*++av) {
-			t = readfile(*av, &length);
-			s = process(t, length);
-			free(t);
+			t = loadfile(*av, &length, &file);
+			mapname = *av;
+			s = prefetch ? prefetch_partials(t, length) : MUSTACH_OK;
+			if (s >= 0)
+				s = csvsep ? process_csv(t, length) : process(t, length);
+			mustach_wrap_unload_file(&file);
 			if (s != MUSTACH_OK) {
 				s = -s;
 				if (s < 1 || s >= (int)(sizeof errors / sizeof * errors))
@@ -165,36 +1322,146 @@ int main(int ac, char **av)
 				fprintf(stderr, "Template error %s (file %s)\n", errors[s], *av);
 			}
 		}
-		close_json();
+		if (csvsep)
+			close_csv();
+		else
+			close_json();
 	}
+	if (map)
+		fclose(map);
+	mustach_registry_destroy(registry);
 	return 0;
 }
 
-#define MUSTACH_TOOL_JSON_C  1
-#define MUSTACH_TOOL_JANSSON 2
-#define MUSTACH_TOOL_CJSON   3
+/* CSV and TSV, the mapped text is read in place and its rows are streamed */
+
+#include "mustach-csv.h"
+
+static struct mustach_sbuf csvfile;
+static struct mustach_csv *csv;
+
+static int load_csv(const char *filename)
+{
+	static char reason[64];
+	size_t length, errpos;
+
+	loadfile(filename, &length, &csvfile);
+	sequential(&csvfile);
+	csv = mustach_csv_open(csvfile.value, length, csvsep, csvquote, &errpos);
+	if (csv == NULL && errno == EINVAL) {
+		snprintf(reason, sizeof reason, "invalid cell at offset %zu", errpos);
+		errmsg = reason;
+	}
+	return -!csv;
+}
+static int render_csv(const struct mustach_template *tmpl)
+{
+	if (map)
+		return mustach_csv_compiled_write(tmpl, csv, flags, writemap, output);
+	return mustach_csv_compiled_file(tmpl, csv, flags, output);
+}
+static int process_csv(const char *content, size_t length)
+{
+	struct mustach_template *tmpl;
+	int s;
+
+	/* compiled once for all the rows */
+	s = mustach_compile(content, length, flags, &tmpl);
+	if (s != MUSTACH_OK)
+		return s;
+	if (!csvrows)
+		s = render_csv(tmpl);
+	else {
+		while (s == MUSTACH_OK && mustach_csv_next(csv))
+			s = render_csv(tmpl);
+		mustach_csv_rewind(csv);
+	}
+	mustach_template_free(tmpl);
+	return s;
+}
+static void close_csv()
+{
+	mustach_csv_close(csv);
+	mustach_wrap_unload_file(&csvfile);
+}
 
 #if TOOL == MUSTACH_TOOL_JSON_C
 
 #include "mustach-json-c.h"
 
+#include <limits.h>
+
 static struct json_object *o;
-static int load_json(const char *filename)
+static struct json_object *parse_json(const char *text, size_t length, const char **error)
 {
-	o = json_object_from_file(filename);
-#if JSON_C_VERSION_NUM >= 0x000D00
-	errmsg = json_util_get_last_err();
-	if (errmsg != NULL)
-		return -1;
-#endif
-	if (o == NULL) {
-		errmsg = "null json";
-		return -1;
+	struct json_tokener *tok;
+	enum json_tokener_error err;
+	struct json_object *obj;
+	size_t pos, len;
+
+	tok = json_tokener_new();
+	if (tok == NULL) {
+		*error = "out of memory";
+		return NULL;
 	}
-	return 0;
+	/* the text is parsed by chunks as json-c counts with int */
+	pos = 0;
+	do {
+		len = length - pos > INT_MAX ? INT_MAX : length - pos;
+		obj = json_tokener_parse_ex(tok, &text[pos], (int)len);
+		err = json_tokener_get_error(tok);
+		pos += len;
+	} while (err == json_tokener_continue && pos < length);
+	if (err == json_tokener_continue) {
+		/* the end of text terminates a number at top level */
+		obj = json_tokener_parse_ex(tok, "", 1);
+		err = json_tokener_get_error(tok);
+	}
+	json_tokener_free(tok);
+	if (err != json_tokener_success) {
+		*error = json_tokener_error_desc(err);
+		return NULL;
+	}
+	if (obj == NULL)
+		*error = "null json";
+	return obj;
+}
+static int load_json(const char *filename)
+{
+	char *text;
+	size_t length;
+	struct mustach_sbuf file;
+
+	text = loadfile(filename, &length, &file);
+	o = parse_json(text, length, &errmsg);
+	mustach_wrap_unload_file(&file);
+	return -!o;
+}
+static int render_data(const struct mustach_template *tmpl, const char *text, size_t length, char **result, size_t *size)
+{
+	const char *error;
+	struct json_object *data;
+	int rc;
+
+	data = parse_json(text, length, &error);
+	if (data == NULL)
+		return TOOL_ERROR_DATA;
+	rc = mustach_json_c_compiled_mem(tmpl, data, flags, result, size);
+	json_object_put(data);
+	return rc;
 }
 static int process(const char *content, size_t length)
 {
+	char *result;
+	size_t size;
+	int rc;
+
+	if (specialize) {
+		rc = mustach_json_c_specialize(content, length, o, flags, &result, &size);
+		return writespecialized(rc, result, size);
+	}
+	if (map)
+		return mustach_json_c_write(content, length, o, flags, writemap, output);
 	return mustach_json_c_file(content, length, o, flags, output);
 }
 static void close_json()
@@ -210,7 +1477,13 @@ static json_t *o;
 static json_error_t e;
 static int load_json(const char *filename)
 {
-	o = json_load_file(filename, JSON_DECODE_ANY, &e);
+	char *text;
+	size_t length;
+	struct mustach_sbuf file;
+
+	text = loadfile(filename, &length, &file);
+	o = json_loadb(text, length, JSON_DECODE_ANY, &e);
+	mustach_wrap_unload_file(&file);
 	if (o == NULL) {
 		errmsg = e.text;
 		return -1;
@@ -219,8 +1492,31 @@ static int load_json(const char *filename)
 }
 static int process(const char *content, size_t length)
 {
+	char *result;
+	size_t size;
+	int rc;
+
+	if (specialize) {
+		rc = mustach_jansson_specialize(content, length, o, flags, &result, &size);
+		return writespecialized(rc, result, size);
+	}
+	if (map)
+		return mustach_jansson_write(content, length, o, flags, writemap, output);
 	return mustach_jansson_file(content, length, o, flags, output);
 }
+static int render_data(const struct mustach_template *tmpl, const char *text, size_t length, char **result, size_t *size)
+{
+	json_error_t error;
+	json_t *data;
+	int rc;
+
+	data = json_loadb(text, length, JSON_DECODE_ANY, &error);
+	if (data == NULL)
+		return TOOL_ERROR_DATA;
+	rc = mustach_jansson_compiled_mem(tmpl, data, flags, result, size);
+	json_decref(data);
+	return rc;
+}
 static void close_json()
 {
 	json_decref(o);
@@ -235,21 +1531,155 @@ static int load_json(const char *filename)
 {
 	char *t;
 	size_t length;
+	struct mustach_sbuf file;
 
-	t = readfile(filename, &length);
-	o = t ? cJSON_ParseWithLength(t, length) : NULL;
-	free(t);
+	t = loadfile(filename, &length, &file);
+	o = cJSON_ParseWithLength(t, length);
+	mustach_wrap_unload_file(&file);
 	return -!o;
 }
 static int process(const char *content, size_t length)
 {
+	char *result;
+	size_t size;
+	int rc;
+
+	if (specialize) {
+		rc = mustach_cJSON_specialize(content, length, o, flags, &result, &size);
+		return writespecialized(rc, result, size);
+	}
+	if (map)
+		return mustach_cJSON_write(content, length, o, flags, writemap, output);
 	return mustach_cJSON_file(content, length, o, flags, output);
 }
+static int render_data(const struct mustach_template *tmpl, const char *text, size_t length, char **result, size_t *size)
+{
+	cJSON *data;
+	int rc;
+
+	data = cJSON_ParseWithLength(text, length);
+	if (data == NULL)
+		return TOOL_ERROR_DATA;
+	rc = mustach_cJSON_compiled_mem(tmpl, data, flags, result, size);
+	cJSON_Delete(data);
+	return rc;
+}
 static void close_json()
 {
 	cJSON_Delete(o);
 }
 
+#elif TOOL == MUSTACH_TOOL_TAPE
+
+#include <errno.h>
+#include "mustach-tape.h"
+
+static char *text;
+static struct mustach_sbuf file;
+static struct mustach_tape *o;
+
+static int load_json(const char *filename)
+{
+	size_t length;
+
+	text = loadfile(filename, &length, &file);
+	if (stream == NULL) {
+		/* snapshots are used in place */
+		o = mustach_tape_map(text, length);
+		if (o == NULL)
+			o = mustach_tape_parse(text, length, NULL);
+	} else {
+		sequential(&file);
+		o = mustach_tape_parse_stream(text, length, stream, NULL);
+		if (o == NULL && errno == ENOENT)
+			errmsg = "array to stream not found";
+	}
+	return -!o;
+}
+static int write_snapshot(const char *filename)
+{
+	void *snap;
+	size_t size;
+	FILE *file;
+	int rc;
+
+	snap = mustach_tape_snapshot(o, &size);
+	if (snap == NULL)
+		return -1;
+	file = fopen(filename, "w");
+	rc = file == NULL || fwrite(snap, size, 1, file) != 1;
+	if (file != NULL && fclose(file) != 0)
+		rc = 1;
+	free(snap);
+	return -rc;
+}
+static int process(const char *content, size_t length)
+{
+	char *result;
+	size_t size;
+	int rc;
+
+	if (specialize) {
+		rc = mustach_tape_specialize(content, length, o, flags, &result, &size);
+		return writespecialized(rc, result, size);
+	}
+	if (map)
+		return mustach_tape_write(content, length, o, flags, writemap, output);
+	return mustach_tape_file(content, length, o, flags, output);
+}
+static int render_data(const struct mustach_template *tmpl, const char *text, size_t length, char **result, size_t *size)
+{
+	struct mustach_tape *data;
+	int rc;
+
+	data = mustach_tape_parse(text, length, NULL);
+	if (data == NULL)
+		return TOOL_ERROR_DATA;
+	rc = mustach_tape_compiled_mem(tmpl, data, flags, result, size);
+	mustach_tape_free(data);
+	return rc;
+}
+static void close_json()
+{
+	mustach_tape_free(o);
+	mustach_wrap_unload_file(&file);
+}
+
+#elif TOOL == MUSTACH_TOOL_CBOR
+
+#include "mustach-cbor.h"
+
+static char *data;
+static size_t size;
+static struct mustach_sbuf file;
+
+static int load_json(const char *filename)
+{
+	data = loadfile(filename, &size, &file);
+	if (mustach_cbor_check(data, size) < 0) {
+		errmsg = "invalid CBOR data";
+		return -1;
+	}
+	return 0;
+}
+static int process(const char *content, size_t length)
+{
+	/* the data were checked when loaded */
+	if (map)
+		return mustach_cbor_write(content, length, data, size, flags | Mustach_With_Checked, writemap, output);
+	return mustach_cbor_file(content, length, data, size, flags | Mustach_With_Checked, output);
+}
+static int render_data(const struct mustach_template *tmpl, const char *text, size_t length, char **result, size_t *rsize)
+{
+	if (mustach_cbor_check(text, length) < 0)
+		return TOOL_ERROR_DATA;
+	return mustach_cbor_compiled_mem(tmpl, text, length, flags | Mustach_With_Checked, result, rsize);
+}
+static void close_json()
+{
+	mustach_wrap_unload_file(&file);
+}
+
 #else
 #error "no defined json library"
 #endif
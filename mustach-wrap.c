@@ -11,9 +11,29 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #ifdef _WIN32
 #include <malloc.h>
 #endif
+#if !defined(_WIN32) && !defined(NO_MMAP)
+#define USE_MMAP
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if !defined(__GNUC__) && !defined(NO_REGISTRY)
+#define NO_REGISTRY /* the registry uses the atomic builtins of GCC */
+#endif
+#if !defined(NO_REGISTRY)
+#ifdef _WIN32
+#include <windows.h>
+#define registry_yield() SwitchToThread()
+#else
+#include <sched.h>
+#define registry_yield() sched_yield()
+#endif
+#include <pthread.h>
+#endif
 
 #include "mustach.h"
 #include "mustach-wrap.h"
@@ -25,6 +45,14 @@
 /* global hook for partials */
 int (*mustach_wrap_get_partial)(const char *name, struct mustach_sbuf *sbuf) = NULL;
 
+/* global hook for source positions */
+int (*mustach_wrap_srcpos)(const struct mustach_srcpos *pos, void *closure) = NULL;
+
+#if !defined(NO_REGISTRY)
+/* global registry for partials */
+struct mustach_registry *mustach_wrap_registry = NULL;
+#endif
+
 /* internal structure for wrapping */
 struct wrap {
 	/* original interface */
@@ -41,6 +69,14 @@ struct wrap {
 
 	/* write callback */
 	mustach_write_cb_t *writecb;
+
+#if !defined(NO_REGISTRY)
+	/* registry whose read section is entered for the partials */
+	struct mustach_registry *registry;
+
+	/* the entered read section */
+	int section;
+#endif
 };
 
 /* length given by masking with 3 */
@@ -60,6 +96,19 @@ enum sel {
 	S_ok_or_objiter = S_ok | S_objiter
 };
 
+/*
+ * Calls the callback 'cb' of the wrapped interface. An amalgamated build
+ * defines MUSTACH_WRAP_BOUND(cb) as the function of its backend for 'cb':
+ * the call is then direct when the wrapped interface is the one of that
+ * backend, what allows the compiler to inline it.
+ */
+#if defined(MUSTACH_WRAP_BOUND)
+#define WCALL(w,cb,...) ((w)->itf->cb == MUSTACH_WRAP_BOUND(cb) \
+		? MUSTACH_WRAP_BOUND(cb)(__VA_ARGS__) : (w)->itf->cb(__VA_ARGS__))
+#else
+#define WCALL(w,cb,...) ((w)->itf->cb(__VA_ARGS__))
+#endif
+
 static enum comp getcomp(char *head, int sflags)
 {
 	return (head[0] == '=' && (sflags & Mustach_With_Equal)) ? C_eq
@@ -134,13 +183,20 @@ static char *getkey(char **head, int sflags)
 	return result;
 }
 
-static enum sel sel(struct wrap *w, const char *name)
+/*
+ * Selects the item of 'name'. When 'found' isn't NULL, it receives 1 when
+ * the first key of the name is selected, even if the item is not.
+ */
+static enum sel wrap_select(struct wrap *w, const char *name, int *found)
 {
 	enum sel result;
 	int i, j, sflags, scmp;
 	char *key, *value;
 	enum comp k;
 
+	if (found)
+		*found = 0;
+
 	/* make a local writeable copy */
 	size_t lenname = 1 + strlen(name);
 	char buffer[lenname];
@@ -167,7 +223,11 @@ static enum sel sel(struct wrap *w, const char *name)
 	/* case of . alone if Mustach_With_SingleDot? */
 	if (copy[0] == '.' && copy[1] == 0 /*&& (sflags & Mustach_With_SingleDot)*/)
 		/* yes, select current */
-		result = w->itf->sel(w->closure, NULL) ? S_ok : S_none;
+	{
+		result = WCALL(w, sel, w->closure, NULL) ? S_ok : S_none;
+		if (found)
+			*found = 1;
+	}
 	else
 	{
 		/* not the single dot, extract the first key */
@@ -176,22 +236,24 @@ static enum sel sel(struct wrap *w, const char *name)
 			return 0;
 
 		/* select the root item */
-		if (w->itf->sel(w->closure, key))
+		if (WCALL(w, sel, w->closure, key))
 			result = S_ok;
 		else if (key[0] == '*'
 		      && !key[1]
 		      && !value
 		      && !*copy
 		      && (w->flags & Mustach_With_ObjectIter)
-		      && w->itf->sel(w->closure, NULL))
+		      && WCALL(w, sel, w->closure, NULL))
 			result = S_ok_or_objiter;
 		else
 			result = S_none;
+		if (found)
+			*found = result != S_none;
 		if (result == S_ok) {
 			/* iterate the selection of sub items */
 			key = getkey(&copy, sflags);
 			while(result == S_ok && key) {
-				if (w->itf->subsel(w->closure, key))
+				if (WCALL(w, subsel, w->closure, key))
 					/* nothing */;
 				else if (key[0] == '*'
 				      && !key[1]
@@ -211,7 +273,7 @@ static enum sel sel(struct wrap *w, const char *name)
 			result = S_none;
 		else {
 			i = value[0] == '!';
-			scmp = w->itf->compare(w->closure, &value[i]);
+			scmp = WCALL(w, compare, w->closure, &value[i]);
 			switch (k) {
 			case C_eq: j = scmp == 0; break;
 			case C_lt: j = scmp < 0; break;
@@ -227,20 +289,29 @@ static enum sel sel(struct wrap *w, const char *name)
 	return result;
 }
 
-static int start(void *closure)
+static enum sel wrap_sel(struct wrap *w, const char *name)
+{
+	return wrap_select(w, name, NULL);
+}
+
+static int wrap_start(void *closure)
 {
 	struct wrap *w = closure;
 	return w->itf->start ? w->itf->start(w->closure) : MUSTACH_OK;
 }
 
-static void stop(void *closure, int status)
+static void wrap_stop(void *closure, int status)
 {
 	struct wrap *w = closure;
+#if !defined(NO_REGISTRY)
+	if (w->registry)
+		mustach_registry_leave(w->registry, w->section);
+#endif
 	if (w->itf->stop)
 		w->itf->stop(w->closure, status);
 }
 
-static int write(struct wrap *w, const char *buffer, size_t size, FILE *file)
+static int wrap_write(struct wrap *w, const char *buffer, size_t size, FILE *file)
 {
 	int r;
 
@@ -251,7 +322,7 @@ static int write(struct wrap *w, const char *buffer, size_t size, FILE *file)
 	return r;
 }
 
-static int emit(void *closure, const char *buffer, size_t size, int escape, FILE *file)
+static int wrap_emit(void *closure, const char *buffer, size_t size, int escape, FILE *file)
 {
 	struct wrap *w = closure;
 	int r;
@@ -261,7 +332,7 @@ static int emit(void *closure, const char *buffer, size_t size, int escape, FILE
 	if (w->emitcb)
 		r = w->emitcb(file, buffer, size, escape);
 	else if (!escape)
-		r = write(w, buffer, size, file);
+		r = wrap_write(w, buffer, size, file);
 	else {
 		i = 0;
 		r = MUSTACH_OK;
@@ -270,13 +341,13 @@ static int emit(void *closure, const char *buffer, size_t size, int escape, FILE
 			while (i < size && (car = buffer[i]) != '<' && car != '>' && car != '&' && car != '"')
 				i++;
 			if (i != s)
-				r = write(w, &buffer[s], i - s, file);
+				r = wrap_write(w, &buffer[s], i - s, file);
 			if (i < size && r == MUSTACH_OK) {
 				switch(car) {
-				case '<': r = write(w, "&lt;", 4, file); break;
-				case '>': r = write(w, "&gt;", 4, file); break;
-				case '&': r = write(w, "&amp;", 5, file); break;
-				case '"': r = write(w, "&quot;", 6, file); break;
+				case '<': r = wrap_write(w, "&lt;", 4, file); break;
+				case '>': r = wrap_write(w, "&gt;", 4, file); break;
+				case '&': r = wrap_write(w, "&amp;", 5, file); break;
+				case '"': r = wrap_write(w, "&quot;", 6, file); break;
 				}
 				i++;
 			}
@@ -285,34 +356,34 @@ static int emit(void *closure, const char *buffer, size_t size, int escape, FILE
 	return r;
 }
 
-static int enter(void *closure, const char *name)
+static int wrap_enter(void *closure, const char *name)
 {
 	struct wrap *w = closure;
-	enum sel s = sel(w, name);
-	return s == S_none ? 0 : w->itf->enter(w->closure, s & S_objiter);
+	enum sel s = wrap_sel(w, name);
+	return s == S_none ? 0 : WCALL(w, enter, w->closure, s & S_objiter);
 }
 
-static int next(void *closure)
+static int wrap_next(void *closure)
 {
 	struct wrap *w = closure;
-	return w->itf->next(w->closure);
+	return WCALL(w, next, w->closure);
 }
 
-static int leave(void *closure)
+static int wrap_leave(void *closure)
 {
 	struct wrap *w = closure;
-	return w->itf->leave(w->closure);
+	return WCALL(w, leave, w->closure);
 }
 
 static int getoptional(struct wrap *w, const char *name, struct mustach_sbuf *sbuf)
 {
-	enum sel s = sel(w, name);
+	enum sel s = wrap_sel(w, name);
 	if (!(s & S_ok))
 		return 0;
-	return w->itf->get(w->closure, sbuf, s & S_objiter);
+	return WCALL(w, get, w->closure, sbuf, s & S_objiter);
 }
 
-static int get(void *closure, const char *name, struct mustach_sbuf *sbuf)
+static int wrap_get(void *closure, const char *name, struct mustach_sbuf *sbuf)
 {
 	struct wrap *w = closure;
 	if (getoptional(w, name, sbuf) <= 0) {
@@ -323,13 +394,101 @@ static int get(void *closure, const char *name, struct mustach_sbuf *sbuf)
 	return MUSTACH_OK;
 }
 
+#ifdef USE_MMAP
+# define READ_MODE "re" /* close on exec */
+static void unmap_file(const char *value, void *closure)
+{
+	munmap((void*)value, (size_t)(uintptr_t)closure);
+}
+#else
+# define READ_MODE "r"
+#endif
+
+/* reads the file up to its end in a zero terminated buffer */
+static int read_file(FILE *file, struct mustach_sbuf *sbuf)
+{
+	size_t size, pos;
+	char *buffer, *nbuf;
+
+	pos = 0;
+	size = 8192;
+	buffer = malloc(size + 1);
+	while (buffer != NULL) {
+		pos += fread(&buffer[pos], 1, size - pos, file);
+		if (pos < size) {
+			if (ferror(file))
+				break;
+			/* force zero at end */
+			buffer[pos] = 0;
+			sbuf->value = buffer;
+			sbuf->length = pos;
+			sbuf->freecb = free;
+			return MUSTACH_OK;
+		}
+		size += size;
+		nbuf = realloc(buffer, size + 1);
+		if (nbuf == NULL)
+			break;
+		buffer = nbuf;
+	}
+	free(buffer);
+	return MUSTACH_ERROR_SYSTEM;
+}
+
+static int load_file(FILE *file, struct mustach_sbuf *sbuf)
+{
+#ifdef USE_MMAP
+	struct stat st;
+	void *addr;
+
+	/*
+	 * map regular files without the buffer of stdio, the value is not
+	 * copied and not terminated, its pages are the ones of the page cache
+	 */
+	if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (addr != MAP_FAILED) {
+			sbuf->value = addr;
+			sbuf->length = (size_t)st.st_size;
+			sbuf->releasecb = unmap_file;
+			sbuf->closure = (void*)(uintptr_t)st.st_size;
+			return MUSTACH_OK;
+		}
+	}
+#endif
+	return read_file(file, sbuf);
+}
+
+int mustach_wrap_load_file(const char *filename, struct mustach_sbuf *sbuf)
+{
+	FILE *file;
+	int rc;
+
+	/* the standard input is read from its current position */
+	if (filename[0] == '-' && filename[1] == 0)
+		return read_file(stdin, sbuf);
+
+	file = fopen(filename, READ_MODE);
+	if (file == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	rc = load_file(file, sbuf);
+	fclose(file);
+	return rc;
+}
+
+void mustach_wrap_unload_file(struct mustach_sbuf *sbuf)
+{
+	if (sbuf->releasecb)
+		sbuf->releasecb(sbuf->value, sbuf->closure);
+}
+
 static int get_partial_from_file(const char *name, struct mustach_sbuf *sbuf)
 {
 	static char extension[] = INCLUDE_PARTIAL_EXTENSION;
 	size_t s;
-	long pos;
 	FILE *file;
-	char *path, *buffer;
+	char *path;
+	int rc;
 
 	/* allocate path */
 	s = strlen(name);
@@ -339,10 +498,10 @@ static int get_partial_from_file(const char *name, struct mustach_sbuf *sbuf)
 
 	/* try without extension first */
 	memcpy(path, name, s + 1);
-	file = fopen(path, "r");
+	file = fopen(path, READ_MODE);
 	if (file == NULL) {
 		memcpy(&path[s], extension, sizeof extension);
-		file = fopen(path, "r");
+		file = fopen(path, READ_MODE);
 	}
 	free(path);
 
@@ -350,31 +509,404 @@ static int get_partial_from_file(const char *name, struct mustach_sbuf *sbuf)
 	if (file == NULL)
 		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
 
-	/* compute file size */
-	if (fseek(file, 0, SEEK_END) >= 0
-	 && (pos = ftell(file)) >= 0
-	 && fseek(file, 0, SEEK_SET) >= 0) {
-		/* allocate value */
-		s = (size_t)pos;
-		buffer = malloc(s + 1);
-		if (buffer != NULL) {
-			/* read value */
-			if (1 == fread(buffer, s, 1, file)) {
-				/* force zero at end */
-				sbuf->value = buffer;
-				buffer[s] = 0;
-				sbuf->freecb = free;
-				fclose(file);
-				return MUSTACH_OK;
+	rc = load_file(file, sbuf);
+	fclose(file);
+	return rc;
+}
+
+#if !defined(NO_REGISTRY)
+/*
+ * The registry is a fixed hash table of entries that are never removed
+ * before its destruction. The entries point to the current version of
+ * their template, tagged by the generation of its setting and linked to
+ * the version it replaced until that one is released. The outermost read
+ * section of a thread records the current generation and its lookups
+ * return the versions of that generation: the renderings see the
+ * templates as they were when they started.
+ *
+ * Readers count themselves in the counter of the current epoch of their
+ * slot, the slots being spread on distinct cache lines. Writers are
+ * serialized. After replacing a version, a writer switches the epoch and
+ * waits that the counters of the previous epoch are zero, twice, what
+ * ensures that the readers that could use the replaced version left.
+ */
+#define REGISTRY_BUCKETS 256 /* power of 2 */
+#define REGISTRY_SLOTS    16 /* power of 2 */
+
+struct version {
+	struct version *previous;
+	unsigned long generation;
+	struct mustach_template *tmpl; /* NULL when removed */
+	char text[];
+};
+
+struct entry {
+	struct entry *next;
+	struct version *version;
+	char name[];
+};
+
+struct mustach_registry {
+	struct entry *buckets[REGISTRY_BUCKETS];
+	unsigned long generation;
+	unsigned epoch;
+	char writing;
+	struct {
+		unsigned long readers[2];
+		char padding[64 - 2 * sizeof(unsigned long)];
+	} slots[REGISTRY_SLOTS];
+};
+
+/* the read sections of the thread */
+static __thread struct {
+	struct mustach_registry *registry; /* of the outermost section */
+	unsigned long generation;          /* recorded by the outermost section */
+	unsigned depth;                    /* depth of nested sections */
+	unsigned slot;                     /* slot + 1, 0 when not set */
+} reader;
+
+static unsigned registry_hash(const char *name)
+{
+	unsigned h = 2166136261u;
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h & (REGISTRY_BUCKETS - 1);
+}
+
+static struct entry *registry_find(struct mustach_registry *reg, const char *name, unsigned hash)
+{
+	struct entry *e = __atomic_load_n(&reg->buckets[hash], __ATOMIC_ACQUIRE);
+	while (e != NULL && strcmp(e->name, name))
+		e = e->next;
+	return e;
+}
+
+static void registry_lock(struct mustach_registry *reg)
+{
+	while (__atomic_test_and_set(&reg->writing, __ATOMIC_ACQUIRE))
+		registry_yield();
+}
+
+static void registry_unlock(struct mustach_registry *reg)
+{
+	__atomic_clear(&reg->writing, __ATOMIC_RELEASE);
+}
+
+static void registry_release(struct version *v)
+{
+	if (v != NULL) {
+		mustach_template_free(v->tmpl);
+		free(v);
+	}
+}
+
+/* records the version 'v' of 'name' then releases the replaced one */
+static int registry_publish(struct mustach_registry *reg, const char *name, struct version *v)
+{
+	struct version *old;
+	struct entry *e;
+	unsigned hash, epoch, slot;
+	int i;
+
+	registry_lock(reg);
+	hash = registry_hash(name);
+	e = registry_find(reg, name, hash);
+	old = e == NULL ? NULL : e->version;
+	if (v->tmpl == NULL && (old == NULL || old->tmpl == NULL)) {
+		/* nothing to remove */
+		registry_unlock(reg);
+		free(v);
+		return MUSTACH_ERROR_ITEM_NOT_FOUND;
+	}
+	v->previous = old;
+	v->generation = __atomic_add_fetch(&reg->generation, 1, __ATOMIC_SEQ_CST);
+	if (e != NULL)
+		__atomic_store_n(&e->version, v, __ATOMIC_SEQ_CST);
+	else {
+		e = malloc(sizeof *e + strlen(name) + 1);
+		if (e == NULL) {
+			registry_unlock(reg);
+			registry_release(v);
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		strcpy(e->name, name);
+		e->version = v;
+		e->next = reg->buckets[hash];
+		__atomic_store_n(&reg->buckets[hash], e, __ATOMIC_SEQ_CST);
+	}
+	if (old != NULL) {
+		/* wait the end of the read sections that could use 'old' */
+		for (i = 0 ; i < 2 ; i++) {
+			epoch = __atomic_fetch_xor(&reg->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+			for (slot = 0 ; slot < REGISTRY_SLOTS ; slot++)
+				while (__atomic_load_n(&reg->slots[slot].readers[epoch], __ATOMIC_ACQUIRE))
+					registry_yield();
+		}
+		__atomic_store_n(&v->previous, NULL, __ATOMIC_RELAXED);
+	}
+	registry_unlock(reg);
+	registry_release(old);
+	return MUSTACH_OK;
+}
+
+struct mustach_registry *mustach_registry_create(void)
+{
+	return calloc(1, sizeof(struct mustach_registry));
+}
+
+void mustach_registry_destroy(struct mustach_registry *reg)
+{
+	struct entry *e;
+	unsigned i;
+
+	if (reg != NULL) {
+		for (i = 0 ; i < REGISTRY_BUCKETS ; i++)
+			while ((e = reg->buckets[i]) != NULL) {
+				reg->buckets[i] = e->next;
+				registry_release(e->version);
+				free(e);
 			}
-			free(buffer);
+		free(reg);
+	}
+}
+
+int mustach_registry_set(struct mustach_registry *reg, const char *name, const char *template, size_t length, int flags)
+{
+	struct version *v;
+	int rc;
+
+	if (length == 0)
+		length = strlen(template);
+	v = malloc(sizeof *v + length + 1);
+	if (v == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	memcpy(v->text, template, length);
+	v->text[length] = 0;
+	rc = mustach_compile(v->text, length, flags, &v->tmpl);
+	if (rc < 0) {
+		free(v);
+		return rc;
+	}
+	return registry_publish(reg, name, v);
+}
+
+int mustach_registry_remove(struct mustach_registry *reg, const char *name)
+{
+	struct version *v;
+
+	v = malloc(sizeof *v);
+	if (v == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	v->tmpl = NULL;
+	return registry_publish(reg, name, v);
+}
+
+int mustach_registry_enter(struct mustach_registry *reg)
+{
+	static unsigned count = 0;
+	unsigned slot, epoch;
+
+	/* nested sections use the generation of the outermost one */
+	if (reader.depth && reader.registry == reg) {
+		reader.depth++;
+		return -1;
+	}
+	if (reader.slot == 0)
+		reader.slot = (__atomic_fetch_add(&count, 1, __ATOMIC_RELAXED) & (REGISTRY_SLOTS - 1)) + 1;
+	slot = reader.slot - 1;
+	for (;;) {
+		epoch = __atomic_load_n(&reg->epoch, __ATOMIC_SEQ_CST) & 1;
+		__atomic_add_fetch(&reg->slots[slot].readers[epoch], 1, __ATOMIC_SEQ_CST);
+		/* retry if the epoch switched meanwhile, not to delay writers */
+		if ((__atomic_load_n(&reg->epoch, __ATOMIC_SEQ_CST) & 1) == epoch)
+			break;
+		__atomic_sub_fetch(&reg->slots[slot].readers[epoch], 1, __ATOMIC_RELEASE);
+	}
+	if (reader.depth)
+		/* in a section of another registry */
+		return (int)(slot << 2 | epoch);
+	reader.registry = reg;
+	reader.generation = __atomic_load_n(&reg->generation, __ATOMIC_SEQ_CST);
+	reader.depth = 1;
+	return (int)(slot << 2 | 2 | epoch);
+}
+
+void mustach_registry_leave(struct mustach_registry *reg, int section)
+{
+	if (section < 0 || section & 2)
+		reader.depth--;
+	if (section >= 0)
+		__atomic_sub_fetch(&reg->slots[section >> 2].readers[section & 1], 1, __ATOMIC_RELEASE);
+}
+
+const struct mustach_template *mustach_registry_get(struct mustach_registry *reg, const char *name)
+{
+	struct entry *e = registry_find(reg, name, registry_hash(name));
+	struct version *v = e == NULL ? NULL : __atomic_load_n(&e->version, __ATOMIC_SEQ_CST);
+	if (reader.depth && reader.registry == reg)
+		while (v != NULL && v->generation > reader.generation)
+			v = __atomic_load_n(&v->previous, __ATOMIC_RELAXED);
+	return v == NULL ? NULL : v->tmpl;
+}
+
+/*
+ * Prefetching processes a queue of the names of the partials with a pool
+ * of threads. Loading a partial adds the names of its own partials.
+ */
+struct prefetch {
+	struct mustach_registry *reg;
+	int flags;
+	int status;   /* first error or count of loaded partials */
+	int busy;     /* count of threads loading a partial */
+	size_t next;  /* index of the next name to load */
+	size_t count; /* count of names */
+	size_t alloc; /* allocated count of names */
+	char **names;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/* adds the partials of 'tmpl' not already queued, called locked */
+static int prefetch_add(struct prefetch *p, const struct mustach_template *tmpl)
+{
+	const struct mustach_token *tok;
+	char **names;
+	size_t i;
+
+	for (tok = tmpl->tokens ; tok->kind != Mustach_Token_End ; tok++) {
+		if (tok->kind != Mustach_Token_Partial)
+			continue;
+		for (i = 0 ; i < p->count && strcmp(p->names[i], tok->name) ; i++);
+		if (i < p->count)
+			continue;
+		if (p->count == p->alloc) {
+			names = realloc(p->names, (p->alloc + 16) * sizeof *names);
+			if (names == NULL)
+				return MUSTACH_ERROR_SYSTEM;
+			p->names = names;
+			p->alloc += 16;
 		}
+		p->names[p->count] = strdup(tok->name);
+		if (p->names[p->count] == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		p->count++;
 	}
-	fclose(file);
-	return MUSTACH_ERROR_SYSTEM;
+	return MUSTACH_OK;
 }
 
-static int partial(void *closure, const char *name, struct mustach_sbuf *sbuf)
+static void *prefetch_worker(void *closure)
+{
+	struct prefetch *p = closure;
+	const struct mustach_template *tmpl;
+	struct mustach_sbuf sbuf;
+	const char *name;
+	int rc, section, loaded;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		while (p->next == p->count && p->busy && p->status >= 0)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->next == p->count || p->status < 0)
+			break;
+		name = p->names[p->next++];
+		p->busy++;
+		pthread_mutex_unlock(&p->mutex);
+
+		/* load the partial if not already in the registry */
+		rc = MUSTACH_OK;
+		loaded = 0;
+		section = mustach_registry_enter(p->reg);
+		tmpl = mustach_registry_get(p->reg, name);
+		if (tmpl == NULL) {
+			mustach_registry_leave(p->reg, section);
+			memset(&sbuf, 0, sizeof sbuf);
+			if (get_partial_from_file(name, &sbuf) == MUSTACH_OK) {
+				rc = mustach_registry_set(p->reg, name, sbuf.value, sbuf.length, p->flags);
+				loaded = rc == MUSTACH_OK;
+				if (sbuf.releasecb)
+					sbuf.releasecb(sbuf.value, sbuf.closure);
+			}
+			section = mustach_registry_enter(p->reg);
+			tmpl = mustach_registry_get(p->reg, name);
+		}
+
+		pthread_mutex_lock(&p->mutex);
+		if (rc == MUSTACH_OK && tmpl != NULL)
+			rc = prefetch_add(p, tmpl);
+		mustach_registry_leave(p->reg, section);
+		if (p->status >= 0)
+			p->status = rc < 0 ? rc : p->status + loaded;
+		p->busy--;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return NULL;
+}
+
+int mustach_registry_prefetch(struct mustach_registry *reg, const char *template, size_t length, int flags, int nthreads)
+{
+	struct mustach_template *tmpl;
+	struct prefetch p;
+	pthread_t *tids;
+	int i, n, rc;
+
+	rc = mustach_compile(template, length, flags, &tmpl);
+	if (rc < 0)
+		return rc;
+	memset(&p, 0, sizeof p);
+	p.reg = reg;
+	p.flags = flags;
+	pthread_mutex_init(&p.mutex, NULL);
+	pthread_cond_init(&p.cond, NULL);
+	rc = prefetch_add(&p, tmpl);
+	mustach_template_free(tmpl);
+	if (rc == MUSTACH_OK) {
+		/* the calling thread is one of the threads */
+		n = 0;
+		tids = nthreads > 1 ? malloc((size_t)(nthreads - 1) * sizeof *tids) : NULL;
+		if (tids != NULL)
+			while (n < nthreads - 1 && pthread_create(&tids[n], NULL, prefetch_worker, &p) == 0)
+				n++;
+		prefetch_worker(&p);
+		for (i = 0 ; i < n ; i++)
+			pthread_join(tids[i], NULL);
+		free(tids);
+		rc = p.status;
+	}
+	while (p.count)
+		free(p.names[--p.count]);
+	free(p.names);
+	pthread_cond_destroy(&p.cond);
+	pthread_mutex_destroy(&p.mutex);
+	return rc;
+}
+
+static int wrap_compiled(void *closure, const char *name, const struct mustach_template **tmpl)
+{
+	struct wrap *w = closure;
+	struct mustach_registry *reg = mustach_wrap_registry;
+	struct mustach_sbuf sbuf;
+
+	if (reg == NULL || mustach_wrap_get_partial != NULL)
+		return 0;
+	if (w->flags & Mustach_With_PartialDataFirst) {
+		memset(&sbuf, 0, sizeof sbuf);
+		if (getoptional(w, name, &sbuf) > 0) {
+			if (sbuf.releasecb)
+				sbuf.releasecb(sbuf.value, sbuf.closure);
+			return 0;
+		}
+	}
+	if (w->registry == NULL) {
+		w->section = mustach_registry_enter(reg);
+		w->registry = reg;
+	}
+	*tmpl = mustach_registry_get(w->registry, name);
+	return *tmpl != NULL;
+}
+#endif
+
+static int wrap_partial(void *closure, const char *name, struct mustach_sbuf *sbuf)
 {
 	struct wrap *w = closure;
 	int rc;
@@ -396,16 +928,28 @@ static int partial(void *closure, const char *name, struct mustach_sbuf *sbuf)
 	return MUSTACH_OK;
 }
 
+static int wrap_srcpos(void *closure, const struct mustach_srcpos *pos, FILE *file)
+{
+	(void)closure; /* unused */
+	return mustach_wrap_srcpos != NULL ? mustach_wrap_srcpos(pos, file) : MUSTACH_OK;
+}
+
 const struct mustach_itf mustach_wrap_itf = {
-	.start = start,
+	.start = wrap_start,
 	.put = NULL,
-	.enter = enter,
-	.next = next,
-	.leave = leave,
-	.partial = partial,
-	.get = get,
-	.emit = emit,
-	.stop = stop
+	.enter = wrap_enter,
+	.next = wrap_next,
+	.leave = wrap_leave,
+	.partial = wrap_partial,
+	.get = wrap_get,
+	.emit = wrap_emit,
+	.stop = wrap_stop,
+	.srcpos = wrap_srcpos,
+#if !defined(NO_REGISTRY)
+	.compiled = wrap_compiled
+#else
+	.compiled = NULL
+#endif
 };
 
 static void wrap_init(struct wrap *wrap, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, mustach_write_cb_t *writecb)
@@ -417,6 +961,9 @@ static void wrap_init(struct wrap *wrap, const struct mustach_wrap_itf *itf, voi
 	wrap->flags = flags;
 	wrap->emitcb = emitcb;
 	wrap->writecb = writecb;
+#if !defined(NO_REGISTRY)
+	wrap->registry = NULL;
+#endif
 }
 
 int mustach_wrap_file(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file)
@@ -454,3 +1001,429 @@ int mustach_wrap_emit(const char *template, size_t length, const struct mustach_
 	return mustach_file(template, length, &mustach_wrap_itf, &w, flags, emitclosure);
 }
 
+int mustach_wrap_compiled_file(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, NULL);
+	return mustach_compiled_file(tmpl, &mustach_wrap_itf, &w, flags, file);
+}
+
+int mustach_wrap_compiled_fd(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, NULL);
+	return mustach_compiled_fd(tmpl, &mustach_wrap_itf, &w, flags, fd);
+}
+
+int mustach_wrap_compiled_mem(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, NULL);
+	return mustach_compiled_mem(tmpl, &mustach_wrap_itf, &w, flags, result, size);
+}
+
+int mustach_wrap_compiled_write(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_write_cb_t *writecb, void *writeclosure)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, writecb);
+	return mustach_compiled_file(tmpl, &mustach_wrap_itf, &w, flags, writeclosure);
+}
+
+int mustach_wrap_compiled_emit(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, void *emitclosure)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, emitcb, NULL);
+	return mustach_compiled_file(tmpl, &mustach_wrap_itf, &w, flags, emitclosure);
+}
+
+int mustach_wrap_stream_file(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, NULL);
+	return mustach_stream_file(readcb, readclosure, &mustach_wrap_itf, &w, flags, file);
+}
+
+int mustach_wrap_stream_fd(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, NULL);
+	return mustach_stream_fd(readcb, readclosure, &mustach_wrap_itf, &w, flags, fd);
+}
+
+int mustach_wrap_stream_mem(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	struct wrap w;
+	wrap_init(&w, itf, closure, flags, NULL, NULL);
+	return mustach_stream_mem(readcb, readclosure, &mustach_wrap_itf, &w, flags, result, size);
+}
+
+
+/*
+ * Specialization of templates for static data. The template is cut in
+ * blocks: a block is a line or, when sections open on it, the lines up to
+ * the one closing them, extended by the next lines while its rendering
+ * doesn't end a line of output. Each block is either rendered for the static data,
+ * exactly as process does in mustach.c but keeping the tags of values not
+ * defined, or copied verbatim when it can't be resolved: partials, changes
+ * of delimiters and sections not defined by the static data. So the blocks
+ * always start with the state of a new line and the standalone lines
+ * are processed as when rendering.
+ */
+#define SPEC_VERBATIM 1 /* internal status: the block is copied verbatim */
+
+struct spec {
+	struct wrap w;
+	const struct mustach_token *tokens;
+	char *buffer;
+	size_t size, alloc;
+	size_t oplen;
+	char opstr[MUSTACH_MAX_DELIM_LENGTH];
+};
+
+static int spec_append(struct spec *s, const char *text, size_t length)
+{
+	size_t alloc;
+	char *buffer;
+
+	if (s->size + length >= s->alloc) {
+		alloc = s->alloc ? s->alloc : 4096;
+		while (s->size + length >= alloc)
+			alloc <<= 1;
+		buffer = realloc(s->buffer, alloc);
+		if (buffer == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		s->buffer = buffer;
+		s->alloc = alloc;
+	}
+	if (length) {
+		memcpy(&s->buffer[s->size], text, length);
+		s->size += length;
+	}
+	return MUSTACH_OK;
+}
+
+/* tells if an opening delimiter starts in the result between 'from' and 'to' */
+static int spec_opening(struct spec *s, size_t from, size_t to)
+{
+	from = from >= s->oplen ? from - s->oplen + 1 : 0;
+	for ( ; from < to && from + s->oplen <= s->size ; from++)
+		if (!memcmp(&s->buffer[from], s->opstr, s->oplen))
+			return 1;
+	return 0;
+}
+
+/* appends the text of the template, it must not open a tag with the previous one */
+static int spec_text(struct spec *s, const char *text, size_t length)
+{
+	size_t from = s->size;
+	int rc = spec_append(s, text, length);
+	return rc == MUSTACH_OK && spec_opening(s, from, from) ? SPEC_VERBATIM : rc;
+}
+
+/* keeps the tag of the token */
+static int spec_tag(struct spec *s, const struct mustach_token *tok)
+{
+	const char *tag = tok->text + tok->length;
+	return spec_text(s, tag, (size_t)(tok[1].text - tag));
+}
+
+static int spec_escape(struct spec *s, const char *value, size_t length)
+{
+	size_t i, j;
+	int rc;
+
+	for (rc = MUSTACH_OK, i = 0 ; rc == MUSTACH_OK && i < length ; i = j + 1) {
+		for (j = i ; j < length && !strchr("<>&\"", value[j]) ; j++);
+		rc = spec_append(s, &value[i], j - i);
+		if (rc == MUSTACH_OK && j < length) {
+			switch(value[j]) {
+			case '<': rc = spec_append(s, "&lt;", 4); break;
+			case '>': rc = spec_append(s, "&gt;", 4); break;
+			case '&': rc = spec_append(s, "&amp;", 5); break;
+			case '"': rc = spec_append(s, "&quot;", 6); break;
+			}
+		}
+	}
+	return rc;
+}
+
+/*
+ * Replaces the tag of the token by its value. The tag is kept when the value
+ * is not defined, when it has new lines that would be prefixed by partials
+ * including the specialized template or when it makes an opening delimiter.
+ * Within the 'entered' static sections, a kept tag would be resolved against
+ * the root: so the value is empty when the first key of the tag is found
+ * and, otherwise, the block is copied verbatim.
+ */
+static int spec_value(struct spec *s, const struct mustach_token *tok, int entered)
+{
+	struct mustach_sbuf sbuf;
+	enum sel sel;
+	size_t from, length;
+	int rc, found;
+
+	from = s->size;
+	sel = wrap_select(&s->w, tok->name, &found);
+	if (sel & S_ok) {
+		memset(&sbuf, 0, sizeof sbuf);
+		rc = WCALL(&s->w, get, s->w.closure, &sbuf, sel & S_objiter);
+		if (rc < 0)
+			return rc;
+		if (rc > 0) {
+			length = sbuf.length || sbuf.value == NULL ? sbuf.length : strlen(sbuf.value);
+			if (length && memchr(sbuf.value, '\n', length) != NULL)
+				rc = SPEC_VERBATIM;
+			else if (tok->kind == Mustach_Token_Escaped)
+				rc = spec_escape(s, sbuf.value, length);
+			else
+				rc = spec_append(s, sbuf.value, length);
+			if (sbuf.releasecb)
+				sbuf.releasecb(sbuf.value, sbuf.closure);
+			if (rc < 0)
+				return rc;
+			if (rc == MUSTACH_OK && !spec_opening(s, from, s->size))
+				return MUSTACH_OK;
+			s->size = from;
+			found = 0;
+		}
+	}
+	if (!entered)
+		return spec_tag(s, tok);
+	return found ? MUSTACH_OK : SPEC_VERBATIM;
+}
+
+/*
+ * Renders for the static data the block from 'index' to 'end', mirroring the
+ * processing of the tokens by process in mustach.c. Returns SPEC_VERBATIM
+ * when the block must be copied verbatim.
+ */
+static int spec_block(struct spec *s, size_t index, size_t end)
+{
+	const struct mustach_token *tok;
+	struct { size_t again; unsigned enabled: 1, entered: 1; } stack[MUSTACH_MAX_DEPTH];
+	int depth, rc, enabled, stdalone, entered;
+	const char *prefstart;
+	size_t preflen;
+	enum sel sel;
+
+	stdalone = enabled = 1;
+	depth = entered = 0;
+	prefstart = NULL;
+	preflen = 0;
+	for (rc = MUSTACH_OK ; rc == MUSTACH_OK ; index++) {
+		tok = &s->tokens[index];
+
+		/* text before the tag or the end of line */
+		if (stdalone == 2 && enabled && (tok->kind > Mustach_Token_Line || (tok->flags & Mustach_Token_NonSpace))) {
+			rc = spec_text(s, prefstart, preflen);
+			if (rc != MUSTACH_OK)
+				break;
+			preflen = 0;
+			stdalone = 0;
+		}
+		if (tok->flags & Mustach_Token_NonSpace)
+			stdalone = 0;
+		if (tok->kind <= Mustach_Token_Line) {
+			if (stdalone != 2 && enabled)
+				rc = spec_text(s, tok->text, tok->length);
+			if (index == end)
+				return rc;
+			stdalone = 1;
+			preflen = 0;
+			continue;
+		}
+
+		/* the tag */
+		prefstart = tok->text;
+		preflen = enabled ? tok->length : 0;
+		if (tok->kind >= Mustach_Token_Escaped)
+			stdalone = 0;
+		if (stdalone)
+			stdalone = 2;
+		else if (enabled) {
+			rc = spec_text(s, prefstart, preflen);
+			preflen = 0;
+		}
+		if (rc != MUSTACH_OK)
+			break;
+		switch(tok->kind) {
+		case Mustach_Token_Comment:
+			break;
+		case Mustach_Token_Inverted:
+		case Mustach_Token_Section:
+			rc = enabled;
+			if (rc) {
+				/* the current item of the roots isn't the static one */
+				sel = entered || (tok->name[0] != '.' && tok->name[0] != '*')
+					? wrap_sel(&s->w, tok->name) : S_none;
+				if (sel == S_none) {
+					/* not defined by the static data */
+					rc = SPEC_VERBATIM;
+					break;
+				}
+				rc = WCALL(&s->w, enter, s->w.closure, sel & S_objiter);
+				if (rc < 0)
+					break;
+			}
+			stack[depth].again = index;
+			stack[depth].enabled = enabled != 0;
+			stack[depth].entered = rc != 0;
+			entered += rc != 0;
+			if ((tok->kind == Mustach_Token_Section) == (rc == 0))
+				enabled = 0;
+			depth++;
+			rc = MUSTACH_OK;
+			break;
+		case Mustach_Token_Close:
+			depth--;
+			rc = enabled && stack[depth].entered ? WCALL(&s->w, next, s->w.closure) : 0;
+			if (rc != 0) {
+				/* on error, the section is left below */
+				if (rc > 0) {
+					if (tok->flags & Mustach_Token_Relex)
+						rc = SPEC_VERBATIM;
+					else {
+						index = stack[depth].again;
+						rc = MUSTACH_OK;
+					}
+				}
+				depth++;
+			} else {
+				enabled = stack[depth].enabled;
+				if (enabled && stack[depth].entered) {
+					WCALL(&s->w, leave, s->w.closure);
+					entered--;
+				}
+			}
+			break;
+		case Mustach_Token_Escaped:
+		case Mustach_Token_Raw:
+			if (enabled)
+				rc = !entered && tok->name[0] == '.' && !tok->name[1]
+					? spec_tag(s, tok) : spec_value(s, tok, entered);
+			break;
+		default:
+			/* partials and delimiters aren't specialized */
+			rc = SPEC_VERBATIM;
+			break;
+		}
+	}
+	while (depth)
+		if (stack[--depth].entered)
+			WCALL(&s->w, leave, s->w.closure);
+	return rc;
+}
+
+/* index of the token ending the block starting at 'index' */
+static size_t spec_end(struct spec *s, size_t index, int *verbatim)
+{
+	const struct mustach_token *tok;
+	int depth = 0;
+
+	*verbatim = 0;
+	for (;; index++) {
+		tok = &s->tokens[index];
+		switch(tok->kind) {
+		case Mustach_Token_End:
+			return index;
+		case Mustach_Token_Line:
+			if (depth == 0)
+				return index;
+			break;
+		case Mustach_Token_Section:
+		case Mustach_Token_Inverted:
+			depth++;
+			break;
+		case Mustach_Token_Close:
+			depth--;
+			break;
+		case Mustach_Token_Partial:
+		case Mustach_Token_Delim:
+			*verbatim = 1;
+			break;
+		}
+	}
+}
+
+/* copies verbatim the tokens from 'index' to 'end' included */
+static int spec_verbatim(struct spec *s, size_t index, size_t end)
+{
+	const struct mustach_token *tok;
+	const char *beg;
+	size_t len, l;
+
+	for (tok = &s->tokens[index] ; tok != &s->tokens[end] ; tok++) {
+		if (tok->kind == Mustach_Token_Delim) {
+			/* record the opening delimiter, the delimiters are valid */
+			beg = tok->name;
+			len = tok->namelen;
+			while (len && isspace(*beg))
+				beg++, len--;
+			for (l = 0 ; l < len && !isspace(beg[l]) ; l++);
+			memcpy(s->opstr, beg, l);
+			s->oplen = l;
+		}
+	}
+	beg = s->tokens[index].text;
+	return spec_append(s, beg, (size_t)(tok->text + tok->length - beg));
+}
+
+int mustach_wrap_specialize(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	struct mustach_template *tmpl;
+	struct spec s;
+	size_t index, end, mark, sz;
+	int rc, verbatim;
+
+	*result = NULL;
+	if (size == NULL)
+		size = &sz;
+	*size = 0;
+	rc = mustach_compile(template, length, flags, &tmpl);
+	if (rc < 0)
+		return rc;
+
+	wrap_init(&s.w, itf, closure, flags, NULL, NULL);
+	s.tokens = tmpl->tokens;
+	s.buffer = NULL;
+	s.size = s.alloc = 0;
+	s.opstr[0] = s.opstr[1] = '{';
+	s.oplen = 2;
+	rc = wrap_start(&s.w);
+	for (index = 0 ; rc == MUSTACH_OK ; index = end + 1) {
+		end = spec_end(&s, index, &verbatim);
+		mark = s.size;
+		if (!verbatim) {
+			rc = spec_block(&s, index, end);
+			/* the next block must start a line, so that its standalone
+			 * lines stay standalone: the block is extended until it ends
+			 * its line of output */
+			while (rc == MUSTACH_OK && s.size > mark && s.buffer[s.size - 1] != '\n'
+			    && s.tokens[end].kind != Mustach_Token_End) {
+				end = spec_end(&s, end + 1, &verbatim);
+				s.size = mark;
+				rc = verbatim ? SPEC_VERBATIM : spec_block(&s, index, end);
+			}
+			verbatim = rc == SPEC_VERBATIM;
+		}
+		if (verbatim) {
+			s.size = mark;
+			rc = spec_verbatim(&s, index, end);
+		}
+		if (s.tokens[end].kind == Mustach_Token_End)
+			break;
+	}
+	wrap_stop(&s.w, rc);
+	mustach_template_free(tmpl);
+
+	/* adds terminating null */
+	if (rc == MUSTACH_OK)
+		rc = spec_append(&s, "", 1);
+	if (rc != MUSTACH_OK) {
+		free(s.buffer);
+		return rc;
+	}
+	*result = s.buffer;
+	*size = s.size - 1;
+	return MUSTACH_OK;
+}
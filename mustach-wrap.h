@@ -62,6 +62,8 @@ typedef int mustach_emit_cb_t(void *closure, const char *buffer, size_t size, in
 #define Mustach_With_EscFirstCmp        256
 #define Mustach_With_PartialDataFirst   512
 #define Mustach_With_ErrorUndefined    1024
+#define Mustach_With_ReadOnly          2048     /* the backend never alters the data */
+#define Mustach_With_Checked           4096     /* the backend doesn't check the data again */
 
 #undef  Mustach_With_AllExtensions
 #define Mustach_With_AllExtensions     1023     /* don't include ErrorUndefined */
@@ -150,6 +152,136 @@ extern const struct mustach_itf mustach_wrap_itf;
  */
 extern int (*mustach_wrap_get_partial)(const char *name, struct mustach_sbuf *sbuf);
 
+/**
+ * Global hook for receiving the positions in templates of the produced output.
+ * When set to a not NULL value, the pointed function is called before writing
+ * the output coming from the position 'pos' (see 'srcpos' in mustach_itf).
+ * The 'closure' is the FILE given to mustach_wrap_file or the closure
+ * given to mustach_wrap_write and mustach_wrap_emit.
+ * The function must return MUSTACH_OK or a negative error code that stops
+ * the processing.
+ */
+extern int (*mustach_wrap_srcpos)(const struct mustach_srcpos *pos, void *closure);
+
+/**
+ * mustach_wrap_load_file - Puts in 'sbuf' the content of the file 'filename'
+ * or of the standard input when 'filename' is "-". The regular files are mapped
+ * in memory when possible and their content is then not zero terminated, the
+ * other files are read in a zero terminated buffer. That is the way the
+ * partials are read from files.
+ * The content is released by mustach_wrap_unload_file.
+ *
+ * Returns MUSTACH_OK or MUSTACH_ERROR_SYSTEM with errno set.
+ */
+extern int mustach_wrap_load_file(const char *filename, struct mustach_sbuf *sbuf);
+
+/**
+ * mustach_wrap_unload_file - Releases the content loaded in 'sbuf'
+ * by mustach_wrap_load_file.
+ */
+extern void mustach_wrap_unload_file(struct mustach_sbuf *sbuf);
+
+/**
+ * mustach_registry - Registry of compiled templates shared by threads
+ *
+ * The registry records compiled templates by name. Its lookups are lock-free:
+ * a thread enters a read section, gets the templates it needs and leaves the
+ * read section when it doesn't use them anymore. Setting a template replaces
+ * atomically the template of the same name, the replaced one being released
+ * when all the read sections that could have got it are left. The lookups
+ * of a read section return the templates as they were when it was entered.
+ *
+ * Not available when compiled with NO_REGISTRY or without GCC atomics.
+ */
+struct mustach_registry;
+
+/**
+ * Global registry for the partials. When set to a not NULL value and when
+ * the hook mustach_wrap_get_partial is not set, the partials are first
+ * searched in that registry (or after the data with Mustach_With_PartialDataFirst).
+ * Each rendering enters a read section of the registry at its first partial
+ * and leaves it at its end.
+ */
+extern struct mustach_registry *mustach_wrap_registry;
+
+/**
+ * mustach_registry_create - Returns a new empty registry or NULL with
+ * errno set.
+ */
+extern struct mustach_registry *mustach_registry_create(void);
+
+/**
+ * mustach_registry_destroy - Releases the registry 'reg' and its templates.
+ * No thread must use it anymore.
+ */
+extern void mustach_registry_destroy(struct mustach_registry *reg);
+
+/**
+ * mustach_registry_set - Compiles a copy of the 'template' and records it
+ * in 'reg' under 'name', replacing the previous template of that name.
+ * It waits that the read sections that could have got the replaced template
+ * are left, so it must not be called from a read section.
+ *
+ * @reg:      the registry
+ * @name:     the name of the template
+ * @template: the template string to compile, it is copied
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @flags:    the flags used for parsing (Mustach_With_Colon, Mustach_With_EmptyTag)
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error in the template. On error, the
+ * previous template remains.
+ */
+extern int mustach_registry_set(struct mustach_registry *reg, const char *name, const char *template, size_t length, int flags);
+
+/**
+ * mustach_registry_remove - Removes the template of 'name' from 'reg'.
+ * As mustach_registry_set, it must not be called from a read section.
+ *
+ * Returns 0 in case of success or MUSTACH_ERROR_ITEM_NOT_FOUND.
+ */
+extern int mustach_registry_remove(struct mustach_registry *reg, const char *name);
+
+/**
+ * mustach_registry_enter - Enters a read section of 'reg' and returns
+ * the value to give to mustach_registry_leave. Read sections can be nested,
+ * the nested ones of a same registry use the templates of the outermost.
+ */
+extern int mustach_registry_enter(struct mustach_registry *reg);
+
+/**
+ * mustach_registry_leave - Leaves the read 'section' of 'reg'. The templates
+ * got in the section must not be used anymore.
+ */
+extern void mustach_registry_leave(struct mustach_registry *reg, int section);
+
+/**
+ * mustach_registry_get - Returns the template of 'name' in 'reg' or NULL
+ * when not found. Must be called in a read section, the returned template
+ * remains valid until that read section is left.
+ */
+extern const struct mustach_template *mustach_registry_get(struct mustach_registry *reg, const char *name);
+
+/**
+ * mustach_registry_prefetch - Loads in 'reg' the partials of the 'template'
+ * and their own partials, recursively, before rendering it. The partials
+ * are read from their files, as when rendering, by 'nthreads' threads
+ * reading in parallel, the calling thread being one of them. The partials
+ * already in the registry are not read again and those not found are
+ * ignored. As mustach_registry_set, it must not be called from a read
+ * section.
+ *
+ * @reg:      the registry
+ * @template: the template string
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @flags:    the flags used for parsing (Mustach_With_Colon, Mustach_With_EmptyTag)
+ * @nthreads: the count of threads
+ *
+ * Returns the count of partials read, -1 with errno set in case of system
+ * error or a other negative value in case of error in a template.
+ */
+extern int mustach_registry_prefetch(struct mustach_registry *reg, const char *template, size_t length, int flags, int nthreads);
+
 /**
  * mustach_wrap_file - Renders the mustache 'template' in 'file' for an abstract
  * wrapper of interface 'itf' and 'closure'.
@@ -230,5 +362,209 @@ extern int mustach_wrap_write(const char *template, size_t length, const struct
  */
 extern int mustach_wrap_emit(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, void *emitclosure);
 
-#endif
+/**
+ * mustach_wrap_compiled_file - Renders the compiled template 'tmpl' in 'file' for an abstract
+ * wrapper of interface 'itf' and 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_file(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file);
+
+/**
+ * mustach_wrap_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for an abstract
+ * wrapper of interface 'itf' and 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_fd(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd);
+
+/**
+ * mustach_wrap_compiled_mem - Renders the compiled template 'tmpl' in 'result' for an abstract
+ * wrapper of interface 'itf' and 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_mem(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size);
+
+/**
+ * mustach_wrap_compiled_write - Renders the compiled template 'tmpl' for an abstract
+ * wrapper of interface 'itf' and 'closure' to custom writer
+ * 'writecb' with 'writeclosure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @writecb:  the function that write values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_write(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_write_cb_t *writecb, void *writeclosure);
+
+/**
+ * mustach_wrap_compiled_emit - Renders the compiled template 'tmpl' for an abstract
+ * wrapper of interface 'itf' and 'closure' to custom emiter 'emitcb'
+ * with 'emitclosure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface of the abstract wrapper
+ * @closure:  the closure of the abstract wrapper
+ * @emitcb:   the function that emit values
+ * @closure:  the closure for the write function
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_compiled_emit(const struct mustach_template *tmpl, const struct mustach_wrap_itf *itf, void *closure, int flags, mustach_emit_cb_t *emitcb, void *emitclosure);
+
+/**
+ * mustach_wrap_stream_file - Renders in 'file' for an abstract wrapper of
+ * interface 'itf' and 'closure' the mustache template read progressively
+ * by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:      the function reading the template
+ * @readclosure: the closure of the reading function
+ * @itf:         the interface of the abstract wrapper
+ * @closure:     the closure of the abstract wrapper
+ * @file:        the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_stream_file(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_wrap_itf *itf, void *closure, int flags, FILE *file);
 
+/**
+ * mustach_wrap_stream_fd - Renders in 'fd' for an abstract wrapper of
+ * interface 'itf' and 'closure' the mustache template read progressively
+ * by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:      the function reading the template
+ * @readclosure: the closure of the reading function
+ * @itf:         the interface of the abstract wrapper
+ * @closure:     the closure of the abstract wrapper
+ * @fd:          the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_stream_fd(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_wrap_itf *itf, void *closure, int flags, int fd);
+
+/**
+ * mustach_wrap_stream_mem - Renders in 'result' for an abstract wrapper of
+ * interface 'itf' and 'closure' the mustache template read progressively
+ * by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:      the function reading the template
+ * @readclosure: the closure of the reading function
+ * @itf:         the interface of the abstract wrapper
+ * @closure:     the closure of the abstract wrapper
+ * @result:      the pointer receiving the result when 0 is returned
+ * @size:        the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_stream_mem(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size);
+
+/**
+ * mustach_wrap_specialize - Specializes the mustache 'template' for the static
+ * data of the abstract wrapper of interface 'itf' and 'closure'.
+ *
+ * In the specialized template, the tags and the sections defined by the
+ * static data are replaced by the text they render. The tags of the values
+ * not defined by the static data remain, as the lines that can't be resolved
+ * remain verbatim: lines of partials, of changes of delimiters and of sections
+ * not defined by the static data. The specialized template renders as the
+ * template when the static data is given as the last root (see the layers of
+ * the JSON libraries) and when the other roots don't define its names.
+ * The values of escaped tags are escaped as done by default.
+ *
+ * @template: the template string to specialize
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @itf:      the interface of the abstract wrapper of the static data
+ * @closure:  the closure of the abstract wrapper of the static data
+ * @result:   the pointer receiving the specialized template when 0 is returned
+ * @size:     the size of the returned template
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_wrap_specialize(const char *template, size_t length, const struct mustach_wrap_itf *itf, void *closure, int flags, char **result, size_t *size);
+
+/*
+ * Rendering for layered roots
+ *
+ * The backends able to render for a list of roots declare, with the macro
+ * MUSTACH_WRAP_LAYERS_DECLARE(prefix, type), the functions
+ * prefix_layers_XXX and prefix_compiled_layers_XXX where XXX is one of
+ * file, fd, mem, write or emit. These functions are the ones of
+ * mustach_wrap_XXX and mustach_wrap_compiled_XXX where the interface and
+ * its closure are replaced by the array 'roots' of 'count' roots of 'type'.
+ *
+ * The roots are the bottom frames of the context stack: a name not found
+ * in the sections is searched in the first root, then in the second root,
+ * and so on. That renders for data of layers, like data of the request,
+ * of the tenant and global data, without merging nor copying them. The
+ * list must have at least one root.
+ *
+ * The backends define these functions with the macro
+ * MUSTACH_WRAP_LAYERS_DEFINE(prefix, type, itf, expl, init) where 'itf'
+ * is their interface, 'expl' the type of its closure and 'init' the
+ * function 'void *init(expl *e, type *const *roots, unsigned count, int flags)'
+ * preparing the closure 'e' and returning it.
+ */
+#define MUSTACH_WRAP_LAYERS_DECLARE(prefix,type) \
+extern int prefix##_layers_file(const char *template, size_t length, type *const *roots, unsigned count, int flags, FILE *file); \
+extern int prefix##_layers_fd(const char *template, size_t length, type *const *roots, unsigned count, int flags, int fd); \
+extern int prefix##_layers_mem(const char *template, size_t length, type *const *roots, unsigned count, int flags, char **result, size_t *size); \
+extern int prefix##_layers_write(const char *template, size_t length, type *const *roots, unsigned count, int flags, mustach_write_cb_t *writecb, void *closure); \
+extern int prefix##_layers_emit(const char *template, size_t length, type *const *roots, unsigned count, int flags, mustach_emit_cb_t *emitcb, void *closure); \
+extern int prefix##_compiled_layers_file(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, FILE *file); \
+extern int prefix##_compiled_layers_fd(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, int fd); \
+extern int prefix##_compiled_layers_mem(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, char **result, size_t *size); \
+extern int prefix##_compiled_layers_write(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, mustach_write_cb_t *writecb, void *closure); \
+extern int prefix##_compiled_layers_emit(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, mustach_emit_cb_t *emitcb, void *closure)
+
+#define MUSTACH_WRAP_LAYERS_DEFINE(prefix,type,itf,expl,init) \
+int prefix##_layers_file(const char *template, size_t length, type *const *roots, unsigned count, int flags, FILE *file) \
+	{ expl e; return mustach_wrap_file(template, length, itf, init(&e, roots, count, flags), flags, file); } \
+int prefix##_layers_fd(const char *template, size_t length, type *const *roots, unsigned count, int flags, int fd) \
+	{ expl e; return mustach_wrap_fd(template, length, itf, init(&e, roots, count, flags), flags, fd); } \
+int prefix##_layers_mem(const char *template, size_t length, type *const *roots, unsigned count, int flags, char **result, size_t *size) \
+	{ expl e; return mustach_wrap_mem(template, length, itf, init(&e, roots, count, flags), flags, result, size); } \
+int prefix##_layers_write(const char *template, size_t length, type *const *roots, unsigned count, int flags, mustach_write_cb_t *writecb, void *closure) \
+	{ expl e; return mustach_wrap_write(template, length, itf, init(&e, roots, count, flags), flags, writecb, closure); } \
+int prefix##_layers_emit(const char *template, size_t length, type *const *roots, unsigned count, int flags, mustach_emit_cb_t *emitcb, void *closure) \
+	{ expl e; return mustach_wrap_emit(template, length, itf, init(&e, roots, count, flags), flags, emitcb, closure); } \
+int prefix##_compiled_layers_file(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, FILE *file) \
+	{ expl e; return mustach_wrap_compiled_file(tmpl, itf, init(&e, roots, count, flags), flags, file); } \
+int prefix##_compiled_layers_fd(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, int fd) \
+	{ expl e; return mustach_wrap_compiled_fd(tmpl, itf, init(&e, roots, count, flags), flags, fd); } \
+int prefix##_compiled_layers_mem(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, char **result, size_t *size) \
+	{ expl e; return mustach_wrap_compiled_mem(tmpl, itf, init(&e, roots, count, flags), flags, result, size); } \
+int prefix##_compiled_layers_write(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, mustach_write_cb_t *writecb, void *closure) \
+	{ expl e; return mustach_wrap_compiled_write(tmpl, itf, init(&e, roots, count, flags), flags, writecb, closure); } \
+int prefix##_compiled_layers_emit(const struct mustach_template *tmpl, type *const *roots, unsigned count, int flags, mustach_emit_cb_t *emitcb, void *closure) \
+	{ expl e; return mustach_wrap_compiled_emit(tmpl, itf, init(&e, roots, count, flags), flags, emitcb, closure); }
+
+#endif
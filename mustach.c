@@ -13,15 +13,23 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 #ifdef _WIN32
 #include <malloc.h>
+#include <io.h>
+#else
+#include <unistd.h>
 #endif
 
 #include "mustach.h"
 
+#if !defined(__GNUC__) && !defined(NO_LAZY)
+#define NO_LAZY /* lazy compilation uses the atomic builtins of GCC */
+#endif
+
 struct iwrap {
 	int (*emit)(void *closure, const char *buffer, size_t size, int escape, FILE *file);
-	void *closure; /* closure for: enter, next, leave, emit, get */
+	void *closure; /* closure for: enter, next, leave, emit, get, compiled */
 	int (*put)(void *closure, const char *name, int escape, FILE *file);
 	void *closure_put; /* closure for put */
 	int (*enter)(void *closure, const char *name);
@@ -30,13 +38,85 @@ struct iwrap {
 	int (*get)(void *closure, const char *name, struct mustach_sbuf *sbuf);
 	int (*partial)(void *closure, const char *name, struct mustach_sbuf *sbuf);
 	void *closure_partial; /* closure for partial */
+	int (*srcpos)(void *closure, const struct mustach_srcpos *pos, FILE *file);
+	int (*compiled)(void *closure, const char *name, const struct mustach_template **tmpl);
 	int flags;
 };
 
+/*
+ * Calls the callback 'cb' of the interface. An amalgamated build defines
+ * MUSTACH_BOUND(cb) as the function of its wrapper for 'cb': the call is
+ * then direct when the interface is the one of the wrapper, what allows
+ * the compiler to inline it.
+ */
+#if defined(MUSTACH_BOUND)
+#define ICALL(iw,cb,...) ((iw)->cb == MUSTACH_BOUND(cb) \
+		? MUSTACH_BOUND(cb)(__VA_ARGS__) : (iw)->cb(__VA_ARGS__))
+#else
+#define ICALL(iw,cb,...) ((iw)->cb(__VA_ARGS__))
+#endif
+
 struct prefix {
 	size_t len;
 	const char *start;
-	struct prefix *prefix;
+	const struct prefix *indent; /* flattened prefixes of the including partials or NULL */
+};
+
+/* size of the indentations built without allocation */
+#define INDENT_SIZE 128
+
+struct delims {
+	size_t oplen, cllen;
+	char opstr[MUSTACH_MAX_DELIM_LENGTH], clstr[MUSTACH_MAX_DELIM_LENGTH];
+};
+
+/*
+ * Section of a template compiled lazily: its opening token, whose 'partial'
+ * points to that structure, is followed by the token following its closing
+ * tag. Its body is compiled when first entered, also lazily, and then shared
+ * by the threads rendering the template.
+ */
+struct lazy {
+	struct mustach_template body; /* text after the opening tag up to the end of the closing tag */
+	unsigned line;                /* line of the body */
+	int flags;                    /* flags of the compilation */
+	struct delims start, end;     /* delimiters of the body and after the section */
+	const char *close;            /* text preceding the closing tag */
+	int stdalone;                 /* standalone state after skipping the body or -1 if unchanged */
+};
+
+/* initial size of the window of the templates read progressively */
+#define STREAM_SIZE 65536
+
+/*
+ * Template read progressively: only a window of its text is in memory,
+ * from 'keep', set by process, up to the text being scanned. When the
+ * window moves, the pointers of process are rebased from 'from', the start
+ * of the window in their old buffer 'old' if it changed, to 'keep'.
+ */
+struct stream {
+	mustach_read_cb_t *readcb;
+	void *closure;
+	char *buffer, *old;
+	size_t size;
+	const char *keep, *from;
+	size_t offset;            /* offset of the window in the template */
+	int eof;
+	char *names;              /* names of the open sections not in the window */
+	size_t nameslen, namessize;
+};
+
+struct lexer {
+	const char *template, *pos, *end;
+	const struct mustach_token *tok; /* compiled tokens or NULL when scanning */
+	struct stream *stream;           /* the template read progressively or NULL */
+	int (*render)(const struct mustach_run *run); /* generated rendering or NULL */
+	unsigned line;
+	int flags;
+	size_t oplen, cllen;
+	char opstr[MUSTACH_MAX_DELIM_LENGTH], clstr[MUSTACH_MAX_DELIM_LENGTH];
+	struct mustach_token token; /* last scanned token */
+	char name[MUSTACH_MAX_LENGTH + 1]; /* zero terminated name of token */
 };
 
 #if !defined(NO_OPEN_MEMSTREAM)
@@ -185,11 +265,11 @@ static int iwrap_put(void *closure, const char *name, int escape, FILE *file)
 	size_t length;
 
 	sbuf_reset(&sbuf);
-	rc = iwrap->get(iwrap->closure, name, &sbuf);
+	rc = ICALL(iwrap, get, iwrap->closure, name, &sbuf);
 	if (rc >= 0) {
 		length = sbuf_length(&sbuf);
 		if (length)
-			rc = iwrap->emit(iwrap->closure, sbuf.value, length, escape, file);
+			rc = ICALL(iwrap, emit, iwrap->closure, sbuf.value, length, escape, file);
 		sbuf_release(&sbuf);
 	}
 	return rc;
@@ -223,214 +303,640 @@ static int iwrap_partial(void *closure, const char *name, struct mustach_sbuf *s
 	return rc;
 }
 
-static int emitprefix(struct iwrap *iwrap, FILE *file, struct prefix *prefix)
+/* emits the prefixes of the including partials and the text preceding a tag */
+static int emitpref(struct iwrap *iwrap, FILE *file, struct prefix *pref)
 {
-	if (prefix->prefix) {
-		int rc = emitprefix(iwrap, file, prefix->prefix);
+	if (pref->indent) {
+		int rc = ICALL(iwrap, emit, iwrap->closure, pref->indent->start, pref->indent->len, 0, file);
 		if (rc < 0)
 			return rc;
 	}
-	return prefix->len ? iwrap->emit(iwrap->closure, prefix->start, prefix->len, 0, file) : 0;
+	return pref->len ? ICALL(iwrap, emit, iwrap->closure, pref->start, pref->len, 0, file) : 0;
+}
+
+/* offset of 'at' in the text of 'lex' */
+static inline size_t lexer_offset(const struct lexer *lex, const char *at)
+{
+	return (size_t)(at - lex->template) + (lex->stream == NULL ? 0 : lex->stream->offset);
+}
+
+/* reports the position 'at' of the text of 'lex', the inlined texts having no position */
+static inline int srcpos(struct iwrap *iwrap, FILE *file, struct mustach_srcpos *pos, const struct lexer *lex, const char *at, unsigned line)
+{
+	if (!iwrap->srcpos || at < lex->template || at > lex->end)
+		return 0;
+	pos->offset = lexer_offset(lex, at);
+	pos->line = line;
+	return iwrap->srcpos(iwrap->closure, pos, file);
+}
+
+static void lexer_init(struct lexer *lex, const char *template, size_t length, const struct mustach_token *tokens, int flags)
+{
+	lex->template = lex->pos = template;
+	lex->end = template + (length ? length : strlen(template));
+	lex->tok = tokens;
+	lex->stream = NULL;
+	lex->render = NULL;
+	lex->line = 1;
+	lex->flags = flags;
+	lex->opstr[0] = lex->opstr[1] = '{';
+	lex->clstr[0] = lex->clstr[1] = '}';
+	lex->oplen = lex->cllen = 2;
+	lex->token.partial = NULL;
+}
+
+static void lexer_init_compiled(struct lexer *lex, const struct mustach_template *tmpl, int flags)
+{
+	lexer_init(lex, tmpl->text, tmpl->length, tmpl->tokens, flags);
+	lex->render = tmpl->render;
+}
+
+static int lexer_delim(struct lexer *lex, const char *beg, size_t len)
+{
+	size_t l;
+
+	if (len < 4 || beg[len - 1] != '=')
+		return MUSTACH_ERROR_BAD_SEPARATORS;
+	len--;
+	while (len && isspace(*beg))
+		beg++, len--;
+	while (len && isspace(beg[len - 1]))
+		len--;
+	for (l = 0; l < len && !isspace(beg[l]) ; l++);
+	if (l == len || l > MUSTACH_MAX_DELIM_LENGTH)
+		return MUSTACH_ERROR_BAD_SEPARATORS;
+	lex->oplen = l;
+	memcpy(lex->opstr, beg, l);
+	while (l < len && isspace(beg[l])) l++;
+	if (l == len || len - l > MUSTACH_MAX_DELIM_LENGTH)
+		return MUSTACH_ERROR_BAD_SEPARATORS;
+	lex->cllen = len - l;
+	memcpy(lex->clstr, beg + l, lex->cllen);
+	return 0;
+}
+
+static void lexer_save_delims(struct lexer *lex, struct delims *delims)
+{
+	delims->oplen = lex->oplen;
+	delims->cllen = lex->cllen;
+	memcpy(delims->opstr, lex->opstr, lex->oplen);
+	memcpy(delims->clstr, lex->clstr, lex->cllen);
+}
+
+#if !defined(NO_LAZY)
+static void lexer_restore_delims(struct lexer *lex, const struct delims *delims)
+{
+	lex->oplen = delims->oplen;
+	lex->cllen = delims->cllen;
+	memcpy(lex->opstr, delims->opstr, delims->oplen);
+	memcpy(lex->clstr, delims->clstr, delims->cllen);
+}
+#endif
+
+static int lexer_scan(struct lexer *lex)
+{
+	struct mustach_token *token = &lex->token;
+	const char *beg, *term, *end = lex->end;
+	size_t len, l;
+	char c;
+
+	token->text = lex->pos;
+	token->line = lex->line;
+	token->flags = 0;
+	token->name = NULL;
+	token->namelen = 0;
+
+	/* search next openning delimiter */
+	for (beg = lex->pos ; ; beg++) {
+		if (beg == end) {
+			token->kind = Mustach_Token_End;
+			token->length = (size_t)(beg - lex->pos);
+			return 0;
+		}
+		c = *beg;
+		if (c == '\n') {
+			token->kind = Mustach_Token_Line;
+			token->length = (size_t)(++beg - lex->pos);
+			lex->pos = beg;
+			lex->line++;
+			return 0;
+		}
+		if (!isspace(c)) {
+			if (c == *lex->opstr && end - beg >= (ssize_t)lex->oplen) {
+				for (l = 1 ; l < lex->oplen && beg[l] == lex->opstr[l] ; l++);
+				if (l == lex->oplen)
+					break;
+			}
+			token->flags = Mustach_Token_NonSpace;
+		}
+	}
+	token->length = (size_t)(beg - lex->pos);
+	token->kind = Mustach_Token_Escaped; /* a tag, even if the scan fails */
+	beg += lex->oplen;
+
+	/* search next closing delimiter */
+	for (term = beg ; ; term++) {
+		if (term == end)
+			return MUSTACH_ERROR_UNEXPECTED_END;
+		if (*term == *lex->clstr && end - term >= (ssize_t)lex->cllen) {
+			for (l = 1 ; l < lex->cllen && term[l] == lex->clstr[l] ; l++);
+			if (l == lex->cllen)
+				break;
+		}
+		lex->line += *term == '\n';
+	}
+	lex->pos = term + lex->cllen;
+	len = (size_t)(term - beg);
+	c = *beg;
+	switch(c) {
+	case ':':
+		token->kind = Mustach_Token_Escaped;
+		if (lex->flags & Mustach_With_Colon)
+			goto exclude_first;
+		goto get_name;
+	case '!':
+		token->kind = Mustach_Token_Comment;
+		token->name = "";
+		return 0;
+	case '=':
+		token->kind = Mustach_Token_Delim;
+		token->name = beg + 1;
+		token->namelen = len - 1;
+		return 0;
+	case '{':
+		for (l = 0 ; l < lex->cllen && lex->clstr[l] == '}' ; l++);
+		if (l < lex->cllen) {
+			if (!len || beg[len-1] != '}')
+				return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
+			len--;
+		} else {
+			if (term[l] != '}')
+				return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
+			lex->pos++;
+		}
+		/*@fallthrough@*/
+	case '&':
+		token->kind = Mustach_Token_Raw;
+		goto exclude_first;
+	case '^':
+		token->kind = Mustach_Token_Inverted;
+		goto exclude_first;
+	case '#':
+		token->kind = Mustach_Token_Section;
+		goto exclude_first;
+	case '/':
+		token->kind = Mustach_Token_Close;
+		goto exclude_first;
+	case '>':
+		token->kind = Mustach_Token_Partial;
+exclude_first:
+		beg++;
+		len--;
+		goto get_name;
+	default:
+		token->kind = Mustach_Token_Escaped;
+get_name:
+		while (len && isspace(beg[0])) { beg++; len--; }
+		while (len && isspace(beg[len-1])) len--;
+		if (len == 0 && !(lex->flags & Mustach_With_EmptyTag))
+			return MUSTACH_ERROR_EMPTY_TAG;
+		if (len > MUSTACH_MAX_LENGTH)
+			return MUSTACH_ERROR_TAG_TOO_LONG;
+		memcpy(lex->name, beg, len);
+		lex->name[len] = 0;
+		token->name = beg;
+		token->namelen = len;
+		return 0;
+	}
+}
+
+/* reads more text of the stream after moving the kept text at the start of the window */
+static int stream_fill(struct lexer *lex)
+{
+	struct stream *stream = lex->stream;
+	size_t len, size, at;
+	char *buffer, *end;
+	int rc;
+
+	/* the kept text is moved in a larger window when filling more than half of it */
+	len = (size_t)(lex->end - stream->keep);
+	buffer = stream->buffer;
+	for (size = stream->size ; size - len < size / 2 ; size *= 2);
+	if (size != stream->size) {
+		buffer = malloc(size + 1);
+		if (buffer == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		memcpy(buffer, stream->keep, len);
+		if (stream->old == NULL)
+			stream->old = stream->buffer;
+		else
+			free(stream->buffer);
+		stream->buffer = buffer;
+		stream->size = size;
+	}
+	else if (stream->keep != buffer)
+		memmove(buffer, stream->keep, len);
+	if (stream->keep != buffer) {
+		at = (size_t)(lex->pos - stream->keep);
+		stream->offset += (size_t)(stream->keep - lex->template);
+		if (stream->from == NULL)
+			stream->from = stream->keep;
+		stream->keep = lex->template = lex->pos = buffer;
+		lex->pos += at;
+	}
+
+	/* fills the window */
+	end = &buffer[len];
+	while (!stream->eof && end != &buffer[size]) {
+		len = (size_t)(&buffer[size] - end);
+		rc = stream->readcb(stream->closure, end, len > INT_MAX ? INT_MAX : len);
+		if (rc < 0)
+			return rc;
+		if (rc == 0)
+			stream->eof = 1;
+		end += rc;
+	}
+	*end = 0;
+	lex->end = end;
+	return 0;
+}
+
+/* scans the next token of the stream, reading the text until the token is complete */
+static int stream_scan(struct lexer *lex)
+{
+	unsigned line = lex->line;
+	int rc;
+
+	for (;;) {
+		rc = lexer_scan(lex);
+		if (lex->stream->eof || (rc != MUSTACH_ERROR_UNEXPECTED_END
+				&& lex->token.kind != Mustach_Token_End && lex->pos < lex->end))
+			return rc;
+		lex->pos = lex->token.text;
+		lex->line = line;
+		rc = stream_fill(lex);
+		if (rc < 0)
+			return rc;
+	}
+}
+
+/* rebases the pointer 'at' of process after the move of the window */
+static inline const char *stream_rebase(const struct stream *stream, const char *at)
+{
+	return stream->keep + (at - stream->from);
+}
+
+/* releases the previous window after the rebase of the pointers of process */
+static void stream_rebased(struct stream *stream)
+{
+	free(stream->old);
+	stream->old = NULL;
+	stream->from = NULL;
+}
+
+/* records the name of a section whose text isn't kept */
+static int stream_push_name(struct stream *stream, const char *name, size_t length)
+{
+	char *names;
+	size_t size;
+
+	if (stream->namessize - stream->nameslen < length) {
+		size = stream->namessize + (length > 1024 ? length : 1024);
+		names = realloc(stream->names, size);
+		if (names == NULL)
+			return MUSTACH_ERROR_SYSTEM;
+		stream->names = names;
+		stream->namessize = size;
+	}
+	memcpy(&stream->names[stream->nameslen], name, length);
+	stream->nameslen += length;
+	return 0;
+}
+
+static inline int lexer_next(struct lexer *lex, const struct mustach_token **token)
+{
+	if (lex->tok) {
+		*token = lex->tok++;
+		return 0;
+	}
+	*token = &lex->token;
+	return lex->stream == NULL ? lexer_scan(lex) : stream_scan(lex);
 }
 
-static int process(const char *template, size_t length, struct iwrap *iwrap, FILE *file, struct prefix *prefix)
+/* zero terminated name of the token returned by lexer_next */
+static inline const char *lexer_name(struct lexer *lex, const struct mustach_token *token)
+{
+	return token == &lex->token ? lex->name : token->name;
+}
+
+static int process(struct lexer *lex, struct iwrap *iwrap, FILE *file, const struct prefix *indent, const struct mustach_srcpos *parent, const char *partname);
+#if !defined(NO_LAZY)
+static const struct mustach_token *lazy_body(const struct mustach_token *open);
+#endif
+
+static int process_partial(struct iwrap *iwrap, FILE *file, const struct prefix *indent, const struct mustach_srcpos *parent, const struct mustach_template *compiled, const char *name)
 {
 	struct mustach_sbuf sbuf;
-	char opstr[MUSTACH_MAX_DELIM_LENGTH], clstr[MUSTACH_MAX_DELIM_LENGTH];
-	char name[MUSTACH_MAX_LENGTH + 1], c;
-	const char *beg, *term, *end;
-	struct { const char *name, *again; size_t length; unsigned enabled: 1, entered: 1; } stack[MUSTACH_MAX_DEPTH];
-	size_t oplen, cllen, len, l;
-	int depth, rc, enabled, stdalone;
+	struct lexer lex;
+	int rc;
+
+	if (!compiled && iwrap->compiled) {
+		rc = iwrap->compiled(iwrap->closure, name, &compiled);
+		if (rc < 0)
+			return rc;
+		if (rc == 0)
+			compiled = NULL;
+	}
+	if (compiled) {
+		lexer_init_compiled(&lex, compiled, iwrap->flags);
+		return process(&lex, iwrap, file, indent, parent, name);
+	}
+	sbuf_reset(&sbuf);
+	rc = ICALL(iwrap, partial, iwrap->closure_partial, name, &sbuf);
+	if (rc >= 0) {
+		lexer_init(&lex, sbuf.value, sbuf_length(&sbuf), NULL, iwrap->flags);
+		rc = process(&lex, iwrap, file, indent, parent, name);
+		sbuf_release(&sbuf);
+	}
+	return rc;
+}
+
+/*
+ * Processes the partial whose tag is preceded by 'pref'. The prefix of its
+ * texts is the one of the including partials followed by the text of 'pref',
+ * flattened in one string so that it is emitted at once.
+ */
+static int process_indented(struct iwrap *iwrap, FILE *file, const struct prefix *pref, const struct mustach_srcpos *parent, const struct mustach_template *compiled, const char *name)
+{
+	struct prefix indent;
+	char buffer[INDENT_SIZE], *text;
+	int rc;
+
+	if (!pref->len)
+		return process_partial(iwrap, file, pref->indent, parent, compiled, name);
+	indent.indent = NULL;
+	if (!pref->indent) {
+		indent.start = pref->start;
+		indent.len = pref->len;
+		return process_partial(iwrap, file, &indent, parent, compiled, name);
+	}
+	indent.len = pref->indent->len + pref->len;
+	text = indent.len <= sizeof buffer ? buffer : malloc(indent.len);
+	if (text == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	memcpy(text, pref->indent->start, pref->indent->len);
+	memcpy(&text[pref->indent->len], pref->start, pref->len);
+	indent.start = text;
+	rc = process_partial(iwrap, file, &indent, parent, compiled, name);
+	if (text != buffer)
+		free(text);
+	return rc;
+}
+
+/* renders by its generated function 'render' the template prefixed by 'indent' */
+static int process_generated(int (*render)(const struct mustach_run *run), struct iwrap *iwrap, FILE *file, const struct prefix *indent)
+{
+	struct mustach_run run;
+
+	run.emit = iwrap->emit;
+	run.put = iwrap->put;
+	run.enter = iwrap->enter;
+	run.next = iwrap->next;
+	run.leave = iwrap->leave;
+	run.closure = iwrap->closure;
+	run.closure_put = iwrap->closure_put;
+	run.file = file;
+	run.prefix = indent ? indent->start : NULL;
+	run.prefixlen = indent ? indent->len : 0;
+	run.internal = iwrap;
+	return render(&run);
+}
+
+int mustach_run_partial(const struct mustach_run *run, const char *name,
+		const struct mustach_template *tmpl, const char *prefix, size_t length)
+{
+	struct prefix indent, pref;
+
+	indent.start = run->prefix;
+	indent.len = run->prefixlen;
+	indent.indent = NULL;
+	pref.start = prefix;
+	pref.len = length;
+	pref.indent = run->prefix ? &indent : NULL;
+	return process_indented(run->internal, run->file, &pref, NULL, tmpl, name);
+}
+
+/*
+ * Processes the template of 'lex'. When it is a partial, its texts are
+ * prefixed by 'indent', the flattened prefixes of the including partials.
+ */
+static int process(struct lexer *lex, struct iwrap *iwrap, FILE *file, const struct prefix *indent, const struct mustach_srcpos *parent, const char *partname)
+{
+	const struct mustach_token *tok;
+	const char *name;
+	struct { const char *name, *again; const struct mustach_token *againtok, *resume; size_t length; unsigned line; unsigned enabled: 1, entered: 1, keep: 1; } stack[MUSTACH_MAX_DEPTH];
+	int depth, rc, enabled, stdalone, i;
 	struct prefix pref;
+	struct mustach_srcpos pos;
+	const char *keep;
 
-	pref.prefix = prefix;
-	end = template + (length ? length : strlen(template));
-	opstr[0] = opstr[1] = '{';
-	clstr[0] = clstr[1] = '}';
-	oplen = cllen = 2;
+	/* the generated functions don't report positions, their tokens do */
+	if (lex->render != NULL && iwrap->srcpos == NULL)
+		return process_generated(lex->render, iwrap, file, indent);
+	pref.indent = indent;
+	pos.parent = parent;
+	pos.name = partname;
+	pos.text = lex->stream == NULL ? lex->template : NULL;
 	stdalone = enabled = 1;
 	depth = pref.len = 0;
+	keep = NULL;
 	for (;;) {
-		/* search next openning delimiter */
-		for (beg = template ; ; beg++) {
-			c = beg == end ? '\n' : *beg;
-			if (c == '\n') {
-				l = (beg != end) + (size_t)(beg - template);
-				if (stdalone != 2 && enabled) {
-					if (beg != template /* don't prefix empty lines */) {
-						rc = emitprefix(iwrap, file, &pref);
-						if (rc < 0)
-							return rc;
+		if (lex->stream == NULL)
+			rc = lexer_next(lex, &tok);
+		else {
+			/* the text of the sections that can iterate and the pending text are kept */
+			lex->stream->keep = keep != NULL ? keep : stdalone == 2 ? pref.start : lex->pos;
+			rc = lexer_next(lex, &tok);
+			if (lex->stream->from != NULL) {
+				for (i = 0 ; i < depth ; i++)
+					if (stack[i].name != NULL) {
+						stack[i].name = stream_rebase(lex->stream, stack[i].name);
+						stack[i].again = stream_rebase(lex->stream, stack[i].again);
 					}
-					rc = iwrap->emit(iwrap->closure, template, l, 0, file);
+				if (keep != NULL)
+					keep = stream_rebase(lex->stream, keep);
+				if (stdalone == 2)
+					pref.start = stream_rebase(lex->stream, pref.start);
+				stream_rebased(lex->stream);
+			}
+		}
+
+		/* text before the tag or the end of line */
+		if (stdalone == 2 && enabled && (tok->kind > Mustach_Token_Line || (tok->flags & Mustach_Token_NonSpace))) {
+			int rc2 = srcpos(iwrap, file, &pos, lex, pref.start, tok->line);
+			if (rc2 >= 0)
+				rc2 = emitpref(iwrap, file, &pref);
+			if (rc2 < 0)
+				return rc2;
+			pref.len = 0;
+			stdalone = 0;
+		}
+		if (rc < 0)
+			return rc;
+		if (tok->flags & Mustach_Token_NonSpace)
+			stdalone = 0;
+		if (tok->kind <= Mustach_Token_Line) {
+			if (stdalone != 2 && enabled) {
+				if (tok->length) {
+					rc = srcpos(iwrap, file, &pos, lex, tok->text, tok->line);
 					if (rc < 0)
 						return rc;
 				}
-				if (beg == end) /* no more mustach */
-					return depth ? MUSTACH_ERROR_UNEXPECTED_END : MUSTACH_OK;
-				template += l;
-				stdalone = 1;
-				pref.len = 0;
-			}
-			else if (!isspace(c)) {
-				if (stdalone == 2 && enabled) {
-					rc = emitprefix(iwrap, file, &pref);
+				if (tok->length > (tok->kind == Mustach_Token_Line) /* don't prefix empty lines */) {
+					rc = emitpref(iwrap, file, &pref);
 					if (rc < 0)
 						return rc;
-					pref.len = 0;
-					stdalone = 0;
-				}
-				if (c == *opstr && end - beg >= (ssize_t)oplen) {
-					for (l = 1 ; l < oplen && beg[l] == opstr[l] ; l++);
-					if (l == oplen)
-						break;
 				}
-				stdalone = 0;
+				rc = ICALL(iwrap, emit, iwrap->closure, tok->text, tok->length, 0, file);
+				if (rc < 0)
+					return rc;
 			}
+			if (tok->kind == Mustach_Token_End) /* no more mustach */
+				return depth ? MUSTACH_ERROR_UNEXPECTED_END : MUSTACH_OK;
+			stdalone = 1;
+			pref.len = 0;
+			continue;
 		}
 
-		pref.start = template;
-		pref.len = enabled ? (size_t)(beg - template) : 0;
-		beg += oplen;
-
-		/* search next closing delimiter */
-		for (term = beg ; ; term++) {
-			if (term == end)
-				return MUSTACH_ERROR_UNEXPECTED_END;
-			if (*term == *clstr && end - term >= (ssize_t)cllen) {
-				for (l = 1 ; l < cllen && term[l] == clstr[l] ; l++);
-				if (l == cllen)
-					break;
-			}
-		}
-		template = term + cllen;
-		len = (size_t)(term - beg);
-		c = *beg;
-		switch(c) {
-		case ':':
-			stdalone = 0;
-			if (iwrap->flags & Mustach_With_Colon)
-				goto exclude_first;
-			goto get_name;
-		case '!':
-		case '=':
-			break;
-		case '{':
-			for (l = 0 ; l < cllen && clstr[l] == '}' ; l++);
-			if (l < cllen) {
-				if (!len || beg[len-1] != '}')
-					return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
-				len--;
-			} else {
-				if (term[l] != '}')
-					return MUSTACH_ERROR_BAD_UNESCAPE_TAG;
-				template++;
-			}
-			c = '&';
-			/*@fallthrough@*/
-		case '&':
+		/* the tag */
+		pref.start = tok->text;
+		pref.len = enabled ? tok->length : 0;
+		if (tok->kind >= Mustach_Token_Escaped)
 			stdalone = 0;
-			/*@fallthrough@*/
-		case '^':
-		case '#':
-		case '/':
-		case '>':
-exclude_first:
-			beg++;
-			len--;
-			goto get_name;
-		default:
-			stdalone = 0;
-get_name:
-			while (len && isspace(beg[0])) { beg++; len--; }
-			while (len && isspace(beg[len-1])) len--;
-			if (len == 0 && !(iwrap->flags & Mustach_With_EmptyTag))
-				return MUSTACH_ERROR_EMPTY_TAG;
-			if (len > MUSTACH_MAX_LENGTH)
-				return MUSTACH_ERROR_TAG_TOO_LONG;
-			memcpy(name, beg, len);
-			name[len] = 0;
-			break;
-		}
 		if (stdalone)
 			stdalone = 2;
 		else if (enabled) {
-			rc = emitprefix(iwrap, file, &pref);
+			if (pref.len || pref.indent) {
+				rc = srcpos(iwrap, file, &pos, lex, pref.start, tok->line);
+				if (rc < 0)
+					return rc;
+			}
+			rc = emitpref(iwrap, file, &pref);
 			if (rc < 0)
 				return rc;
 			pref.len = 0;
 		}
-		switch(c) {
-		case '!':
-			/* comment */
+		name = lexer_name(lex, tok);
+		switch(tok->kind) {
+		case Mustach_Token_Comment:
 			/* nothing to do */
 			break;
-		case '=':
+		case Mustach_Token_Delim:
 			/* defines delimiters */
-			if (len < 5 || beg[len - 1] != '=')
-				return MUSTACH_ERROR_BAD_SEPARATORS;
-			beg++;
-			len -= 2;
-			while (len && isspace(*beg))
-				beg++, len--;
-			while (len && isspace(beg[len - 1]))
-				len--;
-			for (l = 0; l < len && !isspace(beg[l]) ; l++);
-			if (l == len || l > MUSTACH_MAX_DELIM_LENGTH)
-				return MUSTACH_ERROR_BAD_SEPARATORS;
-			oplen = l;
-			memcpy(opstr, beg, l);
-			while (l < len && isspace(beg[l])) l++;
-			if (l == len || len - l > MUSTACH_MAX_DELIM_LENGTH)
-				return MUSTACH_ERROR_BAD_SEPARATORS;
-			cllen = len - l;
-			memcpy(clstr, beg + l, cllen);
+			rc = lexer_delim(lex, tok->name, tok->namelen);
+			if (rc < 0)
+				return rc;
 			break;
-		case '^':
-		case '#':
+		case Mustach_Token_Inverted:
+		case Mustach_Token_Section:
 			/* begin section */
 			if (depth == MUSTACH_MAX_DEPTH)
 				return MUSTACH_ERROR_TOO_DEEP;
 			rc = enabled;
 			if (rc) {
-				rc = iwrap->enter(iwrap->closure, name);
+				rc = ICALL(iwrap, enter, iwrap->closure, name);
 				if (rc < 0)
 					return rc;
 			}
-			stack[depth].name = beg;
-			stack[depth].again = template;
-			stack[depth].length = len;
+			stack[depth].resume = NULL;
+#if !defined(NO_LAZY)
+			if (lex->tok && tok->partial) {
+				/* section compiled lazily, its body is not in the tokens */
+				const struct lazy *lz = (const struct lazy*)tok->partial;
+				if (!enabled || (tok->kind == Mustach_Token_Section) == (rc == 0)) {
+					/* skip the body */
+					if (rc)
+						ICALL(iwrap, leave, iwrap->closure);
+					lexer_restore_delims(lex, &lz->end);
+					pref.start = lz->close;
+					pref.len = 0;
+					if (lz->stdalone >= 0)
+						stdalone = lz->stdalone;
+					break;
+				}
+				stack[depth].resume = lex->tok;
+				lex->tok = lazy_body(tok);
+				if (lex->tok == NULL)
+					return MUSTACH_ERROR_SYSTEM;
+			}
+#endif
+			stack[depth].name = tok->name;
+			stack[depth].length = tok->namelen;
+			stack[depth].againtok = lex->tok;
+			stack[depth].again = lex->tok ? lex->tok->text : lex->pos;
+			stack[depth].line = lex->tok ? lex->tok->line : lex->line;
 			stack[depth].enabled = enabled != 0;
 			stack[depth].entered = rc != 0;
-			if ((c == '#') == (rc == 0))
+			stack[depth].keep = 0;
+			if (lex->stream != NULL && keep == NULL) {
+				if (rc && tok->kind == Mustach_Token_Section) {
+					/* the section can iterate, its text is kept from its opening */
+					keep = tok->text;
+					stack[depth].keep = 1;
+				} else {
+					/* the section is processed once, only its name is kept */
+					int rc2 = stream_push_name(lex->stream, tok->name, tok->namelen);
+					if (rc2 < 0)
+						return rc2;
+					stack[depth].name = NULL;
+				}
+			}
+			if ((tok->kind == Mustach_Token_Section) == (rc == 0))
 				enabled = 0;
 			depth++;
 			break;
-		case '/':
+		case Mustach_Token_Close:
 			/* end section */
-			if (depth-- == 0 || len != stack[depth].length || memcmp(stack[depth].name, name, len))
+			if (depth-- == 0 || tok->namelen != stack[depth].length)
 				return MUSTACH_ERROR_CLOSING;
-			rc = enabled && stack[depth].entered ? iwrap->next(iwrap->closure) : 0;
+			if (stack[depth].name != NULL)
+				name = stack[depth].name;
+			else {
+				/* name of a section read progressively whose text isn't kept */
+				lex->stream->nameslen -= tok->namelen;
+				name = &lex->stream->names[lex->stream->nameslen];
+			}
+			if (memcmp(name, tok->name, tok->namelen))
+				return MUSTACH_ERROR_CLOSING;
+			rc = enabled && stack[depth].entered ? ICALL(iwrap, next, iwrap->closure) : 0;
 			if (rc < 0)
 				return rc;
 			if (rc) {
-				template = stack[depth++].again;
+				if (lex->tok && !(tok->flags & Mustach_Token_Relex))
+					lex->tok = stack[depth].againtok;
+				else {
+					/* iterate on the text with the current delimiters */
+					lex->tok = NULL;
+					lex->pos = stack[depth].again;
+					lex->line = stack[depth].line;
+				}
+				depth++;
 			} else {
 				enabled = stack[depth].enabled;
 				if (enabled && stack[depth].entered)
-					iwrap->leave(iwrap->closure);
+					ICALL(iwrap, leave, iwrap->closure);
+				if (stack[depth].resume && lex->tok) /* back to the tokens of the lazy parent unless rescanning */
+					lex->tok = stack[depth].resume;
+				if (stack[depth].keep)
+					keep = NULL;
 			}
 			break;
-		case '>':
+		case Mustach_Token_Partial:
 			/* partials */
 			if (enabled) {
-				sbuf_reset(&sbuf);
-				rc = iwrap->partial(iwrap->closure_partial, name, &sbuf);
-				if (rc >= 0) {
-					rc = process(sbuf.value, sbuf_length(&sbuf), iwrap, file, &pref);
-					sbuf_release(&sbuf);
-				}
+				pos.offset = lexer_offset(lex, tok->text + tok->length);
+				pos.line = tok->line;
+				rc = process_indented(iwrap, file, &pref, &pos, tok->partial, name);
 				if (rc < 0)
 					return rc;
 			}
@@ -438,7 +944,10 @@ get_name:
 		default:
 			/* replacement */
 			if (enabled) {
-				rc = iwrap->put(iwrap->closure_put, name, c != '&', file);
+				rc = srcpos(iwrap, file, &pos, lex, tok->text + tok->length, tok->line);
+				if (rc < 0)
+					return rc;
+				rc = iwrap->put(iwrap->closure_put, name, tok->kind == Mustach_Token_Escaped, file);
 				if (rc < 0)
 					return rc;
 			}
@@ -447,7 +956,524 @@ get_name:
 	}
 }
 
-int mustach_file(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, FILE *file)
+struct sizes {
+	size_t tokens;  /* count of tokens */
+	size_t lazies;  /* count of lazy sections */
+	size_t names;   /* size of the names */
+};
+
+/*
+ * Compiles the text of 'lex' or, when 'open' is not NULL, the body of the
+ * section opened by 'open' up to its closing token included. When 'lazy' is
+ * set, the sections are not compiled but recorded in 'lazies'.
+ */
+static int compile(struct lexer *lex, struct mustach_token *tokens, struct lazy *lazies, char *names, int lazy, const struct mustach_token *open, struct sizes *sizes)
+{
+	const struct mustach_token *tok;
+	struct { const char *name; size_t length; struct delims delims; } stack[MUSTACH_MAX_DEPTH];
+	struct lazy *lz;
+	int depth, level, rc, relex, record, opening, brk, nl;
+	size_t n, l, s;
+
+	depth = level = 0;
+	n = l = s = 0;
+	lz = NULL;
+	brk = nl = 0;
+	if (open != NULL) {
+		stack[0].name = open->name;
+		stack[0].length = open->namelen;
+		lexer_save_delims(lex, &stack[0].delims);
+		depth = level = 1;
+	}
+	for (;;) {
+		rc = lexer_scan(lex);
+		if (rc < 0)
+			return rc;
+		tok = &lex->token;
+		relex = opening = 0;
+		record = !lazy || depth <= level;
+		if (!record) {
+			/* standalone state when skipping the body, as in process */
+			if (tok->flags & Mustach_Token_NonSpace)
+				brk = 1;
+			if (tok->kind == Mustach_Token_Line)
+				brk = 0, nl = 1;
+			else if (tok->kind >= Mustach_Token_Escaped)
+				brk = 1;
+		}
+		switch (tok->kind) {
+		case Mustach_Token_End:
+			if (depth)
+				return MUSTACH_ERROR_UNEXPECTED_END;
+			break;
+		case Mustach_Token_Delim:
+			rc = lexer_delim(lex, tok->name, tok->namelen);
+			if (rc < 0)
+				return rc;
+			break;
+		case Mustach_Token_Inverted:
+		case Mustach_Token_Section:
+			if (depth == MUSTACH_MAX_DEPTH)
+				return MUSTACH_ERROR_TOO_DEEP;
+			stack[depth].name = tok->name;
+			stack[depth].length = tok->namelen;
+			lexer_save_delims(lex, &stack[depth].delims);
+			if (lazy && depth == level) {
+				opening = 1;
+				brk = nl = 0;
+				if (lazies != NULL) {
+					lz = &lazies[l];
+					lz->body.text = lex->pos;
+					lz->body.tokens = NULL;
+					lz->body.render = NULL;
+					lz->line = lex->line;
+					lz->flags = lex->flags;
+					lexer_save_delims(lex, &lz->start);
+				}
+				l++;
+			}
+			depth++;
+			break;
+		case Mustach_Token_Close:
+			if (depth-- == 0 || tok->namelen != stack[depth].length || memcmp(stack[depth].name, tok->name, tok->namelen))
+				return MUSTACH_ERROR_CLOSING;
+			relex = stack[depth].delims.oplen != lex->oplen || stack[depth].delims.cllen != lex->cllen
+				|| memcmp(stack[depth].delims.opstr, lex->opstr, lex->oplen)
+				|| memcmp(stack[depth].delims.clstr, lex->clstr, lex->cllen);
+			if (!record && depth == level && lz != NULL) {
+				/* end of the lazy section */
+				lz->body.length = (size_t)(lex->pos - lz->body.text);
+				lexer_save_delims(lex, &lz->end);
+				lz->close = tok->text;
+				lz->stdalone = brk ? 0 : nl ? 2 : -1;
+			}
+			break;
+		}
+		if (record) {
+			if (tokens != NULL) {
+				tokens[n] = *tok;
+				if (relex)
+					tokens[n].flags |= Mustach_Token_Relex;
+				if (opening)
+					tokens[n].partial = &lz->body;
+				if (tok->name != NULL) {
+					memcpy(&names[s], tok->name, tok->namelen);
+					names[s + tok->namelen] = 0;
+					tokens[n].name = &names[s];
+				}
+			}
+			if (tok->name != NULL)
+				s += tok->namelen + 1;
+			n++;
+		}
+		if (tok->kind == Mustach_Token_End || (open != NULL && depth == 0))
+			break;
+	}
+	sizes->tokens = n;
+	sizes->lazies = l;
+	sizes->names = s;
+	return MUSTACH_OK;
+}
+
+static int compile_template(const char *template, size_t length, int flags, int lazy, struct mustach_template **result)
+{
+	struct lexer lex;
+	struct mustach_template *tmpl;
+	struct mustach_token *tokens;
+	struct lazy *lazies;
+	struct sizes sizes;
+	int rc;
+
+	*result = NULL;
+	lexer_init(&lex, template, length, NULL, flags);
+	rc = compile(&lex, NULL, NULL, NULL, lazy, NULL, &sizes);
+	if (rc < 0)
+		return rc;
+	tmpl = malloc(sizeof *tmpl + sizes.tokens * sizeof *tokens + sizes.lazies * sizeof *lazies + sizes.names);
+	if (tmpl == NULL) {
+		errno = ENOMEM;
+		return MUSTACH_ERROR_SYSTEM;
+	}
+	tokens = (struct mustach_token*)&tmpl[1];
+	lazies = (struct lazy*)&tokens[sizes.tokens];
+	lexer_init(&lex, template, length, NULL, flags);
+	compile(&lex, tokens, lazies, (char*)&lazies[sizes.lazies], lazy, NULL, &sizes);
+	tmpl->text = template;
+	tmpl->length = (size_t)(lex.end - template);
+	tmpl->tokens = tokens;
+	tmpl->render = NULL;
+	*result = tmpl;
+	return MUSTACH_OK;
+}
+
+int mustach_compile(const char *template, size_t length, int flags, struct mustach_template **result)
+{
+	return compile_template(template, length, flags, 0, result);
+}
+
+int mustach_compile_lazy(const char *template, size_t length, int flags, struct mustach_template **result)
+{
+#if defined(NO_LAZY)
+	return compile_template(template, length, flags, 0, result);
+#else
+	return compile_template(template, length, flags, 1, result);
+#endif
+}
+
+#if !defined(NO_LAZY)
+/*
+ * Returns the tokens of the body of the lazy section opened by 'open',
+ * compiling them when first entered. When threads race for compiling,
+ * the first to publish wins and the others release their tokens.
+ */
+static const struct mustach_token *lazy_body(const struct mustach_token *open)
+{
+	struct lazy *lz = (struct lazy*)open->partial;
+	const struct mustach_token *tokens;
+	struct mustach_token *compiled;
+	struct lazy *lazies;
+	struct lexer lex;
+	struct sizes sizes;
+	int pass;
+
+	tokens = __atomic_load_n(&lz->body.tokens, __ATOMIC_ACQUIRE);
+	if (tokens != NULL)
+		return tokens;
+	compiled = NULL;
+	lazies = NULL;
+	for (pass = 0 ; pass < 2 ; pass++) {
+		lexer_init(&lex, lz->body.text, lz->body.length, NULL, lz->flags);
+		lex.line = lz->line;
+		lexer_restore_delims(&lex, &lz->start);
+		if (compile(&lex, compiled, lazies, compiled ? (char*)&lazies[sizes.lazies] : NULL, 1, open, &sizes) < 0) {
+			free(compiled);
+			return NULL;
+		}
+		if (pass == 0) {
+			compiled = malloc(sizes.tokens * sizeof *compiled + sizes.lazies * sizeof *lazies + sizes.names);
+			if (compiled == NULL) {
+				errno = ENOMEM;
+				return NULL;
+			}
+			lazies = (struct lazy*)&compiled[sizes.tokens];
+		}
+	}
+	if (__atomic_compare_exchange_n(&lz->body.tokens, &tokens, compiled, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		tokens = compiled;
+	else
+		free(compiled); /* compiled meanwhile by an other thread */
+	return tokens;
+}
+#endif
+
+/* releases the bodies compiled for the lazy sections of 'tok' */
+static void lazy_free(const struct mustach_token *tok)
+{
+	const struct lazy *lz;
+
+	for ( ; tok->kind != Mustach_Token_End && tok->kind != Mustach_Token_Close ; tok++)
+		if ((tok->kind == Mustach_Token_Section || tok->kind == Mustach_Token_Inverted) && tok->partial != NULL) {
+			lz = (const struct lazy*)tok->partial;
+			if (lz->body.tokens != NULL) {
+				lazy_free(lz->body.tokens);
+				free((void*)lz->body.tokens);
+			}
+		}
+}
+
+void mustach_template_free(struct mustach_template *tmpl)
+{
+	if (tmpl != NULL) {
+		lazy_free(tmpl->tokens);
+		free(tmpl);
+	}
+}
+
+/*
+ * Inlining of the partials: the tokens of the partials known when inlining
+ * replace their standalone tags, the prefix of the tags being put in the
+ * texts of the partials as process emits it. The partials are resolved once,
+ * when counting, and then taken in the same order when filling.
+ */
+struct indent {
+	const char *text;
+	size_t len;
+	const struct indent *outer;
+};
+
+struct inliner {
+	int (*compiled)(void *closure, const char *name, const struct mustach_template **tmpl);
+	void *closure;
+	struct mustach_token *tokens; /* NULL when counting */
+	char *texts;
+	size_t ntokens, ntexts;
+	const struct mustach_template **found; /* resolved partials or NULL */
+	size_t nfound, afound, ifound;
+	int nested; /* count of partials being inlined */
+	const struct mustach_template *inlining[MUSTACH_MAX_DEPTH];
+};
+
+static size_t indent_length(const struct indent *ind)
+{
+	size_t len;
+
+	for (len = 0 ; ind != NULL ; ind = ind->outer)
+		len += ind->len;
+	return len;
+}
+
+static char *indent_put(char *dest, const struct indent *ind)
+{
+	if (ind != NULL) {
+		dest = indent_put(dest, ind->outer);
+		memcpy(dest, ind->text, ind->len);
+		dest += ind->len;
+	}
+	return dest;
+}
+
+/* adds a copy of 'tok' of 'kind', its text prefixed by 'ind' */
+static struct mustach_token *inline_add(struct inliner *inl, const struct mustach_token *tok, unsigned char kind, size_t length, const struct indent *ind)
+{
+	struct mustach_token *added;
+	size_t len;
+	char *text;
+
+	len = indent_length(ind);
+	added = NULL;
+	if (inl->tokens != NULL) {
+		added = &inl->tokens[inl->ntokens];
+		*added = *tok;
+		added->kind = kind;
+		added->length = length;
+		if (len) {
+			text = &inl->texts[inl->ntexts];
+			memcpy(indent_put(text, ind), tok->text, length);
+			added->text = text;
+			added->length = len + length;
+		}
+	}
+	inl->ntokens++;
+	inl->ntexts += len ? len + length : 0;
+	return added;
+}
+
+/* resolves the partial of 'tok', returns 1 if found, 0 if not or a negative error */
+static int inline_partial(struct inliner *inl, const struct mustach_token *tok, const struct mustach_template **partial)
+{
+	const struct mustach_template **found;
+	int rc;
+
+	if (inl->tokens != NULL) {
+		*partial = inl->found[inl->ifound++];
+		return *partial != NULL;
+	}
+	*partial = tok->partial;
+	rc = *partial != NULL;
+	if (!rc && inl->compiled != NULL) {
+		rc = inl->compiled(inl->closure, tok->name, partial);
+		if (rc < 0)
+			return rc;
+		if (rc == 0)
+			*partial = NULL;
+	}
+	if (inl->nfound == inl->afound) {
+		inl->afound = inl->afound ? 2 * inl->afound : 16;
+		found = realloc(inl->found, inl->afound * sizeof *found);
+		if (found == NULL) {
+			errno = ENOMEM;
+			return MUSTACH_ERROR_SYSTEM;
+		}
+		inl->found = found;
+	}
+	inl->found[inl->nfound++] = *partial;
+	return rc;
+}
+
+/* tells if the section opened by 'tok' is iterated from the text */
+static int inline_relexed(const struct mustach_token *tok)
+{
+	int depth;
+
+	for (depth = 0 ;; ) {
+		switch (tok++->kind) {
+		case Mustach_Token_Section:
+		case Mustach_Token_Inverted:
+			depth++;
+			break;
+		case Mustach_Token_Close:
+			if (--depth == 0)
+				return (tok[-1].flags & Mustach_Token_Relex) != 0;
+			break;
+		case Mustach_Token_End:
+			return 0;
+		}
+	}
+}
+
+/*
+ * Tells if 'tmpl' can be inlined at 'depth' of sections. When 'prefixed',
+ * the prefix that process would emit alone, without the text of a tag,
+ * must not be lost: its partials must begin the lines and the sections
+ * that can be standalone must end their lines.
+ */
+static int inline_able(struct inliner *inl, const struct mustach_template *tmpl, int depth, int prefixed)
+{
+	const struct mustach_token *tok;
+	int i, bol, stdalone;
+
+	if (inl->nested == MUSTACH_MAX_DEPTH)
+		return 0;
+	for (i = 0 ; i < inl->nested ; i++)
+		if (inl->inlining[i] == tmpl)
+			return 0; /* recursion */
+	bol = stdalone = 1;
+	for (tok = tmpl->tokens ; tok->kind != Mustach_Token_End ; bol = tok++->kind == Mustach_Token_Line) {
+		if (tok->flags & Mustach_Token_NonSpace)
+			stdalone = 0;
+		switch (tok->kind) {
+		case Mustach_Token_Line:
+			stdalone = 1;
+			break;
+		case Mustach_Token_Delim:
+			return 0; /* its delimiters would leak */
+		case Mustach_Token_Section:
+		case Mustach_Token_Inverted:
+			if (tok->partial != NULL || ++depth > MUSTACH_MAX_DEPTH)
+				return 0; /* compiled lazily or too deep */
+			break;
+		case Mustach_Token_Close:
+			depth--;
+			if (prefixed && stdalone && (tok[1].kind > Mustach_Token_Line || (tok[1].flags & Mustach_Token_NonSpace)))
+				return 0; /* the prefix would be emitted alone after a disabled section */
+			break;
+		case Mustach_Token_Partial:
+			if (prefixed && (!bol || (tok->flags & Mustach_Token_NonSpace)))
+				return 0; /* the prefix emitted before the tag would be lost */
+			break;
+		case Mustach_Token_Escaped:
+		case Mustach_Token_Raw:
+			stdalone = 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Inlines the tokens 'tok' prefixed by 'ind' at 'depth' of sections.
+ * For partials, 'nested' is set and their end becomes an end of line.
+ */
+static int inline_tokens(struct inliner *inl, const struct mustach_token *tok, const struct indent *ind, int depth, int nested)
+{
+	const struct mustach_template *partial;
+	struct mustach_token *added;
+	struct indent sub;
+	int rc, bol, first, frozen;
+	size_t length;
+
+	bol = 1;
+	frozen = 0;
+	for (;; tok++) {
+		first = bol;
+		bol = tok->kind == Mustach_Token_Line;
+		switch (tok->kind) {
+		case Mustach_Token_End:
+		case Mustach_Token_Line:
+			length = tok->length;
+		endofline:
+			/* like process, empty lines aren't prefixed */
+			inline_add(inl, tok, tok->kind == Mustach_Token_End && nested ? Mustach_Token_Line : tok->kind, length,
+				length > (tok->kind == Mustach_Token_Line) ? ind : NULL);
+			if (tok->kind == Mustach_Token_End)
+				return MUSTACH_OK;
+			continue;
+		case Mustach_Token_Section:
+		case Mustach_Token_Inverted:
+			depth++;
+			if (!frozen && inline_relexed(tok))
+				frozen = depth; /* its text is processed when iterated */
+			break;
+		case Mustach_Token_Close:
+			if (frozen == depth)
+				frozen = 0;
+			depth--;
+			break;
+		case Mustach_Token_Partial:
+			rc = inline_partial(inl, tok, &partial);
+			if (rc < 0)
+				return rc;
+			if (rc && !frozen && first && !(tok->flags & Mustach_Token_NonSpace)
+			 && tok[1].kind <= Mustach_Token_Line && !(tok[1].flags & Mustach_Token_NonSpace)
+			 && inline_able(inl, partial, depth, tok->length || indent_length(ind))) {
+				/* standalone tag replaced by the prefixed partial */
+				sub.text = tok->text;
+				sub.len = tok->length;
+				sub.outer = ind;
+				inl->inlining[inl->nested++] = partial;
+				rc = inline_tokens(inl, partial->tokens, &sub, depth, 1);
+				inl->nested--;
+				if (rc < 0)
+					return rc;
+				/* the end of its line is dropped */
+				bol = 1;
+				if (tok[1].kind == Mustach_Token_Line) {
+					tok++;
+					continue;
+				}
+				tok++;
+				length = 0;
+				goto endofline;
+			}
+			added = inline_add(inl, tok, tok->kind, tok->length, ind);
+			if (added != NULL)
+				added->partial = partial;
+			continue;
+		}
+		inline_add(inl, tok, tok->kind, tok->length, ind);
+	}
+}
+
+int mustach_inline(const struct mustach_template *tmpl,
+		int (*compiled)(void *closure, const char *name, const struct mustach_template **tmpl),
+		void *closure, struct mustach_template **result)
+{
+	struct inliner inl;
+	struct mustach_template *inlined;
+	const struct mustach_token *tok;
+	int rc;
+
+	*result = NULL;
+	for (tok = tmpl->tokens ; tok->kind != Mustach_Token_End ; tok++)
+		if ((tok->kind == Mustach_Token_Section || tok->kind == Mustach_Token_Inverted) && tok->partial != NULL)
+			return MUSTACH_ERROR_INVALID_ITF; /* compiled lazily */
+	memset(&inl, 0, sizeof inl);
+	inl.compiled = compiled;
+	inl.closure = closure;
+	rc = inline_tokens(&inl, tmpl->tokens, NULL, 0, 0);
+	if (rc >= 0) {
+		inlined = malloc(sizeof *inlined + inl.ntokens * sizeof *inl.tokens + inl.ntexts);
+		if (inlined == NULL) {
+			errno = ENOMEM;
+			rc = MUSTACH_ERROR_SYSTEM;
+		}
+		else {
+			inl.tokens = (struct mustach_token*)&inlined[1];
+			inl.texts = (char*)&inl.tokens[inl.ntokens];
+			inl.ntokens = inl.ntexts = 0;
+			inline_tokens(&inl, tmpl->tokens, NULL, 0, 0);
+			inlined->text = tmpl->text;
+			inlined->length = tmpl->length;
+			inlined->tokens = inl.tokens;
+			inlined->render = NULL;
+			*result = inlined;
+		}
+	}
+	free(inl.found);
+	return rc;
+}
+
+static int render_file(struct lexer *lex, const struct mustach_itf *itf, void *closure, FILE *file)
 {
 	int rc;
 	struct iwrap iwrap;
@@ -480,18 +1506,20 @@ int mustach_file(const char *template, size_t length, const struct mustach_itf *
 	iwrap.next = itf->next;
 	iwrap.leave = itf->leave;
 	iwrap.get = itf->get;
-	iwrap.flags = flags;
+	iwrap.srcpos = itf->srcpos;
+	iwrap.compiled = itf->compiled;
+	iwrap.flags = lex->flags;
 
 	/* process */
 	rc = itf->start ? itf->start(closure) : 0;
 	if (rc == 0)
-		rc = process(template, length, &iwrap, file, 0);
+		rc = process(lex, &iwrap, file, 0, NULL, NULL);
 	if (itf->stop)
 		itf->stop(closure, rc);
 	return rc;
 }
 
-int mustach_fd(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, int fd)
+static int render_fd(struct lexer *lex, const struct mustach_itf *itf, void *closure, int fd)
 {
 	int rc;
 	FILE *file;
@@ -501,13 +1529,13 @@ int mustach_fd(const char *template, size_t length, const struct mustach_itf *it
 		rc = MUSTACH_ERROR_SYSTEM;
 		errno = ENOMEM;
 	} else {
-		rc = mustach_file(template, length, itf, closure, flags, file);
+		rc = render_file(lex, itf, closure, file);
 		fclose(file);
 	}
 	return rc;
 }
 
-int mustach_mem(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size)
+static int render_mem(struct lexer *lex, const struct mustach_itf *itf, void *closure, char **result, size_t *size)
 {
 	int rc;
 	FILE *file;
@@ -520,7 +1548,7 @@ int mustach_mem(const char *template, size_t length, const struct mustach_itf *i
 	if (file == NULL)
 		rc = MUSTACH_ERROR_SYSTEM;
 	else {
-		rc = mustach_file(template, length, itf, closure, flags, file);
+		rc = render_file(lex, itf, closure, file);
 		if (rc < 0)
 			memfile_abort(file, result, size);
 		else
@@ -529,6 +1557,120 @@ int mustach_mem(const char *template, size_t length, const struct mustach_itf *i
 	return rc;
 }
 
+int mustach_file(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, FILE *file)
+{
+	struct lexer lex;
+	lexer_init(&lex, template, length, NULL, flags);
+	return render_file(&lex, itf, closure, file);
+}
+
+int mustach_fd(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, int fd)
+{
+	struct lexer lex;
+	lexer_init(&lex, template, length, NULL, flags);
+	return render_fd(&lex, itf, closure, fd);
+}
+
+int mustach_mem(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	struct lexer lex;
+	lexer_init(&lex, template, length, NULL, flags);
+	return render_mem(&lex, itf, closure, result, size);
+}
+
+int mustach_compiled_file(const struct mustach_template *tmpl, const struct mustach_itf *itf, void *closure, int flags, FILE *file)
+{
+	struct lexer lex;
+	lexer_init_compiled(&lex, tmpl, flags);
+	return render_file(&lex, itf, closure, file);
+}
+
+int mustach_compiled_fd(const struct mustach_template *tmpl, const struct mustach_itf *itf, void *closure, int flags, int fd)
+{
+	struct lexer lex;
+	lexer_init_compiled(&lex, tmpl, flags);
+	return render_fd(&lex, itf, closure, fd);
+}
+
+int mustach_compiled_mem(const struct mustach_template *tmpl, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	struct lexer lex;
+	lexer_init_compiled(&lex, tmpl, flags);
+	return render_mem(&lex, itf, closure, result, size);
+}
+
+static int stream_open(struct stream *stream, struct lexer *lex, mustach_read_cb_t *readcb, void *readclosure, int flags)
+{
+	stream->readcb = readcb;
+	stream->closure = readclosure;
+	stream->buffer = malloc(STREAM_SIZE + 1);
+	if (stream->buffer == NULL)
+		return MUSTACH_ERROR_SYSTEM;
+	stream->old = stream->names = NULL;
+	stream->size = STREAM_SIZE;
+	stream->keep = stream->buffer;
+	stream->from = NULL;
+	stream->offset = stream->nameslen = stream->namessize = 0;
+	stream->eof = 0;
+	stream->buffer[0] = 0; /* empty window */
+	lexer_init(lex, stream->buffer, 0, NULL, flags);
+	lex->stream = stream;
+	return 0;
+}
+
+static void stream_close(struct stream *stream)
+{
+	free(stream->buffer);
+	free(stream->old);
+	free(stream->names);
+}
+
+int mustach_fd_reader(void *closure, char *buffer, size_t size)
+{
+	ssize_t rc;
+
+	do {
+		rc = read(*(int*)closure, buffer, size > INT_MAX ? INT_MAX : size);
+	} while (rc < 0 && errno == EINTR);
+	return rc < 0 ? MUSTACH_ERROR_SYSTEM : (int)rc;
+}
+
+int mustach_stream_file(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_itf *itf, void *closure, int flags, FILE *file)
+{
+	struct stream stream;
+	struct lexer lex;
+	int rc = stream_open(&stream, &lex, readcb, readclosure, flags);
+	if (rc == 0) {
+		rc = render_file(&lex, itf, closure, file);
+		stream_close(&stream);
+	}
+	return rc;
+}
+
+int mustach_stream_fd(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_itf *itf, void *closure, int flags, int fd)
+{
+	struct stream stream;
+	struct lexer lex;
+	int rc = stream_open(&stream, &lex, readcb, readclosure, flags);
+	if (rc == 0) {
+		rc = render_fd(&lex, itf, closure, fd);
+		stream_close(&stream);
+	}
+	return rc;
+}
+
+int mustach_stream_mem(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size)
+{
+	struct stream stream;
+	struct lexer lex;
+	int rc = stream_open(&stream, &lex, readcb, readclosure, flags);
+	if (rc == 0) {
+		rc = render_mem(&lex, itf, closure, result, size);
+		stream_close(&stream);
+	}
+	return rc;
+}
+
 int fmustach(const char *template, const struct mustach_itf *itf, void *closure, FILE *file)
 {
 	return mustach_file(template, 0, itf, closure, Mustach_With_AllExtensions, file);
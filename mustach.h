@@ -10,11 +10,14 @@
 #define _mustach_h_included_
 
 struct mustach_sbuf; /* see below */
+struct mustach_srcpos; /* see below */
+struct mustach_template; /* see below */
+struct mustach_run; /* see below */
 
 /**
  * Current version of mustach and its derivates
  */
-#define MUSTACH_VERSION 102
+#define MUSTACH_VERSION 200
 #define MUSTACH_VERSION_MAJOR (MUSTACH_VERSION / 100)
 #define MUSTACH_VERSION_MINOR (MUSTACH_VERSION % 100)
 
@@ -134,9 +137,26 @@ struct mustach_sbuf; /* see below */
  *        processing occurered. The status returned by the processing
  *        is passed to the stop.
  *
+ * @srcpos: If defined (can be NULL), receives in 'pos' the position in
+ *          the templates of the text or of the tag that produces the
+ *          output coming next. The output written after that call and
+ *          before the next call to 'srcpos' comes from the position 'pos'.
+ *          It allows to map the output to the templates that produced it.
+ *          The 'file' is the same that is given to 'emit' and 'put'.
+ *          The generated functions 'render' of the compiled templates
+ *          don't report positions: when 'srcpos' is defined, the tokens
+ *          of these templates are processed instead.
+ *          @see mustach_srcpos
+ *
+ * @compiled: If defined (can be NULL), called for the partials that are
+ *            not bound statically before calling 'partial'. It returns 1
+ *            and sets 'tmpl' with the compiled template of the partial of
+ *            'name' that must remain valid until 'stop', or returns 0 when
+ *            the partial is to be queried by 'partial'.
+ *
  * The array below summarize status of callbacks:
  *
- *    FULLY OPTIONAL:   start partial
+ *    FULLY OPTIONAL:   start partial srcpos compiled
  *    MANDATORY:        enter next leave
  *    COMBINATORIAL:    put emit get
  *
@@ -172,6 +192,8 @@ struct mustach_itf {
 	int (*emit)(void *closure, const char *buffer, size_t size, int escape, FILE *file);
 	int (*get)(void *closure, const char *name, struct mustach_sbuf *sbuf);
 	void (*stop)(void *closure, int status);
+	int (*srcpos)(void *closure, const struct mustach_srcpos *pos, FILE *file);
+	int (*compiled)(void *closure, const char *name, const struct mustach_template **tmpl);
 };
 
 /**
@@ -209,6 +231,256 @@ struct mustach_sbuf {
 	size_t length;
 };
 
+/**
+ * mustach_srcpos - Position in templates given to the callback 'srcpos'
+ *
+ * The positions are linked through 'parent' from the innermost partial
+ * to the main template. The structures are only valid during the call
+ * to 'srcpos'.
+ *
+ * @parent:   The position of the tag including the partial of 'name'
+ *            or NULL for the main template.
+ *
+ * @name:     The name of the partial or NULL for the main template.
+ *
+ * @text:     The text of the template or of the partial, NULL for the
+ *            templates read progressively.
+ *
+ * @offset:   The offset of the position in 'text'.
+ *
+ * @line:     The line number of the position, starting at 1.
+ */
+struct mustach_srcpos {
+	const struct mustach_srcpos *parent;
+	const char *name;
+	const char *text;
+	size_t offset;
+	unsigned line;
+};
+
+/**
+ * Kinds of tokens of compiled templates
+ */
+#define Mustach_Token_End        0  /* end of the template, no tag */
+#define Mustach_Token_Line       1  /* end of line, no tag */
+#define Mustach_Token_Comment    2  /* {{! comment }} */
+#define Mustach_Token_Delim      3  /* {{=<% %>=}} */
+#define Mustach_Token_Section    4  /* {{#name}} */
+#define Mustach_Token_Inverted   5  /* {{^name}} */
+#define Mustach_Token_Close      6  /* {{/name}} */
+#define Mustach_Token_Partial    7  /* {{>name}} */
+#define Mustach_Token_Escaped    8  /* {{name}} */
+#define Mustach_Token_Raw        9  /* {{{name}}} or {{&name}} */
+
+/**
+ * Flags of tokens of compiled templates
+ */
+#define Mustach_Token_NonSpace   1  /* text has characters other than spaces */
+#define Mustach_Token_Relex      2  /* delimiters differ from the opening */
+
+/**
+ * mustach_token - Item of a compiled template
+ *
+ * A token records the text preceding it in the template, up to a tag or to
+ * the end of the line, and the tag that follows that text if any.
+ *
+ * @text:    The text preceding the tag, pointing in the template.
+ *           For Mustach_Token_Line, the new line is included.
+ *
+ * @length:  Length of 'text'.
+ *
+ * @name:    For tags, the zero terminated name of the tag, without
+ *           surrounding spaces. For Mustach_Token_Delim, the content after
+ *           the first equal sign. For Mustach_Token_Comment, empty.
+ *           NULL for Mustach_Token_Line and Mustach_Token_End.
+ *
+ * @namelen: Length of 'name'.
+ *
+ * @partial: For Mustach_Token_Partial, if not NULL, the compiled template
+ *           of the partial that is then used without calling 'partial'.
+ *           For Mustach_Token_Section and Mustach_Token_Inverted of the
+ *           templates returned by 'mustach_compile_lazy', private data
+ *           of the section whose body is compiled when first entered.
+ *           Otherwise NULL.
+ *
+ * @line:    Line number of 'text' in the template, starting at 1.
+ *
+ * @kind:    The kind of the token, one of Mustach_Token_...
+ *
+ * @flags:   Mustach_Token_NonSpace if 'text' has characters other than
+ *           spaces, Mustach_Token_Relex on Mustach_Token_Close when the
+ *           delimiters changed since the opening. In that case, iterations
+ *           of the section are made from the template text.
+ */
+struct mustach_token {
+	const char *text;
+	size_t length;
+	const char *name;
+	size_t namelen;
+	const struct mustach_template *partial;
+	unsigned line;
+	unsigned char kind;
+	unsigned char flags;
+};
+
+/**
+ * mustach_template - Compiled template
+ *
+ * A compiled template is the result of the parsing of a template. It
+ * can be rendered many times without parsing the template again.
+ * Compiled templates are either returned by 'mustach_compile' or
+ * defined statically, for example by code generators.
+ *
+ * @text:    The text of the template, it must remain valid as long
+ *           as the compiled template is used.
+ *
+ * @length:  Length of the text.
+ *
+ * @tokens:  The tokens of the template, terminated by a token of
+ *           kind Mustach_Token_End.
+ *
+ * @render:  If not NULL, the function rendering the template without
+ *           processing its tokens, as generated in C by 'mustach --generate'.
+ *           NULL for the templates returned by the functions of mustach.
+ *           Not used when the callback 'srcpos' is defined.
+ */
+struct mustach_template {
+	const char *text;
+	size_t length;
+	const struct mustach_token *tokens;
+	int (*render)(const struct mustach_run *run);
+};
+
+/**
+ * mustach_run - Rendering by the function 'render' of a compiled template
+ *
+ * The function 'render' writes the text of the template and the values
+ * of its tags by calling directly the callbacks of the rendering.
+ *
+ * @emit:        Emits 'size' bytes of 'buffer' in 'file', unescaped here.
+ *
+ * @put:         Puts the value of 'name' in 'file', escaped if 'escape'.
+ *
+ * @enter:       As 'enter' of 'mustach_itf'.
+ *
+ * @next:        As 'next' of 'mustach_itf'.
+ *
+ * @leave:       As 'leave' of 'mustach_itf'.
+ *
+ * @closure:     The closure of 'emit', 'enter', 'next' and 'leave'.
+ *
+ * @closure_put: The closure of 'put'.
+ *
+ * @file:        The file given to 'emit' and 'put'.
+ *
+ * @prefix:      The text of the including partials to emit before the lines
+ *               of the template and before its tags that aren't standalone,
+ *               or NULL.
+ *
+ * @prefixlen:   Length of 'prefix'.
+ *
+ * @internal:    Private data of mustach.
+ */
+struct mustach_run {
+	int (*emit)(void *closure, const char *buffer, size_t size, int escape, FILE *file);
+	int (*put)(void *closure, const char *name, int escape, FILE *file);
+	int (*enter)(void *closure, const char *name);
+	int (*next)(void *closure);
+	int (*leave)(void *closure);
+	void *closure;
+	void *closure_put;
+	FILE *file;
+	const char *prefix;
+	size_t prefixlen;
+	void *internal;
+};
+
+/**
+ * mustach_run_partial - Renders the partial 'name' for the function 'render'.
+ *
+ * @run:    the current rendering
+ * @name:   the name of the partial
+ * @tmpl:   the compiled partial or NULL when it is queried as by the
+ *          rendering of the tokens
+ * @prefix: the text preceding the tag of the partial, emitted after the
+ *          prefix of 'run' before the lines of the partial
+ * @length: length of 'prefix'
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_run_partial(const struct mustach_run *run, const char *name,
+		const struct mustach_template *tmpl, const char *prefix, size_t length);
+
+/**
+ * mustach_compile - Compiles the mustache 'template'.
+ *
+ * @template: the template string to compile, it is not copied
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @flags:    the flags used for parsing (Mustach_With_Colon, Mustach_With_EmptyTag)
+ * @result:   the pointer receiving the compiled template when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error in the template.
+ */
+extern int mustach_compile(const char *template, size_t length, int flags, struct mustach_template **result);
+
+/**
+ * mustach_compile_lazy - Compiles the mustache 'template' lazily.
+ *
+ * Same as 'mustach_compile' but the bodies of the sections are compiled
+ * when first entered by a rendering, the sections never entered costing
+ * no compilation. The template is checked completely and the compiled
+ * bodies are shared safely by concurrent renderings. Because the tokens of
+ * the bodies are not reachable through 'tokens', such templates can only
+ * be rendered.
+ *
+ * @template: the template string to compile, it is not copied
+ * @length:   length of the template or zero if unknown and template null terminated
+ * @flags:    the flags used for parsing (Mustach_With_Colon, Mustach_With_EmptyTag)
+ * @result:   the pointer receiving the compiled template when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error in the template.
+ */
+extern int mustach_compile_lazy(const char *template, size_t length, int flags, struct mustach_template **result);
+
+/**
+ * mustach_inline - Inlines the partials of the compiled template 'tmpl'.
+ *
+ * The partials bound to 'tmpl' or returned by 'compiled' replace their
+ * tags when these tags are standalone, the text preceding the tags being
+ * put before the texts of the partials where the rendering emits it. The
+ * partials included by the inlined partials are also inlined, except a
+ * partial within itself. Other partials are bound to their tags, partials
+ * that change the delimiters or whose rendering would differ aren't
+ * inlined. No source position is reported for the texts of the inlined
+ * partials.
+ *
+ * @tmpl:     the compiled template, not compiled lazily
+ * @compiled: if not NULL, returns 1 and the compiled partial of 'name'
+ *            in 'tmpl' when known, like the callback 'compiled' of
+ *            'mustach_itf'. The partials must remain valid as long as
+ *            the result is used.
+ * @closure:  the closure of 'compiled'
+ * @result:   the pointer receiving the inlined template when 0 is returned
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error,
+ * MUSTACH_ERROR_INVALID_ITF if 'tmpl' was compiled lazily or the error
+ * returned by 'compiled'.
+ */
+extern int mustach_inline(const struct mustach_template *tmpl,
+		int (*compiled)(void *closure, const char *name, const struct mustach_template **tmpl),
+		void *closure, struct mustach_template **result);
+
+/**
+ * mustach_template_free - Releases the compiled template returned by 'mustach_compile',
+ *                         'mustach_compile_lazy' or 'mustach_inline'.
+ *
+ * @tmpl: the compiled template to release, can be NULL
+ */
+extern void mustach_template_free(struct mustach_template *tmpl);
+
 /**
  * mustach_file - Renders the mustache 'template' in 'file' for 'itf' and 'closure'.
  *
@@ -252,6 +524,113 @@ extern int mustach_fd(const char *template, size_t length, const struct mustach_
  */
 extern int mustach_mem(const char *template, size_t length, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size);
 
+/**
+ * mustach_compiled_file - Renders the compiled template 'tmpl' in 'file' for 'itf' and 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to functions called
+ * @file:     the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compiled_file(const struct mustach_template *tmpl, const struct mustach_itf *itf, void *closure, int flags, FILE *file);
+
+/**
+ * mustach_compiled_fd - Renders the compiled template 'tmpl' in 'fd' for 'itf' and 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to functions called
+ * @fd:       the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compiled_fd(const struct mustach_template *tmpl, const struct mustach_itf *itf, void *closure, int flags, int fd);
+
+/**
+ * mustach_compiled_mem - Renders the compiled template 'tmpl' in 'result' for 'itf' and 'closure'.
+ *
+ * @tmpl:     the compiled template to instantiate
+ * @itf:      the interface to the functions that mustach calls
+ * @closure:  the closure to pass to functions called
+ * @result:   the pointer receiving the result when 0 is returned
+ * @size:     the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_compiled_mem(const struct mustach_template *tmpl, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size);
+
+/**
+ * mustach_read_cb_t - Callback reading progressively the text of a template
+ *
+ * It reads at most 'size' bytes of the template in 'buffer' and returns
+ * the count of bytes read, 0 at the end of the template or a negative
+ * error that stops the rendering.
+ */
+typedef int mustach_read_cb_t(void *closure, char *buffer, size_t size);
+
+/**
+ * mustach_fd_reader - Reading callback for the templates read from a
+ * file descriptor whose number is pointed by 'closure' (an int *).
+ */
+extern int mustach_fd_reader(void *closure, char *buffer, size_t size);
+
+/**
+ * mustach_stream_file - Renders in 'file' for 'itf' and 'closure' the mustache
+ * template read progressively by 'readcb'.
+ *
+ * Only a window of the text of the template is kept in memory and the
+ * output begins before the end of the reading. The texts of the sections
+ * that can iterate, because they are entered, are kept until their closing.
+ * The sources positions given to 'srcpos' have a NULL 'text' for the
+ * template, their offsets are from its beginning.
+ *
+ * @readcb:      the function reading the template
+ * @readclosure: the closure of the reading function
+ * @itf:         the interface to the functions that mustach calls
+ * @closure:     the closure to pass to functions called
+ * @file:        the file where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_stream_file(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_itf *itf, void *closure, int flags, FILE *file);
+
+/**
+ * mustach_stream_fd - Renders in 'fd' for 'itf' and 'closure' the mustache
+ * template read progressively by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:      the function reading the template
+ * @readclosure: the closure of the reading function
+ * @itf:         the interface to the functions that mustach calls
+ * @closure:     the closure to pass to functions called
+ * @fd:          the file descriptor number where to write the result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_stream_fd(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_itf *itf, void *closure, int flags, int fd);
+
+/**
+ * mustach_stream_mem - Renders in 'result' for 'itf' and 'closure' the mustache
+ * template read progressively by 'readcb'. @see mustach_stream_file
+ *
+ * @readcb:      the function reading the template
+ * @readclosure: the closure of the reading function
+ * @itf:         the interface to the functions that mustach calls
+ * @closure:     the closure to pass to functions called
+ * @result:      the pointer receiving the result when 0 is returned
+ * @size:        the size of the returned result
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+extern int mustach_stream_mem(mustach_read_cb_t *readcb, void *readclosure, const struct mustach_itf *itf, void *closure, int flags, char **result, size_t *size);
+
 /***************************************************************************
 * compatibility with version before 1.0
 */
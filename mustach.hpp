@@ -0,0 +1,522 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _mustach_hpp_included_
+#define _mustach_hpp_included_
+
+/*
+ * mustach.hpp is a header only binding of mustach for C++20.
+ *
+ * Templates given as string literals are compiled at compile time
+ * in static compiled templates, see 'mustach::static_template' and
+ * the literal operator '_mustach'. Templates only known at run time
+ * are rendered by the runtime engine.
+ *
+ * The data are explored through any type satisfying the concept
+ * 'mustach::explorer', that mimics 'struct mustach_wrap_itf'.
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <array>
+#include <concepts>
+
+/*
+ * The C headers use 'template' as parameter name and declare the deprecated
+ * function 'mustach' that would clash with the namespace. They must be
+ * included through this header.
+ */
+#define template template_
+#define mustach mustach_deprecated_
+extern "C" {
+#include "mustach.h"
+#include "mustach-wrap.h"
+}
+#undef mustach
+#undef template
+
+namespace mustach {
+
+/**
+ * literal - String literal usable as template argument
+ */
+template <std::size_t N>
+struct literal {
+	char value[N];
+	static constexpr std::size_t length = N - 1;
+
+	consteval literal(const char (&str)[N])
+	{
+		for (std::size_t i = 0 ; i < N ; i++)
+			value[i] = str[i];
+	}
+};
+
+namespace detail {
+
+/*
+ * Reports an error in a template parsed at compile time: not being
+ * constexpr, calling it stops the compilation with the message.
+ */
+inline void error(const char *message)
+{
+	(void)message;
+}
+
+constexpr bool isspace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+constexpr bool same(const char *a, const char *b, std::size_t len)
+{
+	for (std::size_t i = 0 ; i < len ; i++)
+		if (a[i] != b[i])
+			return false;
+	return true;
+}
+
+/*
+ * Compile time counterpart of the lexer and of the compiler of mustach.c.
+ * It must produce the same tokens as 'mustach_compile'.
+ */
+struct compiler {
+	const char *pos, *end;
+	unsigned line;
+	int flags;
+	std::size_t oplen, cllen;
+	char opstr[MUSTACH_MAX_DELIM_LENGTH], clstr[MUSTACH_MAX_DELIM_LENGTH];
+
+	constexpr compiler(const char *text, std::size_t length, int flags)
+		: pos(text), end(text + length), line(1), flags(flags),
+		  oplen(2), cllen(2), opstr{'{', '{'}, clstr{'}', '}'}
+	{
+	}
+
+	constexpr void delim(const char *beg, std::size_t len)
+	{
+		std::size_t l;
+
+		if (len < 4 || beg[len - 1] != '=')
+			error("mustach: bad separators");
+		len--;
+		while (len && isspace(*beg))
+			beg++, len--;
+		while (len && isspace(beg[len - 1]))
+			len--;
+		for (l = 0 ; l < len && !isspace(beg[l]) ; l++);
+		if (l == len || l > MUSTACH_MAX_DELIM_LENGTH)
+			error("mustach: bad separators");
+		oplen = l;
+		for (std::size_t i = 0 ; i < l ; i++)
+			opstr[i] = beg[i];
+		while (l < len && isspace(beg[l]))
+			l++;
+		if (l == len || len - l > MUSTACH_MAX_DELIM_LENGTH)
+			error("mustach: bad separators");
+		cllen = len - l;
+		for (std::size_t i = 0 ; i < cllen ; i++)
+			clstr[i] = beg[l + i];
+	}
+
+	constexpr void scan(mustach_token &token)
+	{
+		const char *beg, *term;
+		std::size_t len, l;
+		char c;
+
+		token = mustach_token{pos, 0, nullptr, 0, nullptr, line, Mustach_Token_End, 0};
+
+		/* search next openning delimiter */
+		for (beg = pos ; ; beg++) {
+			if (beg == end) {
+				token.length = (std::size_t)(beg - pos);
+				return;
+			}
+			c = *beg;
+			if (c == '\n') {
+				token.kind = Mustach_Token_Line;
+				token.length = (std::size_t)(++beg - pos);
+				pos = beg;
+				line++;
+				return;
+			}
+			if (!isspace(c)) {
+				if (c == *opstr && end - beg >= (std::ptrdiff_t)oplen && same(beg, opstr, oplen))
+					break;
+				token.flags = Mustach_Token_NonSpace;
+			}
+		}
+		token.length = (std::size_t)(beg - pos);
+		beg += oplen;
+
+		/* search next closing delimiter */
+		for (term = beg ; ; term++) {
+			if (term == end)
+				error("mustach: unexpected end");
+			if (*term == *clstr && end - term >= (std::ptrdiff_t)cllen && same(term, clstr, cllen))
+				break;
+			line += *term == '\n';
+		}
+		pos = term + cllen;
+		len = (std::size_t)(term - beg);
+		c = *beg;
+		switch(c) {
+		case ':':
+			token.kind = Mustach_Token_Escaped;
+			if (flags & Mustach_With_Colon)
+				beg++, len--;
+			break;
+		case '!':
+			token.kind = Mustach_Token_Comment;
+			token.name = "";
+			return;
+		case '=':
+			token.kind = Mustach_Token_Delim;
+			token.name = beg + 1;
+			token.namelen = len - 1;
+			return;
+		case '{':
+			for (l = 0 ; l < cllen && clstr[l] == '}' ; l++);
+			if (l < cllen) {
+				if (!len || beg[len - 1] != '}')
+					error("mustach: bad unescape tag");
+				len--;
+			} else {
+				if (term[l] != '}')
+					error("mustach: bad unescape tag");
+				pos++;
+			}
+			token.kind = Mustach_Token_Raw;
+			beg++, len--;
+			break;
+		case '&':
+			token.kind = Mustach_Token_Raw;
+			beg++, len--;
+			break;
+		case '^':
+			token.kind = Mustach_Token_Inverted;
+			beg++, len--;
+			break;
+		case '#':
+			token.kind = Mustach_Token_Section;
+			beg++, len--;
+			break;
+		case '/':
+			token.kind = Mustach_Token_Close;
+			beg++, len--;
+			break;
+		case '>':
+			token.kind = Mustach_Token_Partial;
+			beg++, len--;
+			break;
+		default:
+			token.kind = Mustach_Token_Escaped;
+			break;
+		}
+		while (len && isspace(beg[0]))
+			beg++, len--;
+		while (len && isspace(beg[len - 1]))
+			len--;
+		if (len == 0 && !(flags & Mustach_With_EmptyTag))
+			error("mustach: empty tag");
+		if (len > MUSTACH_MAX_LENGTH)
+			error("mustach: tag too long");
+		token.name = beg;
+		token.namelen = len;
+	}
+
+	/* calls 'emit(token)' for each token, names are not yet copied */
+	template <class Emit>
+	constexpr void run(Emit &&emit)
+	{
+		struct {
+			const char *name;
+			std::size_t length, oplen, cllen;
+			char opstr[MUSTACH_MAX_DELIM_LENGTH], clstr[MUSTACH_MAX_DELIM_LENGTH];
+		} stack[MUSTACH_MAX_DEPTH] = {};
+		int depth = 0;
+		mustach_token token = {};
+
+		for (;;) {
+			scan(token);
+			switch (token.kind) {
+			case Mustach_Token_End:
+				if (depth)
+					error("mustach: unexpected end");
+				break;
+			case Mustach_Token_Delim:
+				delim(token.name, token.namelen);
+				break;
+			case Mustach_Token_Inverted:
+			case Mustach_Token_Section:
+				if (depth == MUSTACH_MAX_DEPTH)
+					error("mustach: too deep");
+				stack[depth].name = token.name;
+				stack[depth].length = token.namelen;
+				stack[depth].oplen = oplen;
+				stack[depth].cllen = cllen;
+				for (std::size_t i = 0 ; i < oplen ; i++)
+					stack[depth].opstr[i] = opstr[i];
+				for (std::size_t i = 0 ; i < cllen ; i++)
+					stack[depth].clstr[i] = clstr[i];
+				depth++;
+				break;
+			case Mustach_Token_Close:
+				if (depth-- == 0 || token.namelen != stack[depth].length
+				 || !same(stack[depth].name, token.name, token.namelen))
+					error("mustach: closing");
+				if (stack[depth].oplen != oplen || stack[depth].cllen != cllen
+				 || !same(stack[depth].opstr, opstr, oplen)
+				 || !same(stack[depth].clstr, clstr, cllen))
+					token.flags |= Mustach_Token_Relex;
+				break;
+			}
+			emit(token);
+			if (token.kind == Mustach_Token_End)
+				return;
+		}
+	}
+};
+
+struct sizes {
+	std::size_t tokens, names;
+};
+
+template <literal S, int Flags>
+consteval sizes count()
+{
+	sizes result = { 0, 0 };
+	compiler(S.value, S.length, Flags).run([&](const mustach_token &token) {
+		result.tokens++;
+		if (token.name != nullptr)
+			result.names += token.namelen + 1;
+	});
+	return result;
+}
+
+template <literal S, int Flags, std::size_t N>
+consteval std::array<char, N> names()
+{
+	std::array<char, N> result = {};
+	std::size_t s = 0;
+	compiler(S.value, S.length, Flags).run([&](const mustach_token &token) {
+		if (token.name != nullptr) {
+			for (std::size_t i = 0 ; i < token.namelen ; i++)
+				result[s + i] = token.name[i];
+			s += token.namelen + 1;
+		}
+	});
+	return result;
+}
+
+template <literal S, int Flags, std::size_t N>
+consteval std::array<mustach_token, N> tokens(const char *names)
+{
+	std::array<mustach_token, N> result = {};
+	std::size_t n = 0, s = 0;
+	compiler(S.value, S.length, Flags).run([&](const mustach_token &token) {
+		result[n] = token;
+		if (token.name != nullptr) {
+			result[n].name = &names[s];
+			s += token.namelen + 1;
+		}
+		n++;
+	});
+	return result;
+}
+
+template <literal S, int Flags>
+struct compiled {
+	static constexpr sizes size = count<S, Flags>();
+	static constexpr std::array<char, size.names + 1> names = detail::names<S, Flags, size.names + 1>();
+	static constexpr std::array<mustach_token, size.tokens> tokens = detail::tokens<S, Flags, size.tokens>(names.data());
+	static constexpr mustach_template tmpl = { S.value, S.length, tokens.data(), nullptr };
+};
+
+} /* namespace detail */
+
+/**
+ * static_template - Compiled template of the string literal 'S'
+ *
+ * The template is parsed at compile time with the 'Flags' (Mustach_With_Colon,
+ * Mustach_With_EmptyTag) and an invalid template is a compilation error.
+ * Partials are not included, they are queried at rendering as for other
+ * compiled templates.
+ */
+template <literal S, int Flags = Mustach_With_AllExtensions>
+inline constexpr const mustach_template &static_template = detail::compiled<S, Flags>::tmpl;
+
+inline namespace literals {
+
+/**
+ * operator""_mustach - Compiled template of the string literal, same as
+ * 'static_template' with the default flags.
+ *
+ * Example: mustach::render("Hello {{name}}!"_mustach, data, stdout);
+ */
+template <literal S>
+consteval const mustach_template &operator""_mustach()
+{
+	return detail::compiled<S, Mustach_With_AllExtensions>::tmpl;
+}
+
+} /* namespace literals */
+
+/**
+ * explorer - Concept of the types giving the data to render
+ *
+ * The member functions have the meaning of the callbacks of the same
+ * name of 'struct mustach_wrap_itf' without the closure. The functions
+ * 'start', 'stop' and 'compare' are optional. The functions are called
+ * from C code and must not throw.
+ */
+template <class T>
+concept explorer = requires(T &t, const char *name, int flag, mustach_sbuf *sbuf) {
+	{ t.sel(name) } -> std::convertible_to<int>;
+	{ t.subsel(name) } -> std::convertible_to<int>;
+	{ t.enter(flag) } -> std::convertible_to<int>;
+	{ t.next() } -> std::convertible_to<int>;
+	{ t.leave() } -> std::convertible_to<int>;
+	{ t.get(sbuf, flag) } -> std::convertible_to<int>;
+};
+
+/**
+ * adapter - Wrap interface of the explorer type T, the closure is the
+ * address of the explored object.
+ */
+template <explorer T>
+struct adapter {
+	static constexpr bool has_stop = requires(T &t) { t.stop(0); };
+	static constexpr bool has_compare = requires(T &t) { t.compare(""); };
+
+	static int start(void *closure) noexcept
+	{
+		if constexpr (requires(T &t) { t.start(); })
+			return static_cast<T*>(closure)->start();
+		else
+			return MUSTACH_OK;
+	}
+	static void stop(void *closure, int status) noexcept
+	{
+		if constexpr (has_stop)
+			static_cast<T*>(closure)->stop(status);
+	}
+	static int compare(void *closure, const char *value) noexcept
+	{
+		if constexpr (has_compare)
+			return static_cast<T*>(closure)->compare(value);
+		else
+			return 0;
+	}
+	static int sel(void *closure, const char *name) noexcept
+	{
+		return static_cast<T*>(closure)->sel(name);
+	}
+	static int subsel(void *closure, const char *name) noexcept
+	{
+		return static_cast<T*>(closure)->subsel(name);
+	}
+	static int enter(void *closure, int objiter) noexcept
+	{
+		return static_cast<T*>(closure)->enter(objiter);
+	}
+	static int next(void *closure) noexcept
+	{
+		return static_cast<T*>(closure)->next();
+	}
+	static int leave(void *closure) noexcept
+	{
+		return static_cast<T*>(closure)->leave();
+	}
+	static int get(void *closure, mustach_sbuf *sbuf, int key) noexcept
+	{
+		return static_cast<T*>(closure)->get(sbuf, key);
+	}
+
+	static constexpr struct mustach_wrap_itf itf = {
+		.start = start,
+		.stop = has_stop ? stop : nullptr,
+		.compare = has_compare ? compare : nullptr,
+		.sel = sel,
+		.subsel = subsel,
+		.enter = enter,
+		.next = next,
+		.leave = leave,
+		.get = get
+	};
+};
+
+namespace detail {
+
+inline int append(void *closure, const char *buffer, std::size_t size) noexcept
+{
+#if defined(__cpp_exceptions)
+	try {
+		static_cast<std::string*>(closure)->append(buffer, size);
+	} catch (...) {
+		return MUSTACH_ERROR_SYSTEM;
+	}
+#else
+	static_cast<std::string*>(closure)->append(buffer, size);
+#endif
+	return MUSTACH_OK;
+}
+
+/* text and length of a runtime template, zero length means null terminated */
+inline const char *text(std::string_view tmpl)
+{
+	return tmpl.empty() ? "" : tmpl.data();
+}
+
+} /* namespace detail */
+
+/**
+ * render - Renders the compiled template 'tmpl' in 'file' for 'data'.
+ *
+ * Returns 0 in case of success, -1 with errno set in case of system error
+ * a other negative value in case of error.
+ */
+template <explorer T>
+int render(const mustach_template &tmpl, T &data, FILE *file, int flags = Mustach_With_AllExtensions)
+{
+	return mustach_wrap_compiled_file(&tmpl, &adapter<T>::itf, &data, flags, file);
+}
+
+/**
+ * render - Renders the compiled template 'tmpl' appending to 'out' for 'data'.
+ */
+template <explorer T>
+int render(const mustach_template &tmpl, T &data, std::string &out, int flags = Mustach_With_AllExtensions)
+{
+	return mustach_wrap_compiled_write(&tmpl, &adapter<T>::itf, &data, flags, detail::append, &out);
+}
+
+/**
+ * render - Renders the template 'tmpl' known at run time in 'file' for 'data'.
+ */
+template <explorer T>
+int render(std::string_view tmpl, T &data, FILE *file, int flags = Mustach_With_AllExtensions)
+{
+	return mustach_wrap_file(detail::text(tmpl), tmpl.size(), &adapter<T>::itf, &data, flags, file);
+}
+
+/**
+ * render - Renders the template 'tmpl' known at run time appending to 'out' for 'data'.
+ */
+template <explorer T>
+int render(std::string_view tmpl, T &data, std::string &out, int flags = Mustach_With_AllExtensions)
+{
+	return mustach_wrap_write(detail::text(tmpl), tmpl.size(), &adapter<T>::itf, &data, flags, detail::append, &out);
+}
+
+} /* namespace mustach */
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+/*
+ * Renders the templates of the corpus with each backend available
+ * in order to collect the profile of a representative use.
+ *
+ * usage: pgo-driver COUNT DATA TEMPLATE...
+ *
+ * Each template is rendered COUNT times to /dev/null by each backend,
+ * both from its text and from its compiled form. The JSON backends
+ * render DATA.json, cbor renders DATA.cbor, csv renders the table
+ * DATA.csv and each of its rows and struct renders the C structures
+ * filled from DATA.json. The data is parsed again for each round so
+ * that loading is profiled too.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mustach-wrap.h"
+
+#if defined(PGO_JSON_C)
+#include "mustach-json-c.h"
+#endif
+#if defined(PGO_JANSSON)
+#include "mustach-jansson.h"
+#endif
+#if defined(PGO_CJSON)
+#include "mustach-cjson.h"
+#endif
+#if defined(PGO_TAPE) || defined(PGO_STRUCT)
+#include "mustach-tape.h"
+#endif
+#if defined(PGO_CBOR)
+#include "mustach-cbor.h"
+#endif
+#if defined(PGO_CSV)
+#include "mustach-csv.h"
+#endif
+#if defined(PGO_STRUCT)
+#include "mustach-struct.h"
+#endif
+
+struct template {
+	char *text;
+	size_t length;
+	struct mustach_template *compiled;
+};
+
+static char *readfile(const char *filename, size_t *length)
+{
+	FILE *file;
+	char *buffer;
+	long pos;
+
+	file = fopen(filename, "r");
+	if (file == NULL
+	 || fseek(file, 0, SEEK_END) < 0
+	 || (pos = ftell(file)) < 0
+	 || fseek(file, 0, SEEK_SET) < 0
+	 || (buffer = malloc((size_t)pos + 1)) == NULL) {
+		fprintf(stderr, "Can't read file: %s\n", filename);
+		exit(1);
+	}
+	if (pos && 1 != fread(buffer, (size_t)pos, 1, file)) {
+		fprintf(stderr, "Can't read file: %s\n", filename);
+		exit(1);
+	}
+	fclose(file);
+	buffer[pos] = 0;
+	*length = (size_t)pos;
+	return buffer;
+}
+
+static void check(int rc, const char *backend, const char *name)
+{
+	if (rc < 0) {
+		fprintf(stderr, "%s failed to render %s: %d\n", backend, name, rc);
+		exit(1);
+	}
+}
+
+static char *datafile(const char *data, const char *extension, size_t *length)
+{
+	char *filename, *result;
+
+	filename = malloc(strlen(data) + strlen(extension) + 1);
+	if (filename == NULL)
+		exit(1);
+	result = readfile(strcat(strcpy(filename, data), extension), length);
+	free(filename);
+	return result;
+}
+
+#if defined(PGO_STRUCT)
+/*
+ * The C structures of the data of the corpus, filled from its JSON
+ * parsed by tape. Their allocations are released at once.
+ */
+struct item { const char *product; int qty; double price; };
+struct order { const char *id, *status; struct item *items; unsigned nitems; const char *note; };
+struct address { const char *street, *zip; };
+struct user {
+	int id;
+	const char *name, *email, *city;
+	bool admin;
+	int score;
+	const char **tags;
+	unsigned ntags;
+	struct address address;
+	struct order *orders;
+	unsigned norders;
+};
+struct link { const char *href, *label; };
+struct site { const char *title, *lang; int year; };
+struct stats { int users, threshold; const char *currency; };
+struct data {
+	struct site site;
+	struct link *nav;
+	unsigned nnav;
+	struct user *users;
+	unsigned nusers;
+	int *empty;
+	unsigned nempty;
+	struct stats stats;
+};
+
+static const struct mustach_struct_field item_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct item, product, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct item, qty, Mustach_Struct_Int),
+	MUSTACH_STRUCT_FIELD(struct item, price, Mustach_Struct_Double)
+};
+static const struct mustach_struct_desc item_desc = MUSTACH_STRUCT_DESC(struct item, item_fields);
+
+static const struct mustach_struct_field order_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct order, id, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct order, status, Mustach_Struct_String),
+	MUSTACH_STRUCT_ARRAY(struct order, items, Mustach_Struct_Struct, &item_desc, &order_fields[3]),
+	MUSTACH_STRUCT_FIELD(struct order, nitems, Mustach_Struct_Unsigned),
+	MUSTACH_STRUCT_FIELD(struct order, note, Mustach_Struct_String)
+};
+static const struct mustach_struct_desc order_desc = MUSTACH_STRUCT_DESC(struct order, order_fields);
+
+static const struct mustach_struct_field address_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct address, street, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct address, zip, Mustach_Struct_String)
+};
+static const struct mustach_struct_desc address_desc = MUSTACH_STRUCT_DESC(struct address, address_fields);
+
+static const struct mustach_struct_field user_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct user, id, Mustach_Struct_Int),
+	MUSTACH_STRUCT_FIELD(struct user, name, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct user, email, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct user, city, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct user, admin, Mustach_Struct_Bool),
+	MUSTACH_STRUCT_FIELD(struct user, score, Mustach_Struct_Int),
+	MUSTACH_STRUCT_ARRAY(struct user, tags, Mustach_Struct_String, NULL, &user_fields[7]),
+	MUSTACH_STRUCT_FIELD(struct user, ntags, Mustach_Struct_Unsigned),
+	MUSTACH_STRUCT_STRUCT(struct user, address, Mustach_Struct_Struct, &address_desc),
+	MUSTACH_STRUCT_ARRAY(struct user, orders, Mustach_Struct_Struct, &order_desc, &user_fields[10]),
+	MUSTACH_STRUCT_FIELD(struct user, norders, Mustach_Struct_Unsigned)
+};
+static const struct mustach_struct_desc user_desc = MUSTACH_STRUCT_DESC(struct user, user_fields);
+
+static const struct mustach_struct_field link_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct link, href, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct link, label, Mustach_Struct_String)
+};
+static const struct mustach_struct_desc link_desc = MUSTACH_STRUCT_DESC(struct link, link_fields);
+
+static const struct mustach_struct_field site_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct site, title, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct site, lang, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct site, year, Mustach_Struct_Int)
+};
+static const struct mustach_struct_desc site_desc = MUSTACH_STRUCT_DESC(struct site, site_fields);
+
+static const struct mustach_struct_field stats_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct stats, users, Mustach_Struct_Int),
+	MUSTACH_STRUCT_FIELD(struct stats, threshold, Mustach_Struct_Int),
+	MUSTACH_STRUCT_FIELD(struct stats, currency, Mustach_Struct_String)
+};
+static const struct mustach_struct_desc stats_desc = MUSTACH_STRUCT_DESC(struct stats, stats_fields);
+
+static const struct mustach_struct_field data_fields[] = {
+	MUSTACH_STRUCT_STRUCT(struct data, site, Mustach_Struct_Struct, &site_desc),
+	MUSTACH_STRUCT_ARRAY(struct data, nav, Mustach_Struct_Struct, &link_desc, &data_fields[2]),
+	MUSTACH_STRUCT_FIELD(struct data, nnav, Mustach_Struct_Unsigned),
+	MUSTACH_STRUCT_ARRAY(struct data, users, Mustach_Struct_Struct, &user_desc, &data_fields[4]),
+	MUSTACH_STRUCT_FIELD(struct data, nusers, Mustach_Struct_Unsigned),
+	MUSTACH_STRUCT_ARRAY(struct data, empty, Mustach_Struct_Int, NULL, &data_fields[6]),
+	MUSTACH_STRUCT_FIELD(struct data, nempty, Mustach_Struct_Unsigned),
+	MUSTACH_STRUCT_STRUCT(struct data, stats, Mustach_Struct_Struct, &stats_desc)
+};
+static const struct mustach_struct_desc data_desc = MUSTACH_STRUCT_DESC(struct data, data_fields);
+
+static void **allocs;
+static size_t nallocs;
+
+static void *keep(void *ptr)
+{
+	allocs = realloc(allocs, (nallocs + 1) * sizeof *allocs);
+	if (ptr == NULL || allocs == NULL)
+		exit(1);
+	return allocs[nallocs++] = ptr;
+}
+
+static void release(void)
+{
+	while (nallocs)
+		free(allocs[--nallocs]);
+	free(allocs);
+	allocs = NULL;
+}
+
+static const char *getstr(const struct mustach_tape *tape, unsigned node, const char *name)
+{
+	return keep(mustach_tape_string(tape, mustach_tape_member(tape, node, name)));
+}
+
+static int getint(const struct mustach_tape *tape, unsigned node, const char *name)
+{
+	char *json = mustach_tape_json(tape, mustach_tape_member(tape, node, name));
+	int result = json ? atoi(json) : 0;
+
+	free(json);
+	return result;
+}
+
+static bool getbool(const struct mustach_tape *tape, unsigned node, const char *name)
+{
+	char *json = mustach_tape_json(tape, mustach_tape_member(tape, node, name));
+	bool result = json && !strcmp(json, "true");
+
+	free(json);
+	return result;
+}
+
+static double getdouble(const struct mustach_tape *tape, unsigned node)
+{
+	char *json = mustach_tape_json(tape, node);
+	double result = json ? strtod(json, NULL) : 0;
+
+	free(json);
+	return result;
+}
+
+static void *getarray(const struct mustach_tape *tape, unsigned node, const char *name, size_t size, unsigned *count, unsigned *array)
+{
+	*array = mustach_tape_member(tape, node, name);
+	*count = mustach_tape_count(tape, *array);
+	return keep(calloc(*count + 1, size));
+}
+
+static void fill(struct data *data, const struct mustach_tape *tape)
+{
+	unsigned root, node, arr, i, j, k, a, b;
+	struct user *user;
+	struct order *order;
+
+	root = mustach_tape_root(tape);
+	node = mustach_tape_member(tape, root, "site");
+	data->site.title = getstr(tape, node, "title");
+	data->site.lang = getstr(tape, node, "lang");
+	data->site.year = getint(tape, node, "year");
+	node = mustach_tape_member(tape, root, "stats");
+	data->stats.users = getint(tape, node, "users");
+	data->stats.threshold = getint(tape, node, "threshold");
+	data->stats.currency = getstr(tape, node, "currency");
+	data->empty = getarray(tape, root, "empty", sizeof *data->empty, &data->nempty, &arr);
+	data->nav = getarray(tape, root, "nav", sizeof *data->nav, &data->nnav, &arr);
+	for (i = 0 ; i < data->nnav ; i++) {
+		node = mustach_tape_item(tape, arr, i);
+		data->nav[i].href = getstr(tape, node, "href");
+		data->nav[i].label = getstr(tape, node, "label");
+	}
+	data->users = getarray(tape, root, "users", sizeof *data->users, &data->nusers, &arr);
+	for (i = 0 ; i < data->nusers ; i++) {
+		user = &data->users[i];
+		node = mustach_tape_item(tape, arr, i);
+		user->id = getint(tape, node, "id");
+		user->name = getstr(tape, node, "name");
+		user->email = getstr(tape, node, "email");
+		user->city = getstr(tape, node, "city");
+		user->admin = getbool(tape, node, "admin");
+		user->score = getint(tape, node, "score");
+		user->tags = getarray(tape, node, "tags", sizeof *user->tags, &user->ntags, &a);
+		for (j = 0 ; j < user->ntags ; j++)
+			user->tags[j] = keep(mustach_tape_string(tape, mustach_tape_item(tape, a, j)));
+		user->address.street = getstr(tape, mustach_tape_member(tape, node, "address"), "street");
+		user->address.zip = getstr(tape, mustach_tape_member(tape, node, "address"), "zip");
+		user->orders = getarray(tape, node, "orders", sizeof *user->orders, &user->norders, &a);
+		for (j = 0 ; j < user->norders ; j++) {
+			order = &user->orders[j];
+			node = mustach_tape_item(tape, a, j);
+			order->id = getstr(tape, node, "id");
+			order->status = getstr(tape, node, "status");
+			order->note = getstr(tape, node, "note");
+			order->items = getarray(tape, node, "items", sizeof *order->items, &order->nitems, &b);
+			for (k = 0 ; k < order->nitems ; k++) {
+				node = mustach_tape_item(tape, b, k);
+				order->items[k].product = getstr(tape, node, "product");
+				order->items[k].qty = getint(tape, node, "qty");
+				order->items[k].price = getdouble(tape, mustach_tape_member(tape, node, "price"));
+			}
+		}
+	}
+}
+#endif
+
+int main(int ac, char **av)
+{
+	int count, round, i, n, rc, flags;
+	char *json;
+	size_t jsonlen;
+	struct template *tmpls;
+	FILE *out;
+#if defined(PGO_CBOR)
+	char *cbor;
+	size_t cborlen;
+#endif
+#if defined(PGO_CSV)
+	char *csvtext;
+	size_t csvlen;
+#endif
+
+	if (ac < 4) {
+		fprintf(stderr, "usage: %s COUNT DATA TEMPLATE...\n", av[0]);
+		return 1;
+	}
+	count = atoi(av[1]);
+	json = datafile(av[2], ".json", &jsonlen);
+#if defined(PGO_CBOR)
+	cbor = datafile(av[2], ".cbor", &cborlen);
+#endif
+#if defined(PGO_CSV)
+	csvtext = datafile(av[2], ".csv", &csvlen);
+#endif
+	n = ac - 3;
+	flags = Mustach_With_AllExtensions;
+
+	tmpls = calloc((size_t)n, sizeof *tmpls);
+	if (tmpls == NULL)
+		return 1;
+	for (i = 0 ; i < n ; i++) {
+		tmpls[i].text = readfile(av[i + 3], &tmpls[i].length);
+		rc = mustach_compile(tmpls[i].text, tmpls[i].length, flags, &tmpls[i].compiled);
+		check(rc, "compiler", av[i + 3]);
+	}
+
+	out = fopen("/dev/null", "w");
+	if (out == NULL)
+		return 1;
+
+	for (round = 0 ; round < count ; round++) {
+#if defined(PGO_JSON_C)
+		{
+			struct json_object *root = json_tokener_parse(json);
+			for (i = 0 ; i < n ; i++) {
+				rc = mustach_json_c_file(tmpls[i].text, tmpls[i].length, root, flags, out);
+				check(rc, "json-c", av[i + 3]);
+				rc = mustach_json_c_compiled_file(tmpls[i].compiled, root, flags, out);
+				check(rc, "json-c", av[i + 3]);
+			}
+			json_object_put(root);
+		}
+#endif
+#if defined(PGO_JANSSON)
+		{
+			json_error_t error;
+			json_t *root = json_loadb(json, jsonlen, 0, &error);
+			for (i = 0 ; i < n ; i++) {
+				rc = mustach_jansson_file(tmpls[i].text, tmpls[i].length, root, flags, out);
+				check(rc, "jansson", av[i + 3]);
+				rc = mustach_jansson_compiled_file(tmpls[i].compiled, root, flags, out);
+				check(rc, "jansson", av[i + 3]);
+			}
+			json_decref(root);
+		}
+#endif
+#if defined(PGO_CJSON)
+		{
+			cJSON *root = cJSON_ParseWithLength(json, jsonlen);
+			for (i = 0 ; i < n ; i++) {
+				rc = mustach_cJSON_file(tmpls[i].text, tmpls[i].length, root, flags, out);
+				check(rc, "cJSON", av[i + 3]);
+				rc = mustach_cJSON_compiled_file(tmpls[i].compiled, root, flags, out);
+				check(rc, "cJSON", av[i + 3]);
+			}
+			cJSON_Delete(root);
+		}
+#endif
+#if defined(PGO_TAPE)
+		{
+			struct mustach_tape *root = mustach_tape_parse(json, jsonlen, NULL);
+			for (i = 0 ; i < n ; i++) {
+				rc = mustach_tape_file(tmpls[i].text, tmpls[i].length, root, flags, out);
+				check(rc, "tape", av[i + 3]);
+				rc = mustach_tape_compiled_file(tmpls[i].compiled, root, flags, out);
+				check(rc, "tape", av[i + 3]);
+			}
+			mustach_tape_free(root);
+		}
+#endif
+#if defined(PGO_CBOR)
+		for (i = 0 ; i < n ; i++) {
+			rc = mustach_cbor_file(tmpls[i].text, tmpls[i].length, cbor, cborlen, flags, out);
+			check(rc, "cbor", av[i + 3]);
+			rc = mustach_cbor_compiled_file(tmpls[i].compiled, cbor, cborlen, flags, out);
+			check(rc, "cbor", av[i + 3]);
+		}
+#endif
+#if defined(PGO_CSV)
+		{
+			struct mustach_csv *csv = mustach_csv_open(csvtext, csvlen, ',', '"', NULL);
+			if (csv == NULL)
+				check(-1, "csv", av[2]);
+			do {
+				for (i = 0 ; i < n ; i++) {
+					rc = mustach_csv_file(tmpls[i].text, tmpls[i].length, csv, flags, out);
+					check(rc, "csv", av[i + 3]);
+					rc = mustach_csv_compiled_file(tmpls[i].compiled, csv, flags, out);
+					check(rc, "csv", av[i + 3]);
+				}
+			} while (mustach_csv_next(csv));
+			mustach_csv_close(csv);
+		}
+#endif
+#if defined(PGO_STRUCT)
+		{
+			struct data data;
+			struct mustach_tape *root = mustach_tape_parse(json, jsonlen, NULL);
+			fill(&data, root);
+			for (i = 0 ; i < n ; i++) {
+				rc = mustach_struct_file(tmpls[i].text, tmpls[i].length, &data, &data_desc, flags, out);
+				check(rc, "struct", av[i + 3]);
+				rc = mustach_struct_compiled_file(tmpls[i].compiled, &data, &data_desc, flags, out);
+				check(rc, "struct", av[i + 3]);
+			}
+			release();
+			mustach_tape_free(root);
+		}
+#endif
+	}
+
+	fclose(out);
+#if defined(PGO_CBOR)
+	free(cbor);
+#endif
+#if defined(PGO_CSV)
+	free(csvtext);
+#endif
+	for (i = 0 ; i < n ; i++) {
+		mustach_template_free(tmpls[i].compiled);
+		free(tmpls[i].text);
+	}
+	free(tmpls);
+	free(json);
+	return 0;
+}
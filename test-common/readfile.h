@@ -0,0 +1,49 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#ifndef _test_readfile_h_included_
+#define _test_readfile_h_included_
+
+/*
+ * Reading of the files given to the test programs, included by them.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * returns the zero terminated content of the file 'filename', its length
+ * being stored in 'length', or exits when it can't be read, the content
+ * must be released using 'free'
+ */
+static char *readfile(const char *filename, size_t *length)
+{
+	FILE *file;
+	char *buffer;
+	long pos;
+
+	file = fopen(filename, "r");
+	if (file == NULL
+	 || fseek(file, 0, SEEK_END) < 0
+	 || (pos = ftell(file)) < 0
+	 || fseek(file, 0, SEEK_SET) < 0
+	 || (buffer = malloc((size_t)pos + 1)) == NULL) {
+		fprintf(stderr, "Can't read file: %s\n", filename);
+		exit(1);
+	}
+	if (pos && 1 != fread(buffer, (size_t)pos, 1, file)) {
+		fprintf(stderr, "Can't read file: %s\n", filename);
+		exit(1);
+	}
+	fclose(file);
+	buffer[pos] = 0;
+	*length = (size_t)pos;
+	return buffer;
+}
+
+#endif
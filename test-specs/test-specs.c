@@ -10,9 +10,6 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 
@@ -21,6 +18,7 @@
 #define TEST_JSON_C  1
 #define TEST_JANSSON 2
 #define TEST_CJSON   3
+#define TEST_TAPE    4
 
 static const char *errors[] = {
 	"??? unreferenced ???",
@@ -57,71 +55,6 @@ static void help(char *prog)
 	exit(0);
 }
 
-#if TEST == TEST_CJSON
-
-static const size_t BLOCKSIZE = 8192;
-
-static char *readfile(const char *filename, size_t *length)
-{
-	int f;
-	struct stat s;
-	char *result;
-	size_t size, pos;
-	ssize_t rc;
-
-	result = NULL;
-	if (filename[0] == '-' &&  filename[1] == 0)
-		f = dup(0);
-	else
-		f = open(filename, O_RDONLY);
-	if (f < 0) {
-		fprintf(stderr, "Can't open file: %s\n", filename);
-		exit(1);
-	}
-
-	fstat(f, &s);
-	switch (s.st_mode & S_IFMT) {
-	case S_IFREG:
-		size = s.st_size;
-		break;
-	case S_IFSOCK:
-	case S_IFIFO:
-		size = BLOCKSIZE;
-		break;
-	default:
-		fprintf(stderr, "Bad file: %s\n", filename);
-		exit(1);
-	}
-
-	pos = 0;
-	result = malloc(size + 1);
-	do {
-		if (result == NULL) {
-			fprintf(stderr, "Out of memory\n");
-			exit(1);
-		}
-		rc = read(f, &result[pos], (size - pos) + 1);
-		if (rc < 0) {
-			fprintf(stderr, "Error while reading %s\n", filename);
-			exit(1);
-		}
-		if (rc > 0) {
-			pos += (size_t)rc;
-			if (pos > size) {
-				size = pos + BLOCKSIZE;
-				result = realloc(result, size + 1);
-			}
-		}
-	} while(rc > 0);
-
-	close(f);
-	if (length != NULL)
-		*length = pos;
-	result[pos] = 0;
-	return result;
-}
-#endif
-
 typedef struct {
 	unsigned nerror;
 	unsigned ndiffers;
@@ -424,12 +357,12 @@ static int get_partial(const char *name, struct mustach_sbuf *sbuf)
 
 static int load_json(const char *filename)
 {
-	char *t;
-	size_t length;
+	struct mustach_sbuf file;
 
-	t = readfile(filename, &length);
-	o = t ? cJSON_ParseWithLength(t, length) : NULL;
-	free(t);
+	if (mustach_wrap_load_file(filename, &file) != MUSTACH_OK)
+		return -1;
+	o = cJSON_ParseWithLength(file.value, file.length);
+	mustach_wrap_unload_file(&file);
 	return -!o;
 }
 static int process(counters *c)
@@ -513,6 +446,116 @@ static void close_json()
 	cJSON_Delete(o);
 }
 
+#elif TEST == TEST_TAPE
+
+#include "mustach-tape.h"
+
+static struct mustach_sbuf file;
+static struct mustach_tape *o;
+static unsigned partials;
+static int get_partial(const char *name, struct mustach_sbuf *sbuf)
+{
+	unsigned x = partials == MUSTACH_TAPE_NONE ? MUSTACH_TAPE_NONE : mustach_tape_member(o, partials, name);
+	char *value = x == MUSTACH_TAPE_NONE ? NULL : mustach_tape_string(o, x);
+	if (value == NULL)
+		return MUSTACH_ERROR_PARTIAL_NOT_FOUND;
+	sbuf->value = value;
+	sbuf->freecb = free;
+	return MUSTACH_OK;
+}
+
+static int load_json(const char *filename)
+{
+	if (mustach_wrap_load_file(filename, &file) != MUSTACH_OK)
+		return -1;
+	o = mustach_tape_parse(file.value, file.length, NULL);
+	return -!o;
+}
+static int process(counters *c)
+{
+	char *t, *e, *got, *tmp, *name, *desc;
+	unsigned i, n, tests, unit, data, template, expected;
+	struct mustach_tape *sub;
+	size_t length;
+	int s;
+
+	tests = mustach_tape_member(o, mustach_tape_root(o), "tests");
+	if (tests == MUSTACH_TAPE_NONE)
+		return -1;
+
+	i = 0;
+	n = mustach_tape_count(o, tests);
+	while (i < n) {
+		unit = mustach_tape_item(o, tests, i);
+		name = desc = t = e = NULL;
+		sub = NULL;
+		if (unit == MUSTACH_TAPE_NONE
+		 || (data = mustach_tape_member(o, unit, "data")) == MUSTACH_TAPE_NONE
+		 || (template = mustach_tape_member(o, unit, "template")) == MUSTACH_TAPE_NONE
+		 || (expected = mustach_tape_member(o, unit, "expected")) == MUSTACH_TAPE_NONE
+		 || !(name = mustach_tape_string(o, mustach_tape_member(o, unit, "name")))
+		 || !(desc = mustach_tape_string(o, mustach_tape_member(o, unit, "desc")))
+		 || !(t = mustach_tape_string(o, template))
+		 || !(e = mustach_tape_string(o, expected))
+		 || !(sub = mustach_tape_sub(o, data))) {
+			fprintf(stderr, "invalid test %u\n", i);
+			c->ninvalid++;
+		}
+		else {
+			fprintf(output, "[%u] %s\n", i, name);
+			fprintf(output, "\t%s\n", desc);
+			partials = mustach_tape_member(o, unit, "partials");
+			s = mustach_tape_mem(t, 0, sub, flags, &got, &length);
+			if (s == 0 && strcmp(got, e) == 0) {
+				fprintf(output, "\t=> SUCCESS\n");
+				c->nsuccess++;
+			}
+			else {
+				if (s < 0) {
+					fprintf(output, "\t=> ERROR %s\n", mustach_error_string(s));
+					c->nerror++;
+				}
+				else {
+					fprintf(output, "\t=> DIFFERS\n");
+					c->ndiffers++;
+				}
+				if (partials != MUSTACH_TAPE_NONE) {
+					tmp = mustach_tape_json(o, partials);
+					fprintf(output, "\t.. PARTIALS[%s]\n", tmp);
+					free(tmp);
+				}
+				tmp = mustach_tape_json(o, data);
+				fprintf(output, "\t..     DATA[%s]\n", tmp);
+				free(tmp);
+				fprintf(output, "\t.. TEMPLATE[");
+				emit(output, t);
+				fprintf(output, "]\n");
+				fprintf(output, "\t.. EXPECTED[");
+				emit(output, e);
+				fprintf(output, "]\n");
+				if (s == 0) {
+					fprintf(output, "\t..      GOT[");
+					emit(output, got);
+					fprintf(output, "]\n");
+				}
+			}
+			free(got);
+		}
+		mustach_tape_free(sub);
+		free(name);
+		free(desc);
+		free(t);
+		free(e);
+		i++;
+	}
+	return 0;
+}
+static void close_json()
+{
+	mustach_tape_free(o);
+	mustach_wrap_unload_file(&file);
+}
+
 #else
 #error "no defined json library"
 #endif
@@ -0,0 +1,227 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "mustach.hpp"
+
+using namespace mustach::literals;
+
+/* a minimal tree of data */
+struct node {
+	enum kind { null, boolean, number, string, array, object } type = null;
+	std::string value;
+	std::vector<node> items;
+	std::vector<std::pair<std::string, node>> members;
+
+	static node str(const char *v, kind t = string) { node n; n.type = t; n.value = v; return n; }
+	static node num(const char *v) { return str(v, number); }
+	static node boolean_(bool v) { return str(v ? "true" : "false", boolean); }
+	const node *member(const char *name) const
+	{
+		for (auto &m : members)
+			if (m.first == name)
+				return &m.second;
+		return nullptr;
+	}
+};
+
+/* the explorer of the tree of data */
+struct tree {
+	struct frame {
+		const node *cont, *obj;
+		std::size_t index, count;
+		bool objiter;
+	};
+	const node *root, *selection = nullptr;
+	std::vector<frame> stack;
+
+	tree(const node &r) : root(&r) {}
+
+	int start()
+	{
+		stack.assign(1, frame{ nullptr, root, 0, 1, false });
+		selection = nullptr;
+		return MUSTACH_OK;
+	}
+
+	int compare(const char *value)
+	{
+		if (selection->type == node::number) {
+			double d = std::atof(selection->value.c_str()) - std::atof(value);
+			return d < 0 ? -1 : d > 0 ? 1 : 0;
+		}
+		return std::strcmp(selection->value.c_str(), value);
+	}
+
+	int sel(const char *name)
+	{
+		if (name == nullptr) {
+			selection = stack.back().obj;
+			return 1;
+		}
+		for (std::size_t i = stack.size() ; i-- ; ) {
+			const node *o = stack[i].obj->member(name);
+			if (o != nullptr) {
+				selection = o;
+				return 1;
+			}
+		}
+		selection = nullptr;
+		return 0;
+	}
+
+	int subsel(const char *name)
+	{
+		const node *o = selection->member(name);
+		if (o != nullptr)
+			selection = o;
+		return o != nullptr;
+	}
+
+	int enter(int objiter)
+	{
+		const node *o = selection;
+		if (stack.size() >= MUSTACH_MAX_DEPTH)
+			return MUSTACH_ERROR_TOO_DEEP;
+		if (objiter) {
+			if (o->type != node::object || o->members.empty())
+				return 0;
+			stack.push_back(frame{ o, &o->members[0].second, 0, o->members.size(), true });
+		} else if (o->type == node::array) {
+			if (o->items.empty())
+				return 0;
+			stack.push_back(frame{ o, &o->items[0], 0, o->items.size(), false });
+		} else if (o->type == node::object || (o->type != node::null && o->value != "false"))
+			stack.push_back(frame{ nullptr, o, 0, 1, false });
+		else
+			return 0;
+		return 1;
+	}
+
+	int next()
+	{
+		frame &f = stack.back();
+		if (++f.index >= f.count)
+			return 0;
+		f.obj = f.objiter ? &f.cont->members[f.index].second : &f.cont->items[f.index];
+		return 1;
+	}
+
+	int leave()
+	{
+		stack.pop_back();
+		return 0;
+	}
+
+	int get(mustach_sbuf *sbuf, int key)
+	{
+		const frame &f = stack.back();
+		if (key)
+			sbuf->value = f.objiter ? f.cont->members[f.index].first.c_str() : "";
+		else if (selection->type == node::array || selection->type == node::object)
+			sbuf->value = "[...]";
+		else
+			sbuf->value = selection->value.c_str();
+		return 1;
+	}
+};
+
+static_assert(mustach::explorer<tree>);
+
+#define TEXT \
+	"Hello {{name}}!\n" \
+	"{{#items}}\n" \
+	"{{> item}}\n" \
+	"{{/items}}\n" \
+	"{{#sizes.*}}{{*}}={{.}} {{/sizes.*}}\n" \
+	"{{#count>2}}more than two{{/count>2}}\n" \
+	"{{#items}}{{=<% %>=}}<%label%>;<%={{ }}=%>{{/items}}\n" \
+	"{{^missing}}no missing{{/missing}}\n" \
+	"{{! comment }}\n" \
+	"  {{#name}}\n" \
+	"{{{html}}} / {{&html}} / {{html}}\n" \
+	"  {{/name}}\n"
+
+/* the tokens compiled at compile time are the tokens compiled at run time */
+static int same_tokens(const mustach_template &ct, const char *text)
+{
+	mustach_template *rt;
+	const mustach_token *a, *b;
+	int rc = mustach_compile(text, 0, Mustach_With_AllExtensions, &rt);
+
+	if (rc < 0)
+		return 0;
+	for (a = ct.tokens, b = rt->tokens ; ; a++, b++) {
+		if (a->text - ct.text != b->text - rt->text || a->length != b->length
+		 || a->namelen != b->namelen || a->line != b->line
+		 || a->kind != b->kind || a->flags != b->flags
+		 || (a->name == nullptr) != (b->name == nullptr)
+		 || (a->name != nullptr && std::strcmp(a->name, b->name))) {
+			rc = -1;
+			break;
+		}
+		if (a->kind == Mustach_Token_End)
+			break;
+	}
+	mustach_template_free(rt);
+	return rc == 0;
+}
+
+int main()
+{
+	node root;
+	node item1, item2, item3, sizes;
+	std::string out;
+	int rc;
+
+	root.type = node::object;
+	root.members.emplace_back("name", node::str("World"));
+	root.members.emplace_back("html", node::str("<b>&</b>"));
+	root.members.emplace_back("count", node::num("3"));
+	item1.type = item2.type = item3.type = node::object;
+	item1.members.emplace_back("label", node::str("one"));
+	item1.members.emplace_back("price", node::num("1.5"));
+	item2.members.emplace_back("label", node::str("two \"2\""));
+	item3.members.emplace_back("label", node::str("three"));
+	item3.members.emplace_back("price", node::boolean_(false));
+	node items;
+	items.type = node::array;
+	items.items = { item1, item2, item3 };
+	root.members.emplace_back("items", items);
+	sizes.type = node::object;
+	sizes.members.emplace_back("small", node::num("1"));
+	sizes.members.emplace_back("large", node::num("10"));
+	root.members.emplace_back("sizes", sizes);
+
+	tree data(root);
+	constexpr const mustach_template &tmpl = TEXT ""_mustach;
+
+	std::printf("--- compile time template\n");
+	std::fflush(stdout);
+	rc = mustach::render(tmpl, data, stdout);
+	std::printf("--- status %d\n", rc);
+
+	std::printf("--- run time template\n");
+	rc = mustach::render(std::string_view(TEXT), data, out);
+	std::fputs(out.c_str(), stdout);
+	std::printf("--- status %d\n", rc);
+
+	std::printf("--- static template\n");
+	out.clear();
+	rc = mustach::render(mustach::static_template<"{{#items}}[{{label}}]{{/items}}\n">, data, out);
+	std::fputs(out.c_str(), stdout);
+	std::printf("--- status %d\n", rc);
+
+	std::printf("--- tokens %s\n", same_tokens(tmpl, TEXT) ? "same" : "differ");
+	return 0;
+}
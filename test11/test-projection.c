@@ -0,0 +1,89 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-tape.h"
+#include "readfile.h"
+
+static char *render(const char *template, size_t length, const struct mustach_tape *tape)
+{
+	char *result;
+	size_t size;
+	int rc;
+
+	rc = mustach_tape_mem(template, length, tape, Mustach_With_AllExtensions, &result, &size);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Template error %d\n", rc);
+		exit(1);
+	}
+	return result;
+}
+
+/*
+ * usage: test-projection JSON TEMPLATE PARTIAL...
+ *
+ * Renders TEMPLATE with the complete tape of JSON and with its tape
+ * projected on TEMPLATE and the PARTIALs, the results must be the same.
+ */
+int main(int ac, char **av)
+{
+	struct mustach_tape_projection *proj;
+	struct mustach_tape *full, *projected;
+	char *json, *template, *text, *all, *some;
+	size_t jsonlen, length, textlen;
+	int i;
+
+	if (ac < 3) {
+		fprintf(stderr, "usage: %s JSON TEMPLATE PARTIAL...\n", av[0]);
+		return 1;
+	}
+	json = readfile(av[1], &jsonlen);
+	template = readfile(av[2], &length);
+
+	proj = mustach_tape_projection_create();
+	if (proj == NULL
+	 || mustach_tape_projection_add(proj, template, length, Mustach_With_AllExtensions) != MUSTACH_OK) {
+		fprintf(stderr, "Can't project %s\n", av[2]);
+		return 1;
+	}
+	for (i = 3 ; i < ac ; i++) {
+		text = readfile(av[i], &textlen);
+		if (mustach_tape_projection_add(proj, text, textlen, Mustach_With_AllExtensions) != MUSTACH_OK) {
+			fprintf(stderr, "Can't project %s\n", av[i]);
+			return 1;
+		}
+		free(text);
+	}
+
+	full = mustach_tape_parse(json, jsonlen, NULL);
+	projected = mustach_tape_parse_projected(json, jsonlen, proj, NULL);
+	if (full == NULL || projected == NULL) {
+		fprintf(stderr, "Can't parse %s\n", av[1]);
+		return 1;
+	}
+
+	text = mustach_tape_json(projected, mustach_tape_root(projected));
+	printf("--- projection\n%s\n", text);
+	free(text);
+
+	all = render(template, length, full);
+	some = render(template, length, projected);
+	printf("--- full\n%s--- projected\n%s--- %s\n", all, some, strcmp(all, some) ? "differ" : "same");
+	free(all);
+	free(some);
+
+	mustach_tape_free(projected);
+	mustach_tape_free(full);
+	mustach_tape_projection_free(proj);
+	free(template);
+	free(json);
+	return 0;
+}
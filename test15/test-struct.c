@@ -0,0 +1,138 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mustach-struct.h"
+#include "mustach-tape.h"
+#include "readfile.h"
+
+struct line {
+	const char *item;
+	int qty;
+	float price;
+};
+
+struct customer {
+	char name[16];
+	const char *email;
+	bool vip;
+};
+
+struct order {
+	unsigned id;
+	struct customer customer;
+	struct line *lines;
+	int nlines;
+	double total;
+	const char *note;
+	struct order *previous;
+	int64_t delta;
+	uint64_t big;
+	size_t count;
+	long codes[3];
+	const char *tags[2];
+	const long *codesptr;
+};
+
+static const struct mustach_struct_field line_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct line, item, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct line, qty, Mustach_Struct_Int),
+	MUSTACH_STRUCT_FIELD(struct line, price, Mustach_Struct_Float)
+};
+static const struct mustach_struct_desc line_desc = MUSTACH_STRUCT_DESC(struct line, line_fields);
+
+static const struct mustach_struct_field customer_fields[] = {
+	MUSTACH_STRUCT_CHARS(struct customer, name),
+	MUSTACH_STRUCT_FIELD(struct customer, email, Mustach_Struct_String),
+	MUSTACH_STRUCT_FIELD(struct customer, vip, Mustach_Struct_Bool)
+};
+static const struct mustach_struct_desc customer_desc = MUSTACH_STRUCT_DESC(struct customer, customer_fields);
+
+static const struct mustach_struct_desc order_desc;
+static const struct mustach_struct_field order_fields[] = {
+	MUSTACH_STRUCT_FIELD(struct order, id, Mustach_Struct_Unsigned),
+	MUSTACH_STRUCT_STRUCT(struct order, customer, Mustach_Struct_Struct, &customer_desc),
+	MUSTACH_STRUCT_ARRAY(struct order, lines, Mustach_Struct_Struct, &line_desc, &order_fields[3]),
+	MUSTACH_STRUCT_FIELD(struct order, nlines, Mustach_Struct_Int),
+	MUSTACH_STRUCT_FIELD(struct order, total, Mustach_Struct_Double),
+	MUSTACH_STRUCT_FIELD(struct order, note, Mustach_Struct_String),
+	MUSTACH_STRUCT_STRUCT(struct order, previous, Mustach_Struct_Pointer, &order_desc),
+	MUSTACH_STRUCT_FIELD(struct order, delta, Mustach_Struct_Int64),
+	MUSTACH_STRUCT_FIELD(struct order, big, Mustach_Struct_UInt64),
+	MUSTACH_STRUCT_FIELD(struct order, count, Mustach_Struct_Size),
+	MUSTACH_STRUCT_VECTOR(struct order, tags, Mustach_Struct_String, NULL, NULL),
+	MUSTACH_STRUCT_VECTOR(struct order, codes, Mustach_Struct_Long, NULL, &order_fields[3]),
+	MUSTACH_STRUCT_ARRAY(struct order, codesptr, Mustach_Struct_Long, NULL, &order_fields[9])
+};
+static const struct mustach_struct_desc order_desc = MUSTACH_STRUCT_DESC(struct order, order_fields);
+
+/*
+ * usage: test-struct TEMPLATE
+ *
+ * Renders TEMPLATE with C structures and with the tape of their JSON,
+ * the results must be the same.
+ */
+int main(int ac, char **av)
+{
+	static struct line lines[] = {
+		{ "pen", 3, 1.5f },
+		{ "ink \"blue\"", 1, 7.25f },
+		{ "paper", 500, 0.1f }
+	};
+	static const long codes[] = { 7, -8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18 };
+	struct order first = {
+		.id = 41, .customer = { "Doe", NULL, false }, .lines = NULL, .nlines = 0,
+		.total = 0, .note = "to call back", .previous = NULL,
+		.delta = -1, .big = 1, .count = 0, .codesptr = NULL
+	};
+	struct order order = {
+		.id = 42, .customer = { "Smith & Co", "smith@example.com", true },
+		.lines = lines, .nlines = 3, .total = 6000, .note = NULL, .previous = &first,
+		.delta = INT64_MIN, .big = UINT64_MAX, .count = 12,
+		.codes = { 4, 5, 6 }, .tags = { "new", "" }, .codesptr = codes
+	};
+	struct mustach_tape *tape;
+	char *template, *json, *all, *some;
+	size_t length, size;
+	int rc;
+
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s TEMPLATE\n", av[0]);
+		return 1;
+	}
+	template = readfile(av[1], &length);
+
+	json = mustach_struct_json(&order, &order_desc);
+	tape = json ? mustach_tape_parse(json, 0, NULL) : NULL;
+	if (tape == NULL) {
+		fprintf(stderr, "Can't get the JSON\n");
+		return 1;
+	}
+	printf("--- json\n%s\n", json);
+
+	rc = mustach_struct_mem(template, length, &order, &order_desc, Mustach_With_AllExtensions, &all, &size);
+	if (rc == MUSTACH_OK)
+		rc = mustach_tape_mem(template, length, tape, Mustach_With_AllExtensions, &some, &size);
+	if (rc != MUSTACH_OK) {
+		fprintf(stderr, "Template error %d\n", rc);
+		return 1;
+	}
+	printf("--- struct\n%s--- tape\n%s--- %s\n", all, some, strcmp(all, some) ? "differ" : "same");
+	free(all);
+	free(some);
+
+	mustach_tape_free(tape);
+	free(json);
+	free(template);
+	return 0;
+}
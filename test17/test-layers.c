@@ -0,0 +1,115 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(TEST_JSON_C)
+#include "mustach-json-c.h"
+#define LAYERS(suffix) mustach_json_c_##suffix
+typedef struct json_object root_t;
+#else
+#include "mustach-tape.h"
+#define LAYERS(suffix) mustach_tape_##suffix
+typedef const struct mustach_tape root_t;
+#endif
+
+#include "readfile.h"
+
+#if defined(TEST_JSON_C)
+static root_t *load(const char *filename)
+{
+	return json_object_from_file(filename);
+}
+
+static void release(root_t *root)
+{
+	json_object_put(root);
+}
+#else
+/* the text of the tape is released with it */
+static char *texts[3];
+static unsigned ntexts;
+
+static root_t *load(const char *filename)
+{
+	size_t length;
+	char *text = readfile(filename, &length);
+
+	texts[ntexts++] = text;
+	return mustach_tape_parse(text, length, NULL);
+}
+
+static void release(root_t *root)
+{
+	mustach_tape_free((struct mustach_tape*)root);
+	free(texts[--ntexts]);
+}
+#endif
+
+static const char *names[] = { "request.json", "tenant.json", "global.json" };
+
+int main(int ac, char **av)
+{
+	struct mustach_template *tmpl;
+	char *template;
+	root_t *roots[3];
+	unsigned i, n = sizeof names / sizeof *names;
+	char *text;
+	size_t size, length;
+	int rc;
+
+	if (ac != 2) {
+		fprintf(stderr, "usage: %s template\n", av[0]);
+		return 1;
+	}
+	template = readfile(av[1], &length);
+	for (i = 0 ; i < n ; i++) {
+		roots[i] = load(names[i]);
+		if (roots[i] == NULL) {
+			fprintf(stderr, "can't read %s\n", names[i]);
+			return 1;
+		}
+	}
+
+	/* all the layers, then without the request, then the global alone */
+	for (i = 0 ; i < n ; i++) {
+		printf("--- %u layer(s)\n", n - i);
+		rc = LAYERS(layers_file)(template, length, &roots[i], n - i, Mustach_With_AllExtensions, stdout);
+		if (rc < 0)
+			printf("error %d\n", rc);
+	}
+
+	/* compiled once, rendered twice */
+	rc = mustach_compile(template, length, Mustach_With_AllExtensions, &tmpl);
+	if (rc < 0)
+		printf("error %d\n", rc);
+	else {
+		printf("--- compiled\n");
+		rc = LAYERS(compiled_layers_mem)(tmpl, roots, n, Mustach_With_AllExtensions, &text, &size);
+		if (rc < 0)
+			printf("error %d\n", rc);
+		else {
+			fwrite(text, 1, size, stdout);
+			free(text);
+		}
+		rc = LAYERS(compiled_layers_file)(tmpl, &roots[1], n - 1, Mustach_With_AllExtensions, stdout);
+		if (rc < 0)
+			printf("error %d\n", rc);
+		mustach_template_free(tmpl);
+	}
+
+	/* no layer at all is an error */
+	rc = LAYERS(layers_file)(template, length, roots, 0, Mustach_With_AllExtensions, stdout);
+	printf("--- no layer: %d\n", rc);
+
+	for (i = n ; i > 0 ; i--)
+		release(roots[i - 1]);
+	free(template);
+	return 0;
+}
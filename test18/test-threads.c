@@ -0,0 +1,118 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mustach-json-c.h"
+#include "readfile.h"
+
+#define THREADS 8
+#define ROUNDS  200
+
+static struct json_object *root;
+static struct mustach_template *tmpl;
+static const char *template;
+static size_t length;
+
+/*
+ * Each thread renders the shared tree alternatively from the template
+ * and from the compiled template, and returns the last result or NULL
+ * when the results differ.
+ */
+static void *render(void *arg)
+{
+	int flags = Mustach_With_AllExtensions | Mustach_With_ReadOnly;
+	char *first = NULL, *text;
+	size_t size, firstsize = 0;
+	int i, rc;
+
+	(void)arg; /* unused */
+	for (i = 0 ; i < ROUNDS ; i++) {
+		rc = (i & 1)
+			? mustach_json_c_compiled_mem(tmpl, root, flags, &text, &size)
+			: mustach_json_c_mem(template, length, root, flags, &text, &size);
+		if (rc < 0) {
+			free(first);
+			return NULL;
+		}
+		if (first == NULL) {
+			first = text;
+			firstsize = size;
+		}
+		else {
+			rc = size != firstsize || memcmp(text, first, size);
+			free(text);
+			if (rc) {
+				free(first);
+				return NULL;
+			}
+		}
+	}
+	return first;
+}
+
+/*
+ * usage: test-threads json template
+ *
+ * Renders template for json from many threads sharing the same tree in
+ * read-only mode then checks that the results are the same and are the
+ * same than the result of the default mode.
+ */
+int main(int ac, char **av)
+{
+	pthread_t threads[THREADS];
+	char *results[THREADS], *text;
+	size_t size;
+	int i, ok, rc;
+
+	if (ac != 3) {
+		fprintf(stderr, "usage: %s json template\n", av[0]);
+		return 1;
+	}
+	root = json_object_from_file(av[1]);
+	if (root == NULL) {
+		fprintf(stderr, "Can't read json: %s\n", av[1]);
+		return 1;
+	}
+	template = readfile(av[2], &length);
+	rc = mustach_compile(template, length, Mustach_With_AllExtensions, &tmpl);
+	if (rc < 0) {
+		fprintf(stderr, "Can't compile: %s\n", av[2]);
+		return 1;
+	}
+
+	for (i = 0 ; i < THREADS ; i++)
+		if (pthread_create(&threads[i], NULL, render, NULL)) {
+			fprintf(stderr, "Can't create thread\n");
+			return 1;
+		}
+	for (i = 0 ; i < THREADS ; i++)
+		pthread_join(threads[i], (void**)&results[i]);
+
+	/* rendering in default mode after the threads, it alters the tree */
+	rc = mustach_json_c_mem(template, length, root, Mustach_With_AllExtensions, &text, &size);
+	if (rc < 0) {
+		fprintf(stderr, "Can't render: %d\n", rc);
+		return 1;
+	}
+	fwrite(text, 1, size, stdout);
+	for (ok = 1, i = 0 ; i < THREADS ; i++) {
+		ok = ok && results[i] != NULL && strlen(results[i]) == size && !memcmp(results[i], text, size);
+		free(results[i]);
+	}
+	printf("%d threads x %d rounds: %s\n", THREADS, ROUNDS, ok ? "same" : "DIFFERENT");
+
+	free(text);
+	mustach_template_free(tmpl);
+	free((char*)template);
+	json_object_put(root);
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mustach-tape.h"
+#include "readfile.h"
+
+#define THREADS 8
+#define ROUNDS  300
+#define SWAPS   100
+
+static struct mustach_tape *tape;
+static struct mustach_registry *registry;
+static char *expected[2];
+static size_t expsize[2];
+
+static void set(const char *name, const char *filename)
+{
+	char *text;
+	size_t length;
+
+	text = readfile(filename, &length);
+	if (mustach_registry_set(registry, name, text, length, Mustach_With_AllExtensions) < 0) {
+		fprintf(stderr, "Can't set %s\n", name);
+		exit(1);
+	}
+	free(text);
+}
+
+/* renders the page of the registry, the partial item resolved through the registry */
+static char *render(size_t *size)
+{
+	const struct mustach_template *tmpl;
+	char *text;
+	int section, rc;
+
+	section = mustach_registry_enter(registry);
+	tmpl = mustach_registry_get(registry, "page");
+	rc = tmpl == NULL ? MUSTACH_ERROR_ITEM_NOT_FOUND
+		: mustach_tape_compiled_mem(tmpl, tape, Mustach_With_AllExtensions, &text, size);
+	mustach_registry_leave(registry, section);
+	return rc < 0 ? NULL : text;
+}
+
+/*
+ * Each thread renders the page while the partial is replaced and returns
+ * NULL when a result is not one of the expected ones.
+ */
+static void *reader(void *arg)
+{
+	char *text;
+	size_t size;
+	int i, ok;
+
+	for (i = 0 ; i < ROUNDS ; i++) {
+		text = render(&size);
+		ok = text != NULL
+			&& ((size == expsize[0] && !memcmp(text, expected[0], size))
+			 || (size == expsize[1] && !memcmp(text, expected[1], size)));
+		free(text);
+		if (!ok)
+			return NULL;
+	}
+	return arg;
+}
+
+/*
+ * usage: test-registry json page item1 item2
+ *
+ * Renders the page from many threads while the partial 'item' is
+ * replaced alternatively by item1 and item2, then removes it.
+ */
+int main(int ac, char **av)
+{
+	pthread_t threads[THREADS];
+	void *results[THREADS];
+	char *json, *text;
+	size_t length;
+	int i, ok;
+
+	if (ac != 5) {
+		fprintf(stderr, "usage: %s json page item1 item2\n", av[0]);
+		return 1;
+	}
+	json = readfile(av[1], &length);
+	tape = mustach_tape_parse(json, length, NULL);
+	registry = mustach_registry_create();
+	if (tape == NULL || registry == NULL) {
+		fprintf(stderr, "Can't initialize\n");
+		return 1;
+	}
+	mustach_wrap_registry = registry;
+	set("page", av[2]);
+	for (i = 0 ; i < 2 ; i++) {
+		set("item", av[3 + i]);
+		expected[i] = render(&expsize[i]);
+		if (expected[i] == NULL) {
+			fprintf(stderr, "Can't render\n");
+			return 1;
+		}
+		fwrite(expected[i], 1, expsize[i], stdout);
+	}
+
+	for (i = 0 ; i < THREADS ; i++)
+		if (pthread_create(&threads[i], NULL, reader, registry)) {
+			fprintf(stderr, "Can't create thread\n");
+			return 1;
+		}
+	for (i = 0 ; i < SWAPS ; i++)
+		set("item", av[3 + (i & 1)]);
+	for (ok = 1, i = 0 ; i < THREADS ; i++) {
+		pthread_join(threads[i], &results[i]);
+		ok = ok && results[i] != NULL;
+	}
+	printf("%d threads x %d rounds, %d swaps: %s\n", THREADS, ROUNDS, SWAPS, ok ? "consistent" : "INCONSISTENT");
+
+	/* without the partial in the registry, it comes from the file */
+	printf("remove item: %d\n", mustach_registry_remove(registry, "item"));
+	printf("remove item: %d\n", mustach_registry_remove(registry, "item"));
+	text = render(&length);
+	if (text != NULL)
+		fwrite(text, 1, length, stdout);
+	free(text);
+
+	free(expected[0]);
+	free(expected[1]);
+	mustach_wrap_registry = NULL;
+	mustach_registry_destroy(registry);
+	mustach_tape_free(tape);
+	free(json);
+	return 0;
+}
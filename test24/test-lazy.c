@@ -0,0 +1,100 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mustach-tape.h"
+#include "readfile.h"
+
+#define THREADS 8
+#define ROUNDS  50
+
+static struct mustach_tape *tape;
+static struct mustach_template *lazy;
+static char *expected;
+static size_t expsize;
+
+/*
+ * Each thread renders twice the lazily compiled template, the first
+ * rendering racing with the other threads for compiling the sections,
+ * and returns NULL when a result differs from the eager one.
+ */
+static void *renderer(void *arg)
+{
+	char *text;
+	size_t size;
+	int i, ok;
+
+	for (ok = 1, i = 0 ; ok && i < 2 ; i++) {
+		ok = mustach_tape_compiled_mem(lazy, tape, Mustach_With_AllExtensions, &text, &size) >= 0;
+		if (ok) {
+			ok = size == expsize && !memcmp(text, expected, size);
+			free(text);
+		}
+	}
+	return ok ? arg : NULL;
+}
+
+/*
+ * usage: test-lazy json template
+ *
+ * Renders the template compiled eagerly, then renders it from many
+ * threads, each round with a new lazily compiled template.
+ */
+int main(int ac, char **av)
+{
+	pthread_t threads[THREADS];
+	void *result;
+	struct mustach_template *eager;
+	char *json, *text;
+	size_t jsonlen, length;
+	int i, r, ok;
+
+	if (ac != 3) {
+		fprintf(stderr, "usage: %s json template\n", av[0]);
+		return 1;
+	}
+	json = readfile(av[1], &jsonlen);
+	text = readfile(av[2], &length);
+	tape = mustach_tape_parse(json, jsonlen, NULL);
+	if (tape == NULL
+	 || mustach_compile(text, length, Mustach_With_AllExtensions, &eager) < 0
+	 || mustach_tape_compiled_mem(eager, tape, Mustach_With_AllExtensions, &expected, &expsize) < 0) {
+		fprintf(stderr, "Can't render\n");
+		return 1;
+	}
+	fwrite(expected, 1, expsize, stdout);
+
+	for (ok = 1, r = 0 ; ok && r < ROUNDS ; r++) {
+		if (mustach_compile_lazy(text, length, Mustach_With_AllExtensions, &lazy) < 0) {
+			fprintf(stderr, "Can't compile\n");
+			return 1;
+		}
+		for (i = 0 ; i < THREADS ; i++)
+			if (pthread_create(&threads[i], NULL, renderer, tape)) {
+				fprintf(stderr, "Can't create thread\n");
+				return 1;
+			}
+		for (i = 0 ; i < THREADS ; i++) {
+			pthread_join(threads[i], &result);
+			ok = ok && result != NULL;
+		}
+		mustach_template_free(lazy);
+	}
+	printf("%d threads x %d rounds: %s\n", THREADS, ROUNDS, ok ? "same as eager" : "DIFFERENT");
+
+	mustach_template_free(eager);
+	mustach_tape_free(tape);
+	free(expected);
+	free(text);
+	free(json);
+	return 0;
+}
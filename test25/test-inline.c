@@ -0,0 +1,110 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mustach-tape.h"
+#include "readfile.h"
+
+#define MAX_PARTIALS 16
+
+static struct {
+	char *name;
+	char *text;
+	struct mustach_template *tmpl;
+} partials[MAX_PARTIALS];
+static int count;
+
+/* the partials known when inlining */
+static int compiled(void *closure, const char *name, const struct mustach_template **tmpl)
+{
+	int i;
+
+	(void)closure; /* unused */
+	for (i = 0 ; i < count ; i++)
+		if (!strcmp(name, partials[i].name)) {
+			*tmpl = partials[i].tmpl;
+			return 1;
+		}
+	return 0;
+}
+
+static int tags(const struct mustach_template *tmpl)
+{
+	const struct mustach_token *tok;
+	int n;
+
+	for (n = 0, tok = tmpl->tokens ; tok->kind != Mustach_Token_End ; tok++)
+		n += tok->kind == Mustach_Token_Partial;
+	return n;
+}
+
+/*
+ * usage: test-inline json template partials...
+ *
+ * Renders the template with its partials inlined and compares the
+ * result with the rendering reading the partials from their files.
+ */
+int main(int ac, char **av)
+{
+	struct mustach_tape *tape;
+	struct mustach_template *tmpl, *inlined;
+	char *json, *text, *result, *plain, *dot;
+	size_t jsonlen, length, size, plainsize;
+	int i, rc;
+
+	if (ac < 3 || ac - 3 > MAX_PARTIALS) {
+		fprintf(stderr, "usage: %s json template partials...\n", av[0]);
+		return 1;
+	}
+	json = readfile(av[1], &jsonlen);
+	tape = mustach_tape_parse(json, jsonlen, NULL);
+	for (count = 0 ; count < ac - 3 ; count++) {
+		partials[count].name = strdup(av[count + 3]);
+		dot = strrchr(partials[count].name, '.');
+		if (dot != NULL)
+			*dot = 0;
+		partials[count].text = readfile(av[count + 3], &length);
+		if (mustach_compile(partials[count].text, length, Mustach_With_AllExtensions, &partials[count].tmpl) < 0) {
+			fprintf(stderr, "Can't compile %s\n", av[count + 3]);
+			return 1;
+		}
+	}
+	text = readfile(av[2], &length);
+	if (tape == NULL
+	 || mustach_compile(text, length, Mustach_With_AllExtensions, &tmpl) < 0
+	 || mustach_inline(tmpl, compiled, NULL, &inlined) < 0) {
+		fprintf(stderr, "Can't inline\n");
+		return 1;
+	}
+	printf("partial tags: %d, after inlining: %d\n", tags(tmpl), tags(inlined));
+
+	rc = mustach_tape_compiled_mem(inlined, tape, Mustach_With_AllExtensions, &result, &size);
+	if (rc < 0 || mustach_tape_mem(text, length, tape, Mustach_With_AllExtensions, &plain, &plainsize) < 0) {
+		fprintf(stderr, "Can't render\n");
+		return 1;
+	}
+	fwrite(result, 1, size, stdout);
+	printf("%s\n", size == plainsize && !memcmp(result, plain, size) ? "same as not inlined" : "DIFFERENT FROM NOT INLINED");
+
+	free(result);
+	free(plain);
+	mustach_template_free(inlined);
+	mustach_template_free(tmpl);
+	for (i = 0 ; i < count ; i++) {
+		mustach_template_free(partials[i].tmpl);
+		free(partials[i].text);
+		free(partials[i].name);
+	}
+	mustach_tape_free(tape);
+	free(text);
+	free(json);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mustach-tape.h"
+#include "readfile.h"
+
+#define LINES 20000
+
+/* the generated template, given by pieces of at most 7 bytes */
+struct generator {
+	char *text;
+	size_t length, pos;
+	FILE *output;
+	long written; /* output written when the template is completely read */
+};
+
+static int generate(void *closure, char *buffer, size_t size)
+{
+	struct generator *gen = closure;
+	size_t len = gen->length - gen->pos;
+
+	if (len > 7)
+		len = 7;
+	if (len > size)
+		len = size;
+	if (len == 0 && gen->written < 0) {
+		fflush(gen->output);
+		gen->written = ftell(gen->output);
+	}
+	memcpy(buffer, &gen->text[gen->pos], len);
+	gen->pos += len;
+	return (int)len;
+}
+
+static char *generated(size_t *length)
+{
+	char *text;
+	size_t len;
+	int i;
+
+	text = malloc(LINES * 48);
+	if (text == NULL)
+		exit(1);
+	for (len = 0, i = 0 ; i < LINES ; i++) {
+		if (i % 1000 == 0)
+			len += (size_t)sprintf(&text[len], "{{#hidden}}\n");
+		else if (i % 1000 == 499)
+			len += (size_t)sprintf(&text[len], "{{/hidden}}\n");
+		else if (i % 7 == 0)
+			len += (size_t)sprintf(&text[len], "  {{#items}}{{name}} {{/items}}\n");
+		else
+			len += (size_t)sprintf(&text[len], "line %d of {{title}}\n", i);
+	}
+	*length = len;
+	return text;
+}
+
+static int same(const char *what, int rc1, char *r1, size_t s1, int rc2, char *r2, size_t s2)
+{
+	if (rc1 != rc2 || s1 != s2 || memcmp(r1, r2, s1)) {
+		printf("%s: differs from memory (%d, %d)\n", what, rc1, rc2);
+		return 0;
+	}
+	printf("%s: same as in memory\n", what);
+	return 1;
+}
+
+/*
+ * usage: test-stream json template
+ *
+ * Renders the template read from its file descriptor then a large
+ * generated template read by pieces and compares the results with the
+ * renderings of the templates in memory.
+ */
+int main(int ac, char **av)
+{
+	struct mustach_tape *tape;
+	struct generator gen;
+	char *text, *json, *r1, *r2;
+	size_t length, jlength, s1, s2;
+	int fd, rc1, rc2, status;
+
+	if (ac != 3) {
+		fprintf(stderr, "usage: %s json template\n", av[0]);
+		return 1;
+	}
+	json = readfile(av[1], &jlength);
+	tape = mustach_tape_parse(json, jlength, NULL);
+	if (tape == NULL) {
+		fprintf(stderr, "Bad json: %s\n", av[1]);
+		return 1;
+	}
+
+	/* the template read from its file */
+	fd = open(av[2], O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open file: %s\n", av[2]);
+		return 1;
+	}
+	rc1 = mustach_tape_stream_mem(mustach_fd_reader, &fd, tape, Mustach_With_AllExtensions, &r1, &s1);
+	close(fd);
+	if (rc1 == 0)
+		fwrite(r1, 1, s1, stdout);
+	text = readfile(av[2], &length);
+	rc2 = mustach_tape_mem(text, length, tape, Mustach_With_AllExtensions, &r2, &s2);
+	status = same(av[2], rc1, r1, s1, rc2, r2, s2);
+	free(r1);
+	free(r2);
+	free(text);
+
+	/* the generated template */
+	gen.text = generated(&gen.length);
+	gen.pos = 0;
+	gen.written = -1;
+	gen.output = tmpfile();
+	if (gen.output == NULL)
+		return 1;
+	rc1 = mustach_tape_stream_file(generate, &gen, tape, Mustach_With_AllExtensions, gen.output);
+	fflush(gen.output);
+	s1 = (size_t)ftell(gen.output);
+	r1 = malloc(s1 + 1);
+	rewind(gen.output);
+	if (r1 == NULL || (s1 && 1 != fread(r1, s1, 1, gen.output)))
+		return 1;
+	rc2 = mustach_tape_mem(gen.text, gen.length, tape, Mustach_With_AllExtensions, &r2, &s2);
+	status &= same("generated", rc1, r1, s1, rc2, r2, s2);
+	printf("output begun before the end of the template: %s\n",
+		gen.written > 0 && (size_t)gen.written < s1 ? "yes" : "no");
+	fclose(gen.output);
+	free(r1);
+	free(r2);
+	free(gen.text);
+
+	mustach_tape_free(tape);
+	free(json);
+	return !status;
+}
@@ -0,0 +1,91 @@
+/*
+ Author: José Bollo <jobol@nonadev.net>
+
+ https://gitlab.com/jobol/mustach
+
+ SPDX-License-Identifier: ISC
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mustach-tape.h"
+#include "readfile.h"
+
+/* generated by mustach --header must relex */
+#include "must.h"
+
+static FILE *map;
+static const char *mapname;
+static size_t outpos;
+
+static int writeout(void *closure, const char *buffer, size_t size)
+{
+	outpos += size;
+	return fwrite(buffer, 1, size, closure) != size ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+}
+
+/* writes the positions as 'mustach --map' */
+static int srcposmap(const struct mustach_srcpos *pos, void *closure)
+{
+	(void)closure; /* unused */
+	fprintf(map, "%zu", outpos);
+	for ( ; pos ; pos = pos->parent)
+		fprintf(map, " %s:%u:%zu", pos->name ? pos->name : mapname, pos->line, pos->offset);
+	return fputc('\n', map) == EOF ? MUSTACH_ERROR_SYSTEM : MUSTACH_OK;
+}
+
+static int render(const struct mustach_template *tmpl, const char *name, struct mustach_tape *tape)
+{
+	mapname = name;
+	return mustach_tape_compiled_write(tmpl, tape, Mustach_With_AllExtensions, writeout, stdout);
+}
+
+/*
+ * usage: test-generated json [map]
+ *
+ * Renders the template 'must', generated as rendering code, then the
+ * template 'relex', whose section changing the delimiters is rendered
+ * from its tokens. With 'map', the positions of the output are written
+ * to that file, what renders the tokens of 'must'.
+ */
+int main(int ac, char **av)
+{
+	struct mustach_tape *tape;
+	char *json;
+	size_t length;
+	int rc;
+
+	if (ac != 2 && ac != 3) {
+		fprintf(stderr, "usage: %s json [map]\n", av[0]);
+		return 1;
+	}
+	if (ac == 3) {
+		map = fopen(av[2], "w");
+		if (map == NULL) {
+			fprintf(stderr, "Can't create file %s\n", av[2]);
+			return 1;
+		}
+		mustach_wrap_srcpos = srcposmap;
+	}
+	json = readfile(av[1], &length);
+	tape = mustach_tape_parse(json, length, NULL);
+	if (tape == NULL) {
+		fprintf(stderr, "Can't load json file %s\n", av[1]);
+		return 1;
+	}
+	rc = mustach_template_must.render == NULL || mustach_template_relex.render != NULL;
+	if (rc)
+		fprintf(stderr, "Unexpected rendering functions\n");
+	else
+		rc = render(&mustach_template_must, "must", tape);
+	if (rc == MUSTACH_OK)
+		rc = render(&mustach_template_relex, "relex", tape);
+	if (rc != MUSTACH_OK)
+		fprintf(stderr, "Template error %d\n", rc);
+	mustach_tape_free(tape);
+	free(json);
+	if (map != NULL)
+		fclose(map);
+	return rc != MUSTACH_OK;
+}